@@ -0,0 +1,84 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/* This file defines how asynchronous operations are carried out on a socket.
+ *
+ * A submitted read joins read_ops and a submitted write joins write_ops, and
+ * both are attempted right away in the submitting thread. What cannot be
+ * done yet is left to the backend, which completes reads once data arrived
+ * and moves the data of writes into sending_buf as it drains, in both cases
+ * in the order the operations were submitted. Each completion goes to the
+ * queue the operation came with, see foggy_cq.h.
+ *
+ * The data of queued writes counts as unsent, so the FIN of a shutdown or a
+ * close waits for it. foggy_close() fails whatever is still queued once our
+ * FIN was acknowledged, after which the backend no longer touches the
+ * application's buffers.
+ */
+
+#ifndef FOGGY_ASYNC_H_
+#define FOGGY_ASYNC_H_
+
+#include <stdint.h>
+
+#include "foggy_tcp.h"
+
+/**
+ * Moves up to length bytes from received_buf into buf, as foggy_read() does.
+ * Must be called with recv_lock held.
+ *
+ * @param sock The socket.
+ * @param buf The application's buffer.
+ * @param length The size of buf.
+ * @param now us, used for the arrival-to-read latency, may be 0 if no
+ *            segment waits to be read.
+ *
+ * @return The number of bytes moved.
+ */
+int take_received(foggy_socket_t *sock, void *buf, int length, uint64_t now);
+
+/**
+ * Appends data to sending_buf, as foggy_write() does. Must be called with
+ * send_lock held.
+ *
+ * @param sock The socket.
+ * @param data The data.
+ * @param len Its length.
+ */
+void append_sending(foggy_socket_t *sock, const uint8_t *data, int len);
+
+/**
+ * Completes the queued reads that data or the end of the stream allows.
+ * Must be called with recv_lock held.
+ *
+ * @param sock The socket.
+ *
+ * @return The number of bytes read.
+ */
+int async_complete_reads(foggy_socket_t *sock);
+
+/**
+ * Moves the data of queued writes into sending_buf while the send buffer has
+ * room, completing the writes taken whole. Must be called with send_lock
+ * held.
+ *
+ * @param sock The socket.
+ *
+ * @return The number of bytes taken.
+ */
+int async_fill_writes(foggy_socket_t *sock);
+
+/**
+ * Fails the operations still queued on a socket that is being closed.
+ *
+ * @param sock The socket.
+ */
+void async_cancel(foggy_socket_t *sock);
+
+#endif  // FOGGY_ASYNC_H_
@@ -29,6 +29,18 @@ void* begin_backend(void* in);
 
 int has_been_acked(foggy_socket_t *sock, uint32_t seq);
 
+/**
+ * Hands the packets of a received datagram to `on_recv_pkt`.
+ *
+ * @param sock The socket of the connection.
+ * @param buf The datagram, packets are processed in place.
+ * @param len Its length.
+ * @param from Where it came from.
+ * @param seg_size Size of the packets coalesced by GRO, 0 for one packet.
+ */
+void handle_datagram(foggy_socket_t *sock, uint8_t *buf, ssize_t len,
+                     const struct sockaddr_in *from, int seg_size);
+
 /**
  * Checks if the socket received any data.
  *
@@ -41,9 +53,36 @@ int has_been_acked(foggy_socket_t *sock, uint32_t seq);
  */
 void check_for_pkt(foggy_socket_t *sock, foggy_read_mode_t flags);
 
+/**
+ * Wakes up the backend thread of a socket.
+ *
+ * Must be called whenever the application changes state the backend acts on:
+ * data appended to `sending_buf`, `dying` set, or space freed in
+ * `received_buf`.
+ *
+ * @param sock The socket whose backend should be woken up.
+ */
+void notify_backend(foggy_socket_t *sock);
+
+
+/**
+ * Frees a socket and everything it owns, closing its file descriptors.
+ *
+ * @param sock The socket, no longer referenced by the application or backend.
+ */
+void release_socket(foggy_socket_t *sock);
 
 void foggy_listen(foggy_socket_t *sock);
 
-void foggy_connect(foggy_socket_t *sock);
+/**
+ * Performs the initiator side of the handshake, retransmitting the SYN with
+ * exponential backoff. With fast open and a cached cookie, returns right away
+ * and leaves the SYN to the backend.
+ *
+ * @param sock The initiator socket.
+ *
+ * @return 0 on success, -1 if the listener never answered.
+ */
+int foggy_connect(foggy_socket_t *sock);
 
 #endif  // BACKEND_H_
@@ -0,0 +1,66 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/* This file defines the busy-polling mode of the backend, for connections
+ * that would rather burn a core than sleep.
+ *
+ * A connection opts in with FOGGY_BUSY_POLL, the number of microseconds its
+ * backend spins before each wait. Spinning, the backend checks for packets
+ * and notifications without sleeping: with the io_uring engine it watches
+ * the completion queue in memory, otherwise it polls its sockets without a
+ * timeout. It reacts to them within microseconds, and to its timers exactly
+ * when they are due. Whatever did not come while it spun is waited for the
+ * sleeping way.
+ *
+ * The spin is adaptive. A wait that gets an event while spinning resets it
+ * to the full budget, one that spun the whole budget in vain halves it, down
+ * to BUSY_SPIN_MIN. A connection that goes idle thus mostly sleeps, and the
+ * first packet of the next burst restores the budget. On a machine with a
+ * single CPU the backend yields between two checks, since the threads it
+ * waits for need that CPU. The time spent spinning is reported as spin_us
+ * by foggy_get_info.
+ *
+ * FOGGY_CPU pins the backend thread of a connection to a CPU, so that the
+ * spinning core is known and its caches stay warm. FOGGY_SOCKOPTS takes a
+ * range, e.g. "busy_poll=50us,cpu=2-5", which spreads the connections of
+ * the process over these CPUs.
+ */
+
+#ifndef FOGGY_BUSY_H_
+#define FOGGY_BUSY_H_
+
+#include <poll.h>
+#include <stdint.h>
+
+#include "foggy_tcp.h"
+
+#define BUSY_SPIN_MIN 16  // us a wait spins at least once the budget shrank
+
+/**
+ * Takes over the busy-polling options: pins the backend thread to the CPU
+ * of the options and resets the spin budget. Called by the backend when it
+ * starts and whenever the options changed.
+ *
+ * @param sock The socket.
+ */
+void busy_apply(foggy_socket_t *sock);
+
+/**
+ * Spins until a packet or a notification arrives, a timer is due or the spin
+ * budget ran out, whichever comes first, and adapts the budget.
+ *
+ * @param sock The socket, with a spin budget.
+ * @param fds What the backend waits on without the io_uring engine.
+ * @param nfds The number of fds.
+ *
+ * @return 1 if an event arrived, 0 otherwise.
+ */
+int busy_spin(foggy_socket_t *sock, struct pollfd *fds, int nfds);
+
+#endif  // FOGGY_BUSY_H_
@@ -0,0 +1,50 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/* This file defines the congestion control sampler. When FOGGY_CC_LOG names a
+ * directory, every connection writes a CSV time series of its congestion
+ * state there, one row per change of cwnd, ssthresh, Reno state or RTO and,
+ * if FOGGY_CC_LOG_INTERVAL is set (in ms), at least once per interval.
+ *
+ * The file is named foggy-cc-<pid>-<local port>.csv and has the columns
+ *   time_us,cwnd,ssthresh,in_flight,srtt_us,rto_us,state,bytes_acked,
+ *   bytes_retrans
+ * utils/plot_cc.py plots it.
+ */
+
+#ifndef FOGGY_CCLOG_H_
+#define FOGGY_CCLOG_H_
+
+#include <stdint.h>
+
+#include "foggy_tcp.h"
+
+/**
+ * Starts the time series of a connection if FOGGY_CC_LOG is set.
+ *
+ * @param sock The connected socket.
+ */
+void cc_log_open(foggy_socket_t *sock);
+
+/**
+ * Writes a sample if the congestion state changed. The periodic samples are
+ * written from the socket's timer wheel.
+ *
+ * @param sock The socket.
+ */
+void cc_log_sample(foggy_socket_t *sock);
+
+/**
+ * Writes a final sample and closes the time series.
+ *
+ * @param sock The socket.
+ */
+void cc_log_close(foggy_socket_t *sock);
+
+#endif  // FOGGY_CCLOG_H_
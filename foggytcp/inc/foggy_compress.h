@@ -0,0 +1,130 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/* This file defines stream compression.
+ *
+ * With FOGGY_COMPRESS=1 a side asks for CAP_COMPRESS in its SYN. Once the
+ * peer agrees, both directions of the stream are carried in frames, from the
+ * first byte after the data a fast open SYN had accepted on. A frame holds up
+ * to COMPRESS_BLOCK bytes of the stream behind a COMPRESS_HDR_LEN byte
+ * header: the length of its body, with COMPRESS_LZ set if the body is an LZ
+ * block (see foggy_lz.h), then the number of stream bytes it holds. Both
+ * fields are two bytes in network byte order. Sequence numbers, ACKs and the
+ * send window count frame bytes. The frames are cut into segments as the
+ * stream was before, so retransmission, FEC and multipath work unchanged.
+ *
+ * The sender takes blocks off sending_buf until the frames fill the send
+ * window, and only then cuts them into segments. A side that did not set
+ * FOGGY_COMPRESS sends raw frames only. So does one that finds compression
+ * does not pay: a block that shrinks by less than 1 / 2^COMPRESS_GAIN_SHIFT,
+ * or whose compression takes longer than the network would to carry the
+ * bytes it saves at cwnd / srtt, is sent raw, and so are the next blocks, a
+ * number that doubles up to COMPRESS_MAX_SKIP each time it happens again.
+ *
+ * The receiver decompresses the frames as the stream is delivered in order,
+ * so received_buf, foggy_read() and the receive window only ever see the
+ * original bytes.
+ */
+
+#ifndef FOGGY_COMPRESS_H_
+#define FOGGY_COMPRESS_H_
+
+#include <stdint.h>
+
+#include "foggy_tcp.h"
+
+#define COMPRESS_BLOCK 16384      // stream bytes in one frame, at most
+#define COMPRESS_HDR_LEN 4
+#define COMPRESS_LZ 0x8000        // in the body length, the body is an LZ block
+#define COMPRESS_GAIN_SHIFT 4     // a block must shrink by 1/16 to be sent compressed
+#define COMPRESS_MAX_SKIP 64      // blocks sent raw in a row, at most
+#define COMPRESS_MARKS 4096       // frames in flight tracked, a power of two
+
+typedef struct {
+  uint32_t seq;  // where the frame ends in the sequence space
+  uint64_t raw;  // and in the stream, as counted by bytes_written
+} compress_mark_t;
+
+struct compress_state {
+  /* Sender */
+  int skip;         // blocks left to send raw
+  int backoff;      // blocks to skip the next time compression does not pay
+  uint32_t tx_len;  // frame bytes in tx not cut into segments yet
+  uint32_t marks_head, marks_tail;  // frames not fully ACKed, mark n at
+  compress_mark_t marks[COMPRESS_MARKS];  // n & (COMPRESS_MARKS - 1)
+  uint64_t raw_acked;                     // stream bytes fully ACKed
+  uint8_t block[COMPRESS_BLOCK];
+  uint8_t *tx;      // frames to send, room for the send buffer and a frame
+  uint32_t tx_size;
+
+  /* Receiver */
+  uint8_t hdr[COMPRESS_HDR_LEN];  // header of the frame being received
+  int hdr_len;
+  int body_len;      // its body, without COMPRESS_LZ
+  int lz;
+  int raw_len;
+  int have;          // body bytes received
+  int broken;        // a malformed frame arrived, the rest is dropped
+  uint8_t body[COMPRESS_BLOCK];
+  uint8_t raw[COMPRESS_BLOCK];
+};
+
+/**
+ * Reads FOGGY_COMPRESS and asks for CAP_COMPRESS if compression is wanted.
+ *
+ * @param sock The new socket.
+ */
+void compress_init(foggy_socket_t *sock);
+
+/**
+ * Sets up framing on a connection that negotiated CAP_COMPRESS. Both ends
+ * frame from then on, the one with FOGGY_COMPRESS set also compresses.
+ *
+ * @param sock The socket, during the handshake.
+ */
+void compress_start(foggy_socket_t *sock);
+
+/**
+ * Releases the compression state.
+ *
+ * @param sock The socket, may not compress.
+ */
+void compress_destroy(foggy_socket_t *sock);
+
+/**
+ * Frames as much of sending_buf as the send window has room for and sends
+ * it, in place of taking it off and calling send_pkts().
+ *
+ * Must be called without send_lock held.
+ *
+ * @param sock The connected socket.
+ */
+void compress_transmit(foggy_socket_t *sock);
+
+/**
+ * Returns how many bytes of the stream are fully ACKed, the counterpart of
+ * bytes_acked in bytes_written terms.
+ *
+ * @param sock The socket.
+ */
+uint64_t compress_acked(foggy_socket_t *sock);
+
+/**
+ * Takes frame bytes delivered in order and appends what they decode to
+ * received_buf.
+ *
+ * @param sock The socket.
+ * @param data The bytes.
+ * @param len Their number.
+ * @param arrival When the last of them came off the socket, in us.
+ */
+void compress_on_deliver(foggy_socket_t *sock, const uint8_t *data, int len,
+                         uint64_t arrival);
+
+#endif  // FOGGY_COMPRESS_H_
@@ -0,0 +1,147 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/* This file defines C++20 coroutine wrappers of the asynchronous operations.
+ *
+ * Awaiting foggy::read() or foggy::write() submits the operation with the
+ * awaiter as its user_data and suspends the coroutine. foggy::run_once()
+ * drains the completion queue and resumes each coroutine with the result of
+ * its operation, so one thread can keep thousands of coroutines and their
+ * operations in flight:
+ *
+ *   foggy::task echo(void *sock, foggy_cq_t *cq) {
+ *     char buf[4096];
+ *     int n;
+ *     while ((n = co_await foggy::read(sock, cq, buf, sizeof(buf))) > 0) {
+ *       co_await foggy::write(sock, cq, buf, n);
+ *     }
+ *   }
+ *
+ * Coroutines are resumed by the thread calling foggy::run_once(), never by a
+ * backend. Every operation on a queue drained this way must come from an
+ * awaiter. The library itself is C++17, only the code including this file
+ * needs -std=c++20.
+ */
+
+#ifndef FOGGY_CORO_H_
+#define FOGGY_CORO_H_
+
+#if !defined(__cpp_impl_coroutine)
+#error "foggy_coro.h needs C++20 coroutines (-std=c++20)"
+#endif
+
+#include <coroutine>
+#include <exception>
+
+#include "foggy_tcp.h"
+
+#define CORO_BATCH 64  // completions run_once() takes at a time
+
+namespace foggy {
+
+/**
+ * A coroutine that starts at once and frees itself when it returns. Whatever
+ * it awaits keeps it alive.
+ */
+struct task {
+  struct promise_type {
+    task get_return_object() { return task(); }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+/**
+ * Awaits one asynchronous operation, its result is that of the completion.
+ */
+class io_awaiter {
+ public:
+  io_awaiter(foggy_op_t op, void* sock, foggy_cq_t* cq, void* buf, int length)
+      : op_(op), sock_(sock), cq_(cq), buf_(buf), length_(length), result_(-1) {}
+
+  bool await_ready() const noexcept { return false; }
+
+  bool await_suspend(std::coroutine_handle<> handle) {
+    int submitted;
+
+    handle_ = handle;
+    if (op_ == FOGGY_OP_READ) {
+      submitted = foggy_submit_read(sock_, cq_, buf_, length_, this);
+    } else {
+      submitted = foggy_submit_write(sock_, cq_, buf_, length_, this);
+    }
+    return submitted == 0;  // a rejected operation resumes with -1 at once
+  }
+
+  int await_resume() const noexcept { return result_; }
+
+  /**
+   * Resumes the awaiting coroutine with the result of the operation.
+   *
+   * @param result The result of the completion.
+   */
+  void complete(int result) {
+    result_ = result;
+    handle_.resume();
+  }
+
+ private:
+  foggy_op_t op_;
+  void* sock_;
+  foggy_cq_t* cq_;
+  void* buf_;
+  int length_;
+  int result_;
+  std::coroutine_handle<> handle_;
+};
+
+/**
+ * Reads from a socket, see foggy_submit_read.
+ *
+ * @return An awaiter resuming with the number of bytes read, 0 at the end of
+ *         the stream, -1 on error.
+ */
+inline io_awaiter read(void* sock, foggy_cq_t* cq, void* buf, int length) {
+  return io_awaiter(FOGGY_OP_READ, sock, cq, buf, length);
+}
+
+/**
+ * Writes to a socket, see foggy_submit_write.
+ *
+ * @return An awaiter resuming with the number of bytes written, -1 on error.
+ */
+inline io_awaiter write(void* sock, foggy_cq_t* cq, const void* buf,
+                        int length) {
+  return io_awaiter(FOGGY_OP_WRITE, sock, cq, const_cast<void*>(buf), length);
+}
+
+/**
+ * Waits for completions and resumes the coroutines awaiting them.
+ *
+ * @param cq The queue.
+ * @param timeout_ms Longest wait, -1 to wait indefinitely.
+ *
+ * @return The number of coroutines resumed, -1 on error.
+ */
+inline int run_once(foggy_cq_t* cq, int timeout_ms) {
+  foggy_completion_t completions[CORO_BATCH];
+  int n = foggy_cq_wait(cq, completions, CORO_BATCH, timeout_ms);
+
+  for (int i = 0; i < n; ++i) {
+    static_cast<io_awaiter*>(completions[i].user_data)
+        ->complete(completions[i].result);
+  }
+  return n;
+}
+
+}  // namespace foggy
+
+#endif  // FOGGY_CORO_H_
@@ -0,0 +1,59 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/* This file defines the completion queues of asynchronous operations.
+ *
+ * foggy_submit_read() and foggy_submit_write() return at once. The backend of
+ * the socket carries the operation out later and posts a foggy_completion_t
+ * to the queue given at submission, carrying the user_data given with it.
+ * A queue is meant to be drained by one application thread, which may submit
+ * to any number of sockets, while any number of backends post to it.
+ *
+ * The completions sit in a ring that grows as needed, so posting never
+ * blocks a backend for longer than a copy. The queue's eventfd is readable
+ * whenever completions are pending, so an application with its own event
+ * loop can poll it alongside its other descriptors and call foggy_cq_poll()
+ * when it fires. foggy_cq_wait() does the same on its own.
+ *
+ * The queue does not depend on the transport, the kernel TCP build uses it
+ * too.
+ */
+
+#ifndef FOGGY_CQ_H_
+#define FOGGY_CQ_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "foggy_tcp.h"
+
+#define CQ_INITIAL_SIZE 64  // completions, doubled whenever the ring is full
+
+struct foggy_cq {
+  pthread_mutex_t lock;
+  int event_fd;                  // readable while count > 0
+  foggy_completion_t *entries;   // ring of size entries
+  uint32_t size;
+  uint32_t head;                 // oldest completion
+  uint32_t count;
+};
+
+/**
+ * Posts a completion and wakes the thread waiting on the queue.
+ *
+ * @param cq The queue the operation was submitted with.
+ * @param sock The socket of the operation.
+ * @param op FOGGY_OP_READ or FOGGY_OP_WRITE.
+ * @param result Its result, see foggy_completion_t.
+ * @param user_data What was submitted with it.
+ */
+void cq_post(foggy_cq_t *cq, void *sock, foggy_op_t op, int result,
+             void *user_data);
+
+#endif  // FOGGY_CQ_H_
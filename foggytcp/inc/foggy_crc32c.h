@@ -0,0 +1,34 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/* This file defines the CRC32C (Castagnoli) checksum used to protect foggy-TCP
+packets when the UDP checksum cannot be relied on. */
+
+#ifndef FOGGY_CRC32C_H_
+#define FOGGY_CRC32C_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Computes the CRC32C of a buffer.
+ *
+ * Uses the SSE4.2 `crc32` instruction when the CPU supports it and a
+ * slicing-by-8 table otherwise. Calls can be chained by passing the result of
+ * the previous call as `crc`.
+ *
+ * @param crc The CRC of the preceding data, 0 for the first call.
+ * @param buf The data to checksum.
+ * @param len The length of the data.
+ *
+ * @return The CRC32C of the preceding data followed by `buf`.
+ */
+uint32_t crc32c(uint32_t crc, const uint8_t *buf, size_t len);
+
+#endif  // FOGGY_CRC32C_H_
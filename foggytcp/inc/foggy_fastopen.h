@@ -0,0 +1,64 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/* This file defines the cookies used by fast open to carry data on the SYN.
+ *
+ * A listener hands out a cookie bound to the client address in its SYN-ACK.
+ * The initiator caches it per server and presents it in later SYNs; a SYN with
+ * a valid cookie has its payload accepted without waiting for the handshake.
+ */
+
+#ifndef FOGGY_FASTOPEN_H_
+#define FOGGY_FASTOPEN_H_
+
+#include <netinet/in.h>
+#include <stdint.h>
+
+#define FASTOPEN_COOKIE_LEN 8
+
+/**
+ * Computes the cookie a listener issues to a client.
+ *
+ * @param client The address of the client.
+ * @param cookie Filled with `FASTOPEN_COOKIE_LEN` bytes.
+ */
+void fastopen_make_cookie(const struct sockaddr_in *client, uint8_t *cookie);
+
+/**
+ * Checks a cookie presented by a client.
+ *
+ * @param client The address of the client.
+ * @param cookie The cookie from the SYN.
+ * @param cookie_len The length of the cookie from the SYN.
+ *
+ * @return 1 if the cookie is valid for this client, 0 otherwise.
+ */
+int fastopen_check_cookie(const struct sockaddr_in *client,
+                          const uint8_t *cookie, uint8_t cookie_len);
+
+/**
+ * Looks up the cookie cached for a server.
+ *
+ * @param server The address of the server.
+ * @param cookie Filled with the cookie if one is cached.
+ *
+ * @return 1 if a cookie was found, 0 otherwise.
+ */
+int fastopen_get_cookie(const struct sockaddr_in *server, uint8_t *cookie);
+
+/**
+ * Caches the cookie a server issued, replacing any previous one.
+ *
+ * @param server The address of the server.
+ * @param cookie The `FASTOPEN_COOKIE_LEN` bytes cookie.
+ */
+void fastopen_put_cookie(const struct sockaddr_in *server,
+                         const uint8_t *cookie);
+
+#endif  // FOGGY_FASTOPEN_H_
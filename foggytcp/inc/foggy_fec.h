@@ -0,0 +1,151 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/* This file defines forward error correction over the data segments.
+ *
+ * With FOGGY_FEC=k (1 to FEC_MAX_GROUP) the sender asks for CAP_FEC and,
+ * once the peer agrees, follows every k data segments it sends for the first
+ * time with a parity packet: the XOR of their payloads, each zero padded to
+ * the longest. The parity packet carries OPT_FEC with the sequence range it
+ * covers and the number of segments in it, and takes no sequence space. A
+ * group still open FEC_FLUSH_DIV of an RTT after its first segment is
+ * closed as it is, so the tail of a burst is covered too. The overhead is one
+ * packet in k + 1.
+ * FOGGY_FEC=auto adapts k to the loss rate, and sends no parity while it
+ * stays below FEC_AUTO_OFF. Losses are counted where the sender sees them,
+ * as the first duplicate ACK of a hole or a timeout, so the ones parity
+ * repaired count too.
+ *
+ * The receiver keeps the parity packets of the groups it has not fully
+ * received, and the last FEC_HISTORY bytes delivered in order with the
+ * boundaries of their segments. When all but one segment of a group are at
+ * hand, delivered or buffered in the receive window, the missing one is
+ * rebuilt from the parity and goes into the receive window as if it had
+ * arrived, without waiting for a retransmission. Parity is not congestion
+ * controlled, a lost parity packet is never resent.
+ */
+
+#ifndef FOGGY_FEC_H_
+#define FOGGY_FEC_H_
+
+#include <stdint.h>
+
+#include "foggy_tcp.h"
+
+#define FEC_MAX_GROUP 16             // segments covered by one parity packet
+#define FEC_MAX_GROUP_BYTES 524288   // sequence space covered by one, at most
+#define FEC_HISTORY 1048576          // bytes delivered kept, a power of two
+#define FEC_HISTORY_SEGS 1024        // their boundaries, a power of two
+#define FEC_MAX_PENDING 8            // parity packets kept by the receiver
+#define FEC_AUTO -1                  // `fec_group` of FOGGY_FEC=auto
+#define FEC_AUTO_OFF 164             // 0.25%, in 1/65536, no parity below it
+#define FEC_AUTO_GAIN 7              // the loss estimate moves by 1/128 a sample
+#define FEC_FLUSH_DIV 4              // a partial group waits srtt / 4
+
+typedef struct {
+  uint32_t seq;
+  uint32_t len;
+} fec_extent_t;
+
+struct fec_state {
+  /* Sender */
+  int group;            // segments per parity packet, 0 for none
+  uint32_t loss;        // losses per segment sent, in 1/65536
+  uint32_t first;       // sequence range of the open group
+  uint32_t end;
+  uint8_t count;        // segments in the open group
+  uint16_t parity_len;  // longest payload in the open group
+  foggy_timer_t flush_timer;  // closes a group that does not fill up
+  uint8_t parity[RX_BUF_SIZE];
+
+  /* Receiver */
+  uint8_t *pending[FEC_MAX_PENDING];  // parity packets, NULL if free
+  fec_extent_t delivered[FEC_HISTORY_SEGS];  // in order, the last at
+  uint32_t delivered_count;                  // (delivered_count - 1) & mask
+  uint8_t history[FEC_HISTORY];  // byte seq at seq & (FEC_HISTORY - 1)
+  uint8_t buf[RX_BUF_SIZE];      // segment being rebuilt
+};
+
+/**
+ * Reads FOGGY_FEC and asks for CAP_FEC if parity is wanted.
+ *
+ * @param sock The new socket.
+ */
+void fec_init(foggy_socket_t *sock);
+
+/**
+ * Sets up FEC on a connection that negotiated CAP_FEC. Both ends take
+ * parity from then on, the one with FOGGY_FEC set also sends it.
+ *
+ * @param sock The socket, during the handshake.
+ */
+void fec_start(foggy_socket_t *sock);
+
+/**
+ * Releases the FEC state.
+ *
+ * @param sock The socket, may not use FEC.
+ */
+void fec_destroy(foggy_socket_t *sock);
+
+/**
+ * Adds a data segment just sent to the open group, and sends the group's
+ * parity once it is full. Retransmissions are not covered.
+ *
+ * @param sock The socket.
+ * @param n The segment number in the send window.
+ */
+void fec_on_send(foggy_socket_t *sock, uint32_t n);
+
+/**
+ * Counts a loss in the estimate FOGGY_FEC=auto adapts to.
+ *
+ * @param sock The socket.
+ */
+void fec_on_loss(foggy_socket_t *sock);
+
+/**
+ * Sends the parity of the open group now, if it has any segment.
+ *
+ * @param sock The socket.
+ */
+void fec_flush(foggy_socket_t *sock);
+
+/**
+ * Records data delivered in order, for the groups it belongs to.
+ *
+ * @param sock The socket.
+ * @param seq The sequence number of the first byte.
+ * @param data The bytes.
+ * @param len Their number.
+ */
+void fec_on_deliver(foggy_socket_t *sock, uint32_t seq, const uint8_t *data,
+                    uint16_t len);
+
+/**
+ * Takes a parity packet and rebuilds what it can.
+ *
+ * @param sock The socket.
+ * @param pkt The received packet.
+ *
+ * @return 1 if the packet was a parity packet and is consumed, 0 otherwise.
+ */
+int fec_on_recv(foggy_socket_t *sock, uint8_t *pkt);
+
+/**
+ * Rebuilds the segments that are the only ones missing from a group whose
+ * parity arrived, into the receive window.
+ *
+ * @param sock The socket.
+ *
+ * @return The number of segments rebuilt.
+ */
+int fec_recover(foggy_socket_t *sock);
+
+#endif  // FOGGY_FEC_H_
@@ -12,8 +12,7 @@ from releasing their forks in any public places. */
 /**
  * Updates the socket information to represent the newly received packet.
  *
- * In the current stop-and-wait implementation, this function also sends an
- * acknowledgement for the packet.
+ * Data packets are acknowledged right away.
  *
  * @param sock The socket used for handling packets received.
  * @param pkt The packet data received by the socket.
@@ -22,9 +21,16 @@ void on_recv_pkt(foggy_socket_t *sock, uint8_t *pkt);
 
 
 /**
- * Breaks up the data into packets and sends a single packet at a time.
+ * Returns the payload of a full data segment. The options every segment
+ * carries are carved out of the MSS.
  *
- * You should most certainly update this function in your implementation.
+ * @param sock The socket.
+ */
+int segment_payload(foggy_socket_t *sock);
+
+/**
+ * Breaks up the data into segments, queues them in the send window and
+ * sends as many as the congestion and advertised windows allow.
  *
  * @param sock The socket to use for sending data.
  * @param data The data to be sent.
@@ -32,9 +38,208 @@ void on_recv_pkt(foggy_socket_t *sock, uint8_t *pkt);
  */
 void send_pkts(foggy_socket_t *sock, uint8_t *data, int buf_len);
 
+/**
+ * Allocates a packet for the connection of a socket.
+ *
+ * Fills in the ports and the advertised window from the socket state and
+ * reserves room for the options negotiated on the connection (e.g. CRC32C).
+ *
+ * @param sock The socket the packet will be sent on.
+ * @param seq The sequence number.
+ * @param ack The acknowledgement number.
+ * @param flags The flags.
+ * @param ext_len The length of the extra extension options.
+ * @param ext_data The extra extension options, see `foggy_option.h`.
+ * @param payload The payload.
+ * @param payload_len The length of the payload.
+ *
+ * @return A pointer to the newly allocated packet. User must `free` after use.
+ */
+uint8_t *create_socket_packet(foggy_socket_t *sock, uint32_t seq, uint32_t ack,
+                              uint8_t flags, uint16_t ext_len,
+                              const uint8_t *ext_data, const uint8_t *payload,
+                              uint16_t payload_len);
+
+/**
+ * Sends a packet to the peer, filling in its checksum first if it has one.
+ *
+ * @param sock The socket to send the packet on.
+ * @param pkt The packet to send.
+ */
+void send_packet(foggy_socket_t *sock, uint8_t *pkt);
+
+/**
+ * Sends a packet on a given UDP socket and link, filling in its checksum
+ * first if it has one. On a single path `send_packet` is this with the
+ * connection's own socket, peer and link.
+ *
+ * @param sock The socket the packet belongs to.
+ * @param pkt The packet to send.
+ * @param fd The UDP socket to send it on.
+ * @param addr The destination.
+ * @param netem The emulated link to go through, NULL to bypass.
+ */
+void send_packet_to(foggy_socket_t *sock, uint8_t *pkt, int fd,
+                    const struct sockaddr_in *addr, netem_link_t *netem);
+
+/**
+ * Sends consecutive packets of a connection.
+ *
+ * With GSO on, runs of equally sized packets (the last one may be shorter)
+ * leave in a single `sendmsg` and the kernel splits them, otherwise they are
+ * sent one by one. Falls back to single sends for good if the kernel refuses
+ * GSO.
+ *
+ * @param sock The socket to send on.
+ * @param pkts The packets, in order.
+ * @param n The number of packets.
+ */
+void send_packets(foggy_socket_t *sock, uint8_t **pkts, int n);
+
+/**
+ * Verifies the CRC32C option of a received packet.
+ *
+ * Once CRC32C has been negotiated, packets other than SYNs must carry it.
+ *
+ * @param sock The socket the packet was received on.
+ * @param pkt The received packet.
+ *
+ * @return 1 if the packet should be processed, 0 if it must be dropped.
+ */
+int verify_checksum(foggy_socket_t *sock, uint8_t *pkt);
+
+/**
+ * Allocates the SYN packet of an initiator.
+ *
+ * Carries the capabilities we ask for and, with fast open, either a cookie
+ * request or the cached cookie together with the first data segment.
+ *
+ * @param sock The initiator socket.
+ * @param payload The data to send on the SYN, NULL without a cookie.
+ * @param payload_len The length of the data.
+ *
+ * @return A pointer to the newly allocated packet. User must `free` after use.
+ */
+uint8_t *create_syn_packet(foggy_socket_t *sock, const uint8_t *payload,
+                           uint16_t payload_len);
+
+/**
+ * Sends (or resends) the SYN-ACK of a listener.
+ *
+ * @param sock The listener socket that received a SYN.
+ */
+void send_syn_ack(foggy_socket_t *sock);
+
+/**
+ * Returns the current time of the monotonic clock in microseconds.
+ */
+uint64_t get_time_us();
+
+/**
+ * Feeds an RTT sample to the RFC 6298 estimator and recomputes the RTO.
+ *
+ * @param sock The socket the sample was taken on.
+ * @param sample The measured round trip time in us.
+ */
+void update_rtt(foggy_socket_t *sock, uint64_t sample);
+
+/**
+ * Expiry of the retransmission timer. Takes everything outstanding as lost,
+ * backs off the timer and resends from the oldest segment.
+ *
+ * @param arg The socket.
+ */
+void retransmission_timeout(void *arg);
+
+/**
+ * Stamps segment `n` of the send window as sent now, accounting for it as a
+ * retransmission if it went out before.
+ *
+ * @param sock The socket.
+ * @param n The segment number.
+ * @param now The current time in us.
+ *
+ * @return The packet to send.
+ */
+uint8_t *stamp_segment(foggy_socket_t *sock, uint32_t n, uint64_t now);
+
+/**
+ * Decides whether a partial segment, shorter than segment_payload(), waits
+ * for more data under the socket's coalescing mode. Nagle's algorithm is
+ * Minshall's variant: only an earlier partial segment still unACKed holds it,
+ * so the tail of a bulk write goes out at once. Nothing is held once the
+ * sending side is shut down or pushed.
+ *
+ * Must be called by the backend with send_lock held, right before the
+ * segment would be cut.
+ *
+ * @param sock The socket.
+ * @param len The payload of the segment, 0 if there is none.
+ *
+ * @return 1 if it waits, 0 if it goes out.
+ */
+int hold_partial(foggy_socket_t *sock, uint32_t len);
+
+/**
+ * Notes a data segment that was cut, for hold_partial().
+ *
+ * @param sock The socket.
+ * @param seq Its first sequence number.
+ * @param len Its payload length.
+ */
+void note_segment(foggy_socket_t *sock, uint32_t seq, uint16_t len);
+
+/**
+ * Expiry of the cork timer, lets the corked partial segment out.
+ *
+ * @param arg The socket.
+ */
+void cork_timeout(void *arg);
+
+/**
+ * Sends a pure ACK for everything received so far, the delayed one included.
+ *
+ * @param sock The socket.
+ */
+void send_ack(foggy_socket_t *sock);
+
+/**
+ * Expiry of the pacing timer, sends what pacing held back.
+ *
+ * @param arg The socket.
+ */
+void pace_timeout(void *arg);
+
+/**
+ * Expiry of the delayed ACK timer, sends the ACK that waited.
+ *
+ * @param arg The socket.
+ */
+void delack_timeout(void *arg);
+
 /*<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<*/
 
-void add_receive_window(foggy_socket_t *sock, uint8_t *pkt);
+/**
+ * Appends stream bytes to received_buf for foggy_read().
+ *
+ * @param sock The socket.
+ * @param data The bytes.
+ * @param len Their number.
+ * @param arrival When they came off the socket, in us.
+ */
+void append_received(foggy_socket_t *sock, const uint8_t *data, int len,
+                     uint64_t arrival);
+
+/**
+ * Buffers a received segment in the receive window.
+ *
+ * @param sock The socket.
+ * @param pkt The segment.
+ *
+ * @return 0 if it was dropped for lack of room, 1 if it is held or brings
+ *         nothing new.
+ */
+int add_receive_window(foggy_socket_t *sock, uint8_t *pkt);
 
 void process_receive_window(foggy_socket_t *sock);
 
@@ -0,0 +1,55 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/* This file defines the latency histograms. They are log-linear like
+ * HdrHistogram: every power of two is split into 64 linear buckets, so any
+ * value from 1 us to over a day is kept within 1.6% using 8 KB. */
+
+#ifndef FOGGY_HIST_H_
+#define FOGGY_HIST_H_
+
+#include <stdint.h>
+
+#define HIST_SUB_BUCKETS 64
+#define HIST_BUCKETS (HIST_SUB_BUCKETS * 32)
+
+typedef struct {
+  uint32_t counts[HIST_BUCKETS];
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+} hist_t;
+
+/**
+ * Empties a histogram.
+ *
+ * @param hist The histogram.
+ */
+void hist_init(hist_t *hist);
+
+/**
+ * Records one value.
+ *
+ * @param hist The histogram.
+ * @param value The value, in us.
+ */
+void hist_record(hist_t *hist, uint64_t value);
+
+/**
+ * Returns the value below which a fraction of the recorded values fall.
+ *
+ * @param hist The histogram.
+ * @param fraction The fraction, e.g. 0.99 for p99.
+ *
+ * @return The highest value equivalent to the percentile, 0 if empty.
+ */
+uint64_t hist_percentile(const hist_t *hist, double fraction);
+
+#endif  // FOGGY_HIST_H_
@@ -0,0 +1,65 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/* This file defines the block codec of stream compression, a byte oriented
+ * LZ77 in the style of LZ4.
+ *
+ * A block is a list of sequences. Each one starts with a token: the number
+ * of literals in its high four bits and the match length minus LZ_MIN_MATCH
+ * in its low four. A nibble of 15 is continued by bytes added to it, the
+ * last one below 255. The literals follow, then the match offset, two bytes
+ * little endian, then the continuation of the match length. The match is
+ * copied from `offset` bytes back in the output and may overlap it. The last
+ * sequence has literals only and ends the block.
+ *
+ * The compressor finds matches through a hash table of the last position of
+ * every 4 byte prefix, and skips ahead faster the longer it finds none, so
+ * data that does not compress costs little time.
+ */
+
+#ifndef FOGGY_LZ_H_
+#define FOGGY_LZ_H_
+
+#include <stdint.h>
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_INPUT 65535  // bytes in one block, offsets fit in two bytes
+#define LZ_HASH_BITS 12
+
+/**
+ * Returns the largest a block of `len` bytes may grow to.
+ */
+static inline int lz_bound(int len) { return len + len / 255 + 16; }
+
+/**
+ * Compresses one block.
+ *
+ * @param src The data, at most LZ_MAX_INPUT bytes.
+ * @param len Its length.
+ * @param dst Where the block is written.
+ * @param cap The room in `dst`.
+ *
+ * @return The length of the block, or 0 if it does not fit in `cap`.
+ */
+int lz_compress(const uint8_t *src, int len, uint8_t *dst, int cap);
+
+/**
+ * Decompresses one block.
+ *
+ * @param src The block.
+ * @param len Its length.
+ * @param dst Where the data is written.
+ * @param cap The room in `dst`.
+ *
+ * @return The length of the data, or -1 if the block is malformed or the
+ * data does not fit in `cap`.
+ */
+int lz_decompress(const uint8_t *src, int len, uint8_t *dst, int cap);
+
+#endif  // FOGGY_LZ_H_
@@ -0,0 +1,181 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/* This file defines multipath connections, which stripe one byte stream over
+ * several UDP flows in the spirit of MPTCP (RFC 8684).
+ *
+ * An initiator started with FOGGY_SUBFLOWS=n (2 to MP_MAX_SUBFLOWS) asks for
+ * CAP_MULTIPATH in its SYN. Once the listener agrees, the initiator opens
+ * n - 1 more UDP sockets and joins each of them to the connection. They use
+ * other local ports, which is enough for ECMP to pick other paths. If
+ * FOGGY_SUBFLOW_ADDRS is set to a comma separated list of local addresses,
+ * they are also bound to those addresses in turn. Subflow 0 is the
+ * handshake's own socket. The listener keeps its one socket. It tells the
+ * subflows apart by the id in their packets and answers each on the address
+ * it heard it from.
+ *
+ * Sequence numbers stay those of the connection. Every transmission of a
+ * segment also carries OPT_SUBFLOW with the subflow id and a packet number
+ * of that subflow, which is never reused. The receiver echoes it in
+ * OPT_SUBFLOW_ACK on the ACK it sends back on the same subflow. From the
+ * echoes each subflow runs its own RTT estimator and retransmission timer.
+ * It also runs its own congestion window: slow start, then the coupled
+ * increase of RFC 6356, so the subflows together take no more than one TCP
+ * flow at a shared bottleneck. A packet is declared lost once a packet
+ * MP_REORDER_THRESHOLD numbers after it on its subflow was echoed. Lost
+ * segments go out again before new ones, on whichever subflow has room. The
+ * cumulative ACK still frees the send window. The receiver reassembles the
+ * stream in its receive window as before.
+ *
+ * The scheduler gives each segment to the subflow with the lowest smoothed
+ * RTT that has room in its congestion window. A subflow whose timer expires
+ * MP_FAIL_RTOS times in a row leaves the schedule, as long as another one is
+ * working. Its packets are sent again on the others, and it is probed with
+ * joins until it answers.
+ *
+ * FOGGY_MP_NETEM gives each subflow its own emulated link. It is a `;`
+ * separated list of FOGGY_NETEM specifications, in subflow order. An empty
+ * specification keeps the connection's link, see foggy_netem.h.
+ */
+
+#ifndef FOGGY_MP_H_
+#define FOGGY_MP_H_
+
+#include <netinet/in.h>
+#include <stdint.h>
+
+#include "foggy_tcp.h"
+
+#define MP_MAX_SUBFLOWS 8
+#define MP_MAX_PACKETS 256       // unresolved packets per subflow, a power of two
+#define MP_REORDER_THRESHOLD 3   // echoed packets after a lost one
+#define MP_FAIL_RTOS 3           // timeouts before a subflow leaves the schedule
+#define MP_NO_SEGMENT UINT32_MAX // packet number taken by a join
+
+typedef enum {
+  SUBFLOW_IDLE = 0,  // not opened, or not heard from yet on the listener
+  SUBFLOW_JOINING,   // joins sent, no answer yet
+  SUBFLOW_ACTIVE,    // in the schedule
+  SUBFLOW_FAILED,    // stopped answering, probed with joins
+} subflow_state_t;
+
+typedef struct {
+  uint32_t seg;   // segment number in the send window, MP_NO_SEGMENT if none
+  uint16_t len;   // payload bytes
+  uint8_t acked;  // 0 while in flight
+  uint64_t sent;  // us
+} mp_packet_t;
+
+typedef struct {
+  foggy_socket_t *sock;
+  int id;
+  subflow_state_t state;
+  int fd;                   // the connection's own socket, or one of its own
+  struct sockaddr_in addr;  // where the peer receives the subflow
+  netem_link_t *netem;      // link packets go through, NULL to bypass
+  int own_netem;            // the link was created for this subflow
+
+  uint32_t cwnd;            // bytes
+  uint32_t ssthresh;        // bytes
+  uint32_t in_flight;       // payload bytes of the unresolved packets
+  uint64_t reduced_at;      // us, losses of older packets are the same event
+  uint32_t srtt;            // us, 0 until the first sample
+  uint32_t rttvar;          // us
+  uint32_t rto;             // us
+  int timeouts;             // consecutive timer expiries
+  foggy_timer_t rto_timer;
+  foggy_timer_t join_timer;
+
+  uint32_t pn_next;         // packet number of the next transmission
+  uint32_t pn_oldest;       // oldest packet not resolved yet
+  mp_packet_t pkts[MP_MAX_PACKETS];  // packet pn at pn & (MP_MAX_PACKETS - 1)
+} subflow_t;
+
+struct mp_state {
+  subflow_t subflows[MP_MAX_SUBFLOWS];
+  int echo_id;       // subflow to echo on the next ACK, -1 if none
+  uint32_t echo_pn;  // packet number to echo
+  uint32_t lost;     // segments marked SEG_LOST
+  uint8_t tx_buf[RX_BUF_SIZE];  // outgoing packet with its subflow option
+};
+
+/**
+ * Reads FOGGY_SUBFLOWS and asks for CAP_MULTIPATH if more than one subflow is
+ * wanted.
+ *
+ * @param sock The new socket.
+ */
+void mp_init(foggy_socket_t *sock);
+
+/**
+ * Turns a connection that negotiated CAP_MULTIPATH into a multipath one.
+ * The initiator opens and starts joining its other subflows. Does nothing if
+ * it already is one.
+ *
+ * @param sock The socket, during the handshake.
+ */
+void mp_start(foggy_socket_t *sock);
+
+/**
+ * Closes the subflows. Must be called before the connection's socket and
+ * link are closed.
+ *
+ * @param sock The socket, may be single path.
+ */
+void mp_destroy(foggy_socket_t *sock);
+
+/**
+ * Returns the sockets of the subflows other than the connection's own.
+ *
+ * @param sock The socket.
+ * @param fds Filled with up to MP_MAX_SUBFLOWS descriptors.
+ *
+ * @return The number of descriptors.
+ */
+int mp_fds(foggy_socket_t *sock, int *fds);
+
+/**
+ * Takes the subflow options of a received packet: notes the packet to echo,
+ * learns where the subflow is reached and processes the echo it carries.
+ *
+ * @param sock The socket.
+ * @param pkt The received packet.
+ *
+ * @return 1 if the packet was a join and is consumed, 0 otherwise.
+ */
+int mp_on_recv(foggy_socket_t *sock, uint8_t *pkt);
+
+/**
+ * Drops the pending echo because the packet that asked for it was not taken,
+ * e.g. the receive window had no room for it. The echo is what tells the
+ * sender that a segment got through.
+ *
+ * @param sock The socket.
+ */
+void mp_discard_echo(foggy_socket_t *sock);
+
+/**
+ * Sends a packet that is not a segment of the send window, e.g. an ACK. An
+ * ACK carries the pending echo and goes out on the subflow being echoed,
+ * anything else on the first working subflow.
+ *
+ * @param sock The socket.
+ * @param pkt The packet.
+ */
+void mp_send_packet(foggy_socket_t *sock, uint8_t *pkt);
+
+/**
+ * Sends the lost segments again and then new ones, as long as the subflows
+ * and the receiver's window have room.
+ *
+ * @param sock The socket.
+ */
+void mp_transmit(foggy_socket_t *sock);
+
+#endif  // FOGGY_MP_H_
@@ -0,0 +1,127 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/* This file defines an in-process link emulator, a small `tc netem` that sits
+ * between the backend and `sendto`.
+ *
+ * Every socket gets its own emulated egress link. Packets go through, in
+ * order: loss, a token bucket bottleneck with a finite drop-tail queue,
+ * propagation delay with jitter, and reordering and duplication. Delayed
+ * packets are sent by one emulator thread shared by the process. Running
+ * both ends with the same settings impairs both directions.
+ *
+ * A link is a link, not an extra source of loss: closing a socket waits
+ * until its link delivered the packets it holds, such as the last ACK, so
+ * they are not lost when the process exits right after the close.
+ *
+ * The emulator is configured through FOGGY_NETEM, a comma separated list:
+ *
+ *   loss=1%            random loss
+ *   ge=p:r[:h[:k]]     Gilbert-Elliott burst loss, replaces loss: p is the
+ *                      good to bad and r the bad to good transition
+ *                      probability, h and k the loss probability in the bad
+ *                      (default 100%) and good (default 0%) state
+ *   delay=20ms         one-way delay, units us, ms or s
+ *   jitter=5ms         uniform jitter added to the delay
+ *   reorder=5%         packets sent right away, overtaking delayed ones
+ *   dup=1%             packets sent twice
+ *   rate=10mbit        bottleneck rate, units bit, kbit, mbit or gbit
+ *   burst=3kb          token bucket depth, default one packet
+ *   limit=64kb         bottleneck queue, units b, kb or mb, default 100kb
+ *   seed=42            seed for reproducible runs
+ *
+ * e.g. FOGGY_NETEM="delay=20ms,jitter=2ms,loss=1%,rate=10mbit,limit=64kb"
+ */
+
+#ifndef FOGGY_NETEM_H_
+#define FOGGY_NETEM_H_
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+  double loss;       // Bernoulli loss probability
+  double ge_p;       // Gilbert-Elliott good -> bad, 0 disables the model
+  double ge_r;       // Gilbert-Elliott bad -> good
+  double ge_h;       // loss probability in the bad state
+  double ge_k;       // loss probability in the good state
+  uint64_t delay;    // us
+  uint64_t jitter;   // us
+  double reorder;
+  double dup;
+  uint64_t rate;     // bytes per second, 0 for no bottleneck
+  uint32_t burst;    // bytes
+  uint32_t limit;    // bytes
+  uint64_t seed;     // 0 picks a random seed
+} netem_config_t;
+
+typedef struct netem_link netem_link_t;
+
+/**
+ * Parses an emulator specification, see the top of this file.
+ *
+ * @param spec The specification.
+ * @param cfg Filled with the configuration.
+ *
+ * @return 0 on success, -1 if the specification is malformed.
+ */
+int netem_parse(const char *spec, netem_config_t *cfg);
+
+/**
+ * Returns the configuration from FOGGY_NETEM, parsed once per process.
+ *
+ * @return The configuration, or NULL when the emulator is not enabled.
+ */
+const netem_config_t *netem_env_config();
+
+/**
+ * Creates an emulated link.
+ *
+ * @param cfg The link configuration.
+ *
+ * @return The link, or NULL on error.
+ */
+netem_link_t *netem_link_create(const netem_config_t *cfg);
+
+/**
+ * Waits until the link sent the packets it holds, each at its release time.
+ * That takes at most the delay and jitter plus the time the bottleneck queue
+ * needs to drain. Packets sent on the link meanwhile are waited for too.
+ *
+ * Must be called before a socket the link sends on is closed.
+ *
+ * @param link The link, may be NULL.
+ */
+void netem_link_flush(netem_link_t *link);
+
+/**
+ * Destroys a link once it sent the packets it holds, see netem_link_flush.
+ *
+ * Must be called before the socket the link sends on is closed.
+ *
+ * @param link The link, may be NULL.
+ */
+void netem_link_destroy(netem_link_t *link);
+
+/**
+ * Sends a packet through the link.
+ *
+ * The packet is copied, so the caller keeps ownership of `pkt`.
+ *
+ * @param link The link.
+ * @param fd The UDP socket to send on.
+ * @param addr The destination.
+ * @param pkt The packet.
+ * @param len The length of the packet.
+ */
+void netem_send(netem_link_t *link, int fd, const struct sockaddr_in *addr,
+                const uint8_t *pkt, size_t len);
+
+#endif  // FOGGY_NETEM_H_
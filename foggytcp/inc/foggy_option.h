@@ -0,0 +1,92 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/* This file defines the options carried in the header extension field.
+ *
+ * The extension is a sequence of TLV options. Each option starts with a one
+ * byte kind and a one byte length covering the whole option, followed by the
+ * value. Multi-byte values are in network byte order.
+ */
+
+#ifndef FOGGY_OPTION_H_
+#define FOGGY_OPTION_H_
+
+#include <stdint.h>
+
+#include "foggy_packet.h"
+
+#define OPT_CAPS 1    // Capability bitmap, only on SYN and SYN-ACK.
+#define OPT_CRC32C 2  // CRC32C over the whole packet.
+#define OPT_FASTOPEN 3  // Fast-open cookie, empty to request one. SYN only.
+#define OPT_MSS 4       // Largest payload accepted, only on SYN and SYN-ACK.
+#define OPT_PROBE 5     // Path MTU probe of the given size, see foggy_pmtu.h.
+#define OPT_PROBE_ACK 6 // Answer to the probe of the given size.
+#define OPT_SUBFLOW 7   // Subflow id and packet number, see foggy_mp.h.
+#define OPT_SUBFLOW_ACK 8  // Echo of the OPT_SUBFLOW being acknowledged.
+#define OPT_FEC 9       // Range and count of a parity packet, see foggy_fec.h.
+#define OPT_STREAM 10   // Stream, offset and flags of the payload, see foggy_stream.h.
+#define OPT_STREAM_WINDOW 11  // Streams and the offsets they may send up to.
+#define OPT_WSCALE 12   // Window scale shift, only on SYN and SYN-ACK.
+
+#define OPT_CAPS_LEN 6
+#define OPT_CRC32C_LEN 6
+#define OPT_MSS_LEN 4
+#define OPT_PROBE_LEN 4
+#define OPT_SUBFLOW_LEN 7  // also OPT_SUBFLOW_ACK
+#define OPT_FEC_LEN 11
+#define OPT_STREAM_LEN 11
+#define OPT_WSCALE_LEN 3
+
+/* Capability bits exchanged in OPT_CAPS. */
+#define CAP_CRC32C 0x1
+#define CAP_MULTIPATH 0x2
+#define CAP_FEC 0x4
+#define CAP_COMPRESS 0x8
+#define CAP_STREAMS 0x10
+
+/**
+ * Allocates and initializes a packet with extension options.
+ *
+ * Unlike `create_packet`, the header and packet lengths are derived from the
+ * extension and payload lengths, and the extension is placed right after the
+ * fixed header where `get_extension_data` expects it.
+ *
+ * @return A pointer to the newly allocated packet. User must `free` after use.
+ */
+uint8_t *create_packet_ext(uint16_t src, uint16_t dst, uint32_t seq,
+                           uint32_t ack, uint8_t flags, uint16_t adv_window,
+                           uint16_t ext_len, const uint8_t *ext_data,
+                           const uint8_t *payload, uint16_t payload_len);
+
+/**
+ * Appends an option to an extension buffer.
+ *
+ * @param ext The extension buffer, must have room for the option.
+ * @param kind The option kind.
+ * @param value The option value.
+ * @param value_len The length of the value.
+ *
+ * @return The number of bytes written.
+ */
+uint16_t put_option(uint8_t *ext, uint8_t kind, const void *value,
+                    uint8_t value_len);
+
+/**
+ * Finds an option in a received packet.
+ *
+ * @param pkt The packet, at least `get_plen` bytes long.
+ * @param kind The option kind to look for.
+ * @param value_len Set to the length of the option value if not NULL.
+ *
+ * @return A pointer to the option value, or NULL if the option is absent or
+ *         the extension is malformed.
+ */
+uint8_t *find_option(uint8_t *pkt, uint8_t kind, uint8_t *value_len);
+
+#endif  // FOGGY_OPTION_H_
@@ -0,0 +1,74 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/* This file defines the segment size negotiation and packetization layer
+ * path MTU discovery (RFC 8899).
+ *
+ * Both ends announce in OPT_MSS of the SYN and SYN-ACK the largest payload
+ * they accept, FOGGY_MSS or PMTU_MAX - header by default. Data starts at the
+ * compile time MSS, which every path is assumed to carry. If the peer
+ * accepts more, the sender searches the path with padded probes that carry
+ * OPT_PROBE and take no sequence space; the receiver answers each with an
+ * OPT_PROBE_ACK. A size whose probe is answered becomes the new segment
+ * size, one lost PMTU_MAX_PROBES times in a row caps the search. Repeated
+ * timeouts of a segment larger than the base size are taken as a black hole:
+ * the segment size falls back to the base and the search starts over later.
+ */
+
+#ifndef FOGGY_PMTU_H_
+#define FOGGY_PMTU_H_
+
+#include <stdint.h>
+
+#include "foggy_tcp.h"
+
+#define PMTU_BASE MAX_LEN            // packet size every path carries
+#define PMTU_MAX 65000               // largest packet ever probed
+#define PMTU_STEP 64                 // the search stops this close to the limit
+#define PMTU_MAX_PROBES 3            // losses before a size is given up
+#define PMTU_BLACKHOLE_RTOS 2        // timeouts before falling back to the base
+#define PMTU_RAISE_INTERVAL 600000000  // us, between searches for a larger size
+
+/**
+ * Sets up the segment size of a new socket from FOGGY_MSS.
+ *
+ * @param sock The socket.
+ */
+void pmtu_init(foggy_socket_t *sock);
+
+/**
+ * Takes the peer's OPT_MSS from its SYN or SYN-ACK and starts the search if
+ * the peer accepts larger segments.
+ *
+ * @param sock The socket.
+ * @param pkt The SYN or SYN-ACK.
+ */
+void pmtu_start(foggy_socket_t *sock, uint8_t *pkt);
+
+/**
+ * Answers a probe, or accounts for the answer to ours.
+ *
+ * @param sock The socket.
+ * @param pkt The received packet.
+ *
+ * @return 1 if the packet was a probe or a probe answer and is consumed,
+ *         0 otherwise.
+ */
+int pmtu_on_recv(foggy_socket_t *sock, uint8_t *pkt);
+
+/**
+ * Falls back to the base segment size when the retransmission timer keeps
+ * expiring on a packet larger than the base.
+ *
+ * @param sock The socket.
+ * @param plen The length of the packet being retransmitted.
+ */
+void pmtu_on_rto(foggy_socket_t *sock, uint16_t plen);
+
+#endif  // FOGGY_PMTU_H_
@@ -0,0 +1,97 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/* This file defines the send window ring. Segments are numbered in the order
+ * they were queued, and segment n lives at index n & mask of a power of two
+ * ring that doubles when it fills up. The per-segment metadata is kept in
+ * parallel arrays, so the ACK and timer paths only touch the fields they
+ * need.
+ *
+ * The segments in [head, next) have been sent and wait for their ACK, the
+ * ones in [next, tail) have not been sent yet.
+ */
+
+#ifndef FOGGY_RING_H_
+#define FOGGY_RING_H_
+
+#include <stdint.h>
+
+#define SEND_RING_INITIAL_SIZE 64  // segments, a power of two
+
+/* Marks the multipath scheduler keeps per segment, see foggy_mp.h. */
+#define SEG_SACKED 0x1  // one of its copies was echoed by the receiver
+#define SEG_LOST 0x2    // waits to be sent again
+
+typedef struct {
+  uint8_t **msg;        // the packets, network byte order
+  uint32_t *seq;        // first sequence number
+  uint16_t *len;        // payload length
+  uint64_t *send_time;  // us, last transmission, 0 if never sent
+  uint8_t *retx;        // retransmissions so far
+  uint8_t *flags;       // SEG_* marks
+  uint32_t mask;        // size - 1
+  uint32_t head;        // oldest segment
+  uint32_t next;        // oldest segment not sent yet
+  uint32_t tail;        // one past the newest segment
+} send_ring_t;
+
+/**
+ * Allocates an empty ring.
+ *
+ * @param ring The ring.
+ */
+void send_ring_init(send_ring_t *ring);
+
+/**
+ * Frees a ring and the packets still in it.
+ *
+ * @param ring The ring.
+ */
+void send_ring_destroy(send_ring_t *ring);
+
+/**
+ * Queues a packet behind the others, not sent yet. The ring takes ownership
+ * of it.
+ *
+ * @param ring The ring.
+ * @param msg The packet.
+ * @param seq Its first sequence number.
+ * @param len Its payload length.
+ */
+void send_ring_push(send_ring_t *ring, uint8_t *msg, uint32_t seq,
+                    uint16_t len);
+
+/**
+ * Removes the oldest segment.
+ *
+ * @param ring The ring, must not be empty.
+ *
+ * @return The packet, the caller must `free` it.
+ */
+uint8_t *send_ring_pop(send_ring_t *ring);
+
+static inline uint32_t send_ring_slot(const send_ring_t *ring, uint32_t n) {
+  return n & ring->mask;
+}
+
+static inline int send_ring_empty(const send_ring_t *ring) {
+  return ring->head == ring->tail;
+}
+
+/**
+ * Returns the payload bytes sent and not acknowledged yet.
+ */
+static inline uint32_t send_ring_in_flight(const send_ring_t *ring) {
+  if (ring->next == ring->head) return 0;
+  uint32_t last = send_ring_slot(ring, ring->next - 1);
+  return ring->seq[last] + ring->len[last] -
+         ring->seq[send_ring_slot(ring, ring->head)];
+}
+
+#endif  // FOGGY_RING_H_
@@ -0,0 +1,110 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/* This file defines the tunables of a socket behind foggy_setsockopt.
+ *
+ * Every socket starts from the defaults of grading.h and foggy_tcp.h. As
+ * foggy_socket() returns connected, FOGGY_SOCKOPTS sets what must be known
+ * before the handshake, for every socket of the process. It is a comma
+ * separated list of name=value pairs, e.g.
+ *   FOGGY_SOCKOPTS="sndbuf=4mb,rcvbuf=4mb,init_cwnd=10,cc=cubic,pacing=1"
+ * with the names
+ *   sndbuf, rcvbuf        bytes, with an optional kb or mb unit
+ *   init_cwnd             segments of MSS bytes
+ *   init_ssthresh         bytes
+ *   rto_init, rto_min,    times, with an optional s, ms or us unit (us)
+ *   rto_max, delack,
+ *   busy_poll
+ *   cc                    reno or cubic
+ *   pacing, linger        0 or 1
+ *   cpu                   a CPU, or a range of them like 2-5 that the
+ *                         sockets take in turns, see foggy_busy.h
+ *
+ * The application sets options in new_opts under send_lock, the backend
+ * takes them over with sockopt_apply() at its next turn. The receive slots
+ * are reserved right away, so they are never fewer than the receive buffer
+ * the backend works with needs.
+ *
+ * Windows larger than 64 KiB are advertised with the window scale option of
+ * RFC 7323: both SYNs carry OPT_WSCALE with the shift of their sender, which
+ * is the smallest that fits its receive buffer. Windows are scaled once both
+ * sent one, and never on the SYNs themselves.
+ */
+
+#ifndef FOGGY_SOCKOPT_H_
+#define FOGGY_SOCKOPT_H_
+
+#include <stdint.h>
+
+#include "foggy_tcp.h"
+
+/**
+ * Sets the options of a new socket to the defaults and FOGGY_SOCKOPTS, and
+ * reserves its receive slots.
+ *
+ * @param sock The new socket.
+ */
+void sockopt_init(foggy_socket_t *sock);
+
+/**
+ * Takes over the options the application set since the last call. Must be
+ * called by the backend with send_lock held.
+ *
+ * @param sock The socket.
+ */
+void sockopt_apply(foggy_socket_t *sock);
+
+/**
+ * Grows the receive slots so that a receive buffer of the given size never
+ * runs out of them with full segments. Must be called with recv_lock held
+ * once the backend runs.
+ *
+ * @param sock The socket.
+ * @param rcvbuf The receive buffer in bytes.
+ */
+void sockopt_reserve(foggy_socket_t *sock, uint32_t rcvbuf);
+
+/**
+ * Appends the OPT_WSCALE of a SYN or SYN-ACK. The listener only answers one
+ * that came in the SYN.
+ *
+ * @param sock The socket.
+ * @param ext The extension buffer, with room for OPT_WSCALE_LEN bytes.
+ *
+ * @return The number of bytes written.
+ */
+uint16_t sockopt_put_wscale(foggy_socket_t *sock, uint8_t *ext);
+
+/**
+ * Agrees on the window scale with the OPT_WSCALE of the peer's SYN or
+ * SYN-ACK.
+ *
+ * @param sock The socket, during the handshake.
+ * @param pkt The SYN or SYN-ACK.
+ */
+void sockopt_start(foggy_socket_t *sock, uint8_t *pkt);
+
+/**
+ * Returns the window to advertise in a packet, scaled and clamped to fit the
+ * window field.
+ *
+ * @param sock The socket.
+ * @param flags The flags of the packet, SYNs are never scaled.
+ */
+uint16_t sockopt_advertise(foggy_socket_t *sock, uint8_t flags);
+
+/**
+ * Returns the window a received packet advertises, in bytes.
+ *
+ * @param sock The socket.
+ * @param hdr The header of the packet.
+ */
+uint32_t sockopt_peer_window(foggy_socket_t *sock, foggy_tcp_header_t *hdr);
+
+#endif  // FOGGY_SOCKOPT_H_
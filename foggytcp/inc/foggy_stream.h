@@ -0,0 +1,228 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/* This file defines multiplexed streams, independent byte streams sharing
+ * one connection in the spirit of QUIC (RFC 9000).
+ *
+ * With FOGGY_STREAMS=1 a side asks for CAP_STREAMS in its SYN. Once the peer
+ * agrees, every data segment carries OPT_STREAM: the id of the stream its
+ * payload belongs to, the offset of the payload in that stream and the
+ * STREAM_* flags. Sequence numbers, ACKs and retransmissions stay those of
+ * the connection, but the receiver hands each segment to its stream as soon
+ * as it arrives, in order or not. A loss only holds back the stream it hit,
+ * the others keep being delivered while the connection waits for the
+ * retransmission.
+ *
+ * Stream 0 is the connection's own: foggy_read() and foggy_write() use it,
+ * and closing it is foggy_shutdown(), which ends every stream. Other streams
+ * are opened by foggy_stream_open(), even ids by the initiator and odd ones
+ * by the listener. Opening a stream sends nothing, its first segment tells
+ * the peer, which also takes every lower id of the same side as opened.
+ * foggy_stream_close() sends the stream's FIN on its last segment, or on a
+ * segment of one padding byte flagged STREAM_EMPTY if everything was sent
+ * already. A stream is forgotten once both sides closed it and its reader
+ * saw the end.
+ *
+ * Flow control applies per stream on top of the connection's window: a
+ * stream may run STREAM_WINDOW bytes past what the peer's application read.
+ * The receiver announces stream limits in OPT_STREAM_WINDOW on its ACKs: the
+ * limit of the stream it heard from last, and those the application read
+ * half a window from since they were last announced, which also get an ACK
+ * of their own if no data is coming in. Announcements are not
+ * reliable, so a stream out of credit with nothing in flight sends one byte
+ * past its limit after a backed off timeout, like a TCP window probe, and
+ * the ACK brings the limit back. Stream 0 has the connection's window only.
+ *
+ * The scheduler takes one segment from each stream with data and credit in
+ * turn. Streams do not combine with FEC, whose rebuilt segments have no
+ * options, nor with compression, which frames the connection's byte
+ * sequence: a listener that agrees to CAP_STREAMS turns those down.
+ */
+
+#ifndef FOGGY_STREAM_H_
+#define FOGGY_STREAM_H_
+
+#include <stdint.h>
+
+#include "foggy_tcp.h"
+
+#define STREAM_MAX 64          // streams open at once, stream 0 included
+#define STREAM_WINDOW 65536    // bytes a stream may run ahead of the reader
+#define STREAM_MAX_PIECES 64   // out of order segments held per stream
+#define STREAM_MARKS 1024      // stream 0 segments in flight tracked, a power of two
+#define STREAM_ANNOUNCE_MAX 8  // limits one ACK carries
+
+/* OPT_STREAM_WINDOW holds an id and a limit, 4 bytes each, per stream. */
+#define OPT_STREAM_WINDOW_MAX_LEN (2 + 8 * STREAM_ANNOUNCE_MAX)
+
+/* Flags of OPT_STREAM. */
+#define STREAM_FIN 0x1    // the stream ends after this payload
+#define STREAM_EMPTY 0x2  // the payload is one padding byte, not stream data
+
+typedef struct {
+  uint32_t offset;
+  uint16_t len;
+  uint8_t flags;
+  uint8_t *data;
+} stream_piece_t;
+
+typedef struct {
+  int id;  // -1 if the slot is free
+
+  /* Sending side, protected by send_lock. Stream 0 sends sending_buf. */
+  uint8_t *send_buf;
+  int send_len;
+  uint32_t send_offset;  // offset of the next byte to cut into a segment
+  uint32_t send_limit;   // the peer takes bytes up to this offset
+  int send_closed;       // no more writes, the FIN follows the data
+  int fin_sent;
+
+  /* Receiving side, protected by recv_lock. Stream 0 fills received_buf. */
+  uint8_t *recv_buf;
+  int recv_len;
+  uint32_t recv_offset;    // offset of the next byte expected
+  uint32_t read_offset;    // bytes the application read
+  uint32_t read_notified;  // read_offset when the backend was last told
+  uint32_t announced;      // the last limit announced, backend only
+  int peer_fin;            // the FIN is at recv_offset
+  int read_eof;            // the application was told
+  int accepted;            // opened by us or returned by foggy_stream_accept()
+  int piece_count;
+  stream_piece_t pieces[STREAM_MAX_PIECES];  // ahead of recv_offset
+} stream_t;
+
+typedef struct {
+  uint32_t seq;  // where the segment ends in the sequence space
+  uint64_t raw;  // and in stream 0, as counted by bytes_written
+} stream_mark_t;
+
+struct stream_table {
+  stream_t streams[STREAM_MAX];  // stream 0 always at index 0
+  int next_id;        // the id foggy_stream_open() gives next
+  int max_peer_id;    // highest id the peer opened
+  int accept_next;    // next peer id foggy_stream_accept() returns
+  int rr;             // slot the scheduler looks at next
+  int update;         // the application read, limits may be due
+  int wakeup;         // a stream became readable or was opened
+  uint32_t buffered;  // unread bytes of the streams other than 0
+
+  /* What the ACKs carry in OPT_STREAM_WINDOW, backend only. */
+  int announce_count;
+  uint32_t announce[STREAM_ANNOUNCE_MAX][2];  // id and limit, network order
+
+  int probe;                  // the probe timer fired
+  uint32_t probe_backoff;     // us until the next probe
+  foggy_timer_t probe_timer;  // runs while a stream is out of credit
+
+  uint32_t marks_head, marks_tail;  // stream 0 segments not ACKed, mark n at
+  stream_mark_t marks[STREAM_MARKS];  // n & (STREAM_MARKS - 1)
+  uint64_t raw_acked;                 // stream 0 bytes ACKed
+};
+
+/**
+ * Reads FOGGY_STREAMS and asks for CAP_STREAMS if streams are wanted.
+ *
+ * @param sock The new socket.
+ */
+void stream_init(foggy_socket_t *sock);
+
+/**
+ * Sets up the streams of a connection that negotiated CAP_STREAMS. The
+ * initiator calls it once it knows what its SYN delivered.
+ *
+ * @param sock The socket, during the handshake.
+ */
+void stream_start(foggy_socket_t *sock);
+
+/**
+ * Releases the streams and what they buffer.
+ *
+ * @param sock The socket, may not use streams.
+ */
+void stream_destroy(foggy_socket_t *sock);
+
+/**
+ * Hands the payload of a data segment to its stream, as soon as it arrives.
+ * Data already delivered is skipped.
+ *
+ * @param sock The socket.
+ * @param pkt The segment.
+ * @param arrival When it came off the socket, in us.
+ *
+ * @return 1 if it was taken, 0 if the stream has no room to hold it.
+ */
+int stream_on_data(foggy_socket_t *sock, uint8_t *pkt, uint64_t arrival);
+
+/**
+ * Takes the stream limits announced on a received ACK.
+ *
+ * @param sock The socket.
+ * @param pkt The packet.
+ */
+void stream_on_ack(foggy_socket_t *sock, uint8_t *pkt);
+
+/**
+ * Adds the stream limits last planned to the options of an outgoing ACK.
+ *
+ * @param sock The socket.
+ * @param ext The options, with room for OPT_STREAM_WINDOW_MAX_LEN more bytes.
+ *
+ * @return The length of the option added.
+ */
+int stream_put_window(foggy_socket_t *sock, uint8_t *ext);
+
+/**
+ * Builds the OPT_STREAM of a piece of a segment, when the segment is split.
+ *
+ * @param msg The segment.
+ * @param off Where the piece starts in its payload.
+ * @param len The length of the piece.
+ * @param ext Filled with the option.
+ *
+ * @return The length of the option, 0 if the segment has none.
+ */
+int stream_split_option(uint8_t *msg, uint16_t off, uint16_t len, uint8_t *ext);
+
+/**
+ * Cuts the streams' data into segments, a segment per stream in turn, as
+ * long as the send window has room, and sends them. In place of taking
+ * sending_buf apart and calling send_pkts().
+ *
+ * Must be called without send_lock held.
+ *
+ * @param sock The connected socket.
+ */
+void stream_transmit(foggy_socket_t *sock);
+
+/**
+ * Sends an ACK with a stream limit the application's reads moved forward.
+ *
+ * @param sock The socket.
+ */
+void stream_send_update(foggy_socket_t *sock);
+
+/**
+ * Returns how much the streams other than 0 still have to send, their
+ * pending FINs counting one byte each.
+ *
+ * Must be called with send_lock held.
+ *
+ * @param sock The socket.
+ */
+int stream_unsent(foggy_socket_t *sock);
+
+/**
+ * Returns how many bytes of stream 0 are fully ACKed, the counterpart of
+ * bytes_acked in bytes_written terms.
+ *
+ * @param sock The socket.
+ */
+uint64_t stream_acked(foggy_socket_t *sock);
+
+#endif  // FOGGY_STREAM_H_
@@ -16,12 +16,19 @@ from releasing their forks in any public places. */
 #include <netinet/in.h>
 #include <pthread.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <time.h>
+#include <atomic>
 #include <deque>
 
+#include "foggy_fastopen.h"
+#include "foggy_hist.h"
+#include "foggy_netem.h"
 #include "foggy_packet.h"
+#include "foggy_ring.h"
+#include "foggy_timer.h"
 #include "grading.h"
 
 using namespace std;
@@ -31,7 +38,29 @@ using namespace std;
 #define EXIT_FAILURE 1
 
 /* <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<< */
-#define RECEIVE_WINDOW_SLOT_SIZE 64
+#define RECEIVE_WINDOW_SLOT_SIZE 64  // receive slots at least, see sockopt_reserve
+
+#define SOCKOPT_BUF_MAX (64 << 20)  // bytes, largest send or receive buffer
+#define WSCALE_MAX 14               // largest window scale shift (RFC 7323)
+#define PACING_SS_RATIO 200         // percent of cwnd / srtt paced in slow start
+#define PACING_CA_RATIO 120         // and afterwards
+#define CUBIC_C 0.4                 // CUBIC scaling constant (RFC 9438)
+#define CUBIC_BETA 0.7              // CUBIC multiplicative decrease
+
+#define RTO_MIN 200000      // us
+#define RTO_MAX 60000000    // us
+#define SYN_MAX_RETRIES 6   // SYN and SYN-ACK retransmissions before giving up
+#define FIN_MAX_RETRIES 5   // FIN retransmissions before aborting the close
+#define FIN_WAIT_TIMEOUT 10000000  // us to wait for the peer's FIN after ours
+#define TIME_WAIT_MAX 2000000      // us, TIME_WAIT lasts 2 * RTO up to this
+#define CORK_TIMEOUT 200000        // us a corked partial segment waits at most
+#define DELACK_MAX 500000          // us an ACK may be delayed at most (RFC 1122)
+#define DELACK_QUICKACKS 16        // segments ACKed at once when the sender waits
+#define BUSY_POLL_MAX 1000000      // us the backend may spin per wait at most
+
+#define RX_BUF_SIZE 65536      // fits the largest datagram, GRO ones included
+#define GSO_MAX_SEGMENTS 64    // UDP_MAX_SEGMENTS in the kernel
+#define GSO_MAX_BYTES 65000    // below the 65507 bytes of a UDP datagram
 
 typedef enum {
   RENO_SLOW_START = 0,
@@ -40,21 +69,144 @@ typedef enum {
 } reno_state_t;
 
 typedef struct {
-  int is_sent;
   uint8_t* msg;
+  int is_used;
+  uint64_t arrival;  // us, when the segment came off the socket
+} receive_window_slot_t;
+
+/**
+ * Per-connection counters and gauges behind `foggy_get_info`.
+ *
+ * Only one thread writes them at a time (the application during the
+ * handshake, the backend afterwards), so updates are relaxed loads and stores
+ * without read-modify-write, and readers on other threads never take a lock.
+ */
+typedef struct {
+  atomic<uint64_t> bytes_sent{0};     // payload bytes, retransmissions included
+  atomic<uint64_t> bytes_acked{0};
+  atomic<uint64_t> bytes_retrans{0};
+  atomic<uint64_t> segs_sent{0};      // all packets, control packets included
+  atomic<uint64_t> segs_retrans{0};
+  atomic<uint64_t> dup_acks{0};
+  atomic<uint64_t> ooo_segments{0};   // data segments received ahead of a gap
+  atomic<uint64_t> fec_parity_sent{0};
+  atomic<uint64_t> fec_recovered{0};  // segments rebuilt from parity
+  atomic<uint64_t> compress_saved{0};
+  atomic<uint64_t> syscalls{0};      // for packets and wakeups
+  atomic<uint64_t> spin_us{0};       // time the backend spent busy polling
+
+  atomic<uint32_t> cwnd{0};
+  atomic<uint32_t> ssthresh{0};
+  atomic<uint32_t> reno_state{0};
+  atomic<uint32_t> srtt{0};
+  atomic<uint32_t> rttvar{0};
+  atomic<uint32_t> rto{0};
+  atomic<uint32_t> rcv_occupancy{0};
+  atomic<uint32_t> mss{0};
+} foggy_stats_t;
 
-  int is_rtt_sample;
-  struct timespec send_time;
-  time_t timeout_interval;
-} send_window_slot_t;
+static inline void stat_add(atomic<uint64_t> *counter, uint64_t n) {
+  counter->store(counter->load(memory_order_relaxed) + n, memory_order_relaxed);
+}
 
+/**
+ * Congestion control time series of a connection, see foggy_cclog.h.
+ */
 typedef struct {
-  uint8_t* msg;
-  int is_used;
-} receive_window_slot_t;
+  FILE *file;           // NULL when the sampler is off
+  uint64_t start;       // us, time 0 of the series
+  uint64_t interval;    // us between periodic samples, 0 for changes only
+  foggy_timer_t timer;  // next periodic sample
+  uint32_t cwnd;        // last sampled values, a change triggers a sample
+  uint32_t ssthresh;
+  uint32_t reno_state;
+  uint32_t rto;
+} cc_log_t;
+
+struct mp_state;   // see foggy_mp.h
+struct fec_state;  // see foggy_fec.h
+struct compress_state;  // see foggy_compress.h
+struct stream_table;    // see foggy_stream.h
+struct uring_state;     // see foggy_uring.h
+
+/**
+ * Path MTU discovery state of a connection, see foggy_pmtu.h. Sizes are whole
+ * packets, header included.
+ */
+typedef struct {
+  uint16_t plpmtu;      // largest size known to get through
+  uint16_t max;         // search ceiling, 0 if the peer cannot be probed
+  uint16_t high;        // smallest size known not to get through
+  uint16_t probe_size;  // size being probed, 0 once the search is over
+  uint8_t probes;       // probes of probe_size sent so far
+  foggy_timer_t timer;  // next probe, or the next search
+} pmtu_t;
+
+/**
+ * Tunables of a socket, see foggy_setsockopt. The defaults are the constants
+ * of grading.h and this file, FOGGY_SOCKOPTS overrides them.
+ */
+typedef struct {
+  uint32_t sndbuf;         // bytes written but not ACKed, in flight or queued
+  uint32_t rcvbuf;         // bytes the receive side buffers
+  uint32_t init_cwnd;      // bytes
+  uint32_t init_ssthresh;  // bytes
+  uint32_t rto_init;       // us, until the first RTT sample
+  uint32_t rto_min;        // us
+  uint32_t rto_max;        // us
+  uint32_t congestion;     // foggy_cc_t
+  uint32_t pacing;         // spread the window over the RTT
+  uint32_t delack;         // us an ACK may wait for a second segment, 0 if not
+  uint32_t busy_poll;      // us the backend spins before it sleeps, 0 if not
+  int32_t cpu;             // the backend thread is pinned to, -1 if not
+  uint32_t linger;         // foggy_close() waits through TIME_WAIT
+} foggy_sockopts_t;
+
+typedef struct foggy_cq foggy_cq_t;  // see foggy_cq.h
+
+/**
+ * An asynchronous read or write queued on a socket, see foggy_async.h.
+ */
+typedef struct {
+  foggy_cq_t *cq;   // where its completion goes
+  uint8_t *buf;     // the application's buffer
+  int len;
+  int done;         // bytes of a write taken into sending_buf so far
+  void *user_data;
+} async_op_t;
 
 /* >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>> */
 
+/* Options of foggy_setsockopt, all of them int. */
+typedef enum {
+  FOGGY_SO_SNDBUF = 0,   // bytes written but not ACKed, MAX_NETWORK_BUFFER
+  FOGGY_SO_RCVBUF,       // bytes buffered for reading, MAX_NETWORK_BUFFER
+  FOGGY_INIT_CWND,       // bytes, WINDOW_INITIAL_WINDOW_SIZE
+  FOGGY_INIT_SSTHRESH,   // bytes, WINDOW_INITIAL_SSTHRESH
+  FOGGY_RTO_INIT,        // us before the first RTT sample, WINDOW_INITIAL_RTT
+  FOGGY_RTO_MIN,         // us, RTO_MIN
+  FOGGY_RTO_MAX,         // us, RTO_MAX
+  FOGGY_CONGESTION,      // foggy_cc_t, FOGGY_CC_RENO
+  FOGGY_PACING,          // 1 to pace segments at the rate of the window, 0
+  FOGGY_DELACK,          // us an ACK may be delayed, 0 to ACK every segment
+  FOGGY_BUSY_POLL,       // us the backend spins before it sleeps, 0
+  FOGGY_CPU,             // CPU the backend thread is pinned to, -1 for none
+  FOGGY_LINGER,          // 1 for foggy_close() to wait through TIME_WAIT, 0
+} foggy_sockopt_t;
+
+/* Congestion control algorithms, see FOGGY_CONGESTION. */
+typedef enum {
+  FOGGY_CC_RENO = 0,  // NewReno (RFC 5681, RFC 6582)
+  FOGGY_CC_CUBIC,     // CUBIC (RFC 9438)
+} foggy_cc_t;
+
+/* How partial segments of small writes are sent, see foggy_set_coalescing. */
+typedef enum {
+  FOGGY_NAGLE = 0,  // held while an earlier partial segment is unACKed
+  FOGGY_NODELAY,    // sent at once
+  FOGGY_CORK,       // held until uncorked or for CORK_TIMEOUT
+} foggy_coalesce_t;
+
 typedef enum {
   TCP_INITIATOR = 0,
   TCP_LISTENER = 1,
@@ -73,7 +225,16 @@ typedef struct {
   uint32_t congestion_window;
 
   reno_state_t reno_state;
+  uint32_t recover;  // fast recovery ends once this is ACKed (NewReno)
+  uint32_t w_max;    // bytes, window before the last reduction (CUBIC)
+  uint32_t w_est;    // bytes, what Reno would have grown to since (CUBIC)
+  uint64_t epoch;    // us, start of the current growth, 0 if none (CUBIC)
+  double k;          // s, time the growth takes back to w_max (CUBIC)
   pthread_mutex_t ack_lock;
+
+  uint32_t srtt;    // smoothed RTT in us, 0 until the first sample
+  uint32_t rttvar;  // RTT variation in us
+  uint32_t rto;     // retransmission timeout in us
 } window_t;
 
 /**
@@ -94,15 +255,110 @@ struct foggy_socket_t {
   int sending_len;
   foggy_socket_type_t type;
   pthread_mutex_t send_lock;
+  pthread_cond_t send_cond;  // signaled when sending_buf has room again
+  int event_fd;              // eventfd the backend sleeps on, see notify_backend
   int dying;
   pthread_mutex_t death_lock;
   window_t window;
   pthread_mutex_t connected_lock;
   int connected;  // indicates if the socket is in valid connection state
+  uint32_t caps_wanted;  // CAP_* bits this side asks for in the SYN
+  uint32_t caps;         // CAP_* bits negotiated during the handshake
+  uint32_t iss;          // initial sequence number, resent in SYN-ACKs
+
+  /* Handshake retransmission and fast open */
+  uint64_t handshake_sent;  // when the last SYN or SYN-ACK was sent, in us
+  int handshake_retries;
+  int fastopen;          // fast open enabled on this socket
+  int fastopen_pending;  // initiator: SYN deferred until there is data
+  int send_cookie;       // listener: include a cookie in the SYN-ACK
+  uint8_t fastopen_cookie[FASTOPEN_COOKIE_LEN];
+
+  netem_link_t *netem;  // emulated link packets go through, NULL to bypass
+  int gso;              // batch segments with UDP GSO, receive with UDP GRO
+  int uring_wanted;     // FOGGY_URING
+  struct uring_state *uring;  // io_uring engine, NULL on the socket calls
+  uint16_t mss;         // payload of the data segments we send, options included
+  uint16_t local_mss;   // largest payload we accept, announced in OPT_MSS
+  pmtu_t pmtu;
+  uint8_t *rx_buf;      // RX_BUF_SIZE bytes, datagrams are received here
+  struct sockaddr_in rx_from;  // source of the datagram in rx_buf
+  int subflows;         // subflows an initiator opens, FOGGY_SUBFLOWS
+  struct mp_state *mp;  // multipath state, NULL on a single path
+  int fec_group;        // segments per parity packet, FOGGY_FEC
+  struct fec_state *fec;  // FEC state, NULL if not negotiated
+  int compress;         // compress what we send, FOGGY_COMPRESS
+  struct compress_state *comp;  // framing state, NULL if not negotiated
+  int mux;              // multiplex streams, FOGGY_STREAMS
+  struct stream_table *streams;  // NULL if not negotiated
+  int read_blocked;      // foggy_read() is waiting, protected by recv_lock
+
+  /* Asynchronous operations, see foggy_async.h */
+  deque<async_op_t> read_ops;   // protected by recv_lock
+  deque<async_op_t> write_ops;  // protected by send_lock
+  int write_ops_len;            // bytes of write_ops not in sending_buf yet
+
+  /* Coalescing of small writes */
+  foggy_coalesce_t coalesce;  // protected by send_lock, FOGGY_NODELAY/CORK
+  int push;              // send what is held now, protected by send_lock
+  int small_pending;     // a partial segment is unACKed, backend only
+  uint32_t small_end;    // where it ends
+  foggy_timer_t cork_timer;  // bounds the wait of a corked partial segment
+  int cork_expired;      // it fired, the partial segment goes out
+
+  /* Tunables */
+  foggy_sockopts_t opts;      // in effect, backend only once connected
+  foggy_sockopts_t new_opts;  // as last set, protected by send_lock
+  int opts_changed;           // new_opts is ahead of opts, protected by send_lock
+  int wscale_ok;              // both sides scale their windows
+  uint8_t snd_wscale;         // shift of the windows the peer advertises
+  uint8_t rcv_wscale;         // shift of the windows we advertise
+  uint64_t pace_next;         // us, when pacing lets the next segment leave
+  foggy_timer_t pace_timer;   // wakes the paced sender
+  int ack_pending;            // in-order segments not ACKed yet, backend only
+  int quickacks;              // segments still ACKed at once, backend only
+  foggy_timer_t delack_timer; // bounds the wait of a delayed ACK
+  uint32_t spin_budget;       // us the next wait spins, see foggy_busy.h
+  int cpu;                    // the backend runs on, -1 if not pinned
+
+  /* Connection teardown */
+  int write_shutdown;   // no more writes, the FIN follows the queued data
+  int fin_sent;         // our FIN is in the send window
+  uint32_t fin_seq;     // sequence number taken by our FIN
+  int peer_fin;         // the peer's FIN arrived, protected by recv_lock
+  int peer_fin_first;   // the peer closed first, so we skip TIME_WAIT
+  foggy_timer_t close_timer;  // end of FIN_WAIT_2 or TIME_WAIT
+  int time_wait;        // we closed first and acknowledged the peer's FIN
+  int rto_retries;      // consecutive RTO expiries without progress
+  int fin_acked;        // our data and FIN were ACKed, protected by death_lock
+  int close_done;       // the backend exited, protected by death_lock
+  int close_error;      // the FIN was never acknowledged
+  int refs;             // application and backend, protected by death_lock
+  pthread_cond_t close_cond;
+
+  foggy_stats_t stats;
+  cc_log_t cc_log;
+
+  // Latency histograms, each guarded by the lock of the side recording it
+  hist_t write_to_ack;                     // send_lock
+  deque<pair<uint64_t, uint64_t> > write_marks;  // (bytes written, time)
+  uint64_t bytes_written;
+  hist_t arrival_to_read;                  // recv_lock
+  deque<pair<uint64_t, uint64_t> > read_marks;   // (bytes received, time)
+  uint64_t bytes_received;
+  uint64_t bytes_read;
+  uint64_t rx_time;                        // arrival of the packet in hand
+  hist_t read_blocked_hist;                // recv_lock
   
   /* <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<< */
-  deque<send_window_slot_t> send_window;
-  receive_window_slot_t receive_window[RECEIVE_WINDOW_SLOT_SIZE];
+  int window_update_pending;  // last advertised window was clamped to MSS
+  uint32_t last_adv;          // bytes, the window we advertised last
+  timer_wheel_t timers;       // every timer of the socket, run by the backend
+  foggy_timer_t rto_timer;    // retransmission timer
+  send_ring_t send_window;
+  receive_window_slot_t *receive_window;  // rcv_slots of them, recv_lock
+  int rcv_slots;
+  int receive_window_used;    // slots holding segments ahead of a gap
   /* >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>> */
 };
 
@@ -137,7 +393,12 @@ void* foggy_socket(const foggy_socket_type_t socket_type,
                const char* port, const char* server_ip);
 
 /**
- * Closes a CMU-TCP socket.
+ * Closes a CMU-TCP socket. Blocks until the data written and our FIN were
+ * acknowledged, or the peer stopped answering. The backend then waits for
+ * the peer's FIN and goes through TIME_WAIT on its own, and frees the socket
+ * when done. With FOGGY_LINGER set it blocks until then, for a process that
+ * exits right after the close and would take the ACK of the peer's FIN with
+ * it.
  *
  * @param sock The socket to close.
  *
@@ -177,4 +438,293 @@ int foggy_write(void* sock, const void* buf, int length);
  * You can declare more functions after this point if you need to.
  */
 
+/**
+ * Shuts down the sending side of a foggy-TCP socket (half-close).
+ *
+ * Data already written is still delivered and followed by a FIN, after which
+ * the peer's reads return 0. The socket can keep reading until the peer
+ * closes its side too. `foggy_close` must still be called to release it.
+ *
+ * @param sock The socket to shut down.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int foggy_shutdown(void* sock);
+
+/**
+ * Chooses how the partial segments of small writes are sent. Nagle's
+ * algorithm is the default: a partial segment waits while an earlier one is
+ * unacknowledged, so chatty writers send fewer and fuller segments. Leaving
+ * FOGGY_CORK sends what was held right away.
+ *
+ * @param sock The socket.
+ * @param mode FOGGY_NAGLE, FOGGY_NODELAY or FOGGY_CORK.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int foggy_set_coalescing(void* sock, foggy_coalesce_t mode);
+
+/**
+ * Sets an option of a socket, see foggy_sockopt_t. Sizes are clamped to
+ * what the socket supports. The options also apply to a connection in
+ * progress: the buffers grow or shrink, the initial values apply until data
+ * was sent or the first RTT sample was taken. Only a receive buffer set
+ * before the handshake (with FOGGY_SOCKOPTS, see foggy_sockopt.h) is
+ * advertised beyond 64 KiB, since the window scale is agreed on in the SYN.
+ *
+ * @param sock The socket.
+ * @param option The option.
+ * @param value Its new value.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int foggy_setsockopt(void* sock, foggy_sockopt_t option, int value);
+
+/**
+ * Reads an option of a socket, as last set.
+ *
+ * @param sock The socket.
+ * @param option The option.
+ * @param value Filled with its value.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int foggy_getsockopt(void* sock, foggy_sockopt_t option, int* value);
+
+/**
+ * Opens a new stream on a connection that negotiated streams, see
+ * foggy_stream.h. Nothing is sent until the first write or the close.
+ *
+ * @param sock The socket.
+ *
+ * @return The stream id, -1 on error.
+ */
+int foggy_stream_open(void* sock);
+
+/**
+ * Waits for the peer to open a stream.
+ *
+ * @param sock The socket.
+ *
+ * @return The stream id, in the order the peer opened them, -1 once the peer
+ *         closed the connection.
+ */
+int foggy_stream_accept(void* sock);
+
+/**
+ * Reads from a stream, blocking until data, its end or the connection's end
+ * arrives. Stream 0 is `foggy_read`.
+ *
+ * @param sock The socket.
+ * @param stream The stream id.
+ * @param buf Filled with the data.
+ * @param length The size of buf.
+ *
+ * @return The number of bytes read, 0 at the end of the stream, -1 on error.
+ */
+int foggy_stream_read(void* sock, int stream, void* buf, int length);
+
+/**
+ * Writes to a stream, blocking while it buffers a full stream window. Stream 0
+ * is `foggy_write`.
+ *
+ * @param sock The socket.
+ * @param stream The stream id.
+ * @param buf The data to write.
+ * @param length The number of bytes to write.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int foggy_stream_write(void* sock, int stream, const void* buf, int length);
+
+/**
+ * Closes the sending side of a stream, its FIN follows the data written.
+ * Stream 0 is `foggy_shutdown`, which closes every stream.
+ *
+ * @param sock The socket.
+ * @param stream The stream id.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int foggy_stream_close(void* sock, int stream);
+
+/**
+ * Snapshot of the state of a connection, see `foggy_get_info`.
+ */
+typedef struct {
+  uint32_t cwnd;           // congestion window in bytes
+  uint32_t ssthresh;       // slow start threshold in bytes
+  uint32_t reno_state;     // reno_state_t
+  uint32_t srtt_us;        // smoothed RTT, 0 before the first sample
+  uint32_t rttvar_us;      // RTT variation
+  uint32_t rto_us;         // current retransmission timeout
+  uint64_t bytes_sent;     // payload bytes sent, retransmissions included
+  uint64_t bytes_acked;    // payload bytes acknowledged by the peer
+  uint64_t bytes_retrans;  // payload bytes retransmitted
+  uint64_t segs_sent;      // packets sent
+  uint64_t segs_retrans;   // packets retransmitted
+  uint64_t dup_acks;       // duplicate ACKs received
+  uint64_t ooo_segments;   // data segments received out of order
+  uint64_t fec_parity_sent;  // parity packets sent, see foggy_fec.h
+  uint64_t fec_recovered;    // segments rebuilt from parity
+  uint64_t compress_saved;   // bytes compression kept off the wire
+  uint32_t rcv_occupancy;  // bytes buffered on the receive side
+  uint64_t pacing_rate;    // bytes per second the window sustains (cwnd/srtt)
+  uint32_t mss;            // payload of the data segments sent
+  uint64_t syscalls;       // system calls made to send, receive and wait
+  uint64_t spin_us;        // time the backend spent busy polling
+} foggy_info_t;
+
+/**
+ * Fills in a snapshot of the state of a connection.
+ *
+ * The counters are maintained by the backend with relaxed atomics, so this is
+ * cheap enough to poll while the connection is busy. Fields are read one by
+ * one and may be a few packets apart from each other.
+ *
+ * @param sock The socket to inspect.
+ * @param info Filled in with the snapshot.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int foggy_get_info(void* sock, foggy_info_t* info);
+
+typedef enum {
+  FOGGY_LATENCY_WRITE_TO_ACK = 0,     // foggy_write() enqueue to cumulative ACK
+  FOGGY_LATENCY_ARRIVAL_TO_READ = 1,  // segment arrival to foggy_read()
+  FOGGY_LATENCY_READ_BLOCKED = 2,     // time foggy_read() waits for data
+} foggy_latency_kind_t;
+
+/**
+ * Summary of a latency histogram, see `foggy_get_latency`.
+ */
+typedef struct {
+  uint64_t count;
+  uint64_t min_us;
+  uint64_t mean_us;
+  uint64_t p50_us;
+  uint64_t p99_us;
+  uint64_t p999_us;
+  uint64_t max_us;
+} foggy_latency_t;
+
+/**
+ * Summarizes one of the latency histograms of a connection.
+ *
+ * The histograms cover the whole life of the socket. When FOGGY_LATENCY is set
+ * in the environment, `foggy_close` also prints all three.
+ *
+ * @param sock The socket to inspect.
+ * @param kind Which latency to summarize.
+ * @param latency Filled in with the summary.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int foggy_get_latency(void* sock, foggy_latency_kind_t kind,
+                      foggy_latency_t* latency);
+
+/**
+ * Operations of `foggy_submit_read` and `foggy_submit_write`.
+ */
+typedef enum {
+  FOGGY_OP_READ = 0,
+  FOGGY_OP_WRITE = 1,
+} foggy_op_t;
+
+/**
+ * Outcome of an asynchronous operation, see `foggy_cq_poll`.
+ */
+typedef struct {
+  void* sock;       // the socket it was submitted on
+  void* user_data;  // as submitted
+  foggy_op_t op;
+  int result;       // bytes read (0 at the end of the stream) or written, -1
+                    // if the operation failed or the socket was closed first
+} foggy_completion_t;
+
+/**
+ * Creates a completion queue for asynchronous operations, see foggy_cq.h.
+ * One application thread drains it, the operations may be on any sockets.
+ *
+ * @return The queue, NULL on error.
+ */
+foggy_cq_t* foggy_cq_create();
+
+/**
+ * Destroys a completion queue. The sockets its operations were submitted on
+ * must be closed first.
+ *
+ * @param cq The queue.
+ */
+void foggy_cq_destroy(foggy_cq_t* cq);
+
+/**
+ * Returns an eventfd that is readable while completions are pending, to wait
+ * on the queue from another event loop. Only `foggy_cq_poll` clears it.
+ *
+ * @param cq The queue.
+ *
+ * @return The descriptor, owned by the queue.
+ */
+int foggy_cq_fd(foggy_cq_t* cq);
+
+/**
+ * Takes the pending completions without waiting, oldest first.
+ *
+ * @param cq The queue.
+ * @param completions Filled with up to max completions.
+ * @param max The size of completions.
+ *
+ * @return The number of completions taken.
+ */
+int foggy_cq_poll(foggy_cq_t* cq, foggy_completion_t* completions, int max);
+
+/**
+ * Takes the pending completions, waiting for at least one.
+ *
+ * @param cq The queue.
+ * @param completions Filled with up to max completions.
+ * @param max The size of completions.
+ * @param timeout_ms Longest wait, -1 to wait indefinitely.
+ *
+ * @return The number of completions taken, 0 on timeout, -1 on error.
+ */
+int foggy_cq_wait(foggy_cq_t* cq, foggy_completion_t* completions, int max,
+                  int timeout_ms);
+
+/**
+ * Submits a read without blocking. It completes once data or the end of the
+ * stream arrived, with what `foggy_read` would have returned. Reads complete
+ * in the order they were submitted, and buf must stay valid until then.
+ * Blocking and asynchronous reads must not be mixed on a socket.
+ *
+ * @param sock The socket to read from.
+ * @param cq Where the completion goes.
+ * @param buf The buffer to read into.
+ * @param length The size of buf.
+ * @param user_data Handed back in the completion.
+ *
+ * @return 0 if submitted, -1 on error.
+ */
+int foggy_submit_read(void* sock, foggy_cq_t* cq, void* buf, int length,
+                      void* user_data);
+
+/**
+ * Submits a write without blocking. It completes once all of buf was taken
+ * into the send buffer, so buf must stay valid until then. Writes complete in
+ * the order they were submitted and their data is sent in that order; the FIN
+ * of `foggy_shutdown` or `foggy_close` follows them. Blocking and
+ * asynchronous writes must not be mixed on a socket.
+ *
+ * @param sock The socket to write to.
+ * @param cq Where the completion goes.
+ * @param buf The data to write.
+ * @param length The number of bytes to write.
+ * @param user_data Handed back in the completion.
+ *
+ * @return 0 if submitted, -1 on error.
+ */
+int foggy_submit_write(void* sock, foggy_cq_t* cq, const void* buf,
+                       int length, void* user_data);
+
 #endif  // FOGGY_TCP_H_
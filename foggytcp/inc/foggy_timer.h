@@ -0,0 +1,107 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/* This file defines the timer wheel of a backend. Timers are hashed by their
+ * expiry tick into TIMER_WHEEL_LEVELS levels of TIMER_WHEEL_SLOTS slots, each
+ * level TIMER_WHEEL_SLOTS times coarser than the one below. The timers of a
+ * coarse slot move down a level when the wheel reaches it, so arming and
+ * cancelling are O(1) and running the wheel only touches the slots that are
+ * due.
+ *
+ * A timer fires at the first tick at or after its expiry time, never early and
+ * at most one tick late. Timers are owned by their user, typically embedded in
+ * the socket, and the wheel only links them.
+ */
+
+#ifndef FOGGY_TIMER_H_
+#define FOGGY_TIMER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TIMER_TICK_US 1000    // resolution of the wheel
+#define TIMER_WHEEL_BITS 6    // 64 slots, one bit each in `occupied`
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4  // 2^24 ticks, about 4.6 hours at 1 ms
+
+typedef struct foggy_timer {
+  struct foggy_timer *next;
+  struct foggy_timer **pprev;  // the pointer to this timer, NULL if idle
+  int16_t slot;                // level * TIMER_WHEEL_SLOTS + slot, -1 if none
+  uint64_t expires;            // us, kept after the timer fired
+  void (*fn)(void *arg);       // called on expiry, may be NULL
+  void *arg;
+} foggy_timer_t;
+
+typedef struct {
+  foggy_timer_t *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+  uint64_t occupied[TIMER_WHEEL_LEVELS];  // bit n set if slot n is non-empty
+  uint64_t now;                           // next tick to run
+} timer_wheel_t;
+
+/**
+ * Initializes an idle timer.
+ *
+ * @param timer The timer.
+ * @param fn Called with `arg` when the timer expires, NULL if the owner only
+ *           checks `timer_pending`.
+ * @param arg Argument to `fn`.
+ */
+void timer_init(foggy_timer_t *timer, void (*fn)(void *arg), void *arg);
+
+/**
+ * Initializes an empty wheel.
+ *
+ * @param wheel The wheel.
+ * @param now The current time in us.
+ */
+void timer_wheel_init(timer_wheel_t *wheel, uint64_t now);
+
+/**
+ * Arms a timer, or moves it if it is already pending.
+ *
+ * @param wheel The wheel.
+ * @param timer The timer.
+ * @param expires When it should fire, in us. A time in the past fires it on
+ *                the next `timer_wheel_run`.
+ */
+void timer_arm(timer_wheel_t *wheel, foggy_timer_t *timer, uint64_t expires);
+
+/**
+ * Stops a timer. Does nothing if it is not pending.
+ *
+ * @param wheel The wheel.
+ * @param timer The timer.
+ */
+void timer_cancel(timer_wheel_t *wheel, foggy_timer_t *timer);
+
+/**
+ * Fires the timers that expired by `now`. The callbacks may arm and cancel
+ * any timer, themselves included.
+ *
+ * @param wheel The wheel.
+ * @param now The current time in us.
+ */
+void timer_wheel_run(timer_wheel_t *wheel, uint64_t now);
+
+/**
+ * Returns when the wheel next needs to run. This is never later than the
+ * earliest expiry, but can be earlier when coarse slots have to move down.
+ *
+ * @param wheel The wheel.
+ *
+ * @return The time in us, 0 if no timer is pending.
+ */
+uint64_t timer_wheel_next(const timer_wheel_t *wheel);
+
+static inline int timer_pending(const foggy_timer_t *timer) {
+  return timer->pprev != NULL;
+}
+
+#endif  // FOGGY_TIMER_H_
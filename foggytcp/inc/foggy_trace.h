@@ -0,0 +1,108 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/* This file defines the logging macros and the binary event trace. Both are
+selected at compile time, so disabled levels and trace points cost nothing. */
+
+#ifndef FOGGY_TRACE_H_
+#define FOGGY_TRACE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_INFO 2   // connection setup and teardown
+#define LOG_LEVEL_DEBUG 3  // every packet
+
+#ifndef LOG_LEVEL
+#ifdef DEBUG
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#else
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+#endif
+
+#define foggy_log(level, fmt, ...)                                  \
+  do {                                                              \
+    if ((level) <= LOG_LEVEL) fprintf(stdout, fmt, ##__VA_ARGS__);  \
+  } while (0)
+
+#define error_printf(fmt, ...) foggy_log(LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#define info_printf(fmt, ...) foggy_log(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#define debug_printf(fmt, ...) foggy_log(LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+
+typedef enum {
+  TRACE_SEND = 1,        // a: seq, b: payload length, flags: packet flags
+  TRACE_RECV = 2,        // a: seq, b: payload length, flags: packet flags
+  TRACE_ACK = 3,         // a: new cumulative ACK, b: bytes it acknowledged
+  TRACE_RETRANSMIT = 4,  // a: seq, b: payload length, flags: packet flags
+  TRACE_CWND = 5,        // a: congestion window, b: slow start threshold
+} trace_event_t;
+
+/**
+ * One trace event as stored in the rings and written by `foggy_trace_dump`.
+ */
+typedef struct {
+  uint64_t ts_ns;  // CLOCK_MONOTONIC
+  uint64_t conn;   // the socket the event belongs to
+  uint32_t a;
+  uint32_t b;
+  uint16_t type;   // trace_event_t
+  uint16_t flags;
+  uint32_t tid;    // thread that recorded the event
+} trace_record_t;
+
+#define TRACE_RING_SIZE 4096  // events kept per thread, a power of two
+#define TRACE_MAGIC 0x52544746  // "FGTR"
+#define TRACE_VERSION 1
+
+#ifdef FOGGY_TRACE
+#define FOGGY_TRACE_EVENT(type, conn, a, b, flags) \
+  trace_record((type), (const void *)(conn), (a), (b), (flags))
+#else
+#define FOGGY_TRACE_EVENT(type, conn, a, b, flags) \
+  do {                                             \
+  } while (0)
+#endif
+
+/**
+ * Appends an event to the calling thread's trace ring.
+ *
+ * Every thread owns its ring, so recording is a handful of stores and one
+ * release store of the ring head. Once the ring is full the oldest events
+ * are overwritten. Use `FOGGY_TRACE_EVENT`, which disappears unless the
+ * library is built with FOGGY_TRACE.
+ *
+ * @param type The trace_event_t.
+ * @param conn The socket the event belongs to.
+ * @param a Event specific value.
+ * @param b Event specific value.
+ * @param flags Event specific flags.
+ */
+void trace_record(uint16_t type, const void *conn, uint32_t a, uint32_t b,
+                  uint16_t flags);
+
+/**
+ * Writes the events in every thread's ring to a file.
+ *
+ * The file is a `uint32_t` magic, version and record size followed, for each
+ * ring, by a `uint32_t` record count and the records oldest first. Events
+ * recorded while the dump runs may be missing or torn.
+ *
+ * If FOGGY_TRACE_FILE is set in the environment, the rings are also dumped
+ * there whenever a socket is released.
+ *
+ * @param path The file to write.
+ *
+ * @return 0 on success, -1 on error or when tracing is compiled out.
+ */
+int foggy_trace_dump(const char *path);
+
+#endif  // FOGGY_TRACE_H_
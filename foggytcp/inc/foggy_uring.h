@@ -0,0 +1,118 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/* This file defines the io_uring engine, an alternative to the system calls
+ * the backend otherwise makes for every datagram and every wakeup.
+ *
+ * With FOGGY_URING=1 the backend sets up a ring of its own once the
+ * handshake is over, the handshake itself runs on the socket calls. If the
+ * kernel lacks what the engine needs, the socket stays on the socket calls.
+ *
+ * Receiving: each UDP socket of the connection has one multishot recvmsg in
+ * flight. The kernel picks one of the buffers provided to the ring for every
+ * datagram and posts a completion, the backend hands the packets to
+ * on_recv_pkt() in place and provides the buffer again with its next
+ * submission. A multishot request that ends, e.g. when the buffers ran out,
+ * is armed again on the next pass.
+ *
+ * Sending: a packet is copied into a slot of the send pool, a buffer
+ * registered with the ring, and queued as a send of that fixed buffer. The
+ * queued sends go to the kernel in one batch with the next wait, or earlier
+ * when the submission queue or the pool fills up. A slot is free again once
+ * its send completed. A packet larger than a slot, or one finding the pool
+ * full, is sent with sendto() after the queued ones.
+ *
+ * Waking: a multishot poll on the socket's eventfd completes whenever the
+ * application notifies the backend, so the backend waits for datagrams,
+ * notifications and its next timer in a single io_uring_enter().
+ *
+ * Multishot receives need Linux 6.0. Packets of
+ * the link emulator leave through the emulator. UDP GSO is not used for
+ * sending, GRO is still used for receiving.
+ */
+
+#ifndef FOGGY_URING_H_
+#define FOGGY_URING_H_
+
+#include <netinet/in.h>
+#include <stdint.h>
+
+#include "foggy_tcp.h"
+
+#define URING_ENTRIES 256           // submission queue entries
+#define URING_RX_BYTES (1 << 20)    // provided receive buffers per socket
+#define URING_POOL_BYTES (1 << 20)  // send pool per socket
+#define URING_MIN_BUFFERS 8         // receive buffers and send slots at least
+
+/**
+ * Reads FOGGY_URING.
+ *
+ * @param sock The new socket.
+ */
+void uring_init(foggy_socket_t *sock);
+
+/**
+ * Sets up the ring of a socket that asked for it, in the backend thread once
+ * the handshake is over. Leaves the socket on the socket calls on failure.
+ *
+ * @param sock The socket.
+ */
+void uring_start(foggy_socket_t *sock);
+
+/**
+ * Submits what is still queued and frees the ring of a socket, if it has
+ * one. Called by the backend thread as it exits.
+ *
+ * @param sock The socket.
+ */
+void uring_destroy(foggy_socket_t *sock);
+
+/**
+ * Processes the completions posted so far: the datagrams received and the
+ * sends finished. Must be called with recv_lock held.
+ *
+ * @param sock The socket.
+ */
+void uring_poll(foggy_socket_t *sock);
+
+/**
+ * Submits the queued sends and waits for a completion.
+ *
+ * @param sock The socket.
+ * @param timeout_ms Longest wait, -1 to wait indefinitely. Does not wait if
+ *                   completions are pending already.
+ */
+void uring_wait(foggy_socket_t *sock, int timeout_ms);
+
+/**
+ * Submits the queued sends and checks for completions without waiting. Only
+ * enters the kernel if there is something to submit or the kernel holds
+ * completions back, so that spinning on it stays in user space otherwise.
+ *
+ * @param sock The socket.
+ *
+ * @return 1 if completions are pending, 0 otherwise.
+ */
+int uring_ready(foggy_socket_t *sock);
+
+/**
+ * Queues a packet to be sent.
+ *
+ * @param sock The socket.
+ * @param fd The UDP socket to send it on.
+ * @param addr Where to.
+ * @param pkt The packet, copied.
+ * @param len Its length.
+ *
+ * @return 0 if queued, -1 if the caller must send it itself.
+ */
+int uring_send(foggy_socket_t *sock, int fd, const struct sockaddr_in *addr,
+               const uint8_t *pkt, uint16_t len);
+
+#endif  // FOGGY_URING_H_
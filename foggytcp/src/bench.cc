@@ -0,0 +1,148 @@
+/**
+ * Copyright (C) 2024 Hong Kong University of Science and Technology
+ *
+ * This repository is used for the Computer Networks (ELEC 3120) course taught
+ * at Hong Kong University of Science and Technology.
+ *
+ * No part of the project may be copied and/or distributed without the express
+ * permission of the course staff. Everyone is prohibited from releasing their
+ * forks in any public places.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "foggy_tcp.h"
+
+#define BUF_SIZE 65536
+
+/**
+ * This file implements one benchmark run: a server thread and a client thread
+ * in the same process transfer `size` bytes over loopback. It is linked
+ * against either stack and driven by utils/bench.py, which sweeps sizes and
+ * link conditions.
+ *
+ * Usage: ./bench <port> <size>
+ *
+ * Prints one JSON object with the flow completion time (connect to the last
+ * byte read), goodput, CPU time of the process and the sender's counters.
+ */
+
+typedef struct {
+  const char *port;
+  long size;
+  long received;
+  int done;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} bench_t;
+
+static double now_ms() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+static double cpu_ms() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e3 +
+         (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e3;
+}
+
+static void *server(void *in) {
+  bench_t *bench = (bench_t *)in;
+  static char buf[BUF_SIZE];
+  int n;
+
+  void *sock = foggy_socket(TCP_LISTENER, bench->port, "127.0.0.1");
+  while (bench->received < bench->size &&
+         (n = foggy_read(sock, buf, BUF_SIZE)) > 0) {
+    bench->received += n;
+  }
+
+  pthread_mutex_lock(&bench->lock);
+  bench->done = 1;
+  pthread_cond_signal(&bench->cond);
+  pthread_mutex_unlock(&bench->lock);
+
+  // Drain until the client closes so the server never closes first
+  while (foggy_read(sock, buf, BUF_SIZE) > 0) {
+  }
+  foggy_close(sock);
+  return NULL;
+}
+
+int main(int argc, const char *argv[]) {
+  static char buf[BUF_SIZE];
+  bench_t bench;
+  foggy_info_t info;
+  pthread_t server_thread;
+  double start, end, cpu_start, cpu_end;
+
+  if (argc != 3) {
+    fprintf(stderr, "Usage: %s <port> <size>\n", argv[0]);
+    return -1;
+  }
+  bench.port = argv[1];
+  bench.size = atol(argv[2]);
+  bench.received = 0;
+  bench.done = 0;
+  pthread_mutex_init(&bench.lock, NULL);
+  pthread_cond_init(&bench.cond, NULL);
+  memset(buf, '1', sizeof(buf));
+
+  pthread_create(&server_thread, NULL, server, &bench);
+  usleep(100000);  // let the listener bind
+
+  cpu_start = cpu_ms();
+  start = now_ms();
+  void *sock = foggy_socket(TCP_INITIATOR, bench.port, "127.0.0.1");
+  if (sock == NULL) {
+    fprintf(stderr, "Error: connect failed\n");
+    return -1;
+  }
+  for (long sent = 0; sent < bench.size; sent += BUF_SIZE) {
+    long len = bench.size - sent < BUF_SIZE ? bench.size - sent : BUF_SIZE;
+    if (foggy_write(sock, buf, len) < 0) {
+      fprintf(stderr, "Error: write failed\n");
+      return -1;
+    }
+  }
+
+  pthread_mutex_lock(&bench.lock);
+  while (!bench.done) {
+    pthread_cond_wait(&bench.cond, &bench.lock);
+  }
+  pthread_mutex_unlock(&bench.lock);
+  end = now_ms();
+  cpu_end = cpu_ms();
+
+  memset(&info, 0, sizeof(info));
+  foggy_get_info(sock, &info);
+  foggy_close(sock);
+  pthread_join(server_thread, NULL);
+
+  double fct = end - start;
+  printf("{\"size\": %ld, \"received\": %ld, \"fct_ms\": %.3f, "
+         "\"goodput_mbps\": %.3f, \"cpu_ms\": %.3f, \"bytes_sent\": %lu, "
+         "\"bytes_retrans\": %lu, \"segs_sent\": %lu, \"segs_retrans\": %lu, "
+         "\"retrans_ratio\": %.6f, \"srtt_us\": %u, \"mss\": %u, "
+         "\"fec_parity\": %lu, \"compress_saved\": %lu, "
+         "\"syscalls\": %lu, \"spin_us\": %lu}\n",
+         bench.size, bench.received, fct,
+         fct > 0 ? bench.received * 8 / fct / 1e3 : 0.0, cpu_end - cpu_start,
+         (unsigned long)info.bytes_sent, (unsigned long)info.bytes_retrans,
+         (unsigned long)info.segs_sent, (unsigned long)info.segs_retrans,
+         info.bytes_sent > 0 ? (double)info.bytes_retrans / info.bytes_sent
+                             : 0.0,
+         info.srtt_us, info.mss, (unsigned long)info.fec_parity_sent,
+         (unsigned long)info.compress_saved, (unsigned long)info.syscalls,
+         (unsigned long)info.spin_us);
+  return bench.received == bench.size ? 0 : 1;
+}
@@ -0,0 +1,159 @@
+/**
+ * Copyright (C) 2024 Hong Kong University of Science and Technology
+ *
+ * This repository is used for the Computer Networks (ELEC 3120) course taught
+ * at Hong Kong University of Science and Technology.
+ *
+ * No part of the project may be copied and/or distributed without the express
+ * permission of the course staff. Everyone is prohibited from releasing their
+ * forks in any public places.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "foggy_coro.h"
+#include "foggy_tcp.h"
+
+#define BUF_SIZE 65536
+#define MAX_CONNECTIONS 256
+
+/**
+ * This file benchmarks the asynchronous API: `connections` client sockets
+ * each send `size` bytes to their own listener over loopback, and a single
+ * thread drives every read and write as coroutines on one completion queue.
+ *
+ * Usage: ./bench-async <port> <connections> <size>
+ *
+ * Listeners use the ports from <port> on. Prints one JSON object with the
+ * completion time of the whole transfer, the aggregate goodput and the CPU
+ * time of the process.
+ */
+
+typedef struct {
+  const char *port;
+  void *sock;
+} listener_t;
+
+static long received;
+static int running;
+
+static double now_ms() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+static double cpu_ms() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e3 +
+         (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e3;
+}
+
+static void *listen_one(void *in) {
+  listener_t *l = (listener_t *)in;
+  l->sock = foggy_socket(TCP_LISTENER, l->port, "127.0.0.1");
+  return NULL;
+}
+
+// Sends size bytes, then the FIN
+static foggy::task send_all(void *sock, foggy_cq_t *cq, const char *buf,
+                            long size) {
+  ++running;
+  for (long sent = 0; sent < size; sent += BUF_SIZE) {
+    int len = size - sent < BUF_SIZE ? size - sent : BUF_SIZE;
+    if (co_await foggy::write(sock, cq, buf, len) != len) {
+      fprintf(stderr, "Error: write failed\n");
+      break;
+    }
+  }
+  foggy_shutdown(sock);
+  --running;
+}
+
+// Reads until the FIN, then sends its own
+static foggy::task receive_all(void *sock, foggy_cq_t *cq) {
+  char *buf = (char *)malloc(BUF_SIZE);
+  int n;
+
+  ++running;
+  while ((n = co_await foggy::read(sock, cq, buf, BUF_SIZE)) > 0) {
+    received += n;
+  }
+  free(buf);
+  foggy_shutdown(sock);
+  --running;
+}
+
+int main(int argc, const char *argv[]) {
+  static char buf[BUF_SIZE];
+  static char ports[MAX_CONNECTIONS][8];
+  listener_t listeners[MAX_CONNECTIONS];
+  pthread_t threads[MAX_CONNECTIONS];
+  void *clients[MAX_CONNECTIONS];
+  double start, end, cpu_start, cpu_end;
+
+  if (argc != 4) {
+    fprintf(stderr, "Usage: %s <port> <connections> <size>\n", argv[0]);
+    return -1;
+  }
+  int base_port = atoi(argv[1]);
+  int connections = atoi(argv[2]);
+  long size = atol(argv[3]);
+  if (connections < 1 || connections > MAX_CONNECTIONS) {
+    fprintf(stderr, "Error: 1 to %d connections\n", MAX_CONNECTIONS);
+    return -1;
+  }
+  memset(buf, '1', sizeof(buf));
+
+  // A listener returns once connected, so each waits in a thread of its own
+  for (int i = 0; i < connections; ++i) {
+    snprintf(ports[i], sizeof(ports[i]), "%d", base_port + i);
+    listeners[i].port = ports[i];
+    pthread_create(&threads[i], NULL, listen_one, &listeners[i]);
+  }
+  usleep(100000);  // let the listeners bind
+
+  cpu_start = cpu_ms();
+  start = now_ms();
+  for (int i = 0; i < connections; ++i) {
+    clients[i] = foggy_socket(TCP_INITIATOR, ports[i], "127.0.0.1");
+    if (clients[i] == NULL) {
+      fprintf(stderr, "Error: connect failed\n");
+      return -1;
+    }
+  }
+  for (int i = 0; i < connections; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+
+  foggy_cq_t *cq = foggy_cq_create();
+  for (int i = 0; i < connections; ++i) {
+    receive_all(listeners[i].sock, cq);
+    receive_all(clients[i], cq);  // the listener's FIN
+    send_all(clients[i], cq, buf, size);
+  }
+  while (running > 0 && foggy::run_once(cq, -1) >= 0) {
+  }
+  end = now_ms();
+  cpu_end = cpu_ms();
+
+  for (int i = 0; i < connections; ++i) {
+    foggy_close(clients[i]);
+    foggy_close(listeners[i].sock);
+  }
+  foggy_cq_destroy(cq);
+
+  double fct = end - start;
+  printf("{\"connections\": %d, \"size\": %ld, \"received\": %ld, "
+         "\"fct_ms\": %.3f, \"goodput_mbps\": %.3f, \"cpu_ms\": %.3f}\n",
+         connections, size, received, fct,
+         fct > 0 ? received * 8 / fct / 1e3 : 0.0, cpu_end - cpu_start);
+  return received == size * connections ? 0 : 1;
+}
@@ -69,7 +69,9 @@ int main(int argc, const char* argv[]) {
     }
   }
 
-  /* Close the socket and the output file void convert */
+  /* Close the socket and the output file void convert. The process exits
+   * right after, so the close waits through TIME_WAIT for the server's FIN */
+  foggy_setsockopt(sock, FOGGY_LINGER, 1);
   foggy_close(sock);
   ifs.close();
 
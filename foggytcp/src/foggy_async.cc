@@ -0,0 +1,140 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/* This file implements asynchronous reads and writes, see foggy_async.h. */
+
+#include "foggy_async.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "foggy_backend.h"
+#include "foggy_cq.h"
+#include "foggy_function.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+
+int async_complete_reads(foggy_socket_t *sock) {
+  uint64_t now;
+  int n, total = 0;
+
+  while (!sock->read_ops.empty() &&
+         (sock->received_len > 0 || sock->peer_fin)) {
+    async_op_t op = sock->read_ops.front();
+    sock->read_ops.pop_front();
+    now = sock->read_marks.empty() ? 0 : get_time_us();
+    n = take_received(sock, op.buf, op.len, now);
+    total += n;
+    cq_post(op.cq, sock, FOGGY_OP_READ, n, op.user_data);
+  }
+  // A deferred fast open SYN goes out once someone waits for the answer
+  sock->read_blocked = !sock->read_ops.empty();
+  return total;
+}
+
+int async_fill_writes(foggy_socket_t *sock) {
+  int chunk, total = 0;
+
+  while (!sock->write_ops.empty() &&
+         (uint32_t)sock->sending_len < sock->new_opts.sndbuf) {
+    async_op_t *op = &(sock->write_ops.front());
+    chunk = MIN(op->len - op->done,
+                (int)sock->new_opts.sndbuf - sock->sending_len);
+    if (chunk > 0) {
+      append_sending(sock, op->buf + op->done, chunk);
+    }
+    op->done += chunk;
+    sock->write_ops_len -= chunk;
+    total += chunk;
+    if (op->done == op->len) {
+      cq_post(op->cq, sock, FOGGY_OP_WRITE, op->len, op->user_data);
+      sock->write_ops.pop_front();
+    }
+  }
+  return total;
+}
+
+void async_cancel(foggy_socket_t *sock) {
+  while (pthread_mutex_lock(&(sock->recv_lock)) != 0) {
+  }
+  for (const async_op_t &op : sock->read_ops) {
+    cq_post(op.cq, sock, FOGGY_OP_READ, EXIT_ERROR, op.user_data);
+  }
+  sock->read_ops.clear();
+  pthread_mutex_unlock(&(sock->recv_lock));
+
+  while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+  }
+  for (const async_op_t &op : sock->write_ops) {
+    cq_post(op.cq, sock, FOGGY_OP_WRITE, EXIT_ERROR, op.user_data);
+  }
+  sock->write_ops.clear();
+  sock->write_ops_len = 0;
+  pthread_mutex_unlock(&(sock->send_lock));
+}
+
+int foggy_submit_read(void *in_sock, foggy_cq_t *cq, void *buf, int length,
+                      void *user_data) {
+  foggy_socket_t *sock = (foggy_socket_t *)in_sock;
+  async_op_t op;
+  int read_len, was_blocked;
+
+  if (sock == NULL || cq == NULL || length < 0) {
+    perror("ERROR null socket or queue, or negative length");
+    return EXIT_ERROR;
+  }
+  op.cq = cq;
+  op.buf = (uint8_t *)buf;
+  op.len = length;
+  op.done = 0;
+  op.user_data = user_data;
+
+  while (pthread_mutex_lock(&(sock->recv_lock)) != 0) {
+  }
+  was_blocked = sock->read_blocked;
+  sock->read_ops.push_back(op);
+  read_len = async_complete_reads(sock);
+  // Space freed in received_buf, or a deferred fast open SYN to send
+  if (read_len > 0 || (!was_blocked && sock->read_blocked)) {
+    notify_backend(sock);
+  }
+  pthread_mutex_unlock(&(sock->recv_lock));
+  return EXIT_SUCCESS;
+}
+
+int foggy_submit_write(void *in_sock, foggy_cq_t *cq, const void *buf,
+                       int length, void *user_data) {
+  foggy_socket_t *sock = (foggy_socket_t *)in_sock;
+  async_op_t op;
+
+  if (sock == NULL || cq == NULL || length < 0) {
+    perror("ERROR null socket or queue, or negative length");
+    return EXIT_ERROR;
+  }
+  op.cq = cq;
+  op.buf = (uint8_t *)buf;
+  op.len = length;
+  op.done = 0;
+  op.user_data = user_data;
+
+  while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+  }
+  if (sock->write_shutdown) {
+    pthread_mutex_unlock(&(sock->send_lock));
+    perror("ERROR write after shutdown");
+    return EXIT_ERROR;
+  }
+  sock->write_ops.push_back(op);
+  sock->write_ops_len += length;
+  async_fill_writes(sock);
+  pthread_mutex_unlock(&(sock->send_lock));
+  notify_backend(sock);
+  return EXIT_SUCCESS;
+}
@@ -23,14 +23,27 @@ from releasing their forks in any public places. */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <netinet/udp.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "foggy_async.h"
 #include "foggy_backend.h"
+#include "foggy_busy.h"
+#include "foggy_cclog.h"
+#include "foggy_compress.h"
+#include "foggy_fec.h"
 #include "foggy_function.h"
+#include "foggy_mp.h"
+#include "foggy_option.h"
 #include "foggy_packet.h"
+#include "foggy_sockopt.h"
+#include "foggy_stream.h"
 #include "foggy_tcp.h"
+#include "foggy_trace.h"
+#include "foggy_uring.h"
 
 #define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
 #define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
@@ -52,114 +65,580 @@ int has_been_acked(foggy_socket_t *sock, uint32_t seq) {
   return result;
 }
 
+void handle_datagram(foggy_socket_t *sock, uint8_t *buf, ssize_t len,
+                     const struct sockaddr_in *from, int seg_size) {
+  // A multipath connection has a peer address per subflow, kept there
+  sock->rx_from = *from;
+  if (sock->mp == NULL) sock->conn = *from;
+  if (seg_size <= 0) seg_size = len;
+
+  sock->rx_time = get_time_us();
+  for (ssize_t off = 0; off < len; off += seg_size) {
+    uint8_t *pkt = buf + off;
+    ssize_t seg_len = MIN(seg_size, len - off);
+    if (seg_len < (ssize_t)sizeof(foggy_tcp_header_t) ||
+        get_plen((foggy_tcp_header_t *)pkt) > seg_len) {
+      continue;  // truncated
+    }
+    if (verify_checksum(sock, pkt))
+      on_recv_pkt(sock, pkt);  // calling function to handle the received packet, some logic to be implemented in this function
+  }
+}
+
 /**
- * Checks if the socket received any data.
- *
- * It first peeks at the header to figure out the length of the packet and
- * then reads the entire packet.
+ * Reads one datagram from a UDP socket and hands its packets to
+ * `on_recv_pkt`.
  *
- * @param sock The socket used for receiving data on the connection.
+ * @param sock The socket of the connection.
+ * @param fd The UDP socket to read from, the connection's own or a subflow's.
  * @param flags Flags that determine how the socket should wait for data.
- * Check `foggy_read_mode_t` for more information.
  */
-void check_for_pkt(foggy_socket_t *sock, foggy_read_mode_t flags) {
-  foggy_tcp_header_t hdr;
-  uint8_t *pkt;
-  socklen_t conn_len = sizeof(sock->conn);
-  ssize_t len = 0;
-  uint32_t plen = 0, buf_size = 0, n = 0;
+static void read_datagram(foggy_socket_t *sock, int fd,
+                          foggy_read_mode_t flags) {
+  char control[CMSG_SPACE(sizeof(int))];
+  struct iovec iov = {sock->rx_buf, RX_BUF_SIZE};
+  struct sockaddr_in from;
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  ssize_t len = -1;
+  int seg_size = 0;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_name = &from;
+  msg.msg_namelen = sizeof(from);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
 
-  while (pthread_mutex_lock(&(sock->recv_lock)) != 0) {
-  }
   switch (flags) {
     case NO_FLAG:
-      len = recvfrom(sock->socket, &hdr, sizeof(foggy_tcp_header_t), MSG_PEEK,
-                     (struct sockaddr *)&(sock->conn), &conn_len);
+      len = recvmsg(fd, &msg, 0);
       break;
 
     // Fallthrough.
     case NO_WAIT:
-      len = recvfrom(sock->socket, &hdr, sizeof(foggy_tcp_header_t),
-                     MSG_DONTWAIT | MSG_PEEK, (struct sockaddr *)&(sock->conn),
-                     &conn_len);
+      len = recvmsg(fd, &msg, MSG_DONTWAIT);
       break;
 
+    case TIMEOUT: {
+      // Wait at most one RTO, the caller decides what to do on expiry
+      struct pollfd pfd = {fd, POLLIN, 0};
+      stat_add(&sock->stats.syscalls, 1);
+      if (poll(&pfd, 1, (sock->window.rto + 999) / 1000) > 0) {
+        len = recvmsg(fd, &msg, MSG_DONTWAIT);
+      }
+      break;
+    }
+
     default:
       perror("ERROR unknown flag");
   }
+  stat_add(&sock->stats.syscalls, 1);
+
+  if (len > 0) {
+    // With GRO the datagram holds several segments of seg_size bytes, only
+    // the last one can be shorter
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+        memcpy(&seg_size, CMSG_DATA(cmsg), sizeof(seg_size));
+      }
+    }
+    handle_datagram(sock, sock->rx_buf, len, &from, seg_size);
+  }
+}
+
+/**
+ * Checks if the socket received any data.
+ *
+ * It reads one datagram from the connection's socket, waiting as `flags`
+ * says, and then one from each of its other subflows if it has any.
+ *
+ * @param sock The socket used for receiving data on the connection.
+ * @param flags Flags that determine how the socket should wait for data.
+ * Check `foggy_read_mode_t` for more information.
+ */
+void check_for_pkt(foggy_socket_t *sock, foggy_read_mode_t flags) {
+  int fds[MP_MAX_SUBFLOWS];
+
+  while (pthread_mutex_lock(&(sock->recv_lock)) != 0) {
+  }
+  if (sock->uring != NULL) {
+    uring_poll(sock);  // whatever arrived, the ring was reading all along
+  } else {
+    read_datagram(sock, sock->socket, flags);
+    for (int i = 0, n = mp_fds(sock, fds); i < n; ++i) {
+      read_datagram(sock, fds[i], NO_WAIT);
+    }
+  }
+  pthread_mutex_unlock(&(sock->recv_lock));
+}
+
+
+
+void notify_backend(foggy_socket_t *sock) {
+  uint64_t one = 1;
+  // A full counter (EAGAIN) already guarantees a pending wakeup.
+  if (write(sock->event_fd, &one, sizeof(one)) < 0) {
+  }
+}
+
+/**
+ * Returns how long the backend may sleep before its timer wheel needs to run.
+ *
+ * @param sock The socket whose timers to check.
+ *
+ * @return The timeout in ms for poll(), -1 if no timer is running.
+ */
+static int next_timeout(foggy_socket_t *sock) {
+  uint64_t now, deadline = timer_wheel_next(&(sock->timers));
+
+  if (deadline == 0) return -1;
+  now = get_time_us();
+  if (now >= deadline) return 0;
+  return (deadline - now + 999) / 1000;
+}
 
+/**
+ * Blocks until a packet arrives on the socket, the application notifies the
+ * backend through `notify_backend` or the next timer is due. A busy-polling
+ * socket spins first, see foggy_busy.h.
+ *
+ * The eventfd counter is drained before returning, so a notification issued
+ * while the backend was busy is never lost: it simply makes the next call
+ * return immediately.
+ *
+ * @param sock The socket to wait on.
+ */
+static void wait_for_event(foggy_socket_t *sock) {
+  struct pollfd fds[2 + MP_MAX_SUBFLOWS];
+  int sub[MP_MAX_SUBFLOWS];
+  int n = mp_fds(sock, sub);
+  int timeout_ms;
+  uint64_t count;
+
+  fds[0].fd = sock->socket;
+  fds[0].events = POLLIN;
+  fds[1].fd = sock->event_fd;
+  fds[1].events = POLLIN;
+  for (int i = 0; i < n; ++i) {  // the other subflows of a multipath one
+    fds[2 + i].fd = sub[i];
+    fds[2 + i].events = POLLIN;
+  }
 
-  if (len >= (ssize_t)sizeof(foggy_tcp_header_t)) {
-    plen = get_plen(&hdr);
-    pkt = (uint8_t*) malloc(plen);
-    while (buf_size < plen) {
-      n = recvfrom(sock->socket, pkt + buf_size, plen - buf_size, 0,
-                   (struct sockaddr *)&(sock->conn), &conn_len);
-      buf_size = buf_size + n;
+  // Spinning ends early for an event, which is then collected at once
+  timeout_ms = sock->spin_budget > 0 && busy_spin(sock, fds, 2 + n)
+                   ? 0
+                   : next_timeout(sock);
+  if (sock->uring != NULL) {
+    uring_wait(sock, timeout_ms);
+    return;
+  }
+  stat_add(&sock->stats.syscalls, 1);
+  if (poll(fds, 2 + n, timeout_ms) > 0 && (fds[1].revents & POLLIN)) {
+    stat_add(&sock->stats.syscalls, 1);
+    if (read(sock->event_fd, &count, sizeof(count)) < 0) {
     }
-    on_recv_pkt(sock, pkt);  // calling function to handle the received packet, some logic to be implemented in this function
-    free(pkt);
   }
+}
+
+/**
+ * Sends a pure ACK advertising the current receive window if the window we
+ * last advertised was clamped and the application has since freed space.
+ * A delayed ACK goes out as soon as reading opened the window by two
+ * segments, the sender may be waiting for just that.
+ *
+ * @param sock The socket to send the window update on.
+ */
+static void send_window_update(foggy_socket_t *sock) {
+  uint32_t free_space;
+
+  while (pthread_mutex_lock(&(sock->recv_lock)) != 0) {
+  }
+  // Decompressed data may hold more than the window it came in
+  free_space = (uint32_t)sock->received_len < sock->opts.rcvbuf
+                   ? sock->opts.rcvbuf - (uint32_t)sock->received_len
+                   : 0;
   pthread_mutex_unlock(&(sock->recv_lock));
+
+  if (sock->ack_pending > 0 && free_space >= sock->last_adv + 2 * MSS) {
+    send_ack(sock);
+    return;
+  }
+  if (free_space <= MSS) {  // create_socket_packet clamps it to MSS
+    sock->window_update_pending = 1;
+    return;
+  }
+  if (!sock->window_update_pending) return;
+  sock->window_update_pending = 0;
+
+  uint8_t *ack_pkt = create_socket_packet(
+      sock, sock->window.last_byte_sent, sock->window.next_seq_expected,
+      ACK_FLAG_MASK, 0, NULL, NULL, 0);
+  send_packet(sock, ack_pkt);
+  free(ack_pkt);
 }
 
+/**
+ * Sends the deferred SYN of a fast open initiator, with as much queued data as
+ * fits in it.
+ *
+ * The SYN waits until the application writes, blocks in foggy_read() or closes
+ * the socket, so the first request can ride on it.
+ *
+ * @param sock The initiator socket.
+ * @param death Whether the application closed the socket.
+ */
+static void send_fastopen_syn(foggy_socket_t *sock, int death) {
+  int blocked, payload_len;
+  uint8_t *msg;
+
+  while (pthread_mutex_lock(&(sock->recv_lock)) != 0) {
+  }
+  blocked = sock->read_blocked;
+  pthread_mutex_unlock(&(sock->recv_lock));
+
+  while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+  }
+  if (sock->sending_len == 0 && !death && !blocked) {
+    pthread_mutex_unlock(&(sock->send_lock));
+    return;
+  }
+
+  // Leave room for the capability, segment size, window scale and cookie
+  // options
+  sockopt_apply(sock);
+  payload_len = MIN(sock->sending_len, (int)MSS - OPT_CAPS_LEN - OPT_MSS_LEN -
+                                           OPT_WSCALE_LEN - 2 -
+                                           FASTOPEN_COOKIE_LEN);
+  msg = create_syn_packet(sock, sock->sending_buf, payload_len);
+  sock->sending_len -= payload_len;
+  if (sock->sending_len == 0) {
+    free(sock->sending_buf);
+    sock->sending_buf = NULL;
+  } else {
+    memmove(sock->sending_buf, sock->sending_buf + payload_len,
+            sock->sending_len);
+  }
+  pthread_cond_broadcast(&(sock->send_cond));
+  pthread_mutex_unlock(&(sock->send_lock));
+
+  debug_printf("Sending fast open SYN %d with %d bytes\n",
+         sock->window.last_byte_sent, payload_len);
+  send_ring_push(&(sock->send_window), msg, sock->window.last_byte_sent,
+                 payload_len);
+  sock->window.last_byte_sent += 1 + payload_len;  // the SYN takes one seq
+  sock->fastopen_pending = 0;
+}
 
+/**
+ * Puts our FIN behind the data in the send window.
+ *
+ * @param sock The socket being closed or shut down.
+ */
+static void queue_fin(foggy_socket_t *sock) {
+  uint8_t *msg;
+
+  debug_printf("Sending FIN %d\n", sock->window.last_byte_sent);
+  msg = create_socket_packet(sock, sock->window.last_byte_sent,
+                             sock->window.next_seq_expected, FIN_FLAG_MASK, 0,
+                             NULL, NULL, 0);
+  send_ring_push(&(sock->send_window), msg, sock->window.last_byte_sent, 0);
+  sock->fin_seq = sock->window.last_byte_sent;
+  sock->window.last_byte_sent++;  // the FIN takes one seq
+  sock->fin_sent = 1;
+}
+
+/**
+ * Advances the teardown of a socket the application closed.
+ *
+ * Once our FIN is acknowledged foggy_close() may return, unless it lingers,
+ * and we wait (bounded) for the peer's FIN. If we closed first, we then stay
+ * in TIME_WAIT for 2 * RTO, at most TIME_WAIT_MAX, so that a retransmitted
+ * FIN still gets its ACK.
+ *
+ * @param sock The socket being closed.
+ *
+ * @return 1 if the backend can exit, 0 otherwise.
+ */
+static int update_close_state(foggy_socket_t *sock) {
+  uint64_t now = get_time_us();
+  int peer_fin;
+
+  if (!sock->fin_sent) return 0;  // still delivering data
+
+  if (!send_ring_empty(&(sock->send_window))) {  // FIN_WAIT_1, CLOSING or LAST_ACK
+    if (sock->rto_retries <= FIN_MAX_RETRIES) return 0;
+    info_printf("Peer stopped responding, aborting close\n");
+    sock->close_error = 1;
+    return 1;
+  }
+  if (!sock->fin_acked) {  // FIN_WAIT_2 or TIME_WAIT from here on
+    while (pthread_mutex_lock(&(sock->death_lock)) != 0) {
+    }
+    sock->fin_acked = 1;
+    pthread_cond_broadcast(&(sock->close_cond));
+    pthread_mutex_unlock(&(sock->death_lock));
+  }
+
+  while (pthread_mutex_lock(&(sock->recv_lock)) != 0) {
+  }
+  peer_fin = sock->peer_fin;
+  pthread_mutex_unlock(&(sock->recv_lock));
+
+  // Once armed, the close timer going idle means it expired
+  if (!peer_fin) {  // FIN_WAIT_2
+    if (sock->close_timer.expires == 0) {
+      timer_arm(&(sock->timers), &(sock->close_timer), now + FIN_WAIT_TIMEOUT);
+    }
+    return !timer_pending(&(sock->close_timer));
+  }
+  if (sock->peer_fin_first) {  // LAST_ACK done
+    return 1;
+  }
+  if (!sock->time_wait) {  // enter TIME_WAIT
+    timer_arm(&(sock->timers), &(sock->close_timer),
+              now + MIN(2 * (uint64_t)sock->window.rto, TIME_WAIT_MAX));
+    sock->time_wait = 1;
+  }
+  return !timer_pending(&(sock->close_timer));
+}
+
+void release_socket(foggy_socket_t *sock) {
+  send_ring_destroy(&(sock->send_window));
+  for (int i = 0; i < sock->rcv_slots; ++i) {
+    free(sock->receive_window[i].msg);
+  }
+  free(sock->receive_window);
+  free(sock->received_buf);
+  free(sock->sending_buf);
+  mp_destroy(sock);
+  fec_destroy(sock);
+  compress_destroy(sock);
+  stream_destroy(sock);
+  netem_link_destroy(sock->netem);
+  free(sock->rx_buf);
+  close(sock->event_fd);
+  close(sock->socket);
+  delete sock;
+
+#ifdef FOGGY_TRACE
+  const char *trace_file = getenv("FOGGY_TRACE_FILE");
+  if (trace_file != NULL) {
+    foggy_trace_dump(trace_file);
+  }
+#endif
+}
+
+/**
+ * Publishes the gauges read by foggy_get_info().
+ *
+ * @param sock The socket.
+ * @param rcv_occupancy Bytes buffered on the receive side.
+ */
+static void publish_info(foggy_socket_t *sock, uint32_t rcv_occupancy) {
+  foggy_stats_t *stats = &(sock->stats);
+
+  if (stats->cwnd.load(memory_order_relaxed) != sock->window.congestion_window ||
+      stats->ssthresh.load(memory_order_relaxed) != sock->window.ssthresh) {
+    FOGGY_TRACE_EVENT(TRACE_CWND, sock, sock->window.congestion_window,
+                      sock->window.ssthresh, sock->window.reno_state);
+  }
+  stats->cwnd.store(sock->window.congestion_window, memory_order_relaxed);
+  stats->ssthresh.store(sock->window.ssthresh, memory_order_relaxed);
+  stats->reno_state.store(sock->window.reno_state, memory_order_relaxed);
+  stats->srtt.store(sock->window.srtt, memory_order_relaxed);
+  stats->rttvar.store(sock->window.rttvar, memory_order_relaxed);
+  stats->rto.store(sock->window.rto, memory_order_relaxed);
+  stats->rcv_occupancy.store(rcv_occupancy, memory_order_relaxed);
+  stats->mss.store(sock->mss, memory_order_relaxed);
+}
+
+/**
+ * Records the write-to-ACK latency of the writes that are now fully ACKed.
+ *
+ * Must be called with send_lock held.
+ *
+ * @param sock The socket.
+ */
+static void record_acked_writes(foggy_socket_t *sock) {
+  uint64_t acked, now;
+
+  // Compressed or multiplexed, the ACKs count more than written bytes
+  if (sock->comp != NULL) {
+    acked = compress_acked(sock);
+  } else if (sock->streams != NULL) {
+    acked = stream_acked(sock);
+  } else {
+    acked = sock->stats.bytes_acked.load(memory_order_relaxed);
+  }
+
+  if (sock->write_marks.empty() || sock->write_marks.front().first > acked) {
+    return;
+  }
+  now = get_time_us();
+  while (!sock->write_marks.empty() &&
+         sock->write_marks.front().first <= acked) {
+    hist_record(&(sock->write_to_ack), now - sock->write_marks.front().second);
+    sock->write_marks.pop_front();
+  }
+}
 
 void *begin_backend(void *in) {
   foggy_socket_t *sock = (foggy_socket_t *)in;
-  int death, buf_len, send_signal;
+  int death, buf_len, tail, read_len, send_signal, shutdown, last_ref;
+  uint32_t in_flight, rcv_occupancy;
   uint8_t *data;
 
+  cc_log_open(sock);
+  busy_apply(sock);
+  uring_start(sock);
   while (1) {
+    check_for_pkt(sock, NO_WAIT);
+    timer_wheel_run(&(sock->timers), get_time_us());
+    send_window_update(sock);
+    if (sock->streams != NULL) {
+      stream_send_update(sock);
+    }
+
+    while (pthread_mutex_lock(&(sock->recv_lock)) != 0) {
+    }
+
+    read_len = sock->read_ops.empty() ? 0 : async_complete_reads(sock);
+    send_signal = sock->received_len > 0 || sock->peer_fin;
+    rcv_occupancy = sock->received_len;
+    if (sock->streams != NULL) {
+      // Readers of other streams wait on the same condition
+      send_signal |= sock->streams->wakeup;
+      sock->streams->wakeup = 0;
+      rcv_occupancy += sock->streams->buffered;
+    }
+
+    pthread_mutex_unlock(&(sock->recv_lock));
+
+    if (send_signal) {
+      pthread_cond_broadcast(&(sock->wait_cond));
+    }
+    if (read_len > 0) {
+      send_window_update(sock);  // the reads freed space
+    }
+
     while (pthread_mutex_lock(&(sock->death_lock)) != 0) {
     }
     death = sock->dying;
     pthread_mutex_unlock(&(sock->death_lock));
 
+    if (sock->fastopen_pending) {
+      send_fastopen_syn(sock, death);
+    }
+
     while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
     }
+    sockopt_apply(sock);
     buf_len = sock->sending_len;
-
-    if (!sock->send_window.empty()) {
-      // printf("Sending window is not empty\n");
-      send_pkts(sock, NULL, 0);
-      check_for_pkt(sock, NO_WAIT);
+    if (death) {
+      sock->push = 1;  // hold nothing back from the FIN
     }
 
-    if (death && buf_len == 0 && sock->send_window.empty()) { // when the three condition is true, then the socket is destroyed
-      break;   
+    // Only take as much data as the send buffer can hold, the rest stays in
+    // sending_buf and keeps foggy_write() blocked until ACKs free up space.
+    in_flight = sock->window.last_byte_sent - sock->window.last_ack_received;
+    if (sock->connected != 2 || in_flight >= sock->opts.sndbuf) {
+      buf_len = 0;  // still waiting for the SYN-ACK, or the buffer is full
+    } else if (sock->comp != NULL || sock->streams != NULL) {
+      buf_len = 0;  // compress_transmit() or stream_transmit() takes it below
+    } else if (in_flight > 0 &&
+               sock->opts.sndbuf - in_flight <
+                   (uint32_t)MIN(buf_len, segment_payload(sock))) {
+      buf_len = 0;  // wait for room for a full segment rather than cut small ones
+    } else {
+      buf_len = MIN(buf_len, (int)(sock->opts.sndbuf - in_flight));
+      // Cut whole segments only while the send buffer holds back more data.
+      // Otherwise the partial tail goes out with them unless the coalescing
+      // mode keeps it for the next write.
+      tail = buf_len % segment_payload(sock);
+      if (buf_len < sock->sending_len && buf_len > segment_payload(sock)) {
+        buf_len -= tail;
+      } else if (hold_partial(sock, tail)) {
+        buf_len -= tail;
+      }
     }
 
     // Normal Work Flows
+    data = NULL;
     if (buf_len > 0) {  // something in the data to send
       data = (uint8_t*)malloc(buf_len);
       memcpy(data, sock->sending_buf, buf_len); // copy the data to send
 
-      // free the sending buffer and reset the sending length in socket
-      sock->sending_len = 0;
-      free(sock->sending_buf);
-      sock->sending_buf = NULL;
+      // keep whatever did not fit in the sending buffer
+      sock->sending_len -= buf_len;
+      if (sock->sending_len == 0) {
+        free(sock->sending_buf);
+        sock->sending_buf = NULL;
+      } else {
+        memmove(sock->sending_buf, sock->sending_buf + buf_len,
+                sock->sending_len);
+      }
+      pthread_cond_broadcast(&(sock->send_cond));
+    }
+    // unlock the sending lock, allow other process to send data
+    pthread_mutex_unlock(&(sock->send_lock));
 
-      // unlock the sending lock, allow other process to send data
-      pthread_mutex_unlock(&(sock->send_lock));
-      send_pkts(sock, data, buf_len); // logic to send the data, need to be changed
-      free(data);
+    if (sock->comp != NULL && sock->connected == 2) {
+      compress_transmit(sock);
+    } else if (sock->streams != NULL && sock->connected == 2) {
+      stream_transmit(sock);
     } else {
-      pthread_mutex_unlock(&(sock->send_lock));
+      send_pkts(sock, data, buf_len);
     }
+    free(data);
 
-    check_for_pkt(sock, NO_WAIT);
+    while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+    }
+    buf_len = sock->sending_len;
+    if (sock->streams != NULL) {
+      buf_len += stream_unsent(sock);
+    }
+    // Queued writes refill sending_buf for the next round, and hold back
+    // the FIN until they did
+    if (!sock->write_ops.empty() && async_fill_writes(sock) > 0) {
+      notify_backend(sock);
+    }
+    buf_len += sock->write_ops_len;
+    shutdown = sock->write_shutdown;
+    record_acked_writes(sock);
+    pthread_mutex_unlock(&(sock->send_lock));
+
+    // The FIN goes out once everything written before the close is queued
+    if ((death || shutdown) && !sock->fin_sent && buf_len == 0 &&
+        sock->connected == 2 && !sock->fastopen_pending) {
+      queue_fin(sock);
+      send_pkts(sock, NULL, 0);
+    }
 
-    while (pthread_mutex_lock(&(sock->recv_lock)) != 0) {
+    if (death && update_close_state(sock)) {
+      break;
     }
 
-    send_signal = sock->received_len > 0;
+    publish_info(sock, rcv_occupancy);
+    cc_log_sample(sock);
+    wait_for_event(sock);
+  }
 
-    pthread_mutex_unlock(&(sock->recv_lock));
+  cc_log_close(sock);
+  // The thread that submitted to the ring closes it, before the sockets
+  uring_destroy(sock);
 
-    if (send_signal) {
-      pthread_cond_signal(&(sock->wait_cond));
-    }
+  // Whoever of the application and the backend lets go last frees the socket
+  while (pthread_mutex_lock(&(sock->death_lock)) != 0) {
+  }
+  sock->close_done = 1;
+  pthread_cond_broadcast(&(sock->close_cond));
+  last_ref = --sock->refs == 0;
+  pthread_mutex_unlock(&(sock->death_lock));
+  if (last_ref) {
+    release_socket(sock);
   }
 
   pthread_exit(NULL);
@@ -173,59 +652,89 @@ void foggy_listen(foggy_socket_t *sock) {
     return;
   }
   
-  printf("Listening on port %d\n", ntohs(sock->conn.sin_port));
+  info_printf("Listening on port %d\n", ntohs(sock->conn.sin_port));
 
   while(pthread_mutex_lock(&(sock->connected_lock)) != 0) {  
   }
 
   while (sock->connected != 2) {
-    check_for_pkt(sock, NO_FLAG);
+    // Resend the SYN-ACK until the initiator ACKs it, then give up on it
+    if (sock->connected == 1 &&
+        get_time_us() - sock->handshake_sent >= sock->window.rto) {
+      if (++sock->handshake_retries > SYN_MAX_RETRIES) {
+        info_printf("Handshake timed out, waiting for a new SYN\n");
+        sock->connected = 0;
+        sock->window.rto = sock->opts.rto_init;
+        continue;
+      }
+      sock->window.rto = MIN(sock->window.rto * 2, sock->opts.rto_max);
+      send_syn_ack(sock);
+    }
+    check_for_pkt(sock, sock->connected == 1 ? TIMEOUT : NO_FLAG);
   }
 
   sock->window.last_byte_sent++; // update the last byte sent
 
   pthread_mutex_unlock(&(sock->connected_lock)); // release the lock
 
-  printf("Connection established\n");
+  info_printf("Connection established\n");
 }
 
 
 
-void foggy_connect(foggy_socket_t *sock) {
+int foggy_connect(foggy_socket_t *sock) {
   if (sock->type != TCP_INITIATOR) {
     perror("ERROR not a initiator socket");
-    return;
+    return EXIT_ERROR;
   }
 
-  printf("Connecting to port %d\n", ntohs(sock->conn.sin_port));
+  info_printf("Connecting to port %d\n", ntohs(sock->conn.sin_port));
 
-  while(pthread_mutex_lock(&(sock->send_lock)) != 0) {  
+  // With a cookie for this server the SYN is deferred so it can carry data,
+  // the backend sends it and takes care of its retransmissions.
+  if (sock->fastopen && fastopen_get_cookie(&(sock->conn), sock->fastopen_cookie)) {
+    debug_printf("Deferring SYN to carry data (fast open)\n");
+    sock->fastopen_pending = 1;
+    return EXIT_SUCCESS;
   }
 
-  printf("Sending SYN packet %d\n", sock->window.last_byte_sent);
-  
-  uint8_t *syn_pkt = create_packet(
-                  sock->my_port, ntohs(sock->conn.sin_port),
-                  sock->window.last_byte_sent, sock->window.next_seq_expected,
-                  sizeof(foggy_tcp_header_t), sizeof(foggy_tcp_header_t), SYN_FLAG_MASK,
-                  MAX(MAX_NETWORK_BUFFER - (uint32_t)sock->received_len, MSS), 0,
-                  NULL, NULL, 0);
-
-  sendto(sock->socket, syn_pkt, sizeof(foggy_tcp_header_t), 0,
-                    (struct sockaddr *)&(sock->conn), sizeof(sock->conn)); // sending syn packet, currently no timeout
+  while(pthread_mutex_lock(&(sock->connected_lock)) != 0) {  
+  }
 
-  free(syn_pkt); // prevent leakage
+  sock->handshake_retries = 0;
+  while (sock->connected != 2) {
+    if (sock->handshake_retries > SYN_MAX_RETRIES) {
+      pthread_mutex_unlock(&(sock->connected_lock));
+      fprintf(stderr, "ERROR connection timed out\n");
+      return EXIT_ERROR;
+    }
 
-  pthread_mutex_unlock(&(sock->send_lock)); // release the lock
+    debug_printf("Sending SYN packet %d\n", sock->window.last_byte_sent);
 
-  while(pthread_mutex_lock(&(sock->connected_lock)) != 0) {  
+    while(pthread_mutex_lock(&(sock->send_lock)) != 0) {  
+    }
+    uint8_t *syn_pkt = create_syn_packet(sock, NULL, 0);
+    send_packet(sock, syn_pkt);
+    free(syn_pkt); // prevent leakage
+    pthread_mutex_unlock(&(sock->send_lock)); // release the lock
+
+    sock->handshake_sent = get_time_us();
+    while (sock->connected != 2 &&
+           get_time_us() - sock->handshake_sent < sock->window.rto) {
+      check_for_pkt(sock, TIMEOUT);
+    }
+    if (sock->connected != 2) {  // back off and retry
+      sock->handshake_retries++;
+      sock->window.rto = MIN(sock->window.rto * 2, sock->opts.rto_max);
+    }
   }
-  while (sock->connected != 2) {
-    check_for_pkt(sock, NO_FLAG);
+  if (sock->handshake_retries == 0) {
+    update_rtt(sock, get_time_us() - sock->handshake_sent);
   }
   sock->window.last_byte_sent++; // update the last byte sent
 
   pthread_mutex_unlock(&(sock->connected_lock));
   
-  printf("Connection established\n");
-}
\ No newline at end of file
+  info_printf("Connection established\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,116 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/* This file implements the busy-polling mode, see foggy_busy.h. */
+
+#include "foggy_busy.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <sys/sysinfo.h>
+
+#include "foggy_function.h"
+#include "foggy_trace.h"
+#include "foggy_uring.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+
+static pthread_once_t home_once = PTHREAD_ONCE_INIT;
+static cpu_set_t home_cpus;  // where backend threads run unless pinned
+
+/**
+ * Saves the CPUs a backend thread may run on before any was pinned. Backend
+ * threads inherit them from the application thread that created them.
+ */
+static void save_home_cpus() {
+  if (pthread_getaffinity_np(pthread_self(), sizeof(home_cpus), &home_cpus) !=
+      0) {
+    CPU_ZERO(&home_cpus);
+    for (int i = 0; i < CPU_SETSIZE; ++i) CPU_SET(i, &home_cpus);
+  }
+}
+
+void busy_apply(foggy_socket_t *sock) {
+  int cpu = (int32_t)sock->opts.cpu;
+  cpu_set_t set;
+  int ret;
+
+  sock->spin_budget = sock->opts.busy_poll;
+
+  if (cpu == sock->cpu) return;
+  pthread_once(&home_once, save_home_cpus);
+  if (cpu >= 0) {
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+  } else {
+    set = home_cpus;
+  }
+  ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (ret != 0) {
+    errno = ret;
+    perror("ERROR pthread_setaffinity_np");
+    return;
+  }
+  sock->cpu = cpu;
+  debug_printf("Backend runs on CPU %d\n", cpu);
+}
+
+/**
+ * Pauses between two checks. The sibling hyperthread gets the core for a
+ * moment, and on a single CPU the threads that would send us something get
+ * it altogether: spinning there only delays them.
+ */
+static inline void relax(int share) {
+  if (share) {
+    sched_yield();
+    return;
+  }
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+/**
+ * Checks for packets and notifications without waiting.
+ */
+static int ready(foggy_socket_t *sock, struct pollfd *fds, int nfds) {
+  if (sock->uring != NULL) return uring_ready(sock);
+  stat_add(&sock->stats.syscalls, 1);
+  return poll(fds, nfds, 0) > 0;
+}
+
+int busy_spin(foggy_socket_t *sock, struct pollfd *fds, int nfds) {
+  static int share = -1;  // the process has a single CPU to run on
+  uint64_t start = get_time_us(), now = start, timer, until;
+  int event;
+
+  if (share < 0) share = get_nprocs() == 1;
+
+  until = start + sock->spin_budget;
+  timer = timer_wheel_next(&(sock->timers));
+  if (timer != 0) until = MIN(until, timer);
+
+  while (!(event = ready(sock, fds, nfds)) && now < until) {
+    relax(share);
+    now = get_time_us();
+  }
+  stat_add(&sock->stats.spin_us, get_time_us() - start);
+
+  if (event) {
+    sock->spin_budget = sock->opts.busy_poll;
+  } else if (now - start >= sock->spin_budget) {
+    // Spun in vain, the next wait sleeps sooner
+    sock->spin_budget = MIN(sock->opts.busy_poll,
+                            MAX(BUSY_SPIN_MIN, sock->spin_budget / 2));
+  }
+  return event;
+}
@@ -0,0 +1,90 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/*
+ * This file implements the congestion control sampler.
+ */
+
+#include "foggy_cclog.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "foggy_function.h"
+
+static void write_sample(foggy_socket_t *sock, uint64_t now) {
+  cc_log_t *log = &(sock->cc_log);
+  window_t *win = &(sock->window);
+
+  fprintf(log->file, "%lu,%u,%u,%u,%u,%u,%u,%lu,%lu\n",
+          (unsigned long)(now - log->start), win->congestion_window,
+          win->ssthresh, send_ring_in_flight(&(sock->send_window)),
+          win->srtt, win->rto, (uint32_t)win->reno_state,
+          (unsigned long)sock->stats.bytes_acked.load(memory_order_relaxed),
+          (unsigned long)sock->stats.bytes_retrans.load(memory_order_relaxed));
+  log->cwnd = win->congestion_window;
+  log->ssthresh = win->ssthresh;
+  log->reno_state = win->reno_state;
+  log->rto = win->rto;
+  if (log->interval > 0) {
+    timer_arm(&(sock->timers), &(log->timer), now + log->interval);
+  }
+}
+
+static void sample_timeout(void *arg) {
+  foggy_socket_t *sock = (foggy_socket_t *)arg;
+  write_sample(sock, get_time_us());
+}
+
+void cc_log_open(foggy_socket_t *sock) {
+  cc_log_t *log = &(sock->cc_log);
+  const char *dir = getenv("FOGGY_CC_LOG");
+  const char *interval = getenv("FOGGY_CC_LOG_INTERVAL");
+  char path[PATH_MAX];
+
+  log->file = NULL;
+  timer_init(&(log->timer), sample_timeout, sock);
+  if (dir == NULL || *dir == '\0') return;
+
+  snprintf(path, sizeof(path), "%s/foggy-cc-%d-%d.csv", dir, (int)getpid(),
+           sock->my_port);
+  log->file = fopen(path, "w");
+  if (log->file == NULL) {
+    perror("ERROR opening congestion control log");
+    return;
+  }
+  fprintf(log->file, "time_us,cwnd,ssthresh,in_flight,srtt_us,rto_us,state,"
+                     "bytes_acked,bytes_retrans\n");
+  log->start = get_time_us();
+  log->interval = interval != NULL ? strtoull(interval, NULL, 10) * 1000 : 0;
+  write_sample(sock, log->start);
+}
+
+void cc_log_sample(foggy_socket_t *sock) {
+  cc_log_t *log = &(sock->cc_log);
+  window_t *win = &(sock->window);
+
+  if (log->file == NULL) return;
+  if (log->cwnd != win->congestion_window || log->ssthresh != win->ssthresh ||
+      log->reno_state != (uint32_t)win->reno_state || log->rto != win->rto) {
+    write_sample(sock, get_time_us());
+  }
+}
+
+void cc_log_close(foggy_socket_t *sock) {
+  cc_log_t *log = &(sock->cc_log);
+
+  if (log->file == NULL) return;
+  write_sample(sock, get_time_us());
+  timer_cancel(&(sock->timers), &(log->timer));
+  fclose(log->file);
+  log->file = NULL;
+}
@@ -0,0 +1,258 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/*
+ * This file implements stream compression.
+ */
+
+#include "foggy_compress.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "foggy_function.h"
+#include "foggy_lz.h"
+#include "foggy_option.h"
+#include "foggy_trace.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+#define MARKS_MASK (COMPRESS_MARKS - 1)
+
+void compress_init(foggy_socket_t *sock) {
+  const char *env = getenv("FOGGY_COMPRESS");
+
+  sock->comp = NULL;
+  sock->compress = env != NULL && atoi(env) != 0;
+  if (sock->compress) {
+    sock->caps_wanted |= CAP_COMPRESS;
+  }
+}
+
+void compress_start(foggy_socket_t *sock) {
+  struct compress_state *comp;
+
+  if (sock->comp != NULL) return;
+  comp = (struct compress_state *)malloc(sizeof(*comp));
+  sock->comp = comp;
+  comp->skip = sock->compress ? 0 : -1;  // -1 never compresses
+  comp->backoff = 1;
+  comp->tx_len = 0;
+  comp->tx = NULL;
+  comp->tx_size = 0;
+  comp->marks_head = comp->marks_tail = 0;
+  comp->raw_acked = 0;
+  comp->hdr_len = 0;
+  comp->broken = 0;
+}
+
+void compress_destroy(foggy_socket_t *sock) {
+  if (sock->comp != NULL) free(sock->comp->tx);
+  free(sock->comp);
+  sock->comp = NULL;
+}
+
+/**
+ * Tells whether compressing took longer than sending the bytes it saved
+ * would have, at the rate the congestion window sustains.
+ */
+static int cpu_bound(foggy_socket_t *sock, uint64_t spent, int saved) {
+  uint64_t cwnd = MIN(sock->window.congestion_window, sock->opts.sndbuf);
+
+  if (sock->window.srtt == 0 || cwnd == 0) return 0;
+  return spent * cwnd > (uint64_t)saved * sock->window.srtt;
+}
+
+/**
+ * Frames a block at the end of tx, compressed if that pays.
+ */
+static void put_frame(foggy_socket_t *sock, const uint8_t *data, int len) {
+  struct compress_state *comp = sock->comp;
+  uint8_t *frame = comp->tx + comp->tx_len;
+  int body_len = 0;
+
+  if (comp->skip == 0) {
+    uint64_t start = get_time_us();
+    // Anything that does not shrink enough does not fit
+    body_len = lz_compress(data, len, frame + COMPRESS_HDR_LEN,
+                           len - (len >> COMPRESS_GAIN_SHIFT) - 1);
+    if (body_len == 0 ||
+        cpu_bound(sock, get_time_us() - start, len - body_len)) {
+      debug_printf("Compression does not pay, sending %d blocks raw\n",
+                   comp->backoff);
+      comp->skip = comp->backoff;
+      comp->backoff = MIN(comp->backoff * 2, COMPRESS_MAX_SKIP);
+    } else {
+      comp->backoff = 1;
+    }
+  } else if (comp->skip > 0) {
+    comp->skip--;
+  }
+
+  // The compressed block is kept even when it was too slow to make, the
+  // time is spent already
+  if (body_len > 0) {
+    stat_add(&sock->stats.compress_saved, len - body_len);
+    frame[0] = (uint8_t)((body_len | COMPRESS_LZ) >> 8);
+  } else {
+    body_len = len;
+    memcpy(frame + COMPRESS_HDR_LEN, data, len);
+    frame[0] = (uint8_t)(body_len >> 8);
+  }
+  frame[1] = (uint8_t)(body_len & 0xff);
+  frame[2] = (uint8_t)(len >> 8);
+  frame[3] = (uint8_t)(len & 0xff);
+  comp->tx_len += COMPRESS_HDR_LEN + body_len;
+}
+
+void compress_transmit(foggy_socket_t *sock) {
+  struct compress_state *comp = sock->comp;
+  int max_payload = segment_payload(sock), more, room, len;
+  uint32_t in_flight, send_len;
+  uint64_t raw_end;
+
+  // The send buffer may have grown since
+  if (comp->tx_size < sock->opts.sndbuf + COMPRESS_HDR_LEN + COMPRESS_BLOCK) {
+    comp->tx_size = sock->opts.sndbuf + COMPRESS_HDR_LEN + COMPRESS_BLOCK;
+    comp->tx = (uint8_t *)realloc(comp->tx, comp->tx_size);
+  }
+
+  while (1) {
+    // Wait for room for a full segment rather than cut small frames, and
+    // take no more than fits even if the block does not compress
+    in_flight = sock->window.last_byte_sent - sock->window.last_ack_received +
+                comp->tx_len;
+    room = in_flight < sock->opts.sndbuf ? sock->opts.sndbuf - in_flight : 0;
+    if ((in_flight > 0 && room < max_payload) ||
+        comp->marks_tail - comp->marks_head == COMPRESS_MARKS) {
+      room = 0;
+    }
+
+    while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+    }
+    more = sock->sending_len > 0;
+    len = MIN(sock->sending_len, MIN(room - COMPRESS_HDR_LEN, COMPRESS_BLOCK));
+    if (len > 0) {
+      memcpy(comp->block, sock->sending_buf, len);
+      sock->sending_len -= len;
+      if (sock->sending_len == 0) {
+        free(sock->sending_buf);
+        sock->sending_buf = NULL;
+      } else {
+        memmove(sock->sending_buf, sock->sending_buf + len, sock->sending_len);
+      }
+      pthread_cond_broadcast(&(sock->send_cond));
+    }
+    raw_end = sock->bytes_written - sock->sending_len;
+    more = sock->sending_len > 0;
+    pthread_mutex_unlock(&(sock->send_lock));
+    if (len <= 0) break;
+
+    put_frame(sock, comp->block, len);
+    compress_mark_t *mark = &(comp->marks[comp->marks_tail++ & MARKS_MASK]);
+    mark->seq = sock->window.last_byte_sent + comp->tx_len;
+    mark->raw = raw_end;
+  }
+
+  // Cut whole segments only while more data follows, the rest goes out with
+  // the next ACK, or as a partial segment if the coalescing mode lets it
+  send_len = comp->tx_len;
+  if (more && send_len > (uint32_t)max_payload) {
+    send_len -= send_len % max_payload;
+  } else {
+    while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+    }
+    if (hold_partial(sock, send_len % max_payload)) {
+      send_len -= send_len % max_payload;
+    }
+    pthread_mutex_unlock(&(sock->send_lock));
+  }
+  send_pkts(sock, comp->tx, send_len);
+  comp->tx_len -= send_len;
+  memmove(comp->tx, comp->tx + send_len, comp->tx_len);
+}
+
+uint64_t compress_acked(foggy_socket_t *sock) {
+  struct compress_state *comp = sock->comp;
+  uint32_t ack = sock->window.last_ack_received;
+
+  while (comp->marks_head != comp->marks_tail) {
+    compress_mark_t *mark = &(comp->marks[comp->marks_head & MARKS_MASK]);
+    if (after(mark->seq, ack)) break;
+    comp->raw_acked = mark->raw;
+    comp->marks_head++;
+  }
+  return comp->raw_acked;
+}
+
+/**
+ * Checks the header of the next frame.
+ *
+ * @return 0 if it is well formed, -1 otherwise.
+ */
+static int parse_header(struct compress_state *comp) {
+  int body_len = comp->hdr[0] << 8 | comp->hdr[1];
+
+  comp->lz = (body_len & COMPRESS_LZ) != 0;
+  comp->body_len = body_len & ~COMPRESS_LZ;
+  comp->raw_len = comp->hdr[2] << 8 | comp->hdr[3];
+  comp->have = 0;
+  if (comp->raw_len == 0 || comp->raw_len > COMPRESS_BLOCK) return -1;
+  return comp->lz ? (comp->body_len > 0 && comp->body_len < comp->raw_len ? 0 : -1)
+                  : (comp->body_len == comp->raw_len ? 0 : -1);
+}
+
+void compress_on_deliver(foggy_socket_t *sock, const uint8_t *data, int len,
+                         uint64_t arrival) {
+  struct compress_state *comp = sock->comp;
+
+  while (len > 0 && !comp->broken) {
+    int n;
+
+    if (comp->hdr_len < COMPRESS_HDR_LEN) {
+      n = MIN(len, COMPRESS_HDR_LEN - comp->hdr_len);
+      memcpy(comp->hdr + comp->hdr_len, data, n);
+      comp->hdr_len += n;
+      data += n;
+      len -= n;
+      if (comp->hdr_len < COMPRESS_HDR_LEN) return;
+      if (parse_header(comp) < 0) {
+        fprintf(stderr, "ERROR malformed compressed frame, dropping the "
+                        "rest of the stream\n");
+        comp->broken = 1;
+        return;
+      }
+    }
+
+    // A raw body is readable as it arrives, an LZ one once it is complete
+    n = MIN(len, comp->body_len - comp->have);
+    if (comp->lz) {
+      memcpy(comp->body + comp->have, data, n);
+    } else if (n > 0) {
+      append_received(sock, data, n, arrival);
+    }
+    comp->have += n;
+    data += n;
+    len -= n;
+    if (comp->have < comp->body_len) return;
+
+    if (comp->lz) {
+      if (lz_decompress(comp->body, comp->body_len, comp->raw,
+                        comp->raw_len) != comp->raw_len) {
+        fprintf(stderr, "ERROR corrupt compressed frame, dropping the rest "
+                        "of the stream\n");
+        comp->broken = 1;
+        return;
+      }
+      append_received(sock, comp->raw, comp->raw_len, arrival);
+    }
+    comp->hdr_len = 0;
+  }
+}
@@ -0,0 +1,122 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/* This file implements the completion queues, see foggy_cq.h. */
+
+#include "foggy_cq.h"
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+foggy_cq_t *foggy_cq_create() {
+  foggy_cq_t *cq = (foggy_cq_t *)malloc(sizeof(foggy_cq_t));
+
+  cq->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (cq->event_fd < 0) {
+    perror("ERROR opening eventfd");
+    free(cq);
+    return NULL;
+  }
+  pthread_mutex_init(&(cq->lock), NULL);
+  cq->entries = (foggy_completion_t *)malloc(CQ_INITIAL_SIZE *
+                                             sizeof(foggy_completion_t));
+  cq->size = CQ_INITIAL_SIZE;
+  cq->head = 0;
+  cq->count = 0;
+  return cq;
+}
+
+void foggy_cq_destroy(foggy_cq_t *cq) {
+  if (cq == NULL) return;
+  close(cq->event_fd);
+  pthread_mutex_destroy(&(cq->lock));
+  free(cq->entries);
+  free(cq);
+}
+
+int foggy_cq_fd(foggy_cq_t *cq) { return cq->event_fd; }
+
+void cq_post(foggy_cq_t *cq, void *sock, foggy_op_t op, int result,
+             void *user_data) {
+  foggy_completion_t *entries, *c;
+  uint64_t one = 1;
+
+  while (pthread_mutex_lock(&(cq->lock)) != 0) {
+  }
+  if (cq->count == cq->size) {  // unwrap into a ring twice the size
+    entries = (foggy_completion_t *)malloc(2 * cq->size *
+                                           sizeof(foggy_completion_t));
+    for (uint32_t i = 0; i < cq->count; ++i) {
+      entries[i] = cq->entries[(cq->head + i) % cq->size];
+    }
+    free(cq->entries);
+    cq->entries = entries;
+    cq->size *= 2;
+    cq->head = 0;
+  }
+  c = &(cq->entries[(cq->head + cq->count) % cq->size]);
+  c->sock = sock;
+  c->user_data = user_data;
+  c->op = op;
+  c->result = result;
+  // The eventfd follows the queue from empty to pending
+  if (cq->count++ == 0 && write(cq->event_fd, &one, sizeof(one)) < 0) {
+  }
+  pthread_mutex_unlock(&(cq->lock));
+}
+
+int foggy_cq_poll(foggy_cq_t *cq, foggy_completion_t *completions, int max) {
+  uint64_t count;
+  int n = 0;
+
+  while (pthread_mutex_lock(&(cq->lock)) != 0) {
+  }
+  while (n < max && cq->count > 0) {
+    completions[n++] = cq->entries[cq->head];
+    cq->head = (cq->head + 1) % cq->size;
+    --cq->count;
+  }
+  if (n > 0 && cq->count == 0 &&
+      read(cq->event_fd, &count, sizeof(count)) < 0) {
+  }
+  pthread_mutex_unlock(&(cq->lock));
+  return n;
+}
+
+static uint64_t now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int foggy_cq_wait(foggy_cq_t *cq, foggy_completion_t *completions, int max,
+                  int timeout_ms) {
+  struct pollfd pfd;
+  uint64_t deadline = timeout_ms > 0 ? now_ms() + timeout_ms : 0;
+  int n, wait_ms = timeout_ms;
+
+  pfd.fd = cq->event_fd;
+  pfd.events = POLLIN;
+  while ((n = foggy_cq_poll(cq, completions, max)) == 0 && wait_ms != 0) {
+    if (poll(&pfd, 1, wait_ms) < 0) {
+      perror("ERROR polling completion queue");
+      return EXIT_ERROR;
+    }
+    if (timeout_ms > 0) {
+      uint64_t now = now_ms();
+      wait_ms = now < deadline ? (int)(deadline - now) : 0;
+    }
+  }
+  return n;
+}
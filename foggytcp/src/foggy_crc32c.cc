@@ -0,0 +1,109 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/*
+ * This file implements CRC32C with a hardware path (SSE4.2) and a portable
+ * slicing-by-8 fallback. The implementation is picked once at startup.
+ */
+
+#include "foggy_crc32c.h"
+
+#include <string.h>
+
+#define CRC32C_POLY 0x82F63B78  // reflected Castagnoli polynomial
+
+static uint32_t crc_table[8][256];
+
+static void init_crc_table() {
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t crc = i;
+    for (int j = 0; j < 8; ++j) {
+      crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+    }
+    crc_table[0][i] = crc;
+  }
+  for (uint32_t i = 0; i < 256; ++i) {
+    for (int t = 1; t < 8; ++t) {
+      crc_table[t][i] =
+          (crc_table[t - 1][i] >> 8) ^ crc_table[0][crc_table[t - 1][i] & 0xff];
+    }
+  }
+}
+
+/**
+ * Slicing-by-8: consumes eight bytes per iteration with eight independent
+ * table lookups.
+ */
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *buf, size_t len) {
+  uint64_t word;
+
+  while (len > 0 && ((uintptr_t)buf & 7) != 0) {
+    crc = (crc >> 8) ^ crc_table[0][(crc ^ *buf++) & 0xff];
+    len--;
+  }
+  while (len >= 8) {
+    memcpy(&word, buf, sizeof(word));  // little endian assumed, as on x86
+    word ^= crc;
+    crc = crc_table[7][word & 0xff] ^ crc_table[6][(word >> 8) & 0xff] ^
+          crc_table[5][(word >> 16) & 0xff] ^ crc_table[4][(word >> 24) & 0xff] ^
+          crc_table[3][(word >> 32) & 0xff] ^ crc_table[2][(word >> 40) & 0xff] ^
+          crc_table[1][(word >> 48) & 0xff] ^ crc_table[0][word >> 56];
+    buf += 8;
+    len -= 8;
+  }
+  while (len > 0) {
+    crc = (crc >> 8) ^ crc_table[0][(crc ^ *buf++) & 0xff];
+    len--;
+  }
+  return crc;
+}
+
+#if defined(__x86_64__)
+/**
+ * Hardware CRC32C. `crc32q` handles eight bytes per instruction, which runs
+ * at several GB/s on any SSE4.2 capable core.
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t *buf, size_t len) {
+  uint64_t crc64, word;
+
+  while (len > 0 && ((uintptr_t)buf & 7) != 0) {
+    crc = __builtin_ia32_crc32qi(crc, *buf++);
+    len--;
+  }
+  crc64 = crc;
+  while (len >= 8) {
+    memcpy(&word, buf, sizeof(word));
+    crc64 = __builtin_ia32_crc32di(crc64, word);
+    buf += 8;
+    len -= 8;
+  }
+  crc = (uint32_t)crc64;
+  while (len > 0) {
+    crc = __builtin_ia32_crc32qi(crc, *buf++);
+    len--;
+  }
+  return crc;
+}
+#endif
+
+typedef uint32_t (*crc32c_fn_t)(uint32_t, const uint8_t *, size_t);
+
+static crc32c_fn_t select_crc32c() {
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("sse4.2")) return crc32c_hw;
+#endif
+  init_crc_table();
+  return crc32c_sw;
+}
+
+uint32_t crc32c(uint32_t crc, const uint8_t *buf, size_t len) {
+  static const crc32c_fn_t impl = select_crc32c();
+  return ~impl(~crc, buf, len);
+}
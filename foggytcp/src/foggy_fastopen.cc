@@ -0,0 +1,145 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/*
+ * This file implements fast-open cookies. Cookies are a SipHash-2-4 MAC of the
+ * client IP address under a per-process random key, so a client can only use
+ * a cookie from the address it was issued to.
+ */
+
+#include "foggy_fastopen.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <sys/random.h>
+#include <time.h>
+
+#define COOKIE_CACHE_SIZE 64
+
+typedef struct {
+  uint32_t addr;
+  uint16_t port;
+  uint8_t cookie[FASTOPEN_COOKIE_LEN];
+  int is_used;
+} cookie_entry_t;
+
+static cookie_entry_t cookie_cache[COOKIE_CACHE_SIZE];
+static int cookie_cache_next = 0;
+static pthread_mutex_t cookie_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+#define SIPROUND           \
+  do {                     \
+    v0 += v1;              \
+    v1 = ROTL(v1, 13);     \
+    v1 ^= v0;              \
+    v0 = ROTL(v0, 32);     \
+    v2 += v3;              \
+    v3 = ROTL(v3, 16);     \
+    v3 ^= v2;              \
+    v0 += v3;              \
+    v3 = ROTL(v3, 21);     \
+    v3 ^= v0;              \
+    v2 += v1;              \
+    v1 = ROTL(v1, 17);     \
+    v1 ^= v2;              \
+    v2 = ROTL(v2, 32);     \
+  } while (0)
+
+/**
+ * SipHash-2-4 of a single 64-bit word.
+ */
+static uint64_t siphash_word(const uint64_t key[2], uint64_t m) {
+  uint64_t v0 = key[0] ^ 0x736f6d6570736575ULL;
+  uint64_t v1 = key[1] ^ 0x646f72616e646f6dULL;
+  uint64_t v2 = key[0] ^ 0x6c7967656e657261ULL;
+  uint64_t v3 = key[1] ^ 0x7465646279746573ULL;
+  uint64_t b = (uint64_t)8 << 56;
+
+  v3 ^= m;
+  SIPROUND;
+  SIPROUND;
+  v0 ^= m;
+  v3 ^= b;
+  SIPROUND;
+  SIPROUND;
+  v0 ^= b;
+  v2 ^= 0xff;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+
+static uint64_t cookie_key[2];
+static pthread_once_t cookie_key_once = PTHREAD_ONCE_INIT;
+
+static void init_cookie_key() {
+  if (getrandom(cookie_key, sizeof(cookie_key), 0) != sizeof(cookie_key)) {
+    cookie_key[0] = (uint64_t)(uintptr_t)&cookie_key ^ 0x9e3779b97f4a7c15ULL;
+    cookie_key[1] = (uint64_t)time(NULL);
+  }
+}
+
+void fastopen_make_cookie(const struct sockaddr_in *client, uint8_t *cookie) {
+  pthread_once(&cookie_key_once, init_cookie_key);
+  uint64_t mac = siphash_word(cookie_key, client->sin_addr.s_addr);
+  memcpy(cookie, &mac, FASTOPEN_COOKIE_LEN);
+}
+
+int fastopen_check_cookie(const struct sockaddr_in *client,
+                          const uint8_t *cookie, uint8_t cookie_len) {
+  uint8_t expected[FASTOPEN_COOKIE_LEN];
+
+  if (cookie_len != FASTOPEN_COOKIE_LEN) return 0;
+  fastopen_make_cookie(client, expected);
+  return memcmp(expected, cookie, FASTOPEN_COOKIE_LEN) == 0;
+}
+
+int fastopen_get_cookie(const struct sockaddr_in *server, uint8_t *cookie) {
+  int found = 0;
+
+  pthread_mutex_lock(&cookie_cache_lock);
+  for (int i = 0; i < COOKIE_CACHE_SIZE; ++i) {
+    cookie_entry_t *entry = &cookie_cache[i];
+    if (entry->is_used && entry->addr == server->sin_addr.s_addr &&
+        entry->port == server->sin_port) {
+      memcpy(cookie, entry->cookie, FASTOPEN_COOKIE_LEN);
+      found = 1;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&cookie_cache_lock);
+  return found;
+}
+
+void fastopen_put_cookie(const struct sockaddr_in *server,
+                         const uint8_t *cookie) {
+  cookie_entry_t *entry = NULL;
+
+  pthread_mutex_lock(&cookie_cache_lock);
+  for (int i = 0; i < COOKIE_CACHE_SIZE; ++i) {
+    if (cookie_cache[i].is_used &&
+        cookie_cache[i].addr == server->sin_addr.s_addr &&
+        cookie_cache[i].port == server->sin_port) {
+      entry = &cookie_cache[i];
+      break;
+    }
+  }
+  if (entry == NULL) {  // evict round-robin
+    entry = &cookie_cache[cookie_cache_next];
+    cookie_cache_next = (cookie_cache_next + 1) % COOKIE_CACHE_SIZE;
+  }
+  entry->addr = server->sin_addr.s_addr;
+  entry->port = server->sin_port;
+  memcpy(entry->cookie, cookie, FASTOPEN_COOKIE_LEN);
+  entry->is_used = 1;
+  pthread_mutex_unlock(&cookie_cache_lock);
+}
@@ -0,0 +1,363 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/*
+ * This file implements forward error correction.
+ */
+
+#include "foggy_fec.h"
+
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "foggy_function.h"
+#include "foggy_option.h"
+#include "foggy_trace.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+#define HISTORY_MASK (FEC_HISTORY - 1)
+#define SEGS_MASK (FEC_HISTORY_SEGS - 1)
+
+/**
+ * dst ^= src, a word at a time. The compiler turns the loop into vector
+ * instructions.
+ */
+static void xor_bytes(uint8_t *dst, const uint8_t *src, size_t len) {
+  size_t i = 0;
+
+  for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+    uint64_t a, b;
+    memcpy(&a, dst + i, sizeof(a));
+    memcpy(&b, src + i, sizeof(b));
+    a ^= b;
+    memcpy(dst + i, &a, sizeof(a));
+  }
+  for (; i < len; ++i) {
+    dst[i] ^= src[i];
+  }
+}
+
+/**
+ * Sends the parity of a group that stayed open for FEC_FLUSH_DIV of an RTT.
+ */
+static void flush_timeout(void *arg) {
+  fec_flush((foggy_socket_t *)arg);
+}
+
+void fec_init(foggy_socket_t *sock) {
+  const char *env = getenv("FOGGY_FEC");
+
+  sock->fec = NULL;
+  sock->fec_group = 0;
+  if (env == NULL || *env == '\0') return;
+  if (strcmp(env, "auto") == 0) {
+    sock->fec_group = FEC_AUTO;
+  } else {
+    sock->fec_group = MIN(MAX(atoi(env), 0), FEC_MAX_GROUP);
+  }
+  if (sock->fec_group != 0) {
+    sock->caps_wanted |= CAP_FEC;
+  }
+}
+
+void fec_start(foggy_socket_t *sock) {
+  struct fec_state *fec;
+
+  if (sock->fec != NULL) return;
+  fec = (struct fec_state *)malloc(sizeof(*fec));
+  sock->fec = fec;
+  // Adapting starts from no parity, until losses show up
+  fec->group = sock->fec_group == FEC_AUTO ? 0 : sock->fec_group;
+  fec->loss = 0;
+  fec->count = 0;
+  timer_init(&(fec->flush_timer), flush_timeout, sock);
+  for (int i = 0; i < FEC_MAX_PENDING; ++i) {
+    fec->pending[i] = NULL;
+  }
+  fec->delivered_count = 0;
+}
+
+void fec_destroy(foggy_socket_t *sock) {
+  if (sock->fec == NULL) return;
+  timer_cancel(&(sock->timers), &(sock->fec->flush_timer));
+  for (int i = 0; i < FEC_MAX_PENDING; ++i) {
+    free(sock->fec->pending[i]);
+  }
+  free(sock->fec);
+  sock->fec = NULL;
+}
+
+/**
+ * Moves the loss estimate by one segment, and the group size with it when
+ * adapting: about one loss in four groups.
+ */
+static void update_loss(struct fec_state *fec, int group, int lost) {
+  if (lost) {
+    fec->loss += (65536 - fec->loss) >> FEC_AUTO_GAIN;
+  } else {
+    fec->loss -= fec->loss >> FEC_AUTO_GAIN;
+  }
+  if (group != FEC_AUTO) return;
+  if (fec->loss < FEC_AUTO_OFF) {
+    fec->group = 0;
+  } else {
+    fec->group = MIN(MAX(16384 / fec->loss, 1), FEC_MAX_GROUP);
+  }
+}
+
+void fec_on_send(foggy_socket_t *sock, uint32_t n) {
+  struct fec_state *fec = sock->fec;
+  send_ring_t *ring = &(sock->send_window);
+  uint32_t i = send_ring_slot(ring, n);
+  uint16_t len = ring->len[i];
+
+  if (len == 0 || get_flags((foggy_tcp_header_t *)ring->msg[i]) != ACK_FLAG_MASK) {
+    return;  // only data, a FIN is never covered
+  }
+  if (ring->retx[i] > 0) return;
+  update_loss(fec, sock->fec_group, 0);
+
+  // A group is a contiguous range, resegmenting the window breaks it
+  if (fec->count > 0 && ring->seq[i] != fec->end) fec_flush(sock);
+  if (fec->group == 0) return;
+
+  if (fec->count == 0) {
+    fec->first = ring->seq[i];
+    fec->parity_len = 0;
+  }
+  if (len > fec->parity_len) {
+    memset(fec->parity + fec->parity_len, 0, len - fec->parity_len);
+    fec->parity_len = len;
+  }
+  xor_bytes(fec->parity, get_payload(ring->msg[i]), len);
+  fec->end = ring->seq[i] + len;
+  fec->count++;
+  if (fec->count >= fec->group || fec->end - fec->first >= FEC_MAX_GROUP_BYTES) {
+    fec_flush(sock);
+  } else if (!timer_pending(&(fec->flush_timer))) {
+    // Cover the tail of a burst too, if no more data comes to fill the group
+    uint64_t delay = MAX(sock->window.srtt / FEC_FLUSH_DIV, TIMER_TICK_US);
+    timer_arm(&(sock->timers), &(fec->flush_timer), get_time_us() + delay);
+  }
+}
+
+void fec_on_loss(foggy_socket_t *sock) {
+  update_loss(sock->fec, sock->fec_group, 1);
+}
+
+void fec_flush(foggy_socket_t *sock) {
+  struct fec_state *fec = sock->fec;
+  uint8_t value[9];
+  uint8_t ext[OPT_FEC_LEN];
+  uint32_t first = htonl(fec->first), end = htonl(fec->end);
+
+  timer_cancel(&(sock->timers), &(fec->flush_timer));
+  if (fec->count == 0) return;
+  memcpy(value, &first, sizeof(first));
+  memcpy(value + 4, &end, sizeof(end));
+  value[8] = fec->count;
+  uint16_t ext_len = put_option(ext, OPT_FEC, value, sizeof(value));
+  uint8_t *pkt = create_socket_packet(sock, fec->first,
+                                      sock->window.next_seq_expected,
+                                      ACK_FLAG_MASK, ext_len, ext,
+                                      fec->parity, fec->parity_len);
+  debug_printf("Sending parity of %d segments %u %u\n", fec->count,
+               fec->first, fec->end);
+  send_packet(sock, pkt);
+  free(pkt);
+  stat_add(&sock->stats.fec_parity_sent, 1);
+  fec->count = 0;
+}
+
+void fec_on_deliver(foggy_socket_t *sock, uint32_t seq, const uint8_t *data,
+                    uint16_t len) {
+  struct fec_state *fec = sock->fec;
+  uint32_t off = seq & HISTORY_MASK;
+  uint32_t part = MIN((uint32_t)len, FEC_HISTORY - off);
+
+  memcpy(fec->history + off, data, part);
+  memcpy(fec->history, data + part, len - part);
+  fec->delivered[fec->delivered_count & SEGS_MASK] = {seq, len};
+  fec->delivered_count++;
+}
+
+/**
+ * Finds a delivered segment that starts at `pos`, or ends there if `by_end`,
+ * by binary search over the boundaries kept, which are in sequence order.
+ */
+static int find_delivered(foggy_socket_t *sock, uint32_t pos, int by_end,
+                          fec_extent_t *out) {
+  struct fec_state *fec = sock->fec;
+  uint32_t count = MIN(fec->delivered_count, (uint32_t)FEC_HISTORY_SEGS);
+  uint32_t lo = fec->delivered_count - count, hi = fec->delivered_count;
+
+  // The bytes must still be in the history
+  if (sock->window.next_seq_expected - pos > FEC_HISTORY) return 0;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    fec_extent_t *e = &(fec->delivered[mid & SEGS_MASK]);
+    uint32_t key = by_end ? e->seq + e->len : e->seq;
+    if (key == pos) {
+      *out = *e;
+      return 1;
+    }
+    if (before(key, pos)) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Finds a segment of the stream that starts at `pos`, or ends there if
+ * `by_end`, and XORs its payload into the segment being rebuilt.
+ *
+ * @return Its extent, len 0 if it is not at hand.
+ */
+static fec_extent_t take_segment(foggy_socket_t *sock, uint32_t pos,
+                                 int by_end) {
+  struct fec_state *fec = sock->fec;
+  fec_extent_t e = {0, 0};
+
+  if (before(pos - (by_end ? 1 : 0), sock->window.next_seq_expected)) {
+    if (find_delivered(sock, pos, by_end, &e)) {
+      uint32_t off = e.seq & HISTORY_MASK;
+      uint32_t part = MIN(e.len, FEC_HISTORY - off);
+      xor_bytes(fec->buf, fec->history + off, part);
+      xor_bytes(fec->buf + part, fec->history, e.len - part);
+    }
+    return e;
+  }
+  for (int i = 0; i < sock->rcv_slots; ++i) {
+    receive_window_slot_t *slot = &(sock->receive_window[i]);
+    if (!slot->is_used) continue;
+    uint32_t seq = get_seq((foggy_tcp_header_t *)slot->msg);
+    uint16_t len = get_payload_len(slot->msg);
+    if ((by_end ? seq + len : seq) == pos) {
+      xor_bytes(fec->buf, get_payload(slot->msg), len);
+      e.seq = seq;
+      e.len = len;
+      break;
+    }
+  }
+  return e;
+}
+
+/**
+ * Tries to rebuild the segment missing from the group of a parity packet.
+ *
+ * @param rebuilt Incremented if a segment was rebuilt.
+ *
+ * @return 1 if the parity is of no more use, 0 if it has to wait for more of
+ *         the group.
+ */
+static int recover_group(foggy_socket_t *sock, uint8_t *parity, int *rebuilt) {
+  struct fec_state *fec = sock->fec;
+  uint8_t *opt = find_option(parity, OPT_FEC, NULL);
+  uint32_t first, end, pos, gap;
+  uint16_t parity_len = get_payload_len(parity);
+  int found = 0, count = opt[8];
+  fec_extent_t e = {0, 0};
+
+  memcpy(&first, opt, sizeof(first));
+  memcpy(&end, opt + 4, sizeof(end));
+  first = ntohl(first);
+  end = ntohl(end);
+  if (!after(end, sock->window.next_seq_expected)) return 1;  // all delivered
+
+  // Walk in from both ends of the group, what is left in the middle is the
+  // segment missing
+  memcpy(fec->buf, get_payload(parity), parity_len);
+  for (pos = first; pos != end && found < count; pos += e.len, found++) {
+    e = take_segment(sock, pos, 0);
+    if (e.len == 0 || e.len > parity_len) break;
+  }
+  if (pos == end) return 1;  // nothing missing
+  for (gap = pos, pos = end; after(pos, gap) && found < count;
+       pos = e.seq, found++) {
+    e = take_segment(sock, pos, 1);
+    if (e.len == 0 || e.len > parity_len) break;
+  }
+  if (found != count - 1 || !after(pos, gap) || pos - gap > parity_len) {
+    return 0;
+  }
+
+  debug_printf("Rebuilt segment %u %u from parity\n", gap, pos);
+  uint8_t *pkt = create_socket_packet(sock, gap, sock->window.last_byte_sent,
+                                      ACK_FLAG_MASK, 0, NULL, fec->buf,
+                                      pos - gap);
+  add_receive_window(sock, pkt);
+  free(pkt);
+  stat_add(&sock->stats.fec_recovered, 1);
+  (*rebuilt)++;
+  return 1;
+}
+
+int fec_recover(foggy_socket_t *sock) {
+  struct fec_state *fec = sock->fec;
+  int recovered = 0, progress = 1;
+
+  // A segment rebuilt may complete another group
+  while (progress) {
+    progress = 0;
+    for (int i = 0; i < FEC_MAX_PENDING; ++i) {
+      if (fec->pending[i] == NULL) continue;
+      int rebuilt = 0;
+      if (!recover_group(sock, fec->pending[i], &rebuilt)) continue;
+      free(fec->pending[i]);
+      fec->pending[i] = NULL;
+      if (rebuilt) {
+        process_receive_window(sock);
+        recovered++;
+        progress = 1;
+      }
+    }
+  }
+  return recovered;
+}
+
+int fec_on_recv(foggy_socket_t *sock, uint8_t *pkt) {
+  struct fec_state *fec = sock->fec;
+  uint8_t len = 0;
+  int slot = 0;
+
+  if (find_option(pkt, OPT_FEC, &len) == NULL) return 0;
+  if (fec == NULL || len != 9 || get_payload_len(pkt) == 0) return 1;
+
+  // Keep it in a free slot, or in place of the oldest group
+  for (int i = 0; i < FEC_MAX_PENDING; ++i) {
+    if (fec->pending[i] == NULL) {
+      slot = i;
+      break;
+    }
+    if (before(get_seq((foggy_tcp_header_t *)fec->pending[i]),
+               get_seq((foggy_tcp_header_t *)fec->pending[slot]))) {
+      slot = i;
+    }
+  }
+  free(fec->pending[slot]);
+  fec->pending[slot] = (uint8_t *)malloc(get_plen((foggy_tcp_header_t *)pkt));
+  memcpy(fec->pending[slot], pkt, get_plen((foggy_tcp_header_t *)pkt));
+
+  // Acknowledge at once what the rebuilt segments delivered, an ACK that
+  // brings nothing new would count as a duplicate
+  uint32_t next = sock->window.next_seq_expected;
+  if (fec_recover(sock) > 0 && sock->window.next_seq_expected != next) {
+    uint8_t *ack_pkt = create_socket_packet(
+        sock, sock->window.last_byte_sent, sock->window.next_seq_expected,
+        ACK_FLAG_MASK, 0, NULL, NULL, 0);
+    send_packet(sock, ack_pkt);
+    free(ack_pkt);
+  }
+  return 1;
+}
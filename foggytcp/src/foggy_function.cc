@@ -7,30 +7,183 @@ No part of the project may be copied and/or distributed without
 the express permission of the course staff. Everyone is prohibited 
 from releasing their forks in any public places. */
 
+#include <cmath>
 #include <deque>
 #include <cstdlib>
 #include <cstring>
 #include <cstdio>
+#include <errno.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
 
 #include "foggy_function.h"
 #include "foggy_backend.h"
+#include "foggy_compress.h"
+#include "foggy_crc32c.h"
+#include "foggy_fec.h"
+#include "foggy_mp.h"
+#include "foggy_option.h"
+#include "foggy_pmtu.h"
+#include "foggy_sockopt.h"
+#include "foggy_stream.h"
+#include "foggy_trace.h"
+#include "foggy_uring.h"
 
 
 #define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
 #define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
 
-#define DEBUG_PRINT 1
-#define debug_printf(fmt, ...)                            \
-  do {                                                    \
-    if (DEBUG_PRINT) fprintf(stdout, fmt, ##__VA_ARGS__); \
-  } while (0)
 
+/**
+ * A received header in host byte order, so the fast path converts each field
+ * only once.
+ */
+typedef struct {
+  uint32_t seq;
+  uint32_t ack;
+  uint16_t hlen;
+  uint16_t plen;
+  uint16_t adv;
+  uint8_t flags;
+} rx_header_t;
+
+static inline void parse_header(const uint8_t *pkt, rx_header_t *h) {
+  const foggy_tcp_header_t *hdr = (const foggy_tcp_header_t *)pkt;
+  h->seq = ntohl(hdr->seq_num);
+  h->ack = ntohl(hdr->ack_num);
+  h->hlen = ntohs(hdr->hlen);
+  h->plen = ntohs(hdr->plen);
+  h->adv = ntohs(hdr->advertised_window);
+  h->flags = hdr->flags;
+}
+
+void append_received(foggy_socket_t *sock, const uint8_t *data, int len,
+                     uint64_t arrival) {
+  sock->received_buf =
+      (uint8_t *)realloc(sock->received_buf, sock->received_len + len);
+  memcpy(sock->received_buf + sock->received_len, data, len);
+  sock->received_len += len;
+  sock->bytes_received += len;
+  sock->read_marks.push_back(make_pair(sock->bytes_received, arrival));
+}
+
+/**
+ * Hands on stream bytes delivered in order: to the FEC history, then to
+ * received_buf, through the decompressor if the connection is framed.
+ * Multiplexed streams took them on arrival already.
+ */
+static void deliver(foggy_socket_t *sock, uint32_t seq, const uint8_t *data,
+                    uint16_t len, uint64_t arrival) {
+  if (sock->streams != NULL) return;
+  if (sock->fec != NULL) fec_on_deliver(sock, seq, data, len);
+  if (sock->comp != NULL) {
+    compress_on_deliver(sock, data, len, arrival);
+  } else {
+    append_received(sock, data, len, arrival);
+  }
+}
+
+void send_ack(foggy_socket_t *sock) {
+  uint8_t *ack_pkt = create_socket_packet(sock, sock->window.last_byte_sent,
+                                          sock->window.next_seq_expected,
+                                          ACK_FLAG_MASK, 0, NULL, NULL, 0);
+  send_packet(sock, ack_pkt);
+  free(ack_pkt);
+  sock->ack_pending = 0;
+  timer_cancel(&(sock->timers), &(sock->delack_timer));
+}
+
+/**
+ * Acknowledges the data just received. With delayed ACKs an in-order segment
+ * waits for a second one or for the timer, anything else is ACKed at once so
+ * the sender hears of holes right away (RFC 5681 4.2). Multipath ACKs echo
+ * one packet each and are never delayed. Like Linux, the first segments of a
+ * connection and those after a delayed ACK timed out (the sender was waiting
+ * for it, e.g. with Nagle's algorithm) are ACKed at once.
+ *
+ * @param sock The socket.
+ * @param in_order The segment continued the stream with no gap behind it.
+ */
+static void ack_data(foggy_socket_t *sock, int in_order) {
+  if (sock->quickacks > 0) {
+    sock->quickacks--;
+  } else if (in_order && sock->opts.delack != 0 && sock->mp == NULL &&
+             ++sock->ack_pending < 2) {
+    if (!timer_pending(&(sock->delack_timer))) {
+      timer_arm(&(sock->timers), &(sock->delack_timer),
+                get_time_us() + sock->opts.delack);
+    }
+    return;
+  }
+  send_ack(sock);
+}
+
+void delack_timeout(void *arg) {
+  foggy_socket_t *sock = (foggy_socket_t *)arg;
+
+  if (sock->ack_pending > 0) {
+    send_ack(sock);
+    sock->quickacks = DELACK_QUICKACKS;
+  }
+}
+
+/**
+ * Header prediction: handles the two packets a bulk transfer is made of, the
+ * next in-sequence data segment and the pure ACK that moves the window
+ * forward, without going through the state machine of `on_recv_pkt`.
+ *
+ * Only established connections qualify, and only packets whose header holds
+ * nothing but the options every packet carries, so probes and anything else
+ * unusual take the general path.
+ *
+ * @param sock The socket the packet arrived on.
+ * @param pkt The packet, checksum already verified.
+ *
+ * @return 1 if the packet was handled, 0 if it needs the general path.
+ */
+static int receive_fast_path(foggy_socket_t *sock, uint8_t *pkt) {
+  window_t *win = &(sock->window);
+  rx_header_t h;
+
+  parse_header(pkt, &h);
+  if (h.flags != ACK_FLAG_MASK || sock->connected != 2 ||
+      h.hlen != sizeof(foggy_tcp_header_t) +
+                    ((sock->caps & CAP_CRC32C) ? OPT_CRC32C_LEN : 0) ||
+      h.plen < h.hlen) {
+    return 0;
+  }
+  uint16_t payload_len = h.plen - h.hlen;
+
+  if (payload_len == 0) {
+    // Pure ACK, only the one that acknowledges new data is predicted
+    if (!after(h.ack, win->last_ack_received)) return 0;
+    win->last_ack_received = h.ack;
+    win->dup_ack_count = 0;
+    win->advertised_window = (uint32_t)h.adv << sock->snd_wscale;
+    return 1;
+  }
+
+  // Data, only the segment we expect next with nothing waiting to be
+  // reassembled in front of it
+  if (h.seq != win->next_seq_expected || sock->receive_window_used > 0) {
+    return 0;
+  }
+  if (after(h.ack, win->last_ack_received)) {
+    win->last_ack_received = h.ack;
+    win->dup_ack_count = 0;
+  }
+  win->advertised_window = (uint32_t)h.adv << sock->snd_wscale;
+  win->next_seq_expected += payload_len;
+
+  deliver(sock, h.seq, pkt + h.hlen, payload_len, sock->rx_time);
+  ack_data(sock, 1);
+  return 1;
+}
 
 /**
  * Updates the socket information to represent the newly received packet.
  *
- * In the current stop-and-wait implementation, this function also sends an
- * acknowledgement for the packet.
+ * Data packets are acknowledged right away, or as delayed ACKs allow.
  *
  * @param sock The socket used for handling packets received.
  * @param pkt The packet data received by the socket.
@@ -39,83 +192,224 @@ void on_recv_pkt(foggy_socket_t *sock, uint8_t *pkt) {
   debug_printf("Received packet\n");
   foggy_tcp_header_t *hdr = (foggy_tcp_header_t *)pkt;
   uint8_t flags = get_flags(hdr);
+  FOGGY_TRACE_EVENT(TRACE_RECV, sock, get_seq(hdr), get_payload_len(pkt),
+                    flags);
+  if (receive_fast_path(sock, pkt)) {
+    return;
+  }
+  if (pmtu_on_recv(sock, pkt)) {
+    return;  // probes take no sequence space
+  }
+  if (fec_on_recv(sock, pkt)) {
+    return;  // parity neither
+  }
+  if (sock->mp != NULL && mp_on_recv(sock, pkt)) {
+    return;  // joins neither
+  }
+  if (sock->streams != NULL) {
+    stream_on_ack(sock, pkt);
+  }
   switch (flags) {
       case SYN_FLAG_MASK: {
           debug_printf("Receive SYN %d, sending Seq %d \n", get_seq(hdr), sock->window.last_byte_sent);
 
+          if (sock->connected == 2) {
+              // Our SYN-ACK got lost, the initiator is still waiting for it
+              send_syn_ack(sock);
+              break;
+          }
+          if (sock->connected == 0) {
+              sock->handshake_retries = 0;
+          }
+
           // Update next_seq_expected for the first connection
           sock->window.next_seq_expected = get_seq(hdr) + 1;
 
           sock->connected = 1; // inidcate first handshaking done
+          sock->window.last_ack_received = sock->window.last_byte_sent; // nothing sent yet
+          sock->iss = sock->window.last_byte_sent;
+
+          // Accept whichever of the requested capabilities we support
+          uint8_t *caps_opt = find_option(pkt, OPT_CAPS, NULL);
+          uint32_t caps = 0;
+          if (caps_opt != NULL) {
+              memcpy(&caps, caps_opt, sizeof(caps));
+              caps = ntohl(caps) &
+                     (CAP_CRC32C | CAP_MULTIPATH | CAP_FEC | CAP_COMPRESS |
+                      CAP_STREAMS);
+          }
+          if (caps & CAP_STREAMS) {
+              // Neither rebuilds nor frames the options of the segments
+              caps &= ~(CAP_FEC | CAP_COMPRESS);
+          }
+          sock->caps = caps;
+          pmtu_start(sock, pkt);
+          sockopt_start(sock, pkt);
+          if (caps & CAP_MULTIPATH) mp_start(sock);
+          if (caps & CAP_FEC) fec_start(sock);
+          if (caps & CAP_COMPRESS) compress_start(sock);
+          if (caps & CAP_STREAMS) stream_start(sock);
+
+          // Fast open: always answer with a cookie, and take the data on the
+          // SYN right away if the initiator already presented a valid one
+          uint8_t cookie_len = 0;
+          uint8_t *cookie = find_option(pkt, OPT_FASTOPEN, &cookie_len);
+          sock->send_cookie = sock->fastopen && cookie != NULL;
+          if (sock->send_cookie && get_payload_len(pkt) > 0 &&
+              fastopen_check_cookie(&(sock->conn), cookie, cookie_len)) {
+              uint16_t payload_len = get_payload_len(pkt);
+              debug_printf("Accepting %d bytes of fast open data\n", payload_len);
+              // Framing starts after it, the initiator could not know yet
+              if (sock->streams != NULL) {
+                  stream_on_data(sock, pkt, sock->rx_time);  // on stream 0
+              } else {
+                  append_received(sock, get_payload(pkt), payload_len,
+                                   sock->rx_time);
+              }
+              sock->window.next_seq_expected += payload_len;
+              sock->connected = 2; // the cookie vouches for the peer, no need to wait for the ACK
+          }
 
           // Send SYN-ACK
-          uint8_t *syn_ack_pkt = create_packet(
-              sock->my_port, ntohs(sock->conn.sin_port),
-              sock->window.last_byte_sent,  // Telling the client that we are ready to receive, and the initial seq number
-              get_seq(hdr) + 1,
-              sizeof(foggy_tcp_header_t), sizeof(foggy_tcp_header_t), SYN_FLAG_MASK | ACK_FLAG_MASK,
-              MAX(MAX_NETWORK_BUFFER - (uint32_t)sock->received_len, MSS), 0, NULL, NULL, 0);
-          sendto(sock->socket, syn_ack_pkt, sizeof(foggy_tcp_header_t), 0,
-                (struct sockaddr *)&(sock->conn), sizeof(sock->conn));
-          free(syn_ack_pkt);
+          send_syn_ack(sock);
           break;
       }
       case (SYN_FLAG_MASK | ACK_FLAG_MASK): {
           debug_printf("Receive SYN-ACK %d-%d, sending ACK %d \n", get_seq(hdr), get_ack(hdr), get_seq(hdr) + 1);
 
-          // Update next_seq_expected for the first connection
-          sock->window.next_seq_expected = get_seq(hdr) + 1;
-          sock->window.last_ack_received = get_ack(hdr); // update ack
+          if (sock->connected != 2) {
+              // Update next_seq_expected for the first connection
+              sock->window.next_seq_expected = get_seq(hdr) + 1;
+              sock->window.last_ack_received = get_ack(hdr); // update ack
+              // The first data may fill the window it offers right away
+              sock->window.advertised_window = sockopt_peer_window(sock, hdr);
 
-          sock->connected = 2; // handshaking done, initiater side only need to confirm once
+              uint8_t *caps_opt = find_option(pkt, OPT_CAPS, NULL);
+              uint32_t caps = 0;
+              if (caps_opt != NULL) {
+                  memcpy(&caps, caps_opt, sizeof(caps));
+                  caps = ntohl(caps) & sock->caps_wanted;
+              }
+              sock->caps = caps;
+              pmtu_start(sock, pkt);
+              sockopt_start(sock, pkt);
+              if (caps & CAP_MULTIPATH) mp_start(sock);
+              if (caps & CAP_FEC) fec_start(sock);
+              if (caps & CAP_COMPRESS) compress_start(sock);
 
-          // Adding any possible data to receive window
-          add_receive_window(sock, pkt);
-          process_receive_window(sock);
-        
-          // Send SYN-ACK
-          uint8_t *syn_ack_pkt = create_packet(
-              sock->my_port, ntohs(sock->conn.sin_port),
+              uint8_t cookie_len = 0;
+              uint8_t *cookie = find_option(pkt, OPT_FASTOPEN, &cookie_len);
+              if (sock->fastopen && cookie != NULL && cookie_len == FASTOPEN_COOKIE_LEN) {
+                  fastopen_put_cookie(&(sock->conn), cookie);
+              }
+
+              // The listener did not take the data on our fast open SYN (e.g.
+              // the cookie expired): send it again as a regular segment. The
+              // SYN is all the send window holds until we are connected.
+              send_ring_t *ring = &(sock->send_window);
+              if (!send_ring_empty(ring)) {
+                  uint8_t *syn = ring->msg[send_ring_slot(ring, ring->head)];
+                  uint16_t syn_len = get_payload_len(syn);
+                  if ((get_flags((foggy_tcp_header_t *)syn) & SYN_FLAG_MASK) &&
+                      syn_len > 0 &&
+                      get_ack(hdr) == get_seq((foggy_tcp_header_t *)syn) + 1) {
+                      if (caps & (CAP_COMPRESS | CAP_STREAMS)) {
+                          // It is framed like the rest now: put it back in
+                          // front of what is still to be sent, and take its
+                          // sequence numbers back
+                          while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+                          }
+                          sock->sending_buf = (uint8_t *)realloc(
+                              sock->sending_buf, sock->sending_len + syn_len);
+                          memmove(sock->sending_buf + syn_len,
+                                  sock->sending_buf, sock->sending_len);
+                          memcpy(sock->sending_buf, get_payload(syn), syn_len);
+                          sock->sending_len += syn_len;
+                          pthread_mutex_unlock(&(sock->send_lock));
+                          sock->window.last_byte_sent = get_ack(hdr);
+                      } else {
+                          uint8_t *msg = create_socket_packet(
+                              sock, get_ack(hdr), sock->window.next_seq_expected,
+                              ACK_FLAG_MASK, 0, NULL, get_payload(syn), syn_len);
+                          send_ring_push(ring, msg, get_ack(hdr), syn_len);
+                      }
+                  }
+              }
+
+              // Stream 0 goes on from what the SYN delivered
+              if (caps & CAP_STREAMS) stream_start(sock);
+
+              sock->connected = 2; // handshaking done, initiater side only need to confirm once
+
+              // Adding any possible data to receive window
+              add_receive_window(sock, pkt);
+              process_receive_window(sock);
+          }
+
+          // Send ACK, also when the SYN-ACK is a retransmission because our
+          // ACK got lost
+          uint8_t *syn_ack_pkt = create_socket_packet(
+              sock,
               sock->window.last_byte_sent,  // Telling the client that we are ready to receive, and the initial seq number
-              get_seq(hdr) + 1,
-              sizeof(foggy_tcp_header_t), sizeof(foggy_tcp_header_t), ACK_FLAG_MASK,
-              MAX(MAX_NETWORK_BUFFER - (uint32_t)sock->received_len, MSS), 0, NULL, NULL, 0);
-          sendto(sock->socket, syn_ack_pkt, sizeof(foggy_tcp_header_t), 0,
-                (struct sockaddr *)&(sock->conn), sizeof(sock->conn));
+              sock->window.next_seq_expected, ACK_FLAG_MASK, 0, NULL, NULL, 0);
+          send_packet(sock, syn_ack_pkt);
           free(syn_ack_pkt);
           break;
       }
       case FIN_FLAG_MASK: {
-          debug_printf("Receive FIN\n");
-          // Send FIN-ACK
-          uint8_t *fin_ack_pkt = create_packet(
-              sock->my_port, ntohs(sock->conn.sin_port),
-              sock->window.last_byte_sent,  // Telling the client that we are ready to receive, and the initial seq number
-              get_seq(hdr) + 1,
-              sizeof(foggy_tcp_header_t), sizeof(foggy_tcp_header_t), FIN_FLAG_MASK | ACK_FLAG_MASK,
-              MAX(MAX_NETWORK_BUFFER - (uint32_t)sock->received_len, MSS), 0, NULL, NULL, 0);
-          sendto(sock->socket, fin_ack_pkt, sizeof(foggy_tcp_header_t), 0,
-                (struct sockaddr *)&(sock->conn), sizeof(sock->conn));
-          free(fin_ack_pkt);
+          debug_printf("Receive FIN %d\n", get_seq(hdr));
+          // A FIN also acknowledges what the peer received, including our FIN
+          if (after(get_ack(hdr), sock->window.last_ack_received)) {
+              sock->window.last_ack_received = get_ack(hdr);
+          }
+          // Only take the FIN once all the data before it has arrived
+          if (!sock->peer_fin && get_seq(hdr) == sock->window.next_seq_expected) {
+              sock->window.next_seq_expected++;  // the FIN takes one seq
+              sock->peer_fin = 1;  // readers get EOF once received_buf drains
+              sock->peer_fin_first = !sock->fin_sent;
+          }
+          // A FIN ahead of the data is not taken, its echo would say it was
+          if (!sock->peer_fin && sock->mp != NULL) mp_discard_echo(sock);
 
-          // TODO: Implement the logic to close the connection
+          // Send FIN-ACK, or a plain ACK asking for the missing data
+          uint8_t *fin_ack_pkt = create_socket_packet(
+              sock, sock->window.last_byte_sent, sock->window.next_seq_expected,
+              sock->peer_fin ? FIN_FLAG_MASK | ACK_FLAG_MASK : ACK_FLAG_MASK,
+              0, NULL, NULL, 0);
+          send_packet(sock, fin_ack_pkt);
+          free(fin_ack_pkt);
+          sock->ack_pending = 0;  // it covers a delayed ACK too
+          timer_cancel(&(sock->timers), &(sock->delack_timer));
           break;
       }
+      case (FIN_FLAG_MASK | ACK_FLAG_MASK):  // the ACK of our FIN
       case ACK_FLAG_MASK: {
           uint32_t ack = get_ack(hdr);
           debug_printf("Receive ACK %d\n", ack);
 
-          // TODO: change here to implement sliding window
-
-          // if (get_payload_len(pkt) == 0) handle_congestion_window(sock, pkt);
-          sock->window.advertised_window = get_advertised_window(hdr);
+          uint32_t adv = sockopt_peer_window(sock, hdr);
 
           if (after(ack, sock->window.last_ack_received)) {
               sock->window.last_ack_received = ack;
+              sock->window.dup_ack_count = 0;
+          } else if (ack == sock->window.last_ack_received &&
+                     get_payload_len(pkt) == 0 &&
+                     adv == sock->window.advertised_window &&
+                     !send_ring_empty(&(sock->send_window))) {
+              // Same ACK, no data and no window update while data is out
+              sock->window.dup_ack_count++;
+              stat_add(&sock->stats.dup_acks, 1);
+              if (sock->window.dup_ack_count == 1 && sock->fec != NULL) {
+                  fec_on_loss(sock);  // a new hole
+              }
           }
+          sock->window.advertised_window = adv;
 
           if(sock->connected == 1) {
               sock->connected = 2; // connection established
+              if (sock->handshake_retries == 0) {
+                  update_rtt(sock, get_time_us() - sock->handshake_sent);
+              }
           }
       } 
       // Fallthrough
@@ -124,22 +418,20 @@ void on_recv_pkt(foggy_socket_t *sock, uint8_t *pkt) {
               debug_printf("Received data packet %d %d\n", get_seq(hdr),
                           get_seq(hdr) + get_payload_len(pkt));
 
-              sock->window.advertised_window = get_advertised_window(hdr);
+              sock->window.advertised_window = sockopt_peer_window(sock, hdr);
+              uint32_t expected = sock->window.next_seq_expected;
+              int gap = sock->receive_window_used > 0;
               // Add the packet to receive window and process receive window
-              add_receive_window(sock, pkt); 
+              if (!add_receive_window(sock, pkt) && sock->mp != NULL) {
+                  mp_discard_echo(sock);  // the sender has to send it again
+              }
               process_receive_window(sock);
+              if (sock->fec != NULL) fec_recover(sock);  // it may fill a hole
               // Send ACK
               debug_printf("Sending ACK packet %d\n", sock->window.next_seq_expected);
-
-              uint8_t *ack_pkt = create_packet(
-                  sock->my_port, ntohs(sock->conn.sin_port),
-                  sock->window.last_byte_sent, sock->window.next_seq_expected,
-                  sizeof(foggy_tcp_header_t), sizeof(foggy_tcp_header_t), ACK_FLAG_MASK,
-                  MAX(MAX_NETWORK_BUFFER - (uint32_t)sock->received_len, MSS), 0,
-                  NULL, NULL, 0);
-              sendto(sock->socket, ack_pkt, sizeof(foggy_tcp_header_t), 0,
-                    (struct sockaddr *)&(sock->conn), sizeof(sock->conn));
-              free(ack_pkt);
+              ack_data(sock, !gap && sock->receive_window_used == 0 &&
+                                 after(sock->window.next_seq_expected,
+                                       expected));
           }
           break;
       }
@@ -149,10 +441,17 @@ void on_recv_pkt(foggy_socket_t *sock, uint8_t *pkt) {
 
 
 
+int segment_payload(foggy_socket_t *sock) {
+  // Parity packets carry OPT_FEC on top of a full payload
+  return sock->mss - ((sock->caps & CAP_CRC32C) ? OPT_CRC32C_LEN : 0) -
+         (sock->mp != NULL ? OPT_SUBFLOW_LEN : 0) -
+         (sock->fec != NULL && sock->fec_group != 0 ? OPT_FEC_LEN : 0) -
+         (sock->streams != NULL ? OPT_STREAM_LEN : 0);
+}
+
 /**
- * Breaks up the data into packets and sends a single packet at a time.
- *
- * You should most certainly update this function in your implementation.
+ * Breaks up the data into segments, queues them in the send window and
+ * sends as many as the congestion and advertised windows allow.
  *
  * @param sock The socket to use for sending data.
  * @param data The data to be sent.
@@ -160,106 +459,727 @@ void on_recv_pkt(foggy_socket_t *sock, uint8_t *pkt) {
  */
 void send_pkts(foggy_socket_t *sock, uint8_t *data, int buf_len) {
   uint8_t *data_offset = data;
-  transmit_send_window(sock);
+  int max_payload = segment_payload(sock);
 
   if (buf_len > 0) {
     while (buf_len != 0) {
-      uint16_t payload_len = MIN(buf_len, (int)MSS);
-
-      send_window_slot_t slot;
-      slot.is_sent = 0;
-      slot.msg = create_packet(
-          sock->my_port, ntohs(sock->conn.sin_port),
-          sock->window.last_byte_sent, sock->window.next_seq_expected,
-          sizeof(foggy_tcp_header_t), sizeof(foggy_tcp_header_t) + payload_len,
-          ACK_FLAG_MASK,
-          MAX(MAX_NETWORK_BUFFER - (uint32_t)sock->received_len, MSS), 0, NULL,
-          data_offset, payload_len);
-      sock->send_window.push_back(slot);
+      uint16_t payload_len = MIN(buf_len, max_payload);
+
+      uint8_t *msg = create_socket_packet(
+          sock, sock->window.last_byte_sent, sock->window.next_seq_expected,
+          ACK_FLAG_MASK, 0, NULL, data_offset, payload_len);
+      send_ring_push(&(sock->send_window), msg, sock->window.last_byte_sent,
+                     payload_len);
+      note_segment(sock, sock->window.last_byte_sent, payload_len);
 
       buf_len -= payload_len;
       data_offset += payload_len;
       sock->window.last_byte_sent += payload_len;
     }
   }
+  // The backend sleeps between calls, so pop the ACKed slots before
+  // transmitting or the next slot would wait for an unrelated wakeup.
   receive_send_window(sock);
+  transmit_send_window(sock);
+}
+
+int hold_partial(foggy_socket_t *sock, uint32_t len) {
+  if (len == 0 || len >= (uint32_t)segment_payload(sock)) return 0;
+  if (sock->push || sock->write_shutdown) {
+    sock->push = 0;
+    return 0;
+  }
+  switch (sock->coalesce) {
+    case FOGGY_NODELAY:
+      return 0;
+    case FOGGY_CORK:
+      if (sock->cork_expired) {
+        sock->cork_expired = 0;
+        return 0;
+      }
+      if (!timer_pending(&(sock->cork_timer))) {
+        timer_arm(&(sock->timers), &(sock->cork_timer),
+                  get_time_us() + CORK_TIMEOUT);
+      }
+      return 1;
+    default:
+      if (sock->small_pending &&
+          !after(sock->small_end, sock->window.last_ack_received)) {
+        sock->small_pending = 0;
+      }
+      return sock->small_pending;
+  }
+}
+
+void note_segment(foggy_socket_t *sock, uint32_t seq, uint16_t len) {
+  // Whatever was corked went out with it
+  timer_cancel(&(sock->timers), &(sock->cork_timer));
+  sock->cork_expired = 0;
+  if (len < segment_payload(sock)) {
+    sock->small_pending = 1;
+    sock->small_end = seq + len;
+  }
+}
+
+void cork_timeout(void *arg) {
+  ((foggy_socket_t *)arg)->cork_expired = 1;
+}
+
+
+uint8_t *create_socket_packet(foggy_socket_t *sock, uint32_t seq, uint32_t ack,
+                              uint8_t flags, uint16_t ext_len,
+                              const uint8_t *ext_data, const uint8_t *payload,
+                              uint16_t payload_len) {
+  uint8_t ext[UINT8_MAX];
+  uint32_t crc = 0;
+
+  memcpy(ext, ext_data, ext_len);
+  if (sock->streams != NULL && payload_len == 0 && flags == ACK_FLAG_MASK) {
+    ext_len += stream_put_window(sock, ext + ext_len);
+  }
+  if (sock->caps & CAP_CRC32C) {
+    ext_len += put_option(ext + ext_len, OPT_CRC32C, &crc, sizeof(crc));
+  }
+  return create_packet_ext(sock->my_port, ntohs(sock->conn.sin_port), seq, ack,
+                           flags, sockopt_advertise(sock, flags), ext_len, ext,
+                           payload, payload_len);
+}
+
+/**
+ * Fills in the checksum of a packet about to leave and accounts for it.
+ */
+static void seal_packet(foggy_socket_t *sock, uint8_t *pkt) {
+  foggy_tcp_header_t *hdr = (foggy_tcp_header_t *)pkt;
+  uint8_t *crc_opt = find_option(pkt, OPT_CRC32C, NULL);
+
+  if (crc_opt != NULL) {
+    // The checksum covers the whole packet with the CRC value zeroed
+    uint32_t crc = 0;
+    memcpy(crc_opt, &crc, sizeof(crc));
+    crc = htonl(crc32c(0, pkt, get_plen(hdr)));
+    memcpy(crc_opt, &crc, sizeof(crc));
+  }
+  FOGGY_TRACE_EVENT(TRACE_SEND, sock, get_seq(hdr), get_payload_len(pkt),
+                    get_flags(hdr));
+  stat_add(&sock->stats.segs_sent, 1);
+  stat_add(&sock->stats.bytes_sent, get_payload_len(pkt));
+}
+
+void send_packet(foggy_socket_t *sock, uint8_t *pkt) {
+  if (sock->mp != NULL) {
+    mp_send_packet(sock, pkt);  // picks the subflow
+    return;
+  }
+  send_packet_to(sock, pkt, sock->socket, &(sock->conn), sock->netem);
+}
+
+void send_packet_to(foggy_socket_t *sock, uint8_t *pkt, int fd,
+                    const struct sockaddr_in *addr, netem_link_t *netem) {
+  foggy_tcp_header_t *hdr = (foggy_tcp_header_t *)pkt;
+
+  seal_packet(sock, pkt);
+  if (netem != NULL) {
+    netem_send(netem, fd, addr, pkt, get_plen(hdr));
+  } else if (sock->uring == NULL ||
+             uring_send(sock, fd, addr, pkt, get_plen(hdr)) < 0) {
+    stat_add(&sock->stats.syscalls, 1);
+    sendto(fd, pkt, get_plen(hdr), 0, (const struct sockaddr *)addr,
+           sizeof(*addr));
+  }
+}
+
+/**
+ * Sends a run of packets as one GSO datagram.
+ *
+ * @return 0 on success, -1 if the kernel does not support GSO.
+ */
+static int send_gso(foggy_socket_t *sock, uint8_t **pkts, int n,
+                    uint16_t seg_size) {
+  struct iovec iov[GSO_MAX_SEGMENTS];
+  char control[CMSG_SPACE(sizeof(uint16_t))];
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+
+  for (int i = 0; i < n; ++i) {
+    iov[i].iov_base = pkts[i];
+    iov[i].iov_len = get_plen((foggy_tcp_header_t *)pkts[i]);
+  }
+  memset(&msg, 0, sizeof(msg));
+  memset(control, 0, sizeof(control));
+  msg.msg_name = &(sock->conn);
+  msg.msg_namelen = sizeof(sock->conn);
+  msg.msg_iov = iov;
+  msg.msg_iovlen = n;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_UDP;
+  cmsg->cmsg_type = UDP_SEGMENT;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+  memcpy(CMSG_DATA(cmsg), &seg_size, sizeof(seg_size));
+
+  stat_add(&sock->stats.syscalls, 1);
+  if (sendmsg(sock->socket, &msg, 0) < 0 &&
+      (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT ||
+       errno == EOPNOTSUPP)) {
+    return -1;
+  }
+  return 0;  // other errors are losses, the RTO recovers from them
+}
+
+void send_packets(foggy_socket_t *sock, uint8_t **pkts, int n) {
+  int i = 0, j;
+
+  // The emulator works packet by packet, the ring batches on its own
+  if (!sock->gso || sock->netem != NULL || sock->uring != NULL) {
+    for (i = 0; i < n; ++i) {
+      send_packet(sock, pkts[i]);
+    }
+    return;
+  }
+
+  while (i < n) {
+    uint16_t seg_size = get_plen((foggy_tcp_header_t *)pkts[i]);
+    uint32_t total = seg_size;
+
+    // Extend the run with packets of the same size, and one shorter packet
+    for (j = i + 1; j < n && j - i < GSO_MAX_SEGMENTS; ++j) {
+      uint16_t plen = get_plen((foggy_tcp_header_t *)pkts[j]);
+      if (plen > seg_size || total + plen > GSO_MAX_BYTES) break;
+      total += plen;
+      if (plen < seg_size) {
+        ++j;
+        break;
+      }
+    }
+    for (int k = i; k < j; ++k) {
+      seal_packet(sock, pkts[k]);
+    }
+    if (j - i == 1 || send_gso(sock, pkts + i, j - i, seg_size) < 0) {
+      if (j - i > 1) {
+        debug_printf("UDP GSO unsupported, sending segments one by one\n");
+        sock->gso = 0;
+      }
+      for (int k = i; k < j; ++k) {
+        stat_add(&sock->stats.syscalls, 1);
+        sendto(sock->socket, pkts[k], get_plen((foggy_tcp_header_t *)pkts[k]),
+               0, (struct sockaddr *)&(sock->conn), sizeof(sock->conn));
+      }
+    }
+    i = j;
+  }
 }
 
+int verify_checksum(foggy_socket_t *sock, uint8_t *pkt) {
+  foggy_tcp_header_t *hdr = (foggy_tcp_header_t *)pkt;
+  uint8_t *crc_opt = find_option(pkt, OPT_CRC32C, NULL);
+  uint32_t expected, zero = 0;
 
-void add_receive_window(foggy_socket_t *sock, uint8_t *pkt) {
+  if (crc_opt == NULL) {
+    return !(sock->caps & CAP_CRC32C) || (get_flags(hdr) & SYN_FLAG_MASK);
+  }
+  memcpy(&expected, crc_opt, sizeof(expected));
+  memcpy(crc_opt, &zero, sizeof(zero));
+  if (crc32c(0, pkt, get_plen(hdr)) != ntohl(expected)) {
+    debug_printf("Dropping packet %d with bad CRC32C\n", get_seq(hdr));
+    return 0;
+  }
+  memcpy(crc_opt, &expected, sizeof(expected));
+  return 1;
+}
+
+int add_receive_window(foggy_socket_t *sock, uint8_t *pkt) {
   foggy_tcp_header_t *hdr = (foggy_tcp_header_t *)pkt;
+  uint32_t seq = get_seq(hdr), next = sock->window.next_seq_expected;
+  uint16_t payload_len = get_payload_len(pkt);
+  receive_window_slot_t *free_slot = NULL;
+  int seen = 0;
 
-  // Stop-and-wait implementation
-  // Insert the packet into the first place of receive window
-  receive_window_slot_t *cur_slot = &(sock->receive_window[0]);
-  if (cur_slot->is_used == 0) {
-    cur_slot->is_used = 1;
-    cur_slot->msg = (uint8_t*) malloc(get_plen(hdr));
-    memcpy(cur_slot->msg, pkt, get_plen(hdr));
+  // Drop what brings nothing new, e.g. a retransmission whose ACK got lost,
+  // and what lies beyond anything we advertised
+  if (payload_len == 0 || !after(seq + payload_len, next)) {
+    return 1;
   }
+  if (after(seq, next + sock->opts.rcvbuf)) {
+    return 0;
+  }
+  if (after(seq, next)) {
+    stat_add(&sock->stats.ooo_segments, 1);
+  }
+  // Stop once every buffered segment was seen and a free slot found
+  for (int i = 0; i < sock->rcv_slots &&
+                  (seen < sock->receive_window_used || free_slot == NULL);
+       ++i) {
+    receive_window_slot_t *slot = &(sock->receive_window[i]);
+    if (!slot->is_used) {
+      if (free_slot == NULL) free_slot = slot;
+      continue;
+    }
+    seen++;
+    if (get_seq((foggy_tcp_header_t *)slot->msg) == seq) {
+      return 1;  // already buffered
+    }
+  }
+  if (free_slot == NULL) return 0;  // full, the sender retransmits it later
+  if (sock->streams != NULL && !stream_on_data(sock, pkt, sock->rx_time)) {
+    return 0;  // neither has its stream room for it
+  }
+
+  free_slot->is_used = 1;
+  free_slot->arrival = sock->rx_time;
+  free_slot->msg = (uint8_t*) malloc(get_plen(hdr));
+  memcpy(free_slot->msg, pkt, get_plen(hdr));
+  sock->receive_window_used++;
+  return 1;
 }
 
 void process_receive_window(foggy_socket_t *sock) {
-  // Stop-and-wait implementation.
-  // Only process the first packet in the window.
-  receive_window_slot_t *cur_slot = &(sock->receive_window[0]);
-  if (cur_slot->is_used != 0) {
-    foggy_tcp_header_t *hdr = (foggy_tcp_header_t *)cur_slot->msg;
-    // Discard unexpected packet
-    if (get_seq(hdr) != sock->window.next_seq_expected) return;
-    // Update next seq number expected
-    uint16_t payload_len = get_payload_len(cur_slot->msg);
-    sock->window.next_seq_expected += payload_len;
-    // Copy to received_buf
-    sock->received_buf = (uint8_t*)
-        realloc(sock->received_buf, sock->received_len + payload_len);
-    memcpy(sock->received_buf + sock->received_len, get_payload(cur_slot->msg),
-           payload_len);
-    sock->received_len += payload_len;
-    // Free the slot
-    cur_slot->is_used = 0;
-    free(cur_slot->msg);
-    cur_slot->msg = NULL;
-  }
-}
-
-//TODO: implement sliding window
+  int progress = 1;
+
+  // Deliver the buffered segments that continue the stream, in order. A
+  // segment may overlap what was delivered already (e.g. after the sender
+  // resegmented), only its new bytes are taken.
+  while (progress && sock->receive_window_used > 0) {
+    int left = sock->receive_window_used;
+    progress = 0;
+    for (int i = 0; i < sock->rcv_slots && left > 0; ++i) {
+      receive_window_slot_t *slot = &(sock->receive_window[i]);
+      if (!slot->is_used) continue;
+      left--;
+
+      uint32_t seq = get_seq((foggy_tcp_header_t *)slot->msg);
+      uint32_t next = sock->window.next_seq_expected;
+      uint16_t payload_len = get_payload_len(slot->msg);
+      if (after(seq, next)) continue;  // there is still a hole before it
+
+      if (after(seq + payload_len, next)) {
+        uint16_t offset = next - seq, len = payload_len - offset;
+        deliver(sock, next, get_payload(slot->msg) + offset, len,
+                slot->arrival);
+        sock->window.next_seq_expected += len;
+        progress = 1;
+      }
+      slot->is_used = 0;
+      free(slot->msg);
+      slot->msg = NULL;
+      sock->receive_window_used--;
+    }
+  }
+}
+
+
+static uint64_t timespec_to_us(const struct timespec *ts) {
+  return (uint64_t)ts->tv_sec * 1000000 + ts->tv_nsec / 1000;
+}
+
+uint64_t get_time_us() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return timespec_to_us(&now);
+}
+
+void update_rtt(foggy_socket_t *sock, uint64_t sample) {
+  window_t *win = &(sock->window);
+
+  sample = MAX(sample, 1);
+  if (win->srtt == 0) {
+    win->srtt = sample;
+    win->rttvar = sample / 2;
+  } else {
+    uint64_t delta = win->srtt > sample ? win->srtt - sample : sample - win->srtt;
+    win->rttvar = (3 * (uint64_t)win->rttvar + delta) / 4;
+    win->srtt = (7 * (uint64_t)win->srtt + sample) / 8;
+  }
+  win->rto = MIN(MAX(win->srtt + MAX(4 * win->rttvar, 1000), sock->opts.rto_min),
+                 sock->opts.rto_max);
+}
+
+/**
+ * Splits the segments that no longer fit the path into segments of the
+ * current MSS and rewinds the window, so everything is sent again.
+ *
+ * Only called once the path MTU went down, when all that is outstanding was
+ * lost anyway.
+ *
+ * @param sock The socket whose send window to update.
+ */
+static void resegment_window(foggy_socket_t *sock) {
+  send_ring_t *ring = &(sock->send_window);
+  int max_payload = segment_payload(sock);
+  uint32_t count = ring->tail - ring->head;
+
+  // Every segment goes from the front to the back, the order is kept
+  for (uint32_t k = 0; k < count; ++k) {
+    uint8_t *msg = send_ring_pop(ring);
+    foggy_tcp_header_t *hdr = (foggy_tcp_header_t *)msg;
+    uint16_t payload_len = get_payload_len(msg);
+
+    if (get_flags(hdr) != ACK_FLAG_MASK || payload_len <= max_payload) {
+      send_ring_push(ring, msg, get_seq(hdr), payload_len);
+      continue;
+    }
+    for (int off = 0; off < payload_len; off += max_payload) {
+      uint16_t len = MIN(max_payload, payload_len - off);
+      uint8_t ext[OPT_STREAM_LEN];
+      uint16_t ext_len = stream_split_option(msg, off, len, ext);
+      send_ring_push(ring,
+                     create_socket_packet(sock, get_seq(hdr) + off,
+                                          get_ack(hdr), ACK_FLAG_MASK, ext_len,
+                                          ext, get_payload(msg) + off, len),
+                     get_seq(hdr) + off, len);
+    }
+    free(msg);
+  }
+  ring->next = ring->head;
+}
+
+uint8_t *stamp_segment(foggy_socket_t *sock, uint32_t n, uint64_t now) {
+  send_ring_t *ring = &(sock->send_window);
+  uint32_t i = send_ring_slot(ring, n);
+
+  if (ring->send_time[i] != 0) {
+    ring->retx[i]++;
+    FOGGY_TRACE_EVENT(TRACE_RETRANSMIT, sock, ring->seq[i], ring->len[i],
+                      get_flags((foggy_tcp_header_t *)ring->msg[i]));
+    stat_add(&sock->stats.segs_retrans, 1);
+    stat_add(&sock->stats.bytes_retrans, ring->len[i]);
+  }
+  ring->send_time[i] = now;
+  return ring->msg[i];
+}
+
+/**
+ * Resends the oldest outstanding segment right away (fast retransmit).
+ */
+static void retransmit_head(foggy_socket_t *sock, uint64_t now) {
+  send_ring_t *ring = &(sock->send_window);
+
+  debug_printf("Fast retransmit %d\n", ring->seq[send_ring_slot(ring, ring->head)]);
+  send_packet(sock, stamp_segment(sock, ring->head, now));
+}
+
+/**
+ * Returns the slow start threshold after a loss. CUBIC also remembers the
+ * window the loss happened at and starts a new epoch of growth.
+ */
+static uint32_t loss_ssthresh(foggy_socket_t *sock) {
+  window_t *win = &(sock->window);
+  uint32_t in_flight = send_ring_in_flight(&(sock->send_window));
+  uint32_t mss = sock->mss;
+
+  if (sock->opts.congestion != FOGGY_CC_CUBIC) {
+    return MAX(in_flight / 2, 2 * mss);
+  }
+  // Fast convergence: a flow that lost below its last maximum makes room
+  win->w_max = in_flight < win->w_max
+                   ? (uint32_t)(in_flight * (1 + CUBIC_BETA) / 2)
+                   : in_flight;
+  win->epoch = 0;
+  return MAX((uint32_t)(in_flight * CUBIC_BETA), 2 * mss);
+}
+
+void retransmission_timeout(void *arg) {
+  foggy_socket_t *sock = (foggy_socket_t *)arg;
+  send_ring_t *ring = &(sock->send_window);
+  window_t *win = &(sock->window);
+
+  if (ring->next == ring->head) return;  // nothing outstanding
+
+  // Everything outstanding is taken as lost: back off the timer and slow start
+  // again from the oldest segment. The receiver drops whatever it already has.
+  uint8_t *head = ring->msg[send_ring_slot(ring, ring->head)];
+  debug_printf("Retransmission timeout at %d\n",
+               get_seq((foggy_tcp_header_t *)head));
+  win->ssthresh = loss_ssthresh(sock);
+  win->congestion_window = sock->mss;
+  win->reno_state = RENO_SLOW_START;
+  win->dup_ack_count = 0;
+  win->rto = MIN(win->rto * 2, sock->opts.rto_max);
+  sock->rto_retries++;
+  ring->next = ring->head;
+  if (sock->fec != NULL) fec_on_loss(sock);
+
+  // A segment that keeps timing out may be too large for the path
+  pmtu_on_rto(sock, get_plen((foggy_tcp_header_t *)head));
+  if (get_plen((foggy_tcp_header_t *)head) > sock->pmtu.plpmtu) {
+    resegment_window(sock);
+  }
+  timer_arm(&(sock->timers), &(sock->rto_timer), get_time_us() + win->rto);
+  transmit_send_window(sock);
+}
+
+/**
+ * Returns how long a segment holds back the next one when pacing, so that
+ * the window goes out over one smoothed RTT (a bit faster, to let it grow).
+ */
+static uint64_t pace_interval(foggy_socket_t *sock, uint16_t len) {
+  window_t *win = &(sock->window);
+  uint64_t ratio = win->reno_state == RENO_SLOW_START ? PACING_SS_RATIO
+                                                      : PACING_CA_RATIO;
+
+  return (uint64_t)len * win->srtt * 100 / (win->congestion_window * ratio);
+}
+
+void pace_timeout(void *arg) {
+  transmit_send_window((foggy_socket_t *)arg);
+}
 
 void transmit_send_window(foggy_socket_t *sock) {
-  if (sock->send_window.empty()) return;
-
-  // An stop-and-wait implementation. 
-  // For the first slot:
-  // If it has not been sent, send it.
-  // If it has been sent but not ACKed, skip.
-  send_window_slot_t& slot = sock->send_window.front();
-  foggy_tcp_header_t *hdr = (foggy_tcp_header_t *)slot.msg;
-  if (slot.is_sent){
+  send_ring_t *ring = &(sock->send_window);
+  window_t *win = &(sock->window);
+  uint8_t *batch[GSO_MAX_SEGMENTS];
+  uint64_t now;
+  int n, paced;
+
+  if (send_ring_empty(ring)) return;
+  if (sock->mp != NULL) {
+    mp_transmit(sock);
     return;
+  }
+  now = get_time_us();
+
+  // Pacing needs an RTT, and saves no credit beyond a timer tick while idle
+  paced = sock->opts.pacing && win->srtt != 0;
+  if (paced) {
+    sock->pace_next = MAX(sock->pace_next, now - TIMER_TICK_US);
+  }
+
+  // Send what the window has room for, in batches
+  uint32_t window = MIN(win->congestion_window, win->advertised_window);
+  uint32_t in_flight = send_ring_in_flight(ring);
+  do {
+    n = 0;
+    while (ring->next != ring->tail && n < GSO_MAX_SEGMENTS) {
+      uint16_t len = ring->len[send_ring_slot(ring, ring->next)];
+      // Always allow one segment, or a window below the MSS would stall
+      if (in_flight > 0 && in_flight + len > window) break;
+      if (paced && sock->pace_next > now) {
+        if (!timer_pending(&(sock->pace_timer))) {
+          timer_arm(&(sock->timers), &(sock->pace_timer), sock->pace_next);
+        }
+        break;
+      }
+      if (paced) {
+        sock->pace_next += pace_interval(sock, len);
+      }
+
+      debug_printf("Sending packet %d %d\n",
+                   ring->seq[send_ring_slot(ring, ring->next)],
+                   ring->seq[send_ring_slot(ring, ring->next)] + len);
+      batch[n++] = stamp_segment(sock, ring->next++, now);
+      in_flight += len;
+    }
+    if (n > 0) {
+      send_packets(sock, batch, n);
+      // Parity follows the segments it covers
+      for (int k = 0; sock->fec != NULL && k < n; ++k) {
+        fec_on_send(sock, ring->next - n + k);
+      }
+      if (!timer_pending(&(sock->rto_timer))) {
+        timer_arm(&(sock->timers), &(sock->rto_timer), now + win->rto);
+      }
+    }
+  } while (n == GSO_MAX_SEGMENTS);
+}
+
+/**
+ * Grows the window in congestion avoidance along the cubic curve of RFC 9438
+ * that climbs back to w_max, or as fast as Reno would where that is faster.
+ *
+ * @param sock The socket.
+ * @param acked_bytes The bytes newly acknowledged.
+ * @param now The current time in us.
+ */
+static void cubic_increase(foggy_socket_t *sock, uint32_t acked_bytes,
+                           uint64_t now) {
+  window_t *win = &(sock->window);
+  double mss = sock->mss, cwnd = win->congestion_window, t, target;
+
+  if (win->epoch == 0) {
+    win->epoch = now;
+    win->w_est = win->congestion_window;
+    if (win->w_max <= win->congestion_window) {
+      win->w_max = win->congestion_window;
+      win->k = 0;
+    } else {
+      win->k = cbrt((win->w_max - cwnd) / mss / CUBIC_C);
+    }
+  }
+  // Where the curve is one RTT from now, in bytes
+  t = (now - win->epoch + win->srtt) / 1e6;
+  target = CUBIC_C * pow(t - win->k, 3) * mss + win->w_max;
+  target = MIN(MAX(target, cwnd), 1.5 * cwnd);
+
+  // Reno-friendly region: the estimate grows by 3(1-beta)/(1+beta) MSS per
+  // RTT, and the window follows it wherever it is ahead of the curve
+  win->w_est += MAX((uint32_t)(3 * (1 - CUBIC_BETA) / (1 + CUBIC_BETA) * mss *
+                               acked_bytes / cwnd),
+                    1);
+  if (win->w_est > target) {
+    win->congestion_window = win->w_est;
   } else {
-    debug_printf("Sending packet %d %d\n", get_seq(hdr),
-                   get_seq(hdr) + get_payload_len(slot.msg));
-    slot.is_sent = 1;
-    sendto(sock->socket, slot.msg, get_plen(hdr), 0,
-            (struct sockaddr *)&(sock->conn), sizeof(sock->conn));
+    win->congestion_window += (uint32_t)((target - cwnd) * acked_bytes / cwnd);
   }
 }
 
+/**
+ * Grows or shrinks the congestion window after an ACK (Reno, RFC 5681, with
+ * the NewReno recovery of RFC 6582). Slow start counts up to two segments per
+ * ACK (RFC 3465), which delayed ACKs cover. CUBIC only changes how the window
+ * grows in congestion avoidance and how much it gives up on a loss.
+ *
+ * @param sock The socket.
+ * @param ack The cumulative ACK.
+ * @param acked_bytes The bytes it newly acknowledged, 0 for a duplicate.
+ * @param now The current time in us.
+ */
+static void update_congestion_window(foggy_socket_t *sock, uint32_t ack,
+                                     uint32_t acked_bytes, uint64_t now) {
+  send_ring_t *ring = &(sock->send_window);
+  window_t *win = &(sock->window);
+  uint32_t mss = sock->mss;
+
+  if (acked_bytes > 0) {
+    switch (win->reno_state) {
+      case RENO_FAST_RECOVERY:
+        if (!before(ack, win->recover)) {
+          win->congestion_window = win->ssthresh;  // full ACK, deflate
+          win->reno_state = RENO_CONGESTION_AVOIDANCE;
+        } else if (ring->next != ring->head) {
+          // Partial ACK: the segment after it was lost too
+          win->congestion_window = win->ssthresh;
+          retransmit_head(sock, now);
+        }
+        break;
+      case RENO_SLOW_START:
+        win->congestion_window += MIN(acked_bytes, 2 * mss);
+        if (win->congestion_window >= win->ssthresh) {
+          win->reno_state = RENO_CONGESTION_AVOIDANCE;
+        }
+        break;
+      case RENO_CONGESTION_AVOIDANCE:
+        if (sock->opts.congestion == FOGGY_CC_CUBIC) {
+          cubic_increase(sock, acked_bytes, now);
+        } else {
+          win->congestion_window +=
+              MAX((uint64_t)mss * mss / win->congestion_window, 1);
+        }
+        break;
+    }
+    return;
+  }
+
+  // With parity on the way the receiver may rebuild the segment itself, give
+  // it the rest of the group before retransmitting
+  uint32_t dupthresh = 3 + (sock->fec != NULL ? sock->fec->group : 0);
+  if (win->dup_ack_count < dupthresh || ring->next == ring->head) return;
+  if (win->reno_state != RENO_FAST_RECOVERY) {
+    uint32_t last = send_ring_slot(ring, ring->next - 1);
+    win->ssthresh = loss_ssthresh(sock);
+    win->recover = ring->seq[last] + ring->len[last];
+    win->reno_state = RENO_FAST_RECOVERY;
+    retransmit_head(sock, now);
+  }
+  // Every further duplicate means a segment left the network
+  win->congestion_window = win->ssthresh + win->dup_ack_count * mss;
+}
+
 void receive_send_window(foggy_socket_t *sock) {
-  // Pop out the packets that have been ACKed
-  while (1) {
-    if (sock->send_window.empty()) break;
+  send_ring_t *ring = &(sock->send_window);
+  uint32_t ack, acked = 0, acked_bytes = 0;
+  uint64_t now = get_time_us(), sample_time = 0;
 
-    send_window_slot_t slot = sock->send_window.front();
-    foggy_tcp_header_t *hdr = (foggy_tcp_header_t *)slot.msg;
+  while (pthread_mutex_lock(&(sock->window.ack_lock)) != 0) {
+  }
+  ack = sock->window.last_ack_received;
+  pthread_mutex_unlock(&(sock->window.ack_lock));
 
-    if (slot.is_sent == 0) {
-      break;
-    }
-    if (has_been_acked(sock, get_seq(hdr)) == 0) {
-      break;
+  // Pop out the segments that have been ACKed
+  while (!send_ring_empty(ring)) {
+    uint32_t i = send_ring_slot(ring, ring->head);
+    if (!after(ack, ring->seq[i])) break;
+    // Only the newest one gives an RTT sample, never a retransmission (Karn)
+    sample_time = ring->retx[i] == 0 ? ring->send_time[i] : 0;
+    acked_bytes += ring->len[i];
+    acked++;
+    free(send_ring_pop(ring));
+  }
+  if (acked) {
+    sock->rto_retries = 0;
+    if (sample_time != 0 && sock->mp == NULL) {
+      update_rtt(sock, now - sample_time);
     }
-    sock->send_window.pop_front();
-    free(slot.msg);
+    stat_add(&sock->stats.bytes_acked, acked_bytes);
+    FOGGY_TRACE_EVENT(TRACE_ACK, sock, ack, acked_bytes, 0);
+  }
+  // Subflows run their own congestion control and timers from the echoes
+  if (sock->mp != NULL) return;
+
+  // A FIN takes no payload but is progress all the same
+  update_congestion_window(sock, ack, acked ? MAX(acked_bytes, 1) : 0, now);
+
+  // Restart the timer for the remaining outstanding data (RFC 6298 5.3)
+  if (ring->next == ring->head) {
+    timer_cancel(&(sock->timers), &(sock->rto_timer));
+  } else if (acked) {
+    timer_arm(&(sock->timers), &(sock->rto_timer), now + sock->window.rto);
+  }
+}
+
+/**
+ * Appends the OPT_MSS announcing the largest payload we accept.
+ */
+static uint16_t put_mss_option(foggy_socket_t *sock, uint8_t *ext) {
+  uint16_t mss = htons(sock->local_mss);
+  return put_option(ext, OPT_MSS, &mss, sizeof(mss));
+}
+
+uint8_t *create_syn_packet(foggy_socket_t *sock, const uint8_t *payload,
+                           uint16_t payload_len) {
+  uint8_t ext[OPT_CAPS_LEN + OPT_MSS_LEN + OPT_WSCALE_LEN + 2 +
+              FASTOPEN_COOKIE_LEN];
+  uint16_t ext_len = 0;
+
+  // Ask for the optional features we want, the listener echoes the ones it
+  // agrees to in the SYN-ACK
+  if (sock->caps_wanted != 0) {
+    uint32_t caps = htonl(sock->caps_wanted);
+    ext_len += put_option(ext, OPT_CAPS, &caps, sizeof(caps));
+  }
+  ext_len += put_mss_option(sock, ext + ext_len);
+  ext_len += sockopt_put_wscale(sock, ext + ext_len);
+  if (payload_len > 0) {
+    ext_len += put_option(ext + ext_len, OPT_FASTOPEN, sock->fastopen_cookie,
+                          FASTOPEN_COOKIE_LEN);
+  } else if (sock->fastopen) {
+    ext_len += put_option(ext + ext_len, OPT_FASTOPEN, NULL, 0);  // cookie request
+  }
+  return create_socket_packet(sock, sock->window.last_byte_sent,
+                              sock->window.next_seq_expected, SYN_FLAG_MASK,
+                              ext_len, ext, payload, payload_len);
+}
+
+void send_syn_ack(foggy_socket_t *sock) {
+  uint8_t ext[OPT_CAPS_LEN + OPT_MSS_LEN + OPT_WSCALE_LEN + 2 +
+              FASTOPEN_COOKIE_LEN];
+  uint16_t ext_len = 0;
+
+  if (sock->caps != 0) {
+    uint32_t caps = htonl(sock->caps);
+    ext_len += put_option(ext, OPT_CAPS, &caps, sizeof(caps));
   }
+  ext_len += put_mss_option(sock, ext + ext_len);
+  ext_len += sockopt_put_wscale(sock, ext + ext_len);
+  if (sock->send_cookie) {
+    uint8_t cookie[FASTOPEN_COOKIE_LEN];
+    fastopen_make_cookie(&(sock->conn), cookie);
+    ext_len += put_option(ext + ext_len, OPT_FASTOPEN, cookie, sizeof(cookie));
+  }
+
+  uint8_t *syn_ack_pkt = create_socket_packet(
+      sock, sock->iss, sock->window.next_seq_expected,
+      SYN_FLAG_MASK | ACK_FLAG_MASK, ext_len, ext, NULL, 0);
+  send_packet(sock, syn_ack_pkt);
+  free(syn_ack_pkt);
+  sock->handshake_sent = get_time_us();
 }
@@ -0,0 +1,65 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/*
+ * This file implements the log-linear latency histograms.
+ */
+
+#include "foggy_hist.h"
+
+#include <string.h>
+
+#define SUB_BITS 6  // log2(HIST_SUB_BUCKETS)
+
+static int bucket_of(uint64_t value) {
+  if (value < 2 * HIST_SUB_BUCKETS) return (int)value;
+
+  // Keep the top SUB_BITS + 1 bits, the leading one selects the power of two
+  int shift = 63 - __builtin_clzll(value) - SUB_BITS;
+  int bucket = (shift + 1) * HIST_SUB_BUCKETS +
+               (int)(value >> shift) - HIST_SUB_BUCKETS;
+  return bucket < HIST_BUCKETS ? bucket : HIST_BUCKETS - 1;
+}
+
+/* The largest value that lands in a bucket. */
+static uint64_t bucket_top(int bucket) {
+  if (bucket < 2 * HIST_SUB_BUCKETS) return bucket;
+
+  int shift = bucket / HIST_SUB_BUCKETS - 1;
+  uint64_t base = (uint64_t)(bucket % HIST_SUB_BUCKETS + HIST_SUB_BUCKETS);
+  return ((base + 1) << shift) - 1;
+}
+
+void hist_init(hist_t *hist) {
+  memset(hist, 0, sizeof(*hist));
+}
+
+void hist_record(hist_t *hist, uint64_t value) {
+  hist->counts[bucket_of(value)]++;
+  if (hist->count == 0 || value < hist->min) hist->min = value;
+  if (value > hist->max) hist->max = value;
+  hist->count++;
+  hist->sum += value;
+}
+
+uint64_t hist_percentile(const hist_t *hist, double fraction) {
+  uint64_t rank, seen = 0;
+
+  if (hist->count == 0) return 0;
+  rank = (uint64_t)(fraction * hist->count + 0.5);
+  if (rank < 1) rank = 1;
+  for (int i = 0; i < HIST_BUCKETS; ++i) {
+    seen += hist->counts[i];
+    if (seen >= rank) {
+      uint64_t top = bucket_top(i);
+      return top < hist->max ? top : hist->max;
+    }
+  }
+  return hist->max;
+}
@@ -0,0 +1,199 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/*
+ * This file implements the block codec of stream compression.
+ */
+
+#include "foggy_lz.h"
+
+#include <string.h>
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+#define LAST_LITERALS 5  // a match ends at least this far from the end
+#define MATCH_LIMIT 12   // and starts at least this far
+#define SKIP_SHIFT 6     // the search step grows by one every 64 misses
+
+static inline uint32_t read32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint32_t hash4(uint32_t v) {
+  return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+/**
+ * Returns how many bytes two words have in common at the start, given their
+ * XOR is not 0.
+ */
+static inline int common_bytes(uint64_t diff) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  return __builtin_ctzll(diff) >> 3;
+#else
+  return __builtin_clzll(diff) >> 3;
+#endif
+}
+
+/**
+ * Returns where the match at `ip` against `ref` stops, at `limit` at most.
+ */
+static const uint8_t *match_end(const uint8_t *ip, const uint8_t *ref,
+                                const uint8_t *limit) {
+  while (ip + sizeof(uint64_t) <= limit) {
+    uint64_t a, b;
+    memcpy(&a, ip, sizeof(a));
+    memcpy(&b, ref, sizeof(b));
+    if (a != b) return ip + common_bytes(a ^ b);
+    ip += sizeof(uint64_t);
+    ref += sizeof(uint64_t);
+  }
+  while (ip < limit && *ip == *ref) {
+    ip++;
+    ref++;
+  }
+  return ip;
+}
+
+/**
+ * Writes the continuation of a length whose nibble is 15.
+ */
+static uint8_t *put_length(uint8_t *op, int n) {
+  for (; n >= 255; n -= 255) {
+    *op++ = 255;
+  }
+  *op++ = (uint8_t)n;
+  return op;
+}
+
+/**
+ * Reads the continuation of a length whose nibble is 15 and adds it to `n`.
+ *
+ * @return 0, or -1 if the block ends first.
+ */
+static int get_length(const uint8_t **ip, const uint8_t *end, int *n) {
+  uint8_t b;
+
+  do {
+    if (*ip >= end || *n > LZ_MAX_INPUT) return -1;
+    b = *(*ip)++;
+    *n += b;
+  } while (b == 255);
+  return 0;
+}
+
+/**
+ * Writes a sequence, without its match if `ml` is negative.
+ *
+ * @return The new end of the output, NULL if it does not fit.
+ */
+static uint8_t *put_sequence(uint8_t *op, uint8_t *oend, const uint8_t *lit,
+                             int lit_len, int offset, int ml) {
+  uint8_t *token = op++;
+
+  if (oend - op < lit_len + lit_len / 255 + 1 + (ml < 0 ? 0 : 3 + ml / 255)) {
+    return NULL;
+  }
+  *token = (uint8_t)(MIN(lit_len, 15) << 4 | (ml < 0 ? 0 : MIN(ml, 15)));
+  if (lit_len >= 15) op = put_length(op, lit_len - 15);
+  memcpy(op, lit, lit_len);
+  op += lit_len;
+  if (ml < 0) return op;
+  *op++ = (uint8_t)(offset & 0xff);
+  *op++ = (uint8_t)(offset >> 8);
+  if (ml >= 15) op = put_length(op, ml - 15);
+  return op;
+}
+
+int lz_compress(const uint8_t *src, int len, uint8_t *dst, int cap) {
+  uint16_t table[1 << LZ_HASH_BITS];  // position + 1, 0 for none
+  const uint8_t *ip = src, *anchor = src, *end = src + len;
+  uint8_t *op = dst, *oend = dst + cap;
+
+  if (len > LZ_MAX_INPUT || cap < 1) return 0;
+  memset(table, 0, sizeof(table));
+
+  while (len >= MATCH_LIMIT && ip < end - MATCH_LIMIT) {
+    uint32_t seq = read32(ip), h = hash4(seq);
+    int ref_pos = table[h] - 1;
+    table[h] = (uint16_t)(ip - src + 1);
+    if (ref_pos < 0 || read32(src + ref_pos) != seq) {
+      ip += 1 + ((ip - anchor) >> SKIP_SHIFT);
+      continue;
+    }
+
+    // Grow the match backwards over the pending literals, then forwards
+    const uint8_t *ref = src + ref_pos;
+    while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+      ip--;
+      ref--;
+    }
+    const uint8_t *mend = match_end(ip + LZ_MIN_MATCH, ref + LZ_MIN_MATCH,
+                                    end - LAST_LITERALS);
+    op = put_sequence(op, oend, anchor, ip - anchor, ip - ref,
+                      mend - ip - LZ_MIN_MATCH);
+    if (op == NULL) return 0;
+    ip = anchor = mend;
+    if (ip < end - MATCH_LIMIT) {
+      table[hash4(read32(ip - 2))] = (uint16_t)(ip - 2 - src + 1);
+    }
+  }
+  op = put_sequence(op, oend, anchor, end - anchor, 0, -1);
+  return op == NULL ? 0 : op - dst;
+}
+
+int lz_decompress(const uint8_t *src, int len, uint8_t *dst, int cap) {
+  const uint8_t *ip = src, *iend = src + len;
+  uint8_t *op = dst, *oend = dst + cap;
+
+  while (ip < iend) {
+    uint8_t token = *ip++;
+    int lit_len = token >> 4, ml = token & 15, offset;
+
+    if (lit_len == 15 && get_length(&ip, iend, &lit_len) < 0) return -1;
+    if (lit_len > iend - ip || lit_len > oend - op) return -1;
+    memcpy(op, ip, lit_len);
+    ip += lit_len;
+    op += lit_len;
+    if (ip == iend) return op - dst;  // the last sequence has no match
+
+    if (iend - ip < 2) return -1;
+    offset = ip[0] | ip[1] << 8;
+    ip += 2;
+    if (ml == 15 && get_length(&ip, iend, &ml) < 0) return -1;
+    ml += LZ_MIN_MATCH;
+    if (offset == 0 || offset > op - dst || ml > oend - op) return -1;
+
+    // A match closer than a word repeats a short pattern. Write one word of
+    // it a byte at a time, then copy words from a multiple of the pattern
+    // length back.
+    const uint8_t *ref = op - offset;
+    if (offset < (int)sizeof(uint64_t)) {
+      int step = offset * ((sizeof(uint64_t) + offset - 1) / offset);
+      int head = MIN(ml, step);
+      for (int i = 0; i < head; ++i) {
+        op[i] = op[i - offset];
+      }
+      op += head;
+      ml -= head;
+      ref = op - step;
+    }
+    for (; ml >= (int)sizeof(uint64_t); ml -= sizeof(uint64_t)) {
+      memcpy(op, ref, sizeof(uint64_t));
+      op += sizeof(uint64_t);
+      ref += sizeof(uint64_t);
+    }
+    for (; ml > 0; ml--) {
+      *op++ = *ref++;
+    }
+  }
+  return -1;  // no last sequence
+}
@@ -0,0 +1,617 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/*
+ * This file implements multipath connections.
+ */
+
+#include "foggy_mp.h"
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "foggy_fec.h"
+#include "foggy_function.h"
+#include "foggy_option.h"
+#include "foggy_trace.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+#define PKT_MASK (MP_MAX_PACKETS - 1)
+
+static void subflow_timeout(void *arg);
+static void join_timeout(void *arg);
+
+/**
+ * Returns the n-th `;` separated entry of FOGGY_MP_NETEM, or NULL if there is
+ * none or it is empty.
+ */
+static char *netem_spec(int n, char *buf, size_t size) {
+  const char *env = getenv("FOGGY_MP_NETEM");
+  const char *end;
+
+  if (env == NULL) return NULL;
+  for (; n > 0 && env != NULL; --n) {
+    env = strchr(env, ';');
+    if (env != NULL) env++;
+  }
+  if (env == NULL) return NULL;
+  end = strchr(env, ';');
+  size_t len = end != NULL ? (size_t)(end - env) : strlen(env);
+  if (len == 0 || len >= size) return NULL;
+  memcpy(buf, env, len);
+  buf[len] = '\0';
+  return buf;
+}
+
+/**
+ * Returns the n-th entry of FOGGY_SUBFLOW_ADDRS, cycling through the list,
+ * INADDR_ANY if it is not set.
+ */
+static in_addr_t local_addr(int n) {
+  const char *env = getenv("FOGGY_SUBFLOW_ADDRS");
+  char buf[INET_ADDRSTRLEN];
+  const char *p;
+  int count = 1;
+
+  if (env == NULL || *env == '\0') return htonl(INADDR_ANY);
+  for (p = env; *p != '\0'; ++p) {
+    if (*p == ',') count++;
+  }
+  for (p = env, n %= count; n > 0; --n) {
+    p = strchr(p, ',') + 1;
+  }
+  size_t len = strchr(p, ',') != NULL ? (size_t)(strchr(p, ',') - p) : strlen(p);
+  if (len >= sizeof(buf)) return htonl(INADDR_ANY);
+  memcpy(buf, p, len);
+  buf[len] = '\0';
+  return inet_addr(buf);
+}
+
+/**
+ * Puts a subflow in the schedule with fresh congestion state.
+ */
+static void activate(subflow_t *sf) {
+  foggy_socket_t *sock = sf->sock;
+
+  if (sf->state == SUBFLOW_ACTIVE) return;
+  debug_printf("Subflow %d active\n", sf->id);
+  if (sf->state == SUBFLOW_FAILED) {
+    info_printf("Subflow %d is answering again\n", sf->id);
+  }
+  sf->state = SUBFLOW_ACTIVE;
+  sf->cwnd = sock->opts.init_cwnd;
+  sf->ssthresh = sock->opts.init_ssthresh;
+  sf->timeouts = 0;
+  timer_cancel(&(sock->timers), &(sf->join_timer));
+}
+
+static void init_subflow(foggy_socket_t *sock, int id, int fd) {
+  subflow_t *sf = &(sock->mp->subflows[id]);
+  char buf[256];
+  char *spec = netem_spec(id, buf, sizeof(buf));
+  netem_config_t cfg;
+
+  sf->sock = sock;
+  sf->id = id;
+  sf->state = SUBFLOW_IDLE;
+  sf->fd = fd;
+  sf->addr = sock->conn;
+  sf->netem = sock->netem;
+  sf->own_netem = 0;
+  if (spec != NULL) {
+    if (netem_parse(spec, &cfg) == 0) {
+      sf->netem = netem_link_create(&cfg);
+      sf->own_netem = 1;
+    } else {
+      fprintf(stderr, "ERROR malformed FOGGY_MP_NETEM entry \"%s\", ignoring it\n",
+              spec);
+    }
+  }
+  sf->cwnd = sock->opts.init_cwnd;
+  sf->ssthresh = sock->opts.init_ssthresh;
+  sf->in_flight = 0;
+  sf->reduced_at = 0;
+  sf->srtt = 0;
+  sf->rttvar = 0;
+  sf->rto = sock->opts.rto_init;
+  sf->timeouts = 0;
+  timer_init(&(sf->rto_timer), subflow_timeout, sf);
+  timer_init(&(sf->join_timer), join_timeout, sf);
+  sf->pn_next = 0;
+  sf->pn_oldest = 0;
+}
+
+void mp_init(foggy_socket_t *sock) {
+  const char *env = getenv("FOGGY_SUBFLOWS");
+
+  sock->mp = NULL;
+  sock->subflows = env != NULL ? MIN(MAX(atoi(env), 1), MP_MAX_SUBFLOWS) : 1;
+  if (sock->subflows > 1) {
+    sock->caps_wanted |= CAP_MULTIPATH;
+  }
+}
+
+void mp_start(foggy_socket_t *sock) {
+  struct mp_state *mp;
+  uint64_t now = get_time_us();
+
+  if (sock->mp != NULL) return;
+  mp = (struct mp_state *)malloc(sizeof(*mp));
+  sock->mp = mp;
+  mp->echo_id = -1;
+  mp->echo_pn = 0;
+  mp->lost = 0;
+  // The subflows take over the timers of the single path
+  timer_cancel(&(sock->timers), &(sock->rto_timer));
+
+  for (int id = 0; id < MP_MAX_SUBFLOWS; ++id) {
+    init_subflow(sock, id, sock->socket);
+  }
+  mp->subflows[0].state = SUBFLOW_ACTIVE;
+  if (sock->type == TCP_LISTENER) return;  // the initiator opens the others
+
+  for (int id = 1; id < sock->subflows; ++id) {
+    subflow_t *sf = &(mp->subflows[id]);
+    struct sockaddr_in addr;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = local_addr(id - 1);
+    addr.sin_port = 0;
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+      perror("ERROR opening subflow");
+      if (fd >= 0) close(fd);
+      continue;
+    }
+    sf->fd = fd;
+    sf->state = SUBFLOW_JOINING;
+    timer_arm(&(sock->timers), &(sf->join_timer), now);
+  }
+}
+
+void mp_destroy(foggy_socket_t *sock) {
+  struct mp_state *mp = sock->mp;
+
+  if (mp == NULL) return;
+  for (int id = 0; id < MP_MAX_SUBFLOWS; ++id) {
+    subflow_t *sf = &(mp->subflows[id]);
+    // A shared link may still hold packets for this subflow's socket
+    if (sf->own_netem) {
+      netem_link_destroy(sf->netem);
+    } else {
+      netem_link_flush(sf->netem);
+    }
+    if (sf->fd != sock->socket) close(sf->fd);
+  }
+  free(mp);
+  sock->mp = NULL;
+}
+
+int mp_fds(foggy_socket_t *sock, int *fds) {
+  int n = 0;
+
+  if (sock->mp == NULL) return 0;
+  for (int id = 0; id < MP_MAX_SUBFLOWS; ++id) {
+    if (sock->mp->subflows[id].fd != sock->socket) {
+      fds[n++] = sock->mp->subflows[id].fd;
+    }
+  }
+  return n;
+}
+
+/**
+ * Sends a packet on a subflow with one more option appended to it.
+ */
+static void send_with_option(subflow_t *sf, const uint8_t *pkt, uint8_t kind,
+                             uint32_t pn) {
+  foggy_socket_t *sock = sf->sock;
+  uint8_t *out = sock->mp->tx_buf;
+  foggy_tcp_header_t *hdr = (foggy_tcp_header_t *)out;
+  uint16_t hlen = get_hlen((foggy_tcp_header_t *)pkt);
+  uint16_t plen = get_plen((foggy_tcp_header_t *)pkt);
+  uint8_t value[5];
+
+  value[0] = sf->id;
+  pn = htonl(pn);
+  memcpy(value + 1, &pn, sizeof(pn));
+  memcpy(out, pkt, hlen);
+  put_option(out + hlen, kind, value, sizeof(value));
+  memcpy(out + hlen + OPT_SUBFLOW_LEN, pkt + hlen, plen - hlen);
+  set_hlen(hdr, hlen + OPT_SUBFLOW_LEN);
+  set_plen(hdr, plen + OPT_SUBFLOW_LEN);
+  set_extension_length(hdr, get_extension_length(hdr) + OPT_SUBFLOW_LEN);
+  send_packet_to(sock, out, sf->fd, &(sf->addr), sf->netem);
+}
+
+static inline int in_send_window(send_ring_t *ring, uint32_t n) {
+  return n - ring->head < ring->tail - ring->head;
+}
+
+/**
+ * Resolves an unacknowledged packet as lost and marks its segment to be sent
+ * again, unless another copy already got through.
+ *
+ * @return 1 if the loss is news to the congestion control.
+ */
+static int lose_packet(subflow_t *sf, mp_packet_t *pkt) {
+  foggy_socket_t *sock = sf->sock;
+  send_ring_t *ring = &(sock->send_window);
+
+  pkt->acked = 1;
+  sf->in_flight -= pkt->len;
+  if (pkt->seg == MP_NO_SEGMENT || !in_send_window(ring, pkt->seg)) return 0;
+
+  uint32_t i = send_ring_slot(ring, pkt->seg);
+  if (ring->flags[i] & SEG_SACKED) return 0;
+  if (!(ring->flags[i] & SEG_LOST)) {
+    ring->flags[i] |= SEG_LOST;
+    sock->mp->lost++;
+  }
+  return pkt->sent > sf->reduced_at;
+}
+
+/**
+ * Drops the resolved packets at the front of a subflow, and restarts or stops
+ * its timer.
+ */
+static void advance(subflow_t *sf, uint64_t now) {
+  foggy_socket_t *sock = sf->sock;
+
+  while (sf->pn_oldest != sf->pn_next &&
+         sf->pkts[sf->pn_oldest & PKT_MASK].acked) {
+    sf->pn_oldest++;
+  }
+  if (sf->pn_oldest == sf->pn_next) {
+    timer_cancel(&(sock->timers), &(sf->rto_timer));
+  } else {
+    timer_arm(&(sock->timers), &(sf->rto_timer), now + sf->rto);
+  }
+}
+
+/**
+ * Takes every packet in flight on a subflow as lost.
+ */
+static void lose_all(subflow_t *sf) {
+  for (uint32_t pn = sf->pn_oldest; pn != sf->pn_next; ++pn) {
+    mp_packet_t *pkt = &(sf->pkts[pn & PKT_MASK]);
+    if (!pkt->acked) lose_packet(sf, pkt);
+  }
+  sf->pn_oldest = sf->pn_next;
+  timer_cancel(&(sf->sock->timers), &(sf->rto_timer));
+}
+
+/**
+ * Sum of the congestion windows of the subflows in the schedule, reported as
+ * the connection's.
+ */
+static uint32_t total_cwnd(struct mp_state *mp) {
+  uint32_t total = 0;
+
+  for (int id = 0; id < MP_MAX_SUBFLOWS; ++id) {
+    if (mp->subflows[id].state == SUBFLOW_ACTIVE) total += mp->subflows[id].cwnd;
+  }
+  return total;
+}
+
+/**
+ * Grows the window of a subflow for `acked` bytes delivered. Past slow start
+ * the increase is coupled over the subflows (RFC 6356): the aggregate grows
+ * like one Reno flow on the best path, and no subflow grows faster than a
+ * Reno flow of its own would.
+ */
+static void increase_cwnd(subflow_t *sf, uint32_t acked) {
+  struct mp_state *mp = sf->sock->mp;
+  uint32_t mss = sf->sock->mss;
+  double best = 0, sum = 0, inc;
+
+  if (sf->cwnd < sf->ssthresh) {
+    sf->cwnd += MIN(acked, mss);
+    return;
+  }
+  inc = (double)acked * mss / sf->cwnd;
+  for (int id = 0; id < MP_MAX_SUBFLOWS; ++id) {
+    subflow_t *other = &(mp->subflows[id]);
+    if (other->state != SUBFLOW_ACTIVE) continue;
+    if (other->srtt == 0) {
+      sum = 0;  // not enough samples to couple
+      break;
+    }
+    double rtt = other->srtt;
+    best = MAX(best, other->cwnd / (rtt * rtt));
+    sum += other->cwnd / rtt;
+  }
+  if (sum > 0) {
+    inc = MIN(inc, (double)acked * mss * best / (sum * sum));
+  }
+  sf->cwnd += MAX((uint32_t)inc, 1);
+}
+
+static void reduce_cwnd(subflow_t *sf, uint64_t now) {
+  sf->ssthresh = MAX(sf->cwnd / 2, 2 * (uint32_t)sf->sock->mss);
+  sf->cwnd = sf->ssthresh;
+  sf->reduced_at = now;
+}
+
+static void update_subflow_rtt(subflow_t *sf, uint64_t sample) {
+  sample = MAX(sample, 1);
+  if (sf->srtt == 0) {
+    sf->srtt = sample;
+    sf->rttvar = sample / 2;
+  } else {
+    uint64_t delta = sf->srtt > sample ? sf->srtt - sample : sample - sf->srtt;
+    sf->rttvar = (3 * (uint64_t)sf->rttvar + delta) / 4;
+    sf->srtt = (7 * (uint64_t)sf->srtt + sample) / 8;
+  }
+  sf->rto = MIN(MAX(sf->srtt + MAX(4 * sf->rttvar, 1000),
+                    sf->sock->opts.rto_min),
+                sf->sock->opts.rto_max);
+}
+
+/**
+ * Processes the echo of packet `pn` of a subflow.
+ */
+static void on_echo(subflow_t *sf, uint32_t pn) {
+  foggy_socket_t *sock = sf->sock;
+  send_ring_t *ring = &(sock->send_window);
+  uint64_t now = get_time_us();
+  int lost = 0;
+
+  if (pn - sf->pn_oldest >= sf->pn_next - sf->pn_oldest) return;  // stale
+  mp_packet_t *pkt = &(sf->pkts[pn & PKT_MASK]);
+  if (pkt->acked) return;
+
+  pkt->acked = 1;
+  sf->in_flight -= pkt->len;
+  sf->timeouts = 0;
+  update_subflow_rtt(sf, now - pkt->sent);
+  update_rtt(sock, now - pkt->sent);
+  if (sf->state != SUBFLOW_ACTIVE) activate(sf);
+  if (pkt->seg != MP_NO_SEGMENT) {
+    if (in_send_window(ring, pkt->seg)) {
+      ring->flags[send_ring_slot(ring, pkt->seg)] |= SEG_SACKED;
+    }
+    increase_cwnd(sf, MAX(pkt->len, 1));
+  }
+
+  // A subflow keeps its packets in order, what was sent well before the
+  // packet just echoed is gone
+  for (uint32_t p = sf->pn_oldest; pn - p >= MP_REORDER_THRESHOLD && p != pn;
+       ++p) {
+    mp_packet_t *old = &(sf->pkts[p & PKT_MASK]);
+    if (!old->acked) lost |= lose_packet(sf, old);
+  }
+  if (lost) {
+    debug_printf("Subflow %d lost packets before %u\n", sf->id, pn);
+    reduce_cwnd(sf, now);
+  }
+  advance(sf, now);
+  sock->window.congestion_window = total_cwnd(sock->mp);
+  sock->window.ssthresh = sf->ssthresh;
+}
+
+/**
+ * Returns another subflow in the schedule than `sf`, NULL if there is none.
+ */
+static subflow_t *other_active(subflow_t *sf) {
+  struct mp_state *mp = sf->sock->mp;
+
+  for (int id = 0; id < MP_MAX_SUBFLOWS; ++id) {
+    if (id != sf->id && mp->subflows[id].state == SUBFLOW_ACTIVE) {
+      return &(mp->subflows[id]);
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Expiry of the retransmission timer of a subflow. Its packets are taken as
+ * lost and go out again, on the other subflows if it keeps timing out.
+ */
+static void subflow_timeout(void *arg) {
+  subflow_t *sf = (subflow_t *)arg;
+  foggy_socket_t *sock = sf->sock;
+  uint64_t now = get_time_us();
+
+  debug_printf("Subflow %d timed out\n", sf->id);
+  lose_all(sf);
+  sf->ssthresh = MAX(sf->cwnd / 2, 2 * (uint32_t)sock->mss);
+  sf->cwnd = sock->mss;
+  sf->reduced_at = now;
+  sf->rto = MIN(sf->rto * 2, sock->opts.rto_max);
+  sf->timeouts++;
+  sock->rto_retries++;
+
+  if (sf->timeouts >= MP_FAIL_RTOS && sf->state == SUBFLOW_ACTIVE &&
+      other_active(sf) != NULL) {
+    info_printf("Subflow %d stopped answering\n", sf->id);
+    sf->state = SUBFLOW_FAILED;
+    timer_arm(&(sock->timers), &(sf->join_timer), now + sf->rto);
+  }
+  sock->window.congestion_window = total_cwnd(sock->mp);
+  mp_transmit(sock);
+}
+
+/**
+ * Sends a join on a subflow that is not in the schedule, until it is
+ * answered. Older joins are given up, so a dead path holds nothing.
+ */
+static void join_timeout(void *arg) {
+  subflow_t *sf = (subflow_t *)arg;
+  foggy_socket_t *sock = sf->sock;
+  uint64_t now = get_time_us();
+
+  if (sf->state == SUBFLOW_ACTIVE) return;
+  lose_all(sf);
+
+  uint8_t *join = create_socket_packet(sock, sock->window.last_byte_sent,
+                                       sock->window.next_seq_expected,
+                                       ACK_FLAG_MASK, 0, NULL, NULL, 0);
+  mp_packet_t *pkt = &(sf->pkts[sf->pn_next & PKT_MASK]);
+  pkt->seg = MP_NO_SEGMENT;
+  pkt->len = 0;
+  pkt->acked = 0;
+  pkt->sent = now;
+  debug_printf("Joining subflow %d\n", sf->id);
+  send_with_option(sf, join, OPT_SUBFLOW, sf->pn_next++);
+  free(join);
+
+  timer_arm(&(sock->timers), &(sf->join_timer), now + sf->rto);
+  sf->rto = MIN(sf->rto * 2, sock->opts.rto_max);
+}
+
+int mp_on_recv(foggy_socket_t *sock, uint8_t *pkt) {
+  struct mp_state *mp = sock->mp;
+  uint8_t len = 0;
+  uint8_t *opt;
+  uint32_t pn;
+
+  if ((opt = find_option(pkt, OPT_SUBFLOW_ACK, &len)) != NULL && len == 5 &&
+      opt[0] < MP_MAX_SUBFLOWS) {
+    memcpy(&pn, opt + 1, sizeof(pn));
+    on_echo(&(mp->subflows[opt[0]]), ntohl(pn));
+  }
+
+  if ((opt = find_option(pkt, OPT_SUBFLOW, &len)) == NULL || len != 5 ||
+      opt[0] >= MP_MAX_SUBFLOWS) {
+    return 0;
+  }
+  subflow_t *sf = &(mp->subflows[opt[0]]);
+  memcpy(&pn, opt + 1, sizeof(pn));
+  if (sock->type == TCP_LISTENER && sf->id != 0) {
+    sf->addr = sock->rx_from;  // follows the peer if its address changes
+    if (sf->state == SUBFLOW_IDLE) {
+      sf->srtt = mp->subflows[0].srtt;
+      sf->rttvar = mp->subflows[0].rttvar;
+      sf->rto = mp->subflows[0].rto;
+      activate(sf);
+    }
+  }
+  mp->echo_id = sf->id;
+  mp->echo_pn = ntohl(pn);
+
+  // A join takes no sequence space and is answered right away
+  if (get_payload_len(pkt) == 0 &&
+      !(get_flags((foggy_tcp_header_t *)pkt) & FIN_FLAG_MASK)) {
+    uint8_t *ack_pkt = create_socket_packet(
+        sock, sock->window.last_byte_sent, sock->window.next_seq_expected,
+        ACK_FLAG_MASK, 0, NULL, NULL, 0);
+    mp_send_packet(sock, ack_pkt);
+    free(ack_pkt);
+    return 1;
+  }
+  return 0;
+}
+
+void mp_discard_echo(foggy_socket_t *sock) {
+  sock->mp->echo_id = -1;
+}
+
+void mp_send_packet(foggy_socket_t *sock, uint8_t *pkt) {
+  struct mp_state *mp = sock->mp;
+  subflow_t *sf = &(mp->subflows[0]);
+
+  if (mp->echo_id >= 0 && get_payload_len(pkt) == 0) {
+    sf = &(mp->subflows[mp->echo_id]);
+    mp->echo_id = -1;
+    send_with_option(sf, pkt, OPT_SUBFLOW_ACK, mp->echo_pn);
+    return;
+  }
+  if (sf->state != SUBFLOW_ACTIVE && other_active(sf) != NULL) {
+    sf = other_active(sf);
+  }
+  send_packet_to(sock, pkt, sf->fd, &(sf->addr), sf->netem);
+}
+
+/**
+ * Picks the subflow for a segment of `len` bytes: the one with the lowest
+ * smoothed RTT that has room for it, among those that did not time out if
+ * possible.
+ *
+ * @return The subflow, NULL if none has room.
+ */
+static subflow_t *pick_subflow(struct mp_state *mp, uint16_t len) {
+  subflow_t *best = NULL;
+
+  for (int id = 0; id < MP_MAX_SUBFLOWS; ++id) {
+    subflow_t *sf = &(mp->subflows[id]);
+    if (sf->state != SUBFLOW_ACTIVE ||
+        sf->pn_next - sf->pn_oldest == MP_MAX_PACKETS) {
+      continue;
+    }
+    // Always allow one segment, or a window below the MSS would stall
+    if (sf->in_flight > 0 && sf->in_flight + len > sf->cwnd) continue;
+    // One that timed out gets what the others have no room for
+    if (best == NULL || sf->timeouts < best->timeouts ||
+        (sf->timeouts == best->timeouts && sf->srtt < best->srtt)) {
+      best = sf;
+    }
+  }
+  return best;
+}
+
+/**
+ * Sends segment `n` of the send window on a subflow.
+ */
+static void send_segment(subflow_t *sf, uint32_t n, uint64_t now) {
+  foggy_socket_t *sock = sf->sock;
+  send_ring_t *ring = &(sock->send_window);
+  uint32_t i = send_ring_slot(ring, n);
+  mp_packet_t *pkt = &(sf->pkts[sf->pn_next & PKT_MASK]);
+
+  debug_printf("Sending packet %d %d on subflow %d\n", ring->seq[i],
+               ring->seq[i] + ring->len[i], sf->id);
+  pkt->seg = n;
+  pkt->len = ring->len[i];
+  pkt->acked = 0;
+  pkt->sent = now;
+  sf->in_flight += ring->len[i];
+  send_with_option(sf, stamp_segment(sock, n, now), OPT_SUBFLOW, sf->pn_next++);
+  if (sock->fec != NULL) fec_on_send(sock, n);
+  if (!timer_pending(&(sf->rto_timer))) {
+    timer_arm(&(sock->timers), &(sf->rto_timer), now + sf->rto);
+  }
+}
+
+void mp_transmit(foggy_socket_t *sock) {
+  struct mp_state *mp = sock->mp;
+  send_ring_t *ring = &(sock->send_window);
+  uint64_t now = get_time_us();
+  subflow_t *sf;
+
+  // What was lost goes first, oldest first
+  if (mp->lost > 0) {
+    mp->lost = 0;
+    for (uint32_t n = ring->head; n != ring->next; ++n) {
+      uint32_t i = send_ring_slot(ring, n);
+      if (!(ring->flags[i] & SEG_LOST)) continue;
+      if ((ring->flags[i] & SEG_SACKED) ||
+          (sf = pick_subflow(mp, ring->len[i])) != NULL) {
+        ring->flags[i] &= ~SEG_LOST;
+        if (!(ring->flags[i] & SEG_SACKED)) send_segment(sf, n, now);
+      } else {
+        mp->lost++;
+      }
+    }
+  }
+
+  // Then new segments, as far as the receiver's window goes
+  while (ring->next != ring->tail) {
+    uint16_t len = ring->len[send_ring_slot(ring, ring->next)];
+    uint32_t in_flight = send_ring_in_flight(ring);
+    if (in_flight > 0 && in_flight + len > sock->window.advertised_window) break;
+    if ((sf = pick_subflow(mp, len)) == NULL) break;
+    send_segment(sf, ring->next++, now);
+  }
+}
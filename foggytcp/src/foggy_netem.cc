@@ -0,0 +1,440 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/*
+ * This file implements the link emulator. The links decide the fate and the
+ * release time of every packet when it is sent; the packets that are not
+ * released right away wait in a heap ordered by release time, served by a
+ * single emulator thread.
+ */
+
+#include "foggy_netem.h"
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+using namespace std;
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+
+#define NETEM_DEFAULT_BURST 1500
+#define NETEM_DEFAULT_LIMIT (100 * 1024)
+
+struct netem_link {
+  netem_config_t cfg;
+  uint64_t rng;
+  int ge_bad;                   // Gilbert-Elliott state
+  double tokens;                // token bucket content in bytes
+  uint64_t tb_time;             // when `tokens` was last brought up to date
+  uint32_t backlog;             // bytes queued at the bottleneck
+  deque<pair<uint64_t, uint32_t> > departures;  // (time, bytes) in the queue
+  uint32_t queued;              // packets of the link in netem_queue
+};
+
+typedef struct {
+  uint64_t release;
+  uint64_t order;  // keeps packets released at the same time in FIFO order
+  netem_link_t *link;
+  int fd;
+  struct sockaddr_in addr;
+  uint8_t *pkt;
+  size_t len;
+} netem_pkt_t;
+
+static bool release_later(const netem_pkt_t &a, const netem_pkt_t &b) {
+  return a.release != b.release ? a.release > b.release : a.order > b.order;
+}
+
+static vector<netem_pkt_t> netem_queue;  // min-heap on release time
+static uint64_t netem_order = 0;
+static uint64_t netem_links = 0;
+static pthread_mutex_t netem_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t netem_cond;
+static pthread_cond_t netem_sent_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t netem_thread_once = PTHREAD_ONCE_INIT;
+
+static netem_config_t env_config;
+static int env_config_valid = 0;
+static pthread_once_t env_config_once = PTHREAD_ONCE_INIT;
+
+static uint64_t now_us() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/* xorshift64*, returns a number in [0, 1) */
+static double next_random(netem_link_t *link) {
+  link->rng ^= link->rng >> 12;
+  link->rng ^= link->rng << 25;
+  link->rng ^= link->rng >> 27;
+  return (link->rng * 0x2545F4914F6CDD1DULL >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int parse_number(const char *value, double *number, const char **unit) {
+  char *end;
+
+  errno = 0;
+  *number = strtod(value, &end);
+  if (errno != 0 || end == value || *number < 0) return -1;
+  *unit = end;
+  return 0;
+}
+
+static int parse_probability(const char *value, double *prob) {
+  const char *unit;
+
+  if (parse_number(value, prob, &unit) < 0) return -1;
+  if (strcmp(unit, "%") == 0) {
+    *prob /= 100;
+  } else if (*unit != '\0') {
+    return -1;
+  }
+  return *prob <= 1 ? 0 : -1;
+}
+
+static int parse_time(const char *value, uint64_t *us) {
+  const char *unit;
+  double number;
+
+  if (parse_number(value, &number, &unit) < 0) return -1;
+  if (strcmp(unit, "s") == 0) {
+    number *= 1000000;
+  } else if (strcmp(unit, "ms") == 0) {
+    number *= 1000;
+  } else if (*unit != '\0' && strcmp(unit, "us") != 0) {
+    return -1;
+  }
+  *us = (uint64_t)number;
+  return 0;
+}
+
+static int parse_rate(const char *value, uint64_t *bytes_per_sec) {
+  const char *unit;
+  double number;
+
+  if (parse_number(value, &number, &unit) < 0) return -1;
+  if (strcmp(unit, "gbit") == 0) {
+    number *= 1e9 / 8;
+  } else if (strcmp(unit, "mbit") == 0) {
+    number *= 1e6 / 8;
+  } else if (strcmp(unit, "kbit") == 0) {
+    number *= 1e3 / 8;
+  } else if (*unit == '\0' || strcmp(unit, "bit") == 0) {
+    number /= 8;
+  } else if (strcmp(unit, "bps") != 0) {
+    return -1;
+  }
+  *bytes_per_sec = (uint64_t)number;
+  return 0;
+}
+
+static int parse_size(const char *value, uint32_t *bytes) {
+  const char *unit;
+  double number;
+
+  if (parse_number(value, &number, &unit) < 0) return -1;
+  if (strcmp(unit, "mb") == 0) {
+    number *= 1024 * 1024;
+  } else if (strcmp(unit, "kb") == 0) {
+    number *= 1024;
+  } else if (*unit != '\0' && strcmp(unit, "b") != 0) {
+    return -1;
+  }
+  if (number > UINT32_MAX) return -1;
+  *bytes = (uint32_t)number;
+  return 0;
+}
+
+static int parse_gilbert_elliott(const char *value, netem_config_t *cfg) {
+  char buf[128];
+  double *fields[4] = {&cfg->ge_p, &cfg->ge_r, &cfg->ge_h, &cfg->ge_k};
+  char *save, *field = buf;
+  int n = 0;
+
+  if (strlen(value) >= sizeof(buf)) return -1;
+  strcpy(buf, value);
+  for (field = strtok_r(buf, ":", &save); field != NULL && n < 4;
+       field = strtok_r(NULL, ":", &save)) {
+    if (parse_probability(field, fields[n++]) < 0) return -1;
+  }
+  return n >= 2 && field == NULL ? 0 : -1;
+}
+
+int netem_parse(const char *spec, netem_config_t *cfg) {
+  char buf[512];
+  char *save, *item, *value;
+  int ret = 0;
+
+  memset(cfg, 0, sizeof(*cfg));
+  cfg->ge_h = 1;
+  cfg->burst = NETEM_DEFAULT_BURST;
+  cfg->limit = NETEM_DEFAULT_LIMIT;
+  if (strlen(spec) >= sizeof(buf)) return -1;
+  strcpy(buf, spec);
+
+  for (item = strtok_r(buf, ",", &save); item != NULL && ret == 0;
+       item = strtok_r(NULL, ",", &save)) {
+    value = strchr(item, '=');
+    if (value == NULL) return -1;
+    *value++ = '\0';
+    if (strcmp(item, "loss") == 0) {
+      ret = parse_probability(value, &cfg->loss);
+    } else if (strcmp(item, "ge") == 0) {
+      ret = parse_gilbert_elliott(value, cfg);
+    } else if (strcmp(item, "delay") == 0) {
+      ret = parse_time(value, &cfg->delay);
+    } else if (strcmp(item, "jitter") == 0) {
+      ret = parse_time(value, &cfg->jitter);
+    } else if (strcmp(item, "reorder") == 0) {
+      ret = parse_probability(value, &cfg->reorder);
+    } else if (strcmp(item, "dup") == 0) {
+      ret = parse_probability(value, &cfg->dup);
+    } else if (strcmp(item, "rate") == 0) {
+      ret = parse_rate(value, &cfg->rate);
+    } else if (strcmp(item, "burst") == 0) {
+      ret = parse_size(value, &cfg->burst);
+    } else if (strcmp(item, "limit") == 0) {
+      ret = parse_size(value, &cfg->limit);
+    } else if (strcmp(item, "seed") == 0) {
+      cfg->seed = strtoull(value, NULL, 0);
+    } else {
+      ret = -1;
+    }
+  }
+  return ret;
+}
+
+static void init_env_config() {
+  const char *spec = getenv("FOGGY_NETEM");
+
+  if (spec == NULL || *spec == '\0') return;
+  if (netem_parse(spec, &env_config) < 0) {
+    fprintf(stderr, "ERROR malformed FOGGY_NETEM \"%s\", ignoring it\n", spec);
+    return;
+  }
+  env_config_valid = 1;
+}
+
+const netem_config_t *netem_env_config() {
+  pthread_once(&env_config_once, init_env_config);
+  return env_config_valid ? &env_config : NULL;
+}
+
+/**
+ * Sends the queued packets as their release time comes.
+ */
+static void *netem_thread(void *in) {
+  (void)in;
+  while (pthread_mutex_lock(&netem_lock) != 0) {
+  }
+  while (1) {
+    if (netem_queue.empty()) {
+      pthread_cond_wait(&netem_cond, &netem_lock);
+      continue;
+    }
+    netem_pkt_t next = netem_queue.front();
+    uint64_t now = now_us();
+    if (next.release > now) {
+      struct timespec deadline;
+      clock_gettime(CLOCK_MONOTONIC, &deadline);
+      uint64_t ns = deadline.tv_nsec + (next.release - now) * 1000;
+      deadline.tv_sec += ns / 1000000000;
+      deadline.tv_nsec = ns % 1000000000;
+      pthread_cond_timedwait(&netem_cond, &netem_lock, &deadline);
+      continue;
+    }
+    pop_heap(netem_queue.begin(), netem_queue.end(), release_later);
+    netem_queue.pop_back();
+    // Sent under the lock so netem_link_destroy() never races with a send on
+    // a socket that is about to be closed
+    sendto(next.fd, next.pkt, next.len, 0, (struct sockaddr *)&next.addr,
+           sizeof(next.addr));
+    free(next.pkt);
+    if (--next.link->queued == 0) {
+      pthread_cond_broadcast(&netem_sent_cond);  // netem_link_flush() waits
+    }
+  }
+  return NULL;
+}
+
+static void start_netem_thread() {
+  pthread_condattr_t attr;
+  pthread_t thread;
+
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&netem_cond, &attr);
+  pthread_condattr_destroy(&attr);
+  pthread_create(&thread, NULL, netem_thread, NULL);
+  pthread_detach(thread);
+}
+
+netem_link_t *netem_link_create(const netem_config_t *cfg) {
+  netem_link_t *link = new netem_link_t;
+  uint64_t id;
+
+  pthread_once(&netem_thread_once, start_netem_thread);
+  while (pthread_mutex_lock(&netem_lock) != 0) {
+  }
+  id = ++netem_links;
+  pthread_mutex_unlock(&netem_lock);
+
+  link->cfg = *cfg;
+  if (cfg->seed != 0) {
+    // Distinct but reproducible streams for the links of a process
+    link->rng = cfg->seed ^ (id * 0x9E3779B97F4A7C15ULL);
+  } else if (getrandom(&link->rng, sizeof(link->rng), 0) !=
+             sizeof(link->rng)) {
+    link->rng = now_us() ^ (id * 0x9E3779B97F4A7C15ULL);
+  }
+  if (link->rng == 0) link->rng = 1;
+  link->ge_bad = 0;
+  link->tokens = cfg->burst;
+  link->tb_time = 0;
+  link->backlog = 0;
+  link->queued = 0;
+  return link;
+}
+
+void netem_link_flush(netem_link_t *link) {
+  if (link == NULL) return;
+
+  while (pthread_mutex_lock(&netem_lock) != 0) {
+  }
+  while (link->queued > 0) {
+    pthread_cond_wait(&netem_sent_cond, &netem_lock);
+  }
+  pthread_mutex_unlock(&netem_lock);
+}
+
+void netem_link_destroy(netem_link_t *link) {
+  if (link == NULL) return;
+  netem_link_flush(link);
+  delete link;
+}
+
+/**
+ * Decides whether a packet is lost.
+ */
+static int link_drops(netem_link_t *link) {
+  const netem_config_t *cfg = &(link->cfg);
+
+  if (cfg->ge_p > 0) {
+    if (link->ge_bad) {
+      if (next_random(link) < cfg->ge_r) link->ge_bad = 0;
+    } else if (next_random(link) < cfg->ge_p) {
+      link->ge_bad = 1;
+    }
+    return next_random(link) < (link->ge_bad ? cfg->ge_h : cfg->ge_k);
+  }
+  return cfg->loss > 0 && next_random(link) < cfg->loss;
+}
+
+/**
+ * Runs a packet through the bottleneck.
+ *
+ * @return When the packet leaves the bottleneck, or 0 if the queue is full.
+ */
+static uint64_t link_departure(netem_link_t *link, uint64_t now, size_t len) {
+  const netem_config_t *cfg = &(link->cfg);
+
+  if (cfg->rate == 0) return now;
+
+  while (!link->departures.empty() && link->departures.front().first <= now) {
+    link->backlog -= link->departures.front().second;
+    link->departures.pop_front();
+  }
+  if (link->backlog + len > cfg->limit) return 0;
+
+  // The queue is FIFO, nothing leaves before the packet ahead of it
+  uint64_t start = MAX(now, link->tb_time);
+  double tokens = MIN((double)cfg->burst,
+                      link->tokens + (start - link->tb_time) * 1e-6 * cfg->rate);
+  if (tokens < len) {
+    start += (uint64_t)ceil((len - tokens) * 1e6 / cfg->rate);
+    tokens = len;
+  }
+  link->tokens = tokens - len;
+  link->tb_time = start;
+  link->backlog += len;
+  link->departures.push_back(make_pair(start, (uint32_t)len));
+  return MAX(start, 1);
+}
+
+static void queue_packet(netem_link_t *link, int fd,
+                         const struct sockaddr_in *addr, const uint8_t *pkt,
+                         size_t len, uint64_t release) {
+  netem_pkt_t entry;
+
+  entry.release = release;
+  entry.order = netem_order++;
+  entry.link = link;
+  entry.fd = fd;
+  entry.addr = *addr;
+  entry.pkt = (uint8_t *)malloc(len);
+  memcpy(entry.pkt, pkt, len);
+  entry.len = len;
+  link->queued++;
+  netem_queue.push_back(entry);
+  push_heap(netem_queue.begin(), netem_queue.end(), release_later);
+  if (netem_queue.front().order == entry.order) {
+    pthread_cond_signal(&netem_cond);  // new earliest deadline
+  }
+}
+
+void netem_send(netem_link_t *link, int fd, const struct sockaddr_in *addr,
+                const uint8_t *pkt, size_t len) {
+  const netem_config_t *cfg = &(link->cfg);
+  uint64_t now = now_us(), departure, release;
+  int copies;
+
+  while (pthread_mutex_lock(&netem_lock) != 0) {
+  }
+  if (link_drops(link)) {
+    pthread_mutex_unlock(&netem_lock);
+    return;
+  }
+  departure = link_departure(link, now, len);
+  if (departure == 0) {
+    pthread_mutex_unlock(&netem_lock);
+    return;
+  }
+
+  copies = cfg->dup > 0 && next_random(link) < cfg->dup ? 2 : 1;
+  for (int i = 0; i < copies; ++i) {
+    release = departure;
+    if (cfg->reorder == 0 || next_random(link) >= cfg->reorder) {
+      release += cfg->delay;
+      if (cfg->jitter > 0) {
+        double offset = (2 * next_random(link) - 1) * cfg->jitter;
+        release = offset < 0 && (uint64_t)-offset > release - departure
+                      ? departure
+                      : (uint64_t)(release + offset);
+      }
+    }
+    if (release <= now && netem_queue.empty()) {
+      sendto(fd, pkt, len, 0, (const struct sockaddr *)addr, sizeof(*addr));
+    } else {
+      queue_packet(link, fd, addr, pkt, len, release);
+    }
+  }
+  pthread_mutex_unlock(&netem_lock);
+}
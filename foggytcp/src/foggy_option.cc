@@ -0,0 +1,67 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/*
+ * This file implements building and parsing of header extension options.
+ */
+
+#include "foggy_option.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+uint8_t *create_packet_ext(uint16_t src, uint16_t dst, uint32_t seq,
+                           uint32_t ack, uint8_t flags, uint16_t adv_window,
+                           uint16_t ext_len, const uint8_t *ext_data,
+                           const uint8_t *payload, uint16_t payload_len) {
+  uint16_t hlen = sizeof(foggy_tcp_header_t) + ext_len;
+  uint8_t *packet = (uint8_t *)malloc(hlen + payload_len);
+  if (packet == NULL) {
+    return NULL;
+  }
+
+  foggy_tcp_header_t *header = (foggy_tcp_header_t *)packet;
+  set_header(header, src, dst, seq, ack, hlen, hlen + payload_len, flags,
+             adv_window, 0, NULL);
+  set_extension_length(header, ext_len);
+  memcpy(get_extension_data(header), ext_data, ext_len);
+  memcpy(get_payload(packet), payload, payload_len);
+  return packet;
+}
+
+uint16_t put_option(uint8_t *ext, uint8_t kind, const void *value,
+                    uint8_t value_len) {
+  ext[0] = kind;
+  ext[1] = value_len + 2;
+  memcpy(ext + 2, value, value_len);
+  return value_len + 2;
+}
+
+uint8_t *find_option(uint8_t *pkt, uint8_t kind, uint8_t *value_len) {
+  foggy_tcp_header_t *hdr = (foggy_tcp_header_t *)pkt;
+  uint16_t ext_len = get_extension_length(hdr);
+  uint8_t *ext = get_extension_data(hdr);
+  uint16_t off = 0;
+
+  if (sizeof(foggy_tcp_header_t) + ext_len > get_plen(hdr)) {
+    return NULL;
+  }
+  while (off + 2 <= ext_len) {
+    uint8_t len = ext[off + 1];
+    if (len < 2 || off + len > ext_len) {
+      return NULL;
+    }
+    if (ext[off] == kind) {
+      if (value_len != NULL) *value_len = len - 2;
+      return ext + off + 2;
+    }
+    off += len;
+  }
+  return NULL;
+}
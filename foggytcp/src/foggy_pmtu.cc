@@ -0,0 +1,181 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/*
+ * This file implements the segment size negotiation and path MTU discovery.
+ */
+
+#include "foggy_pmtu.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "foggy_function.h"
+#include "foggy_option.h"
+#include "foggy_trace.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+#define HEADER_LEN ((uint16_t)sizeof(foggy_tcp_header_t))
+
+/**
+ * Makes a validated packet size the one data segments use.
+ */
+static void set_plpmtu(foggy_socket_t *sock, uint16_t size) {
+  sock->pmtu.plpmtu = size;
+  sock->mss = size - HEADER_LEN;
+}
+
+/**
+ * Picks the next size to probe, or ends the search.
+ */
+static void next_probe(foggy_socket_t *sock, uint64_t now) {
+  pmtu_t *pmtu = &(sock->pmtu);
+
+  pmtu->probes = 0;
+  if (pmtu->high - pmtu->plpmtu <= PMTU_STEP) {
+    debug_printf("Path MTU search done at %d\n", pmtu->plpmtu);
+    pmtu->probe_size = 0;
+    timer_arm(&(sock->timers), &(pmtu->timer), now + PMTU_RAISE_INTERVAL);
+    return;
+  }
+  // Try the ceiling first, it is all there is to find on loopback
+  if (pmtu->high > pmtu->max) {
+    pmtu->probe_size = pmtu->max;
+  } else {
+    pmtu->probe_size = pmtu->plpmtu + (pmtu->high - pmtu->plpmtu) / 2;
+  }
+  timer_arm(&(sock->timers), &(pmtu->timer), now);
+}
+
+/**
+ * Sends the next probe or retries the outstanding one.
+ */
+static void probe_timeout(void *arg) {
+  foggy_socket_t *sock = (foggy_socket_t *)arg;
+  pmtu_t *pmtu = &(sock->pmtu);
+  uint64_t now = get_time_us();
+
+  if (sock->fin_sent) return;  // not worth it any more
+  if (sock->connected != 2) {
+    timer_arm(&(sock->timers), &(pmtu->timer), now + sock->window.rto);
+    return;
+  }
+
+  if (pmtu->probe_size == 0) {
+    // Time to look for a larger size again
+    pmtu->high = pmtu->max + 1;
+    next_probe(sock, now);
+    if (pmtu->probe_size == 0) return;
+  } else if (pmtu->probes == PMTU_MAX_PROBES) {
+    debug_printf("Path MTU probe of %d bytes lost\n", pmtu->probe_size);
+    pmtu->high = pmtu->probe_size;
+    next_probe(sock, now);
+    if (pmtu->probe_size == 0) return;
+  }
+
+  // The padding fills the probe up to the size being tested
+  uint16_t size = htons(pmtu->probe_size);
+  uint8_t ext[OPT_PROBE_LEN];
+  uint16_t ext_len = put_option(ext, OPT_PROBE, &size, sizeof(size));
+  uint16_t overhead = HEADER_LEN + ext_len +
+                      ((sock->caps & CAP_CRC32C) ? OPT_CRC32C_LEN : 0);
+  uint16_t padding_len = pmtu->probe_size - overhead;
+  uint8_t *padding = (uint8_t *)calloc(padding_len, 1);
+  uint8_t *probe = create_socket_packet(
+      sock, sock->window.last_byte_sent, sock->window.next_seq_expected,
+      ACK_FLAG_MASK, ext_len, ext, padding, padding_len);
+  send_packet(sock, probe);
+  free(probe);
+  free(padding);
+  pmtu->probes++;
+  timer_arm(&(sock->timers), &(pmtu->timer),
+            now + MAX(sock->window.rto, sock->opts.rto_min));
+}
+
+void pmtu_init(foggy_socket_t *sock) {
+  const char *env = getenv("FOGGY_MSS");
+  long mss = env != NULL ? atol(env) : PMTU_MAX - HEADER_LEN;
+
+  sock->local_mss = MIN(MAX(mss, (long)MSS), (long)(PMTU_MAX - HEADER_LEN));
+  sock->mss = MSS;
+  memset(&(sock->pmtu), 0, sizeof(sock->pmtu));
+  sock->pmtu.plpmtu = PMTU_BASE;
+  timer_init(&(sock->pmtu.timer), probe_timeout, sock);
+
+  // Probes must not be fragmented, or every size would seem to get through
+  if (sock->local_mss > MSS) {
+    int mode = IP_PMTUDISC_PROBE;
+    setsockopt(sock->socket, IPPROTO_IP, IP_MTU_DISCOVER, &mode, sizeof(mode));
+  }
+}
+
+void pmtu_start(foggy_socket_t *sock, uint8_t *pkt) {
+  pmtu_t *pmtu = &(sock->pmtu);
+  uint8_t len = 0;
+  uint8_t *opt = find_option(pkt, OPT_MSS, &len);
+  uint16_t peer_mss = 0;
+
+  if (opt == NULL || len != sizeof(peer_mss)) return;  // the peer cannot probe
+  memcpy(&peer_mss, opt, sizeof(peer_mss));
+  peer_mss = MIN(ntohs(peer_mss), sock->local_mss);
+  if (peer_mss <= MSS || pmtu->max != 0) return;
+
+  pmtu->max = peer_mss + HEADER_LEN;
+  pmtu->high = pmtu->max + 1;
+  next_probe(sock, get_time_us());
+}
+
+int pmtu_on_recv(foggy_socket_t *sock, uint8_t *pkt) {
+  pmtu_t *pmtu = &(sock->pmtu);
+  uint8_t len = 0;
+  uint8_t *opt;
+  uint16_t size;
+
+  if ((opt = find_option(pkt, OPT_PROBE, &len)) != NULL) {
+    if (len != sizeof(size)) return 1;
+    // Echo the size so the prober can tell answers to retries apart
+    uint8_t ext[OPT_PROBE_LEN];
+    uint16_t ext_len = put_option(ext, OPT_PROBE_ACK, opt, sizeof(size));
+    uint8_t *ack_pkt = create_socket_packet(
+        sock, sock->window.last_byte_sent, sock->window.next_seq_expected,
+        ACK_FLAG_MASK, ext_len, ext, NULL, 0);
+    send_packet(sock, ack_pkt);
+    free(ack_pkt);
+    return 1;
+  }
+  if ((opt = find_option(pkt, OPT_PROBE_ACK, &len)) != NULL) {
+    if (len != sizeof(size)) return 1;
+    memcpy(&size, opt, sizeof(size));
+    size = ntohs(size);
+    if (pmtu->probe_size != 0 && size == pmtu->probe_size) {
+      debug_printf("Path MTU probe of %d bytes answered\n", size);
+      set_plpmtu(sock, size);
+      next_probe(sock, get_time_us());
+    }
+    return 1;
+  }
+  return 0;
+}
+
+void pmtu_on_rto(foggy_socket_t *sock, uint16_t plen) {
+  pmtu_t *pmtu = &(sock->pmtu);
+
+  if (plen <= PMTU_BASE || sock->rto_retries < PMTU_BLACKHOLE_RTOS) return;
+  info_printf("Packets of %d bytes stopped getting through, back to %d\n",
+              plen, PMTU_BASE);
+  pmtu->high = MIN(pmtu->high, plen);
+  set_plpmtu(sock, PMTU_BASE);
+  pmtu->probe_size = 0;
+  timer_arm(&(sock->timers), &(pmtu->timer),
+            get_time_us() + PMTU_RAISE_INTERVAL);
+}
@@ -0,0 +1,88 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/*
+ * This file implements the send window ring.
+ */
+
+#include "foggy_ring.h"
+
+#include <stdlib.h>
+
+static void alloc_arrays(send_ring_t *ring, uint32_t size) {
+  ring->msg = (uint8_t **)malloc(size * sizeof(*ring->msg));
+  ring->seq = (uint32_t *)malloc(size * sizeof(*ring->seq));
+  ring->len = (uint16_t *)malloc(size * sizeof(*ring->len));
+  ring->send_time = (uint64_t *)malloc(size * sizeof(*ring->send_time));
+  ring->retx = (uint8_t *)malloc(size * sizeof(*ring->retx));
+  ring->flags = (uint8_t *)malloc(size * sizeof(*ring->flags));
+  ring->mask = size - 1;
+}
+
+static void free_arrays(send_ring_t *ring) {
+  free(ring->msg);
+  free(ring->seq);
+  free(ring->len);
+  free(ring->send_time);
+  free(ring->retx);
+  free(ring->flags);
+}
+
+/**
+ * Doubles the size of a full ring. Segment numbers do not change, only the
+ * indices they map to.
+ */
+static void grow(send_ring_t *ring) {
+  send_ring_t old = *ring;
+
+  alloc_arrays(ring, 2 * (old.mask + 1));
+  for (uint32_t n = old.head; n != old.tail; ++n) {
+    uint32_t from = send_ring_slot(&old, n), to = send_ring_slot(ring, n);
+    ring->msg[to] = old.msg[from];
+    ring->seq[to] = old.seq[from];
+    ring->len[to] = old.len[from];
+    ring->send_time[to] = old.send_time[from];
+    ring->retx[to] = old.retx[from];
+    ring->flags[to] = old.flags[from];
+  }
+  free_arrays(&old);
+}
+
+void send_ring_init(send_ring_t *ring) {
+  alloc_arrays(ring, SEND_RING_INITIAL_SIZE);
+  ring->head = ring->next = ring->tail = 0;
+}
+
+void send_ring_destroy(send_ring_t *ring) {
+  while (!send_ring_empty(ring)) {
+    free(send_ring_pop(ring));
+  }
+  free_arrays(ring);
+}
+
+void send_ring_push(send_ring_t *ring, uint8_t *msg, uint32_t seq,
+                    uint16_t len) {
+  if (ring->tail - ring->head == ring->mask + 1) {
+    grow(ring);
+  }
+  uint32_t i = send_ring_slot(ring, ring->tail++);
+  ring->msg[i] = msg;
+  ring->seq[i] = seq;
+  ring->len[i] = len;
+  ring->send_time[i] = 0;
+  ring->retx[i] = 0;
+  ring->flags[i] = 0;
+}
+
+uint8_t *send_ring_pop(send_ring_t *ring) {
+  uint8_t *msg = ring->msg[send_ring_slot(ring, ring->head)];
+  if (ring->next == ring->head) ring->next++;
+  ring->head++;
+  return msg;
+}
@@ -0,0 +1,406 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/* This file implements the tunables of a socket, see foggy_sockopt.h. */
+
+#include "foggy_sockopt.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sysinfo.h>
+
+#include "foggy_backend.h"
+#include "foggy_busy.h"
+#include "foggy_option.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+
+static pthread_once_t env_opts_once = PTHREAD_ONCE_INIT;
+static foggy_sockopts_t env_opts;
+static int env_cpus = 1;  // CPUs in the FOGGY_SOCKOPTS range from env_opts.cpu
+static atomic<int> env_cpu_next{0};  // the next socket is pinned to
+
+static void default_opts(foggy_sockopts_t *opts) {
+  opts->sndbuf = MAX_NETWORK_BUFFER;
+  opts->rcvbuf = MAX_NETWORK_BUFFER;
+  opts->init_cwnd = WINDOW_INITIAL_WINDOW_SIZE;
+  opts->init_ssthresh = WINDOW_INITIAL_SSTHRESH;
+  opts->rto_init = WINDOW_INITIAL_RTT * 1000;
+  opts->rto_min = RTO_MIN;
+  opts->rto_max = RTO_MAX;
+  opts->congestion = FOGGY_CC_RENO;
+  opts->pacing = 0;
+  opts->delack = 0;
+  opts->busy_poll = 0;
+  opts->cpu = -1;
+  opts->linger = 0;
+}
+
+/**
+ * Sets one option, clamping sizes to what the socket supports.
+ *
+ * @return 0 on success, -1 if the value makes no sense for the option.
+ */
+static int set_option(foggy_sockopts_t *opts, int option, int value) {
+  uint32_t v = (uint32_t)value;
+
+  if (value < 0 && !(option == FOGGY_CPU && value == -1)) return -1;
+  switch (option) {
+    case FOGGY_SO_SNDBUF:
+      opts->sndbuf = MIN(MAX(v, 2 * (uint32_t)MSS), SOCKOPT_BUF_MAX);
+      break;
+    case FOGGY_SO_RCVBUF:
+      opts->rcvbuf = MIN(MAX(v, 2 * (uint32_t)MSS), SOCKOPT_BUF_MAX);
+      break;
+    case FOGGY_INIT_CWND:
+      opts->init_cwnd = MIN(MAX(v, (uint32_t)MSS), SOCKOPT_BUF_MAX);
+      break;
+    case FOGGY_INIT_SSTHRESH:
+      opts->init_ssthresh = MAX(v, 2 * (uint32_t)MSS);
+      break;
+    case FOGGY_RTO_INIT:
+      if (v < opts->rto_min || v > opts->rto_max) return -1;
+      opts->rto_init = v;
+      break;
+    case FOGGY_RTO_MIN:
+      if (v < TIMER_TICK_US || v > opts->rto_max) return -1;
+      opts->rto_min = v;
+      opts->rto_init = MAX(opts->rto_init, v);
+      break;
+    case FOGGY_RTO_MAX:
+      if (v < opts->rto_min) return -1;
+      opts->rto_max = v;
+      opts->rto_init = MIN(opts->rto_init, v);
+      break;
+    case FOGGY_CONGESTION:
+      if (v != FOGGY_CC_RENO && v != FOGGY_CC_CUBIC) return -1;
+      opts->congestion = v;
+      break;
+    case FOGGY_PACING:
+      opts->pacing = v != 0;
+      break;
+    case FOGGY_DELACK:
+      opts->delack = MIN(v, DELACK_MAX);
+      break;
+    case FOGGY_BUSY_POLL:
+      opts->busy_poll = MIN(v, BUSY_POLL_MAX);
+      break;
+    case FOGGY_CPU:
+      if (value >= get_nprocs_conf() || value >= CPU_SETSIZE) return -1;
+      opts->cpu = value;
+      break;
+    case FOGGY_LINGER:
+      opts->linger = v != 0;
+      break;
+    default:
+      return -1;
+  }
+  return 0;
+}
+
+static int get_option(const foggy_sockopts_t *opts, int option, int *value) {
+  switch (option) {
+    case FOGGY_SO_SNDBUF: *value = opts->sndbuf; break;
+    case FOGGY_SO_RCVBUF: *value = opts->rcvbuf; break;
+    case FOGGY_INIT_CWND: *value = opts->init_cwnd; break;
+    case FOGGY_INIT_SSTHRESH: *value = opts->init_ssthresh; break;
+    case FOGGY_RTO_INIT: *value = opts->rto_init; break;
+    case FOGGY_RTO_MIN: *value = opts->rto_min; break;
+    case FOGGY_RTO_MAX: *value = opts->rto_max; break;
+    case FOGGY_CONGESTION: *value = opts->congestion; break;
+    case FOGGY_PACING: *value = opts->pacing; break;
+    case FOGGY_DELACK: *value = opts->delack; break;
+    case FOGGY_BUSY_POLL: *value = opts->busy_poll; break;
+    case FOGGY_CPU: *value = opts->cpu; break;
+    case FOGGY_LINGER: *value = opts->linger; break;
+    default: return -1;
+  }
+  return 0;
+}
+
+/**
+ * Parses a number with an optional unit, e.g. "4mb".
+ *
+ * @param value The text.
+ * @param units The unit names, NULL terminated. The first one is the default.
+ * @param scales What each unit is worth.
+ *
+ * @return The number in the first unit, -1 if it is malformed or does not
+ *         fit an int.
+ */
+static long parse_scaled(const char *value, const char *const *units,
+                         const double *scales) {
+  char *end;
+  double number;
+  int i = 0;
+
+  errno = 0;
+  number = strtod(value, &end);
+  if (errno != 0 || end == value || number < 0) return -1;
+  if (*end != '\0') {
+    while (units[i] != NULL && strcmp(end, units[i]) != 0) i++;
+    if (units[i] == NULL) return -1;
+  }
+  number *= scales[i];
+  return number <= INT32_MAX ? (long)number : -1;
+}
+
+static const char *const size_units[] = {"b", "kb", "mb", NULL};
+static const double size_scales[] = {1, 1024, 1024 * 1024};
+static const char *const time_units[] = {"us", "ms", "s", NULL};
+static const double time_scales[] = {1, 1000, 1000000};
+
+/**
+ * Parses a FOGGY_SOCKOPTS specification on top of the options given.
+ *
+ * @return 0 on success, -1 if it is malformed.
+ */
+static int parse_opts(const char *spec, foggy_sockopts_t *opts) {
+  char buf[512];
+  char *save, *item, *value;
+  long number;
+  int option;
+
+  if (strlen(spec) >= sizeof(buf)) return -1;
+  strcpy(buf, spec);
+
+  for (item = strtok_r(buf, ",", &save); item != NULL;
+       item = strtok_r(NULL, ",", &save)) {
+    value = strchr(item, '=');
+    if (value == NULL) return -1;
+    *value++ = '\0';
+    if (strcmp(item, "cc") == 0) {
+      number = strcmp(value, "reno") == 0    ? FOGGY_CC_RENO
+               : strcmp(value, "cubic") == 0 ? FOGGY_CC_CUBIC
+                                             : -1;
+      option = FOGGY_CONGESTION;
+    } else if (strcmp(item, "sndbuf") == 0 || strcmp(item, "rcvbuf") == 0) {
+      number = parse_scaled(value, size_units, size_scales);
+      option = item[0] == 's' ? FOGGY_SO_SNDBUF : FOGGY_SO_RCVBUF;
+    } else if (strcmp(item, "init_cwnd") == 0) {
+      number = atol(value);  // segments
+      number = number > 0 && number <= (long)(SOCKOPT_BUF_MAX / MSS)
+                   ? number * MSS
+                   : -1;
+      option = FOGGY_INIT_CWND;
+    } else if (strcmp(item, "init_ssthresh") == 0) {
+      number = parse_scaled(value, size_units, size_scales);
+      option = FOGGY_INIT_SSTHRESH;
+    } else if (strcmp(item, "rto_init") == 0) {
+      number = parse_scaled(value, time_units, time_scales);
+      option = FOGGY_RTO_INIT;
+    } else if (strcmp(item, "rto_min") == 0) {
+      number = parse_scaled(value, time_units, time_scales);
+      option = FOGGY_RTO_MIN;
+    } else if (strcmp(item, "rto_max") == 0) {
+      number = parse_scaled(value, time_units, time_scales);
+      option = FOGGY_RTO_MAX;
+    } else if (strcmp(item, "delack") == 0) {
+      number = parse_scaled(value, time_units, time_scales);
+      option = FOGGY_DELACK;
+    } else if (strcmp(item, "pacing") == 0) {
+      number = atoi(value);
+      option = FOGGY_PACING;
+    } else if (strcmp(item, "linger") == 0) {
+      number = atoi(value);
+      option = FOGGY_LINGER;
+    } else if (strcmp(item, "busy_poll") == 0) {
+      number = parse_scaled(value, time_units, time_scales);
+      option = FOGGY_BUSY_POLL;
+    } else if (strcmp(item, "cpu") == 0) {
+      // One CPU, or a range the sockets are spread over
+      char *end;
+      number = strtol(value, &end, 10);
+      env_cpus = 1;
+      if (end != value && *end == '-') {
+        env_cpus = (int)(strtol(end + 1, &end, 10) - number + 1);
+      }
+      if (end == value || *end != '\0' || env_cpus < 1) return -1;
+      option = FOGGY_CPU;
+    } else {
+      return -1;
+    }
+    if (number < 0 || set_option(opts, option, (int)number) < 0) return -1;
+  }
+  return 0;
+}
+
+static void init_env_opts() {
+  const char *spec = getenv("FOGGY_SOCKOPTS");
+
+  default_opts(&env_opts);
+  if (spec == NULL || *spec == '\0') return;
+  if (parse_opts(spec, &env_opts) < 0) {
+    fprintf(stderr, "ERROR malformed FOGGY_SOCKOPTS \"%s\", ignoring it\n",
+            spec);
+    default_opts(&env_opts);
+  }
+}
+
+void sockopt_init(foggy_socket_t *sock) {
+  pthread_once(&env_opts_once, init_env_opts);
+  sock->opts = env_opts;
+  if (env_opts.cpu >= 0) {
+    sock->opts.cpu = env_opts.cpu + env_cpu_next.fetch_add(1) % env_cpus;
+    if (sock->opts.cpu >= get_nprocs_conf()) sock->opts.cpu = -1;
+  }
+  sock->new_opts = sock->opts;
+  sock->opts_changed = 0;
+  sock->wscale_ok = 0;
+  sock->snd_wscale = 0;
+  sock->rcv_wscale = 0;
+  sock->receive_window = NULL;
+  sock->rcv_slots = 0;
+  sock->spin_budget = 0;
+  sock->cpu = -1;
+  sockopt_reserve(sock, sock->opts.rcvbuf);
+}
+
+void sockopt_apply(foggy_socket_t *sock) {
+  window_t *win = &(sock->window);
+  foggy_sockopts_t *opts = &(sock->opts);
+
+  if (!sock->opts_changed) return;
+  sock->opts_changed = 0;
+  if (sock->new_opts.congestion != opts->congestion) {
+    win->epoch = 0;
+    win->w_max = 0;
+  }
+  *opts = sock->new_opts;
+
+  // The initial values hold until data went out and an RTT was measured
+  if (sock->stats.bytes_sent.load(memory_order_relaxed) == 0) {
+    win->congestion_window = opts->init_cwnd;
+    win->ssthresh = opts->init_ssthresh;
+  }
+  if (win->srtt == 0) {
+    win->rto = opts->rto_init;
+  }
+  win->rto = MIN(MAX(win->rto, opts->rto_min), opts->rto_max);
+  if (!opts->pacing) {
+    timer_cancel(&(sock->timers), &(sock->pace_timer));
+  }
+  busy_apply(sock);
+}
+
+void sockopt_reserve(foggy_socket_t *sock, uint32_t rcvbuf) {
+  int slots = MAX(RECEIVE_WINDOW_SLOT_SIZE, (int)((rcvbuf + MSS - 1) / MSS));
+
+  if (slots <= sock->rcv_slots) return;
+  sock->receive_window = (receive_window_slot_t *)realloc(
+      sock->receive_window, slots * sizeof(receive_window_slot_t));
+  for (int i = sock->rcv_slots; i < slots; ++i) {
+    sock->receive_window[i].is_used = 0;
+    sock->receive_window[i].msg = NULL;
+  }
+  sock->rcv_slots = slots;
+}
+
+/**
+ * Returns the smallest window scale shift that fits a receive buffer in the
+ * 16 bit window field.
+ */
+static uint8_t wscale_for(uint32_t rcvbuf) {
+  uint8_t shift = 0;
+
+  while (shift < WSCALE_MAX && (rcvbuf >> shift) > UINT16_MAX) shift++;
+  return shift;
+}
+
+uint16_t sockopt_put_wscale(foggy_socket_t *sock, uint8_t *ext) {
+  if (sock->type == TCP_INITIATOR) {
+    sock->rcv_wscale = wscale_for(sock->opts.rcvbuf);
+  } else if (!sock->wscale_ok) {
+    return 0;  // the initiator does not scale
+  }
+  return put_option(ext, OPT_WSCALE, &(sock->rcv_wscale), 1);
+}
+
+void sockopt_start(foggy_socket_t *sock, uint8_t *pkt) {
+  uint8_t len = 0;
+  uint8_t *opt = find_option(pkt, OPT_WSCALE, &len);
+
+  sock->wscale_ok = opt != NULL && len == 1;
+  if (!sock->wscale_ok) {
+    sock->snd_wscale = 0;
+    sock->rcv_wscale = 0;
+    return;
+  }
+  sock->snd_wscale = MIN(*opt, WSCALE_MAX);
+  if (sock->type != TCP_INITIATOR) {
+    sock->rcv_wscale = wscale_for(sock->opts.rcvbuf);
+  }
+}
+
+uint16_t sockopt_advertise(foggy_socket_t *sock, uint8_t flags) {
+  uint32_t rcvbuf = sock->opts.rcvbuf, window;
+  uint8_t shift = (flags & SYN_FLAG_MASK) ? 0 : sock->rcv_wscale;
+
+  // Decompressed data may hold more than the window it came in, and a window
+  // below the MSS would stall the sender
+  window = (uint32_t)sock->received_len < rcvbuf - MSS
+               ? rcvbuf - (uint32_t)sock->received_len
+               : MSS;
+  sock->last_adv = window;
+  window = (window + (1 << shift) - 1) >> shift;
+  return MIN(window, UINT16_MAX);
+}
+
+uint32_t sockopt_peer_window(foggy_socket_t *sock, foggy_tcp_header_t *hdr) {
+  uint8_t shift = (get_flags(hdr) & SYN_FLAG_MASK) ? 0 : sock->snd_wscale;
+  return (uint32_t)get_advertised_window(hdr) << shift;
+}
+
+int foggy_setsockopt(void *in_sock, foggy_sockopt_t option, int value) {
+  struct foggy_socket_t *sock = (struct foggy_socket_t *)in_sock;
+  foggy_sockopts_t opts;
+
+  if (sock == NULL) {
+    perror("ERROR null socket");
+    return EXIT_ERROR;
+  }
+  while (pthread_mutex_lock(&(sock->recv_lock)) != 0) {
+  }
+  while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+  }
+  opts = sock->new_opts;
+  if (set_option(&opts, option, value) < 0) {
+    pthread_mutex_unlock(&(sock->send_lock));
+    pthread_mutex_unlock(&(sock->recv_lock));
+    perror("ERROR invalid socket option");
+    return EXIT_ERROR;
+  }
+  // The slots come first, the backend sees the larger buffer only after
+  sockopt_reserve(sock, opts.rcvbuf);
+  sock->new_opts = opts;
+  sock->opts_changed = 1;
+  pthread_cond_broadcast(&(sock->send_cond));  // a larger send buffer has room
+  pthread_mutex_unlock(&(sock->send_lock));
+  pthread_mutex_unlock(&(sock->recv_lock));
+  notify_backend(sock);
+  return EXIT_SUCCESS;
+}
+
+int foggy_getsockopt(void *in_sock, foggy_sockopt_t option, int *value) {
+  struct foggy_socket_t *sock = (struct foggy_socket_t *)in_sock;
+  int ret;
+
+  if (sock == NULL || value == NULL) {
+    return EXIT_ERROR;
+  }
+  while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+  }
+  ret = get_option(&(sock->new_opts), option, value);
+  pthread_mutex_unlock(&(sock->send_lock));
+  return ret < 0 ? EXIT_ERROR : EXIT_SUCCESS;
+}
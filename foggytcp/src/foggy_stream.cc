@@ -0,0 +1,672 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/*
+ * This file implements multiplexed streams, and the application interface
+ * to them.
+ */
+
+#include "foggy_stream.h"
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "foggy_backend.h"
+#include "foggy_function.h"
+#include "foggy_option.h"
+#include "foggy_trace.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+#define MARKS_MASK (STREAM_MARKS - 1)
+
+static stream_t *find_stream(struct stream_table *tab, int id) {
+  for (int i = 0; i < STREAM_MAX; ++i) {
+    if (tab->streams[i].id == id) return &(tab->streams[i]);
+  }
+  return NULL;
+}
+
+/**
+ * Takes a free slot for a stream.
+ *
+ * Must be called with recv_lock and send_lock held.
+ *
+ * @return The stream, NULL if all slots are taken.
+ */
+static stream_t *new_stream(struct stream_table *tab, int id) {
+  for (int i = 1; i < STREAM_MAX; ++i) {
+    stream_t *s = &(tab->streams[i]);
+    if (s->id >= 0) continue;
+    memset(s, 0, sizeof(*s));
+    s->id = id;
+    s->send_limit = STREAM_WINDOW;
+    s->announced = STREAM_WINDOW;
+    return s;
+  }
+  return NULL;
+}
+
+static void free_stream(stream_t *s) {
+  free(s->send_buf);
+  free(s->recv_buf);
+  for (int i = 0; i < s->piece_count; ++i) {
+    free(s->pieces[i].data);
+  }
+  s->id = -1;
+}
+
+/**
+ * Lets the next stream out of credit send its probe.
+ */
+static void probe_timeout(void *arg) {
+  ((foggy_socket_t *)arg)->streams->probe = 1;
+}
+
+void stream_init(foggy_socket_t *sock) {
+  const char *env = getenv("FOGGY_STREAMS");
+
+  sock->streams = NULL;
+  sock->mux = env != NULL && atoi(env) != 0;
+  if (sock->mux) {
+    sock->caps_wanted |= CAP_STREAMS;
+  }
+}
+
+void stream_start(foggy_socket_t *sock) {
+  struct stream_table *tab;
+  int initiator = sock->type == TCP_INITIATOR;
+
+  if (sock->streams != NULL) return;
+  tab = (struct stream_table *)malloc(sizeof(*tab));
+  for (int i = 0; i < STREAM_MAX; ++i) {
+    tab->streams[i].id = -1;
+  }
+  memset(&(tab->streams[0]), 0, sizeof(stream_t));
+  tab->streams[0].accepted = 1;
+
+  // Stream 0 goes on after what a fast open SYN delivered
+  while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+  }
+  tab->streams[0].send_offset = sock->bytes_written - sock->sending_len;
+  pthread_mutex_unlock(&(sock->send_lock));
+
+  tab->next_id = initiator ? 2 : 1;
+  tab->max_peer_id = initiator ? -1 : 0;
+  tab->accept_next = initiator ? 1 : 2;
+  tab->rr = 0;
+  tab->update = 0;
+  tab->wakeup = 0;
+  tab->buffered = 0;
+  tab->announce_count = 0;
+  tab->probe = 0;
+  tab->probe_backoff = 0;
+  timer_init(&(tab->probe_timer), probe_timeout, sock);
+  tab->marks_head = tab->marks_tail = 0;
+  tab->raw_acked = tab->streams[0].send_offset;
+  sock->streams = tab;
+}
+
+void stream_destroy(foggy_socket_t *sock) {
+  struct stream_table *tab = sock->streams;
+
+  if (tab == NULL) return;
+  timer_cancel(&(sock->timers), &(tab->probe_timer));
+  for (int i = 1; i < STREAM_MAX; ++i) {
+    if (tab->streams[i].id >= 0) free_stream(&(tab->streams[i]));
+  }
+  free(tab);
+  sock->streams = NULL;
+}
+
+/**
+ * Opens the peer's streams up to `id`, which the peer just used for the
+ * first time.
+ *
+ * @return 1 if the stream is open now, 0 if there are not enough free slots,
+ *         -1 if it is not a stream the peer may open (e.g. one forgotten
+ *         already).
+ */
+static int open_peer_streams(foggy_socket_t *sock, int id) {
+  struct stream_table *tab = sock->streams;
+  int parity = sock->type == TCP_INITIATOR ? 1 : 0, free_slots = 0;
+
+  if ((id & 1) != parity || id <= tab->max_peer_id) return -1;
+  for (int i = 1; i < STREAM_MAX; ++i) {
+    free_slots += tab->streams[i].id < 0;
+  }
+  if ((id - tab->max_peer_id) / 2 > free_slots) return 0;
+
+  while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+  }
+  for (int k = tab->max_peer_id + 2; k <= id; k += 2) {
+    new_stream(tab, k);
+  }
+  pthread_mutex_unlock(&(sock->send_lock));
+  tab->max_peer_id = id;
+  tab->wakeup = 1;
+  return 1;
+}
+
+/**
+ * Plans the limits the next ACKs announce: the one of the stream `first`,
+ * then those the application read half a window from since their last
+ * announcement.
+ *
+ * Must be called by the backend with recv_lock held.
+ *
+ * @return The number of limits planned.
+ */
+static int plan_announcements(struct stream_table *tab, int first) {
+  tab->announce_count = 0;
+  for (int k = -1; k < STREAM_MAX; ++k) {
+    stream_t *s = k < 0 ? find_stream(tab, first) : &(tab->streams[k]);
+    if (tab->announce_count == STREAM_ANNOUNCE_MAX) break;
+    if (s == NULL || s->id <= 0 || (k >= 0 && s->id == first)) continue;
+
+    uint32_t limit = s->read_offset + STREAM_WINDOW;
+    if (k >= 0 && limit - s->announced < STREAM_WINDOW / 2) continue;
+    s->announced = limit;
+    tab->announce[tab->announce_count][0] = htonl(s->id);
+    tab->announce[tab->announce_count][1] = htonl(limit);
+    tab->announce_count++;
+  }
+  return tab->announce_count;
+}
+
+/**
+ * Appends bytes that continue a stream to its read queue.
+ */
+static void append_stream(foggy_socket_t *sock, stream_t *s,
+                          const uint8_t *data, int len, uint64_t arrival) {
+  if (s->id == 0) {
+    append_received(sock, data, len, arrival);
+  } else {
+    s->recv_buf = (uint8_t *)realloc(s->recv_buf, s->recv_len + len);
+    memcpy(s->recv_buf + s->recv_len, data, len);
+    s->recv_len += len;
+    sock->streams->buffered += len;
+  }
+  s->recv_offset += len;
+}
+
+/**
+ * Takes the new bytes of a piece that starts at or before recv_offset.
+ */
+static void take_piece(foggy_socket_t *sock, stream_t *s, uint32_t offset,
+                       const uint8_t *data, uint16_t len, uint8_t flags,
+                       uint64_t arrival) {
+  if (after(offset + len, s->recv_offset)) {
+    uint32_t skip = s->recv_offset - offset;
+    append_stream(sock, s, data + skip, len - skip, arrival);
+  }
+  if ((flags & STREAM_FIN) && offset + len == s->recv_offset) {
+    s->peer_fin = 1;
+  }
+}
+
+int stream_on_data(foggy_socket_t *sock, uint8_t *pkt, uint64_t arrival) {
+  struct stream_table *tab = sock->streams;
+  uint8_t opt_len = 0, flags = 0;
+  uint8_t *opt = find_option(pkt, OPT_STREAM, &opt_len);
+  uint16_t len = get_payload_len(pkt);
+  uint32_t id = 0, offset = 0;
+  stream_t *s;
+
+  if (opt != NULL && opt_len == OPT_STREAM_LEN - 2) {
+    memcpy(&id, opt, sizeof(id));
+    memcpy(&offset, opt + 4, sizeof(offset));
+    id = ntohl(id);
+    offset = ntohl(offset);
+    flags = opt[8];
+  } else if (!(get_flags((foggy_tcp_header_t *)pkt) & SYN_FLAG_MASK)) {
+    debug_printf("Data without a stream, dropping it\n");
+    return 1;
+  }  // else the data of a fast open SYN, the start of stream 0
+  if (flags & STREAM_EMPTY) len = 0;
+  if (id > (uint32_t)INT32_MAX) return 1;
+
+  s = find_stream(tab, id);
+  if (s == NULL) {
+    int opened = open_peer_streams(sock, id);
+    if (opened <= 0) return opened < 0;
+    s = find_stream(tab, id);
+  }
+  plan_announcements(tab, id);
+
+  if (after(offset, s->recv_offset)) {
+    // Ahead of the stream: hold it until the gap fills
+    for (int i = 0; i < s->piece_count; ++i) {
+      if (s->pieces[i].offset == offset && s->pieces[i].len >= len) return 1;
+    }
+    if (s->piece_count == STREAM_MAX_PIECES) return 0;
+    stream_piece_t *piece = &(s->pieces[s->piece_count++]);
+    piece->offset = offset;
+    piece->len = len;
+    piece->flags = flags;
+    piece->data = (uint8_t *)malloc(MAX(len, 1));
+    memcpy(piece->data, get_payload(pkt), len);
+    return 1;
+  }
+
+  take_piece(sock, s, offset, get_payload(pkt), len, flags, arrival);
+  for (int i = 0; i < s->piece_count;) {
+    stream_piece_t *piece = &(s->pieces[i]);
+    if (after(piece->offset, s->recv_offset)) {
+      i++;
+      continue;
+    }
+    take_piece(sock, s, piece->offset, piece->data, piece->len, piece->flags,
+               arrival);
+    free(piece->data);
+    *piece = s->pieces[--s->piece_count];
+    i = 0;  // it may have let an earlier one in
+  }
+  tab->wakeup = 1;
+  return 1;
+}
+
+void stream_on_ack(foggy_socket_t *sock, uint8_t *pkt) {
+  struct stream_table *tab = sock->streams;
+  uint8_t opt_len = 0;
+  uint8_t *opt = find_option(pkt, OPT_STREAM_WINDOW, &opt_len);
+  uint32_t id, limit;
+  stream_t *s;
+
+  if (opt == NULL) return;
+  for (int off = 0; off + 8 <= opt_len; off += 8) {
+    memcpy(&id, opt + off, sizeof(id));
+    memcpy(&limit, opt + off + 4, sizeof(limit));
+    id = ntohl(id);
+    limit = ntohl(limit);
+    if (id == 0 || id > (uint32_t)INT32_MAX) continue;
+    s = find_stream(tab, id);
+    if (s == NULL || !after(limit, s->send_limit)) continue;
+
+    if (!after(s->send_limit, s->send_offset)) {
+      // It was out of credit, the probes can stop
+      tab->probe = 0;
+      tab->probe_backoff = 0;
+      timer_cancel(&(sock->timers), &(tab->probe_timer));
+    }
+    s->send_limit = limit;
+  }
+}
+
+int stream_put_window(foggy_socket_t *sock, uint8_t *ext) {
+  struct stream_table *tab = sock->streams;
+
+  if (tab->announce_count == 0) return 0;
+  return put_option(ext, OPT_STREAM_WINDOW, tab->announce,
+                    tab->announce_count * sizeof(tab->announce[0]));
+}
+
+int stream_split_option(uint8_t *msg, uint16_t off, uint16_t len,
+                        uint8_t *ext) {
+  uint8_t opt_len = 0;
+  uint8_t *opt = find_option(msg, OPT_STREAM, &opt_len);
+  uint8_t value[OPT_STREAM_LEN - 2];
+  uint32_t offset;
+
+  if (opt == NULL || opt_len != sizeof(value)) return 0;
+  memcpy(value, opt, sizeof(value));
+  memcpy(&offset, value + 4, sizeof(offset));
+  offset = htonl(ntohl(offset) + off);
+  memcpy(value + 4, &offset, sizeof(offset));
+  // Only the last piece ends the stream
+  if (off + len < get_payload_len(msg)) value[8] &= ~STREAM_FIN;
+  return put_option(ext, OPT_STREAM, value, sizeof(value));
+}
+
+/**
+ * Cuts the next segment, from the first stream after the last one served
+ * that has something to send.
+ *
+ * Must be called with send_lock held.
+ *
+ * @param sock The socket.
+ * @param max_len The largest payload that fits.
+ * @param in_flight The bytes in flight, a probe goes out only if none are.
+ *
+ * @return The segment, NULL if no stream can send.
+ */
+static uint8_t *next_segment(foggy_socket_t *sock, int max_len,
+                             uint32_t in_flight) {
+  static const uint8_t pad = 0;
+  struct stream_table *tab = sock->streams;
+  int blocked = 0;
+
+  for (int k = 0; k < STREAM_MAX; ++k) {
+    int i = (tab->rr + k) % STREAM_MAX;
+    stream_t *s = &(tab->streams[i]);
+    uint8_t **buf = s->id == 0 ? &(sock->sending_buf) : &(s->send_buf);
+    int *pending = s->id == 0 ? &(sock->sending_len) : &(s->send_len);
+    int credit, len, fin;
+
+    if (s->id < 0) continue;
+    if (s->id == 0) {
+      // Each segment takes a mark, which record_acked_writes() goes by
+      if (tab->marks_tail - tab->marks_head == STREAM_MARKS) continue;
+      credit = *pending;
+    } else {
+      credit = after(s->send_limit, s->send_offset)
+                   ? (int)MIN(s->send_limit - s->send_offset, INT32_MAX)
+                   : 0;
+    }
+    len = MIN(*pending, MIN(credit, max_len));
+    fin = s->id != 0 && s->send_closed && !s->fin_sent && len == *pending;
+    if (len > 0 && len == *pending && !fin && hold_partial(sock, len)) {
+      continue;  // coalesced with what the stream gets next
+    }
+    if (len == 0 && *pending > 0) {
+      if (!tab->probe || in_flight > 0) {
+        blocked = 1;
+        continue;
+      }
+      len = 1;  // a window probe, its ACK brings the limit back
+      tab->probe = 0;
+    }
+    fin = s->id != 0 && s->send_closed && !s->fin_sent && len == *pending;
+    if (len == 0 && !fin) continue;
+
+    // The segment
+    uint8_t value[OPT_STREAM_LEN - 2], ext[OPT_STREAM_LEN];
+    uint32_t id = htonl(s->id), offset = htonl(s->send_offset);
+    memcpy(value, &id, sizeof(id));
+    memcpy(value + 4, &offset, sizeof(offset));
+    value[8] = (fin ? STREAM_FIN : 0) | (len == 0 ? STREAM_EMPTY : 0);
+    put_option(ext, OPT_STREAM, value, sizeof(value));
+    uint8_t *msg = create_socket_packet(
+        sock, sock->window.last_byte_sent, sock->window.next_seq_expected,
+        ACK_FLAG_MASK, sizeof(ext), ext, len == 0 ? &pad : *buf, MAX(len, 1));
+
+    // Take the data off the stream
+    *pending -= len;
+    if (*pending == 0) {
+      free(*buf);
+      *buf = NULL;
+    } else {
+      memmove(*buf, *buf + len, *pending);
+    }
+    s->send_offset += len;
+    s->fin_sent |= fin;
+    if (s->id == 0) {
+      stream_mark_t *mark = &(tab->marks[tab->marks_tail++ & MARKS_MASK]);
+      mark->seq = sock->window.last_byte_sent + len;
+      mark->raw = sock->bytes_written - sock->sending_len;
+    }
+    pthread_cond_broadcast(&(sock->send_cond));
+    tab->rr = (i + 1) % STREAM_MAX;
+    return msg;
+  }
+
+  // Out of credit: probe after a while, backing off like the RTO
+  if (blocked && !timer_pending(&(tab->probe_timer))) {
+    tab->probe_backoff = tab->probe_backoff == 0
+                             ? sock->window.rto
+                             : MIN(tab->probe_backoff * 2, sock->opts.rto_max);
+    timer_arm(&(sock->timers), &(tab->probe_timer),
+              get_time_us() + tab->probe_backoff);
+  }
+  return NULL;
+}
+
+/**
+ * Forgets the streams both sides closed and whose reader saw the end.
+ */
+static void reap_streams(foggy_socket_t *sock) {
+  struct stream_table *tab = sock->streams;
+
+  while (pthread_mutex_lock(&(sock->recv_lock)) != 0) {
+  }
+  while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+  }
+  for (int i = 1; i < STREAM_MAX; ++i) {
+    stream_t *s = &(tab->streams[i]);
+    if (s->id >= 0 && s->read_eof &&
+        (s->fin_sent || (sock->write_shutdown && s->send_len == 0))) {
+      debug_printf("Stream %d is done\n", s->id);
+      free_stream(s);
+    }
+  }
+  pthread_mutex_unlock(&(sock->send_lock));
+  pthread_mutex_unlock(&(sock->recv_lock));
+}
+
+void stream_transmit(foggy_socket_t *sock) {
+  int max_payload = segment_payload(sock);
+  uint32_t in_flight, room;
+  uint8_t *msg;
+
+  reap_streams(sock);
+  while (1) {
+    // Wait for room for a full segment rather than cut small ones
+    in_flight = sock->window.last_byte_sent - sock->window.last_ack_received;
+    room = in_flight < sock->opts.sndbuf ? sock->opts.sndbuf - in_flight : 0;
+    if (room == 0 || (in_flight > 0 && room < (uint32_t)max_payload)) break;
+
+    while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+    }
+    msg = next_segment(sock, MIN((int)room, max_payload), in_flight);
+    pthread_mutex_unlock(&(sock->send_lock));
+    if (msg == NULL) break;
+
+    uint16_t len = get_payload_len(msg);
+    send_ring_push(&(sock->send_window), msg, sock->window.last_byte_sent,
+                   len);
+    note_segment(sock, sock->window.last_byte_sent, len);
+    sock->window.last_byte_sent += len;
+  }
+  send_pkts(sock, NULL, 0);
+}
+
+void stream_send_update(foggy_socket_t *sock) {
+  struct stream_table *tab = sock->streams;
+  int due = 0;
+
+  while (pthread_mutex_lock(&(sock->recv_lock)) != 0) {
+  }
+  if (tab->update) {
+    tab->update = 0;
+    due = plan_announcements(tab, 0);
+  }
+  pthread_mutex_unlock(&(sock->recv_lock));
+  if (due == 0) return;
+
+  uint8_t *ack_pkt = create_socket_packet(
+      sock, sock->window.last_byte_sent, sock->window.next_seq_expected,
+      ACK_FLAG_MASK, 0, NULL, NULL, 0);
+  send_packet(sock, ack_pkt);
+  free(ack_pkt);
+}
+
+int stream_unsent(foggy_socket_t *sock) {
+  int unsent = 0;
+
+  for (int i = 1; i < STREAM_MAX; ++i) {
+    stream_t *s = &(sock->streams->streams[i]);
+    if (s->id < 0) continue;
+    unsent += s->send_len + (s->send_closed && !s->fin_sent);
+  }
+  return unsent;
+}
+
+uint64_t stream_acked(foggy_socket_t *sock) {
+  struct stream_table *tab = sock->streams;
+  uint32_t ack = sock->window.last_ack_received;
+
+  while (tab->marks_head != tab->marks_tail) {
+    stream_mark_t *mark = &(tab->marks[tab->marks_head & MARKS_MASK]);
+    if (after(mark->seq, ack)) break;
+    tab->raw_acked = mark->raw;
+    tab->marks_head++;
+  }
+  return tab->raw_acked;
+}
+
+/* The application interface, see foggy_tcp.h. */
+
+int foggy_stream_open(void *in_sock) {
+  foggy_socket_t *sock = (foggy_socket_t *)in_sock;
+  struct stream_table *tab = sock->streams;
+  stream_t *s = NULL;
+  int id = -1;
+
+  if (tab == NULL) {
+    perror("ERROR streams were not negotiated");
+    return EXIT_ERROR;
+  }
+  while (pthread_mutex_lock(&(sock->recv_lock)) != 0) {
+  }
+  while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+  }
+  if (!sock->write_shutdown) {
+    s = new_stream(tab, tab->next_id);
+  }
+  if (s != NULL) {
+    s->accepted = 1;
+    id = tab->next_id;
+    tab->next_id += 2;
+  }
+  pthread_mutex_unlock(&(sock->send_lock));
+  pthread_mutex_unlock(&(sock->recv_lock));
+  if (id < 0) {
+    perror("ERROR no stream left to open");
+    return EXIT_ERROR;
+  }
+  return id;
+}
+
+int foggy_stream_accept(void *in_sock) {
+  foggy_socket_t *sock = (foggy_socket_t *)in_sock;
+  struct stream_table *tab = sock->streams;
+  int id = -1;
+
+  if (tab == NULL) {
+    perror("ERROR streams were not negotiated");
+    return EXIT_ERROR;
+  }
+  while (pthread_mutex_lock(&(sock->recv_lock)) != 0) {
+  }
+  while (tab->accept_next > tab->max_peer_id && !sock->peer_fin) {
+    pthread_cond_wait(&(sock->wait_cond), &(sock->recv_lock));
+  }
+  if (tab->accept_next <= tab->max_peer_id) {
+    id = tab->accept_next;
+    tab->accept_next += 2;
+    stream_t *s = find_stream(tab, id);
+    if (s != NULL) s->accepted = 1;
+  }
+  pthread_mutex_unlock(&(sock->recv_lock));
+  return id;
+}
+
+int foggy_stream_read(void *in_sock, int stream, void *buf, int length) {
+  foggy_socket_t *sock = (foggy_socket_t *)in_sock;
+  struct stream_table *tab = sock->streams;
+  stream_t *s;
+  int read_len, update = 0;
+
+  if (stream == 0) return foggy_read(in_sock, buf, length);
+  if (tab == NULL || length < 0) {
+    perror("ERROR streams were not negotiated or negative length");
+    return EXIT_ERROR;
+  }
+
+  while (pthread_mutex_lock(&(sock->recv_lock)) != 0) {
+  }
+  while ((s = find_stream(tab, stream)) != NULL && s->recv_len == 0 &&
+         !s->peer_fin && !sock->peer_fin) {
+    pthread_cond_wait(&(sock->wait_cond), &(sock->recv_lock));
+  }
+  if (s == NULL) {
+    pthread_mutex_unlock(&(sock->recv_lock));
+    perror("ERROR no such stream");
+    return EXIT_ERROR;
+  }
+  read_len = MIN(length, s->recv_len);
+  memcpy(buf, s->recv_buf, read_len);
+  s->recv_len -= read_len;
+  memmove(s->recv_buf, s->recv_buf + read_len, s->recv_len);
+  s->read_offset += read_len;
+  tab->buffered -= read_len;
+  if (read_len == 0) s->read_eof = 1;
+
+  // Have the limit announced once the reader freed half a window of it
+  if (!s->peer_fin && s->read_offset - s->read_notified >= STREAM_WINDOW / 2) {
+    s->read_notified = s->read_offset;
+    tab->update = update = 1;
+  }
+  pthread_mutex_unlock(&(sock->recv_lock));
+  if (update) notify_backend(sock);
+  return read_len;
+}
+
+int foggy_stream_write(void *in_sock, int stream, const void *buf,
+                       int length) {
+  foggy_socket_t *sock = (foggy_socket_t *)in_sock;
+  const uint8_t *data = (const uint8_t *)buf;
+  stream_t *s;
+  int chunk;
+
+  if (stream == 0) return foggy_write(in_sock, buf, length);
+  if (sock->streams == NULL) {
+    perror("ERROR streams were not negotiated");
+    return EXIT_ERROR;
+  }
+
+  while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+  }
+  while (length > 0) {
+    // Like foggy_write(), wait for the backend to drain the stream
+    while ((s = find_stream(sock->streams, stream)) != NULL &&
+           !s->send_closed && !sock->write_shutdown &&
+           s->send_len >= STREAM_WINDOW) {
+      pthread_cond_wait(&(sock->send_cond), &(sock->send_lock));
+    }
+    if (s == NULL || s->send_closed || sock->write_shutdown) {
+      pthread_mutex_unlock(&(sock->send_lock));
+      perror("ERROR write to a closed stream");
+      return EXIT_ERROR;
+    }
+    chunk = MIN(length, STREAM_WINDOW - s->send_len);
+    s->send_buf = (uint8_t *)realloc(s->send_buf, s->send_len + chunk);
+    memcpy(s->send_buf + s->send_len, data, chunk);
+    s->send_len += chunk;
+    data += chunk;
+    length -= chunk;
+    notify_backend(sock);
+  }
+  pthread_mutex_unlock(&(sock->send_lock));
+  return EXIT_SUCCESS;
+}
+
+int foggy_stream_close(void *in_sock, int stream) {
+  foggy_socket_t *sock = (foggy_socket_t *)in_sock;
+  stream_t *s;
+
+  if (stream == 0) return foggy_shutdown(in_sock);
+  if (sock->streams == NULL) {
+    perror("ERROR streams were not negotiated");
+    return EXIT_ERROR;
+  }
+  while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+  }
+  s = find_stream(sock->streams, stream);
+  if (s != NULL) s->send_closed = 1;
+  pthread_mutex_unlock(&(sock->send_lock));
+  if (s == NULL) {
+    perror("ERROR no such stream");
+    return EXIT_ERROR;
+  }
+  notify_backend(sock);
+  return EXIT_SUCCESS;
+}
@@ -18,10 +18,25 @@ from releasing their forks in any public places. */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <netinet/udp.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include "foggy_async.h"
 #include "foggy_backend.h"
+#include "foggy_compress.h"
+#include "foggy_fec.h"
+#include "foggy_function.h"
+#include "foggy_mp.h"
+#include "foggy_option.h"
+#include "foggy_pmtu.h"
+#include "foggy_sockopt.h"
+#include "foggy_stream.h"
+#include "foggy_trace.h"
+#include "foggy_uring.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
 
 void* foggy_socket(const foggy_socket_type_t socket_type,
                const char *server_port, const char *server_ip) {
@@ -46,6 +61,13 @@ void* foggy_socket(const foggy_socket_type_t socket_type,
   sock->sending_buf = NULL;
   sock->sending_len = 0;
   pthread_mutex_init(&(sock->send_lock), NULL);
+  pthread_cond_init(&(sock->send_cond), NULL);
+
+  sock->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (sock->event_fd < 0) {
+    perror("ERROR opening eventfd");
+    return NULL;
+  }
 
   sock->type = socket_type;
   sock->dying = 0;
@@ -54,6 +76,67 @@ void* foggy_socket(const foggy_socket_type_t socket_type,
   sock->connected = 0;
   pthread_mutex_init(&(sock->connected_lock), NULL);
 
+  // Optional features are requested by the initiator through the environment
+  sock->caps_wanted = 0;
+  sock->caps = 0;
+  const char *crc_env = getenv("FOGGY_CRC32C");
+  if (crc_env != NULL && atoi(crc_env) != 0) {
+    sock->caps_wanted |= CAP_CRC32C;
+  }
+  const char *fastopen_env = getenv("FOGGY_FASTOPEN");
+  sock->fastopen = fastopen_env != NULL && atoi(fastopen_env) != 0;
+  sock->fastopen_pending = 0;
+  sock->send_cookie = 0;
+  sock->handshake_sent = 0;
+  sock->handshake_retries = 0;
+  sock->read_blocked = 0;
+  sock->write_ops_len = 0;
+
+  // Impair the link when FOGGY_NETEM asks for it, see foggy_netem.h
+  const netem_config_t *netem_cfg = netem_env_config();
+  sock->netem = netem_cfg != NULL ? netem_link_create(netem_cfg) : NULL;
+
+  // FOGGY_GSO batches segments on send and coalesces them on receive
+  const char *gso_env = getenv("FOGGY_GSO");
+  sock->gso = gso_env != NULL && atoi(gso_env) != 0;
+  if (sock->gso) {
+    int on = 1;
+    if (setsockopt(sockfd, SOL_UDP, UDP_GRO, &on, sizeof(on)) < 0) {
+      sock->gso = 0;
+    }
+  }
+  sock->rx_buf = (uint8_t *)malloc(RX_BUF_SIZE);
+  uring_init(sock);
+  timer_wheel_init(&(sock->timers), get_time_us());
+  sockopt_init(sock);
+  pmtu_init(sock);
+  mp_init(sock);
+  fec_init(sock);
+  compress_init(sock);
+  stream_init(sock);
+
+  sock->write_shutdown = 0;
+  sock->fin_sent = 0;
+  sock->fin_seq = 0;
+  sock->peer_fin = 0;
+  sock->peer_fin_first = 0;
+  timer_init(&(sock->close_timer), NULL, NULL);
+  sock->rto_retries = 0;
+  sock->time_wait = 0;
+  sock->fin_acked = 0;
+  sock->close_done = 0;
+  sock->close_error = 0;
+  sock->refs = 2;  // the application and the backend
+  pthread_cond_init(&(sock->close_cond), NULL);
+
+  hist_init(&(sock->write_to_ack));
+  hist_init(&(sock->arrival_to_read));
+  hist_init(&(sock->read_blocked_hist));
+  sock->bytes_written = 0;
+  sock->bytes_received = 0;
+  sock->bytes_read = 0;
+  sock->rx_time = 0;
+
   // FIXME: Sequence numbers should be randomly initialized. The next expected
   // sequence number should be initialized according to the SYN packet from the
   // other side of the connection.
@@ -65,16 +148,47 @@ void* foggy_socket(const foggy_socket_type_t socket_type,
   sock->window.dup_ack_count = 0;
   sock->window.next_seq_expected = 0; // to be filled in first connection
 
-  sock->window.ssthresh = WINDOW_INITIAL_SSTHRESH;
+  sock->window.ssthresh = sock->opts.init_ssthresh;
   sock->window.advertised_window = WINDOW_INITIAL_ADVERTISED;
-  sock->window.congestion_window = WINDOW_INITIAL_WINDOW_SIZE;
+  sock->window.congestion_window = sock->opts.init_cwnd;
   sock->window.reno_state = RENO_SLOW_START;
+  sock->window.recover = 0;
+  sock->window.w_max = 0;
+  sock->window.w_est = 0;
+  sock->window.epoch = 0;
+  sock->window.k = 0;
   pthread_mutex_init(&(sock->window.ack_lock), NULL);
-
-  for (int i = 0; i < RECEIVE_WINDOW_SLOT_SIZE; ++i) {
-    sock->receive_window[i].is_used = 0;
-    sock->receive_window[i].msg = NULL;
+  sock->window.srtt = 0;
+  sock->window.rttvar = 0;
+  sock->window.rto = sock->opts.rto_init;
+  sock->window_update_pending = 0;
+  sock->last_adv = 0;
+  timer_init(&(sock->rto_timer), retransmission_timeout, sock);
+  sock->pace_next = 0;
+  timer_init(&(sock->pace_timer), pace_timeout, sock);
+  sock->ack_pending = 0;
+  sock->quickacks = DELACK_QUICKACKS;  // slow start needs every ACK
+  timer_init(&(sock->delack_timer), delack_timeout, sock);
+
+  // Small writes follow Nagle's algorithm unless FOGGY_NODELAY or FOGGY_CORK
+  // is set, see foggy_set_coalescing()
+  const char *nodelay_env = getenv("FOGGY_NODELAY");
+  const char *cork_env = getenv("FOGGY_CORK");
+  sock->coalesce = FOGGY_NAGLE;
+  if (nodelay_env != NULL && atoi(nodelay_env) != 0) {
+    sock->coalesce = FOGGY_NODELAY;
+  }
+  if (cork_env != NULL && atoi(cork_env) != 0) {
+    sock->coalesce = FOGGY_CORK;
   }
+  sock->push = 0;
+  sock->small_pending = 0;
+  sock->small_end = 0;
+  timer_init(&(sock->cork_timer), cork_timeout, sock);
+  sock->cork_expired = 0;
+
+  sock->receive_window_used = 0;
+  send_ring_init(&(sock->send_window));
 
   if (pthread_cond_init(&sock->wait_cond, NULL) != 0) {
     perror("ERROR condition variable not set\n");
@@ -108,7 +222,14 @@ void* foggy_socket(const foggy_socket_type_t socket_type,
         perror("ERROR on binding");
         return NULL;
       }
-      foggy_connect(sock);
+      if (foggy_connect(sock) < 0) {
+        netem_link_destroy(sock->netem);
+        free(sock->rx_buf);
+        close(sockfd);
+        close(sock->event_fd);
+        delete sock;
+        return NULL;
+      }
       break;
 
     case TCP_LISTENER:
@@ -139,43 +260,242 @@ void* foggy_socket(const foggy_socket_type_t socket_type,
   sock->my_port = ntohs(my_addr.sin_port);
 
   pthread_create(&(sock->thread_id), NULL, begin_backend, (void *)sock);
+  pthread_detach(sock->thread_id);  // it frees the socket if it exits last
   return (void*)sock;
 }
 
 
 
 
+static const char *latency_names[] = {"write_to_ack", "arrival_to_read",
+                                      "read_blocked"};
+
+/**
+ * Prints the latency histograms of a socket when FOGGY_LATENCY is set.
+ *
+ * @param sock The socket being closed.
+ */
+static void dump_latency(foggy_socket_t *sock) {
+  const char *env = getenv("FOGGY_LATENCY");
+  foggy_latency_t lat;
+
+  if (env == NULL || atoi(env) == 0) return;
+  for (int kind = FOGGY_LATENCY_WRITE_TO_ACK; kind <= FOGGY_LATENCY_READ_BLOCKED;
+       ++kind) {
+    foggy_get_latency(sock, (foggy_latency_kind_t)kind, &lat);
+    if (lat.count == 0) continue;
+    info_printf("Latency %s: count %lu p50 %lu us p99 %lu us p99.9 %lu us "
+                "max %lu us\n",
+                latency_names[kind], (unsigned long)lat.count,
+                (unsigned long)lat.p50_us, (unsigned long)lat.p99_us,
+                (unsigned long)lat.p999_us, (unsigned long)lat.max_us);
+  }
+}
+
 int foggy_close(void *in_sock) {
   struct foggy_socket_t *sock = (struct foggy_socket_t *)in_sock;
+  int last_ref, error, linger;
+
+  if (sock == NULL) {
+    perror("ERROR null socket\n");
+    return EXIT_ERROR;
+  }
+
+  while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+  }
+  linger = sock->new_opts.linger;
+  pthread_mutex_unlock(&(sock->send_lock));
+
   while (pthread_mutex_lock(&(sock->death_lock)) != 0) {
   }
   sock->dying = 1;
   pthread_mutex_unlock(&(sock->death_lock));
+  notify_backend(sock);
 
-  pthread_join(sock->thread_id, NULL);
+  // Wait until our data and FIN are acknowledged, or the backend gave up on
+  // the peer and exited. Lingering waits for the backend to exit in any case,
+  // after the peer's FIN and TIME_WAIT.
+  while (pthread_mutex_lock(&(sock->death_lock)) != 0) {
+  }
+  while (!sock->close_done && (linger || !sock->fin_acked)) {
+    pthread_cond_wait(&(sock->close_cond), &(sock->death_lock));
+  }
+  error = sock->close_error;
+  pthread_mutex_unlock(&(sock->death_lock));
 
-  if (sock != NULL) {
-    if (sock->received_buf != NULL) {
-      free(sock->received_buf);
-    }
-    if (sock->sending_buf != NULL) {
-      free(sock->sending_buf);
-    }
-  } else {
-    perror("ERROR null socket\n");
+  async_cancel(sock);  // the backend must not touch their buffers any more
+  dump_latency(sock);
+
+  // The backend may still be running, whoever lets go last frees the socket
+  while (pthread_mutex_lock(&(sock->death_lock)) != 0) {
+  }
+  last_ref = --sock->refs == 0;
+  pthread_mutex_unlock(&(sock->death_lock));
+
+  if (last_ref) {
+    release_socket(sock);
+  }
+  return error ? EXIT_ERROR : EXIT_SUCCESS;
+}
+
+int foggy_shutdown(void *in_sock) {
+  struct foggy_socket_t *sock = (struct foggy_socket_t *)in_sock;
+
+  while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+  }
+  sock->write_shutdown = 1;
+  pthread_mutex_unlock(&(sock->send_lock));
+  notify_backend(sock);
+  return EXIT_SUCCESS;
+}
+
+int foggy_set_coalescing(void *in_sock, foggy_coalesce_t mode) {
+  struct foggy_socket_t *sock = (struct foggy_socket_t *)in_sock;
+
+  if (mode != FOGGY_NAGLE && mode != FOGGY_NODELAY && mode != FOGGY_CORK) {
+    perror("ERROR unknown coalescing mode");
     return EXIT_ERROR;
   }
-  return close(sock->socket);
+  while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
+  }
+  // Uncorking sends what the cork held, like TCP_CORK
+  if (sock->coalesce == FOGGY_CORK && mode != FOGGY_CORK) {
+    sock->push = 1;
+  }
+  sock->coalesce = mode;
+  pthread_mutex_unlock(&(sock->send_lock));
+  notify_backend(sock);
+  return EXIT_SUCCESS;
+}
+
+int foggy_get_info(void *in_sock, foggy_info_t *info) {
+  struct foggy_socket_t *sock = (struct foggy_socket_t *)in_sock;
+  foggy_stats_t *stats;
+
+  if (sock == NULL || info == NULL) {
+    return EXIT_ERROR;
+  }
+  stats = &(sock->stats);
+  info->cwnd = stats->cwnd.load(memory_order_relaxed);
+  info->ssthresh = stats->ssthresh.load(memory_order_relaxed);
+  info->reno_state = stats->reno_state.load(memory_order_relaxed);
+  info->srtt_us = stats->srtt.load(memory_order_relaxed);
+  info->rttvar_us = stats->rttvar.load(memory_order_relaxed);
+  info->rto_us = stats->rto.load(memory_order_relaxed);
+  info->bytes_sent = stats->bytes_sent.load(memory_order_relaxed);
+  info->bytes_acked = stats->bytes_acked.load(memory_order_relaxed);
+  info->bytes_retrans = stats->bytes_retrans.load(memory_order_relaxed);
+  info->segs_sent = stats->segs_sent.load(memory_order_relaxed);
+  info->segs_retrans = stats->segs_retrans.load(memory_order_relaxed);
+  info->dup_acks = stats->dup_acks.load(memory_order_relaxed);
+  info->ooo_segments = stats->ooo_segments.load(memory_order_relaxed);
+  info->fec_parity_sent = stats->fec_parity_sent.load(memory_order_relaxed);
+  info->fec_recovered = stats->fec_recovered.load(memory_order_relaxed);
+  info->compress_saved = stats->compress_saved.load(memory_order_relaxed);
+  info->rcv_occupancy = stats->rcv_occupancy.load(memory_order_relaxed);
+  info->pacing_rate = info->srtt_us == 0
+                          ? 0
+                          : (uint64_t)info->cwnd * 1000000 / info->srtt_us;
+  info->mss = stats->mss.load(memory_order_relaxed);
+  info->syscalls = stats->syscalls.load(memory_order_relaxed);
+  info->spin_us = stats->spin_us.load(memory_order_relaxed);
+  return EXIT_SUCCESS;
+}
+
+
+
+
+int foggy_get_latency(void *in_sock, foggy_latency_kind_t kind,
+                      foggy_latency_t *latency) {
+  struct foggy_socket_t *sock = (struct foggy_socket_t *)in_sock;
+  pthread_mutex_t *lock;
+  hist_t *hist;
+
+  if (sock == NULL || latency == NULL) {
+    return EXIT_ERROR;
+  }
+  switch (kind) {
+    case FOGGY_LATENCY_WRITE_TO_ACK:
+      hist = &(sock->write_to_ack);
+      lock = &(sock->send_lock);
+      break;
+    case FOGGY_LATENCY_ARRIVAL_TO_READ:
+      hist = &(sock->arrival_to_read);
+      lock = &(sock->recv_lock);
+      break;
+    case FOGGY_LATENCY_READ_BLOCKED:
+      hist = &(sock->read_blocked_hist);
+      lock = &(sock->recv_lock);
+      break;
+    default:
+      return EXIT_ERROR;
+  }
+
+  while (pthread_mutex_lock(lock) != 0) {
+  }
+  latency->count = hist->count;
+  latency->min_us = hist->min;
+  latency->mean_us = hist->count > 0 ? hist->sum / hist->count : 0;
+  latency->p50_us = hist_percentile(hist, 0.5);
+  latency->p99_us = hist_percentile(hist, 0.99);
+  latency->p999_us = hist_percentile(hist, 0.999);
+  latency->max_us = hist->max;
+  pthread_mutex_unlock(lock);
+  return EXIT_SUCCESS;
 }
 
+int take_received(foggy_socket_t *sock, void *buf, int length, uint64_t now) {
+  uint8_t *new_buf;
+  int read_len;
 
+  if (sock->received_len == 0) {
+    return 0;
+  }
+  if (sock->received_len > length)
+    read_len = length;
+  else
+    read_len = sock->received_len;
+
+  memcpy(buf, sock->received_buf, read_len);
+  if (read_len < sock->received_len) {
+    new_buf = (uint8_t*) malloc(sock->received_len - read_len);
+    memcpy(new_buf, sock->received_buf + read_len,
+            sock->received_len - read_len);
+    free(sock->received_buf);
+    sock->received_len -= read_len;
+    sock->received_buf = new_buf;
+  } else {
+    free(sock->received_buf);
+    sock->received_buf = NULL;
+    sock->received_len = 0;
+  }
+  // A segment counts as read once its last byte is
+  sock->bytes_read += read_len;
+  while (!sock->read_marks.empty() &&
+         sock->read_marks.front().first <= sock->bytes_read) {
+    hist_record(&(sock->arrival_to_read),
+                now - sock->read_marks.front().second);
+    sock->read_marks.pop_front();
+  }
+  return read_len;
+}
 
+void append_sending(foggy_socket_t *sock, const uint8_t *data, int len) {
+  if (sock->sending_buf == NULL)
+    sock->sending_buf = (uint8_t*) malloc(len);
+  else
+    sock->sending_buf = (uint8_t*) realloc(sock->sending_buf, len + sock->sending_len);
+  memcpy(sock->sending_buf + sock->sending_len, data, len);
+  sock->sending_len += len;
+  sock->bytes_written += len;
+  sock->write_marks.push_back(make_pair(sock->bytes_written, get_time_us()));
+}
 
 int foggy_read(void* in_sock, void *buf, int length) {
 
   struct foggy_socket_t *sock = (struct foggy_socket_t *)in_sock;  
-  uint8_t *new_buf;
-  int read_len = 0;
+  int read_len;
+  uint64_t blocked_since = 0, now;
 
   if (length < 0) {
     perror("ERROR negative length");
@@ -185,43 +505,51 @@ int foggy_read(void* in_sock, void *buf, int length) {
   while (pthread_mutex_lock(&(sock->recv_lock)) != 0) {
   }
 
-  while (sock->received_len == 0) {
+  while (sock->received_len == 0 && !sock->peer_fin) {
+    if (!sock->read_blocked) {
+      sock->read_blocked = 1;
+      notify_backend(sock);  // a deferred fast open SYN must go out now
+    }
+    if (blocked_since == 0) {
+      blocked_since = get_time_us();
+    }
     pthread_cond_wait(&(sock->wait_cond), &(sock->recv_lock));
   }
-  if (sock->received_len > 0) {
-    if (sock->received_len > length)
-      read_len = length;
-    else
-      read_len = sock->received_len;
-
-    memcpy(buf, sock->received_buf, read_len);
-    if (read_len < sock->received_len) {
-      new_buf = (uint8_t*) malloc(sock->received_len - read_len);
-      memcpy(new_buf, sock->received_buf + read_len,
-              sock->received_len - read_len);
-      free(sock->received_buf);
-      sock->received_len -= read_len;
-      sock->received_buf = new_buf;
-    } else {
-      free(sock->received_buf);
-      sock->received_buf = NULL;
-      sock->received_len = 0;
-    }
+  sock->read_blocked = 0;
+  now = blocked_since != 0 || !sock->read_marks.empty() ? get_time_us() : 0;
+  if (blocked_since != 0) {
+    hist_record(&(sock->read_blocked_hist), now - blocked_since);
   }
+  read_len = take_received(sock, buf, length, now);
   pthread_mutex_unlock(&(sock->recv_lock));
+  notify_backend(sock);  // space freed in received_buf
   return read_len;
 }
 
 int foggy_write(void *in_sock, const void *buf, int length) {
   struct foggy_socket_t *sock = (struct foggy_socket_t *)in_sock;
+  const uint8_t *data = (const uint8_t *)buf;
+  int chunk;
+
   while (pthread_mutex_lock(&(sock->send_lock)) != 0) {
   }
-  if (sock->sending_buf == NULL)
-    sock->sending_buf = (uint8_t*) malloc(length);
-  else
-    sock->sending_buf = (uint8_t*) realloc(sock->sending_buf, length + sock->sending_len);
-  memcpy(sock->sending_buf + sock->sending_len, buf, length);
-  sock->sending_len += length;
+  if (sock->write_shutdown) {
+    pthread_mutex_unlock(&(sock->send_lock));
+    perror("ERROR write after shutdown");
+    return EXIT_ERROR;
+  }
+  while (length > 0) {
+    // Wait for the backend to drain sending_buf instead of growing it forever.
+    while ((uint32_t)sock->sending_len >= sock->new_opts.sndbuf) {
+      pthread_cond_wait(&(sock->send_cond), &(sock->send_lock));
+    }
+    chunk = MIN(length, (int)sock->new_opts.sndbuf - sock->sending_len);
+    append_sending(sock, data, chunk);
+    data += chunk;
+    length -= chunk;
+
+    notify_backend(sock);
+  }
 
   pthread_mutex_unlock(&(sock->send_lock));
   return EXIT_SUCCESS;
@@ -0,0 +1,181 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/*
+ * This file implements the timer wheel.
+ */
+
+#include "foggy_timer.h"
+
+#define SLOT_MASK ((uint64_t)TIMER_WHEEL_SLOTS - 1)
+#define MAX_DELTA (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+/**
+ * Returns the tick a time in us falls due at, rounded up so no timer fires
+ * early.
+ */
+static inline uint64_t to_tick(uint64_t us) {
+  return (us + TIMER_TICK_US - 1) / TIMER_TICK_US;
+}
+
+static inline uint64_t rotate_right(uint64_t x, unsigned n) {
+  return n == 0 ? x : (x >> n) | (x << (64 - n));
+}
+
+static void unlink_timer(timer_wheel_t *wheel, foggy_timer_t *timer) {
+  *(timer->pprev) = timer->next;
+  if (timer->next != NULL) timer->next->pprev = timer->pprev;
+  if (timer->slot >= 0) {
+    int level = timer->slot / TIMER_WHEEL_SLOTS;
+    int slot = timer->slot % TIMER_WHEEL_SLOTS;
+    if (wheel->slots[level][slot] == NULL) {
+      wheel->occupied[level] &= ~(1ULL << slot);
+    }
+  }
+  timer->next = NULL;
+  timer->pprev = NULL;
+  timer->slot = -1;
+}
+
+/**
+ * Links an idle timer into the slot of its expiry tick, at the finest level
+ * that reaches that far from the current tick.
+ */
+static void link_timer(timer_wheel_t *wheel, foggy_timer_t *timer) {
+  uint64_t tick = to_tick(timer->expires);
+  uint64_t delta;
+  int level = 0, slot;
+
+  if (tick < wheel->now) tick = wheel->now;
+  delta = tick - wheel->now;
+  if (delta >= MAX_DELTA) {  // parked at the edge, linked again from there
+    tick = wheel->now + MAX_DELTA - 1;
+    delta = MAX_DELTA - 1;
+  }
+  while (delta >= (1ULL << (TIMER_WHEEL_BITS * (level + 1)))) {
+    level++;
+  }
+  slot = (tick >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK;
+
+  timer->next = wheel->slots[level][slot];
+  if (timer->next != NULL) timer->next->pprev = &(timer->next);
+  wheel->slots[level][slot] = timer;
+  timer->pprev = &(wheel->slots[level][slot]);
+  timer->slot = level * TIMER_WHEEL_SLOTS + slot;
+  wheel->occupied[level] |= 1ULL << slot;
+}
+
+/**
+ * Moves the timers of a coarse slot down to the finer levels.
+ */
+static void cascade(timer_wheel_t *wheel, int level, int slot) {
+  foggy_timer_t *list = wheel->slots[level][slot];
+
+  wheel->slots[level][slot] = NULL;
+  wheel->occupied[level] &= ~(1ULL << slot);
+  while (list != NULL) {
+    foggy_timer_t *timer = list;
+    list = timer->next;
+    link_timer(wheel, timer);
+  }
+}
+
+/**
+ * Returns the first tick at or after the current one that has work, a level 0
+ * slot to fire or a coarse slot to move down, UINT64_MAX if there is none.
+ */
+static uint64_t next_tick(const timer_wheel_t *wheel) {
+  uint64_t best = UINT64_MAX;
+
+  for (int level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+    if (wheel->occupied[level] == 0) continue;
+    int shift = TIMER_WHEEL_BITS * level;
+    // The first block of this level that starts at or after now; the slot of
+    // the block in progress was moved down when it started
+    uint64_t block = (wheel->now + (1ULL << shift) - 1) >> shift;
+    uint64_t occupied = rotate_right(wheel->occupied[level], block & SLOT_MASK);
+    uint64_t tick = (block + __builtin_ctzll(occupied)) << shift;
+    if (tick < best) best = tick;
+  }
+  return best;
+}
+
+void timer_init(foggy_timer_t *timer, void (*fn)(void *arg), void *arg) {
+  timer->next = NULL;
+  timer->pprev = NULL;
+  timer->slot = -1;
+  timer->expires = 0;
+  timer->fn = fn;
+  timer->arg = arg;
+}
+
+void timer_wheel_init(timer_wheel_t *wheel, uint64_t now) {
+  for (int level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+    for (int slot = 0; slot < TIMER_WHEEL_SLOTS; ++slot) {
+      wheel->slots[level][slot] = NULL;
+    }
+    wheel->occupied[level] = 0;
+  }
+  wheel->now = now / TIMER_TICK_US;
+}
+
+void timer_arm(timer_wheel_t *wheel, foggy_timer_t *timer, uint64_t expires) {
+  if (timer_pending(timer)) unlink_timer(wheel, timer);
+  timer->expires = expires;
+  link_timer(wheel, timer);
+}
+
+void timer_cancel(timer_wheel_t *wheel, foggy_timer_t *timer) {
+  if (timer_pending(timer)) unlink_timer(wheel, timer);
+}
+
+void timer_wheel_run(timer_wheel_t *wheel, uint64_t now) {
+  uint64_t target = now / TIMER_TICK_US;
+
+  while (wheel->now <= target) {
+    uint64_t tick = next_tick(wheel);
+    if (tick > target) {  // nothing due, skip the idle ticks
+      wheel->now = target + 1;
+      break;
+    }
+    wheel->now = tick;
+
+    // Coarsest first, so what comes down from a level is moved on in turn
+    for (int level = TIMER_WHEEL_LEVELS - 1; level > 0; --level) {
+      int shift = TIMER_WHEEL_BITS * level;
+      if ((tick & ((1ULL << shift) - 1)) == 0) {
+        cascade(wheel, level, (tick >> shift) & SLOT_MASK);
+      }
+    }
+
+    // Take the slot out before the callbacks run, whatever they arm from
+    // now on belongs to later ticks
+    int slot = tick & SLOT_MASK;
+    foggy_timer_t *expired = wheel->slots[0][slot];
+    wheel->slots[0][slot] = NULL;
+    wheel->occupied[0] &= ~(1ULL << slot);
+    if (expired != NULL) expired->pprev = &expired;
+    wheel->now = tick + 1;
+
+    while (expired != NULL) {
+      foggy_timer_t *timer = expired;
+      unlink_timer(wheel, timer);
+      if (to_tick(timer->expires) > tick) {  // parked at the edge
+        link_timer(wheel, timer);
+      } else if (timer->fn != NULL) {
+        timer->fn(timer->arg);
+      }
+    }
+  }
+}
+
+uint64_t timer_wheel_next(const timer_wheel_t *wheel) {
+  uint64_t tick = next_tick(wheel);
+  return tick == UINT64_MAX ? 0 : tick * TIMER_TICK_US;
+}
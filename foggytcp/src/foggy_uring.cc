@@ -0,0 +1,659 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+/* This file implements the io_uring engine, see foggy_uring.h. It talks to
+ * the kernel with the raw system calls, there is no liburing to link.
+ */
+
+#include "foggy_uring.h"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <deque>
+
+#include "foggy_backend.h"
+#include "foggy_mp.h"
+#include "foggy_pmtu.h"
+#include "foggy_trace.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+
+#define URING_BGID 0  // the one provided buffer group
+
+/* What a completion is for, in the top byte of its user_data. */
+#define URING_RECV 1ULL  // a multishot receive, then the index of the fd
+#define URING_WAKE 2ULL  // the poll of the eventfd
+#define URING_SEND 3ULL  // a send, then the fixed bit, fd, length and slot
+#define URING_PROVIDE 4ULL  // receive buffers given back
+#define URING_KIND(user_data) ((user_data) >> 56)
+#define URING_SEND_FIXED (1ULL << 55)  // sent from the registered pool
+
+#define URING_MAX_FDS (1 + MP_MAX_SUBFLOWS)
+
+struct uring_state {
+  int fd;
+
+  /* Submission queue, shared with the kernel */
+  void *sq_ring;
+  size_t sq_ring_size;
+  uint32_t *sq_head;
+  uint32_t *sq_tail;
+  uint32_t sq_mask;
+  uint32_t sq_entries;
+  uint32_t *sq_array;
+  uint32_t *sq_flags;  // IORING_SQ_TASKRUN when completions wait to be posted
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+  uint32_t to_submit;  // entries queued since the last io_uring_enter()
+
+  /* Completion queue, shared with the kernel */
+  void *cq_ring;  // the same mapping as sq_ring with IORING_FEAT_SINGLE_MMAP
+  size_t cq_ring_size;
+  uint32_t *cq_head;
+  uint32_t *cq_tail;
+  uint32_t cq_mask;
+  struct io_uring_cqe *cqes;
+  deque<struct io_uring_cqe> deferred;  // reaped while sending, not handled
+
+  /* Receiving */
+  uint8_t *rx_bufs;
+  uint32_t rx_count;
+  uint32_t rx_size;
+  uint16_t *recycled;  // buffers to give back with the next submission
+  uint32_t recycled_len;
+  struct msghdr rx_msg;  // room for the address and the GRO size
+  int fds[URING_MAX_FDS];
+  int armed[URING_MAX_FDS];
+  int nfds;
+  int wake_armed;
+
+  /* Send pool, registered with the ring */
+  uint8_t *pool;
+  size_t pool_size;
+  uint32_t slot_size;
+  uint32_t slots;
+  uint32_t slot_head;  // oldest slot in use
+  uint32_t slot_tail;  // one past the newest slot in use
+  uint8_t *slot_busy;
+  struct sockaddr_in *slot_addr;
+  int fixed;  // sends use the registered pool
+};
+
+static int sys_setup(uint32_t entries, struct io_uring_params *p) {
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, uint32_t to_submit, uint32_t min_complete,
+                     uint32_t flags, const void *arg, size_t argsz) {
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                      arg, argsz);
+}
+
+static int sys_register(int fd, uint32_t opcode, const void *arg,
+                        uint32_t nr_args) {
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/**
+ * Passes the queued entries to the kernel and waits for completions.
+ *
+ * @param sock The socket.
+ * @param min_complete Completions to wait for, 0 to only submit and post
+ *                     those the kernel holds back.
+ * @param timeout_ms Longest wait, -1 to wait indefinitely.
+ */
+static void enter(foggy_socket_t *sock, uint32_t min_complete,
+                  int timeout_ms) {
+  struct uring_state *u = sock->uring;
+  struct io_uring_getevents_arg arg;
+  struct __kernel_timespec ts;
+  uint32_t flags = 0;
+  int ret;
+
+  if (min_complete > 0) {
+    flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask_sz = _NSIG / 8;
+    if (timeout_ms >= 0) {
+      ts.tv_sec = timeout_ms / 1000;
+      ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+      arg.ts = (uint64_t)(uintptr_t)&ts;
+    }
+  } else if (__atomic_load_n(u->sq_flags, __ATOMIC_RELAXED) &
+             IORING_SQ_TASKRUN) {
+    flags = IORING_ENTER_GETEVENTS;
+  } else if (u->to_submit == 0) {
+    return;
+  }
+  stat_add(&sock->stats.syscalls, 1);
+  ret = sys_enter(u->fd, u->to_submit, min_complete, flags,
+                  min_complete > 0 ? &arg : NULL,
+                  min_complete > 0 ? sizeof(arg) : 0);
+  if (ret > 0) {
+    u->to_submit -= MIN((uint32_t)ret, u->to_submit);
+  } else if (ret < 0 && errno != EINTR && errno != ETIME && errno != EAGAIN &&
+             errno != EBUSY) {
+    perror("ERROR io_uring_enter");
+  }
+}
+
+/**
+ * Returns a zeroed submission queue entry, queued once it was filled in,
+ * NULL if the queue stays full.
+ */
+static struct io_uring_sqe *get_sqe(foggy_socket_t *sock) {
+  struct uring_state *u = sock->uring;
+  uint32_t tail = *u->sq_tail;
+  struct io_uring_sqe *sqe;
+
+  if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) == u->sq_entries) {
+    enter(sock, 0, 0);
+    if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) ==
+        u->sq_entries) {
+      return NULL;
+    }
+  }
+  sqe = &(u->sqes[tail & u->sq_mask]);
+  memset(sqe, 0, sizeof(*sqe));
+  u->sq_array[tail & u->sq_mask] = tail & u->sq_mask;
+  return sqe;
+}
+
+/**
+ * Queues the entry get_sqe() returned last.
+ */
+static void queue_sqe(struct uring_state *u) {
+  __atomic_store_n(u->sq_tail, *u->sq_tail + 1, __ATOMIC_RELEASE);
+  ++u->to_submit;
+}
+
+static void arm_recv(foggy_socket_t *sock, int i) {
+  struct uring_state *u = sock->uring;
+  struct io_uring_sqe *sqe = get_sqe(sock);
+
+  if (sqe == NULL) return;  // tried again on the next pass
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = u->fds[i];
+  sqe->addr = (uint64_t)(uintptr_t)&(u->rx_msg);
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URING_BGID;
+  sqe->user_data = URING_RECV << 56 | (uint32_t)i;
+  queue_sqe(u);
+  u->armed[i] = 1;
+}
+
+static void arm_wake(foggy_socket_t *sock) {
+  struct uring_state *u = sock->uring;
+  struct io_uring_sqe *sqe = get_sqe(sock);
+
+  if (sqe == NULL) return;
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = sock->event_fd;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->poll32_events = POLLIN;
+  sqe->user_data = URING_WAKE << 56;
+  queue_sqe(u);
+  u->wake_armed = 1;
+}
+
+/**
+ * Arms the receives of new subflows and those that ended, and the wakeup.
+ */
+static void arm_all(foggy_socket_t *sock) {
+  struct uring_state *u = sock->uring;
+  int fds[MP_MAX_SUBFLOWS];
+  int n = mp_fds(sock, fds);
+
+  for (int i = 0; i < n && 1 + i < URING_MAX_FDS; ++i) {
+    if (i + 1 >= u->nfds || u->fds[i + 1] != fds[i]) {
+      u->fds[i + 1] = fds[i];
+      u->armed[i + 1] = 0;
+    }
+  }
+  u->nfds = MAX(u->nfds, 1 + MIN(n, URING_MAX_FDS - 1));
+  for (int i = 0; i < u->nfds; ++i) {
+    if (!u->armed[i]) arm_recv(sock, i);
+  }
+  if (!u->wake_armed) arm_wake(sock);
+}
+
+/**
+ * Queues the provision of consecutive receive buffers.
+ *
+ * @return 0 if queued, -1 if the submission queue is full.
+ */
+static int provide_buffers(foggy_socket_t *sock, uint16_t bid, uint32_t n) {
+  struct uring_state *u = sock->uring;
+  struct io_uring_sqe *sqe = get_sqe(sock);
+
+  if (sqe == NULL) return -1;
+  sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+  sqe->fd = (int)n;
+  sqe->addr = (uint64_t)(uintptr_t)(u->rx_bufs + (size_t)bid * u->rx_size);
+  sqe->len = u->rx_size;
+  sqe->off = bid;
+  sqe->buf_group = URING_BGID;
+  sqe->user_data = URING_PROVIDE << 56;
+  queue_sqe(u);
+  return 0;
+}
+
+/**
+ * Gives the buffers handled since the last call back to the kernel, runs of
+ * consecutive buffers in one entry. The receives take them in order, so a
+ * pass usually needs a single entry.
+ */
+static void publish_buffers(foggy_socket_t *sock) {
+  struct uring_state *u = sock->uring;
+  uint32_t i = 0, n;
+
+  while (i < u->recycled_len) {
+    for (n = 1; i + n < u->recycled_len &&
+                u->recycled[i + n] == u->recycled[i] + n;
+         ++n) {
+    }
+    if (provide_buffers(sock, u->recycled[i], n) < 0) break;
+    i += n;
+  }
+  // What did not fit goes with the next pass
+  memmove(u->recycled, u->recycled + i,
+          (u->recycled_len - i) * sizeof(*(u->recycled)));
+  u->recycled_len -= i;
+}
+
+/**
+ * Queues the send of a pool slot.
+ *
+ * @return 0 if queued, -1 if the submission queue is full.
+ */
+static int queue_send(foggy_socket_t *sock, int fd, uint32_t slot,
+                      uint16_t len) {
+  struct uring_state *u = sock->uring;
+  struct io_uring_sqe *sqe = get_sqe(sock);
+
+  if (sqe == NULL) return -1;
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)(u->pool + (size_t)slot * u->slot_size);
+  sqe->len = len;
+  sqe->addr2 = (uint64_t)(uintptr_t)&(u->slot_addr[slot]);
+  sqe->addr_len = sizeof(struct sockaddr_in);
+  sqe->user_data = URING_SEND << 56 | (uint64_t)(fd & 0x7fffff) << 32 |
+                   (uint64_t)len << 16 | slot;
+  if (u->fixed) {
+    sqe->ioprio = IORING_RECVSEND_FIXED_BUF;
+    sqe->buf_index = 0;
+    sqe->user_data |= URING_SEND_FIXED;
+  }
+  queue_sqe(u);
+  return 0;
+}
+
+static void free_slot(struct uring_state *u, uint32_t slot) {
+  u->slot_busy[slot] = 0;
+  while (u->slot_head != u->slot_tail && !u->slot_busy[u->slot_head % u->slots]) {
+    ++u->slot_head;
+  }
+}
+
+/**
+ * Handles the completion of a send. A kernel that cannot send from the
+ * registered pool gets the packet again the plain way.
+ */
+static void handle_send(foggy_socket_t *sock, const struct io_uring_cqe *cqe) {
+  struct uring_state *u = sock->uring;
+  uint32_t slot = (uint32_t)(cqe->user_data & 0xffff);
+  uint16_t len = (uint16_t)(cqe->user_data >> 16);
+  int fd = (int)((cqe->user_data >> 32) & 0x7fffff);
+
+  // Every send queued before the first of these failed comes back here
+  if (cqe->res == -EINVAL && (cqe->user_data & URING_SEND_FIXED)) {
+    if (u->fixed) {
+      debug_printf("io_uring cannot send registered buffers, copying them\n");
+      u->fixed = 0;
+    }
+    if (queue_send(sock, fd, slot, len) == 0) return;
+  }
+  free_slot(u, slot);  // other errors are losses, the RTO recovers from them
+}
+
+/**
+ * Handles a receive completion: the datagram in the buffer the kernel
+ * picked, or the end of the multishot request.
+ */
+static void handle_recv(foggy_socket_t *sock, const struct io_uring_cqe *cqe) {
+  struct uring_state *u = sock->uring;
+  int i = (int)(cqe->user_data & 0xffffffff);
+  struct io_uring_recvmsg_out *out;
+  struct sockaddr_in from;
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  uint8_t *buf, *payload;
+  int seg_size = 0;
+
+  if (!(cqe->flags & IORING_CQE_F_MORE) && i < URING_MAX_FDS) {
+    u->armed[i] = 0;  // armed again by arm_all()
+  }
+  if (cqe->res < 0 || !(cqe->flags & IORING_CQE_F_BUFFER)) {
+    return;  // an error, e.g. ENOBUFS when the buffers ran out
+  }
+  uint16_t bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+  buf = u->rx_bufs + (size_t)bid * u->rx_size;
+  out = (struct io_uring_recvmsg_out *)buf;
+  if (cqe->res > 0 && !(out->flags & MSG_TRUNC) &&
+      out->namelen >= sizeof(from)) {
+    memcpy(&from, buf + sizeof(*out), sizeof(from));
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = buf + sizeof(*out) + u->rx_msg.msg_namelen;
+    msg.msg_controllen = out->controllen;
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+        memcpy(&seg_size, CMSG_DATA(cmsg), sizeof(seg_size));
+      }
+    }
+    payload = buf + sizeof(*out) + u->rx_msg.msg_namelen +
+              u->rx_msg.msg_controllen;
+    handle_datagram(sock, payload, out->payloadlen, &from, seg_size);
+  }
+  u->recycled[u->recycled_len++] = bid;
+}
+
+static void handle_cqe(foggy_socket_t *sock, const struct io_uring_cqe *cqe) {
+  switch (URING_KIND(cqe->user_data)) {
+    case URING_RECV:
+      handle_recv(sock, cqe);
+      break;
+    case URING_WAKE:
+      // The backend runs its loop anyway, nothing to read from the eventfd
+      if (!(cqe->flags & IORING_CQE_F_MORE)) sock->uring->wake_armed = 0;
+      break;
+    case URING_SEND:
+      handle_send(sock, cqe);
+      break;
+    case URING_PROVIDE:
+      if (cqe->res < 0) {
+        debug_printf("io_uring provide buffers: %s\n", strerror(-cqe->res));
+      }
+      break;
+  }
+}
+
+/**
+ * Takes the next completion off the queue.
+ *
+ * @return 1 if there was one, 0 otherwise.
+ */
+static int next_cqe(struct uring_state *u, struct io_uring_cqe *cqe) {
+  uint32_t head = *u->cq_head;
+
+  if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) return 0;
+  *cqe = u->cqes[head & u->cq_mask];
+  __atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+/**
+ * Frees the slots of the sends that completed. Other completions are kept
+ * for uring_poll(), which may not run from within a send.
+ */
+static void reap_sends(foggy_socket_t *sock) {
+  struct uring_state *u = sock->uring;
+  struct io_uring_cqe cqe;
+
+  while (next_cqe(u, &cqe)) {
+    if (URING_KIND(cqe.user_data) == URING_SEND) {
+      handle_send(sock, &cqe);
+    } else {
+      u->deferred.push_back(cqe);
+    }
+  }
+}
+
+void uring_init(foggy_socket_t *sock) {
+  const char *env = getenv("FOGGY_URING");
+
+  sock->uring_wanted = env != NULL && atoi(env) != 0;
+  sock->uring = NULL;
+}
+
+/**
+ * Maps the queues of a new ring.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int map_rings(struct uring_state *u, const struct io_uring_params *p) {
+  uint8_t *sq, *cq;
+
+  u->sq_ring_size = p->sq_off.array + p->sq_entries * sizeof(uint32_t);
+  u->cq_ring_size = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+  if (p->features & IORING_FEAT_SINGLE_MMAP) {
+    u->sq_ring_size = u->cq_ring_size = MAX(u->sq_ring_size, u->cq_ring_size);
+  }
+  u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+  if (u->sq_ring == MAP_FAILED) {
+    u->sq_ring = NULL;
+    return -1;
+  }
+  if (p->features & IORING_FEAT_SINGLE_MMAP) {
+    u->cq_ring = u->sq_ring;
+  } else {
+    u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+    if (u->cq_ring == MAP_FAILED) {
+      u->cq_ring = NULL;
+      return -1;
+    }
+  }
+  u->sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+  u->sqes = (struct io_uring_sqe *)mmap(NULL, u->sqes_size,
+                                        PROT_READ | PROT_WRITE,
+                                        MAP_SHARED | MAP_POPULATE, u->fd,
+                                        IORING_OFF_SQES);
+  if (u->sqes == MAP_FAILED) {
+    u->sqes = NULL;
+    return -1;
+  }
+
+  sq = (uint8_t *)u->sq_ring;
+  u->sq_head = (uint32_t *)(sq + p->sq_off.head);
+  u->sq_tail = (uint32_t *)(sq + p->sq_off.tail);
+  u->sq_mask = *(uint32_t *)(sq + p->sq_off.ring_mask);
+  u->sq_entries = *(uint32_t *)(sq + p->sq_off.ring_entries);
+  u->sq_array = (uint32_t *)(sq + p->sq_off.array);
+  u->sq_flags = (uint32_t *)(sq + p->sq_off.flags);
+  cq = (uint8_t *)u->cq_ring;
+  u->cq_head = (uint32_t *)(cq + p->cq_off.head);
+  u->cq_tail = (uint32_t *)(cq + p->cq_off.tail);
+  u->cq_mask = *(uint32_t *)(cq + p->cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe *)(cq + p->cq_off.cqes);
+  return 0;
+}
+
+/**
+ * Allocates the receive buffers and provides them to the ring, in the
+ * first submission. They fit the largest datagram the socket accepts.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int setup_buffers(foggy_socket_t *sock) {
+  struct uring_state *u = sock->uring;
+  uint32_t datagram = sock->gso ? RX_BUF_SIZE
+                                : sizeof(foggy_tcp_header_t) + sock->local_mss;
+
+  u->rx_msg.msg_namelen = sizeof(struct sockaddr_in);
+  u->rx_msg.msg_controllen = CMSG_SPACE(sizeof(int));
+  u->rx_size = sizeof(struct io_uring_recvmsg_out) + u->rx_msg.msg_namelen +
+               u->rx_msg.msg_controllen + datagram;
+  u->rx_count = MIN(MAX(URING_MIN_BUFFERS, URING_RX_BYTES / u->rx_size),
+                    UINT16_MAX);
+  u->rx_bufs = (uint8_t *)malloc((size_t)u->rx_count * u->rx_size);
+  u->recycled = (uint16_t *)malloc(u->rx_count * sizeof(*(u->recycled)));
+  if (u->rx_bufs == NULL || u->recycled == NULL) return -1;
+  return provide_buffers(sock, 0, u->rx_count);
+}
+
+/**
+ * Allocates the send pool, in slots that fit the largest packet the path
+ * search may reach, and registers it. The pool still works unregistered.
+ */
+static void setup_pool(foggy_socket_t *sock) {
+  struct uring_state *u = sock->uring;
+  struct iovec iov;
+
+  u->slot_size = MAX((uint32_t)sock->pmtu.max,
+                     (uint32_t)(sizeof(foggy_tcp_header_t) + sock->mss));
+  u->slot_size = (u->slot_size + 63) & ~63U;
+  u->slots = MAX(URING_MIN_BUFFERS, URING_POOL_BYTES / u->slot_size);
+  u->pool_size = (size_t)u->slots * u->slot_size;
+  u->pool = (uint8_t *)mmap(NULL, u->pool_size, PROT_READ | PROT_WRITE,
+                            MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  u->slot_busy = (uint8_t *)calloc(u->slots, 1);
+  u->slot_addr = (struct sockaddr_in *)calloc(u->slots,
+                                              sizeof(struct sockaddr_in));
+  u->slot_head = u->slot_tail = 0;
+
+  iov.iov_base = u->pool;
+  iov.iov_len = u->pool_size;
+  u->fixed = sys_register(u->fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+}
+
+void uring_start(foggy_socket_t *sock) {
+  struct io_uring_params p;
+  struct uring_state *u;
+
+  if (!sock->uring_wanted) return;
+  memset(&p, 0, sizeof(p));
+  // Only the backend thread submits, and it collects completions itself,
+  // the flag tells a spinning one when to
+  p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN |
+            IORING_SETUP_TASKRUN_FLAG;
+  int fd = sys_setup(URING_ENTRIES, &p);
+  if (fd < 0 && errno == EINVAL) {
+    memset(&p, 0, sizeof(p));
+    fd = sys_setup(URING_ENTRIES, &p);
+  }
+  if (fd < 0) {
+    debug_printf("io_uring unavailable, staying on the socket calls\n");
+    return;
+  }
+
+  u = new uring_state();
+  u->fd = fd;
+  sock->uring = u;
+  if (!(p.features & IORING_FEAT_EXT_ARG) || map_rings(u, &p) < 0 ||
+      setup_buffers(sock) < 0) {
+    debug_printf("io_uring lacks what the engine needs, staying on the "
+                 "socket calls\n");
+    uring_destroy(sock);
+    return;
+  }
+  setup_pool(sock);
+  u->fds[0] = sock->socket;
+  u->nfds = 1;
+  arm_all(sock);
+}
+
+void uring_destroy(foggy_socket_t *sock) {
+  struct uring_state *u = sock->uring;
+
+  if (u == NULL) return;
+  // The sends of the backend's last pass, such as a final ACK, still go out
+  if (u->sqes != NULL) enter(sock, 0, 0);
+  // Closing the ring cancels what is in flight before the buffers go away
+  close(u->fd);
+  if (u->sqes != NULL) munmap(u->sqes, u->sqes_size);
+  if (u->cq_ring != NULL && u->cq_ring != u->sq_ring) {
+    munmap(u->cq_ring, u->cq_ring_size);
+  }
+  if (u->sq_ring != NULL) munmap(u->sq_ring, u->sq_ring_size);
+  if (u->pool != NULL) munmap(u->pool, u->pool_size);
+  free(u->rx_bufs);
+  free(u->recycled);
+  free(u->slot_busy);
+  free(u->slot_addr);
+  delete u;
+  sock->uring = NULL;
+}
+
+void uring_poll(foggy_socket_t *sock) {
+  struct uring_state *u = sock->uring;
+  struct io_uring_cqe cqe;
+
+  // Completions put aside while sending came first
+  while (!u->deferred.empty() || next_cqe(u, &cqe)) {
+    if (!u->deferred.empty()) {
+      cqe = u->deferred.front();
+      u->deferred.pop_front();
+    }
+    handle_cqe(sock, &cqe);
+  }
+  publish_buffers(sock);
+  arm_all(sock);
+}
+
+void uring_wait(foggy_socket_t *sock, int timeout_ms) {
+  struct uring_state *u = sock->uring;
+
+  if (!u->deferred.empty() ||
+      *u->cq_head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+    enter(sock, 0, 0);  // only submit, there is work already
+    return;
+  }
+  enter(sock, 1, timeout_ms);
+}
+
+int uring_ready(foggy_socket_t *sock) {
+  struct uring_state *u = sock->uring;
+
+  enter(sock, 0, 0);  // the queued sends go out while spinning
+  return !u->deferred.empty() ||
+         *u->cq_head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+}
+
+int uring_send(foggy_socket_t *sock, int fd, const struct sockaddr_in *addr,
+               const uint8_t *pkt, uint16_t len) {
+  struct uring_state *u = sock->uring;
+  uint32_t slot;
+
+  if (len > u->slot_size) {
+    enter(sock, 0, 0);  // what was queued before goes first
+    return -1;
+  }
+  if (u->slot_tail - u->slot_head == u->slots) {
+    enter(sock, 0, 0);
+    reap_sends(sock);
+    if (u->slot_tail - u->slot_head == u->slots) {
+      return -1;  // the submission went out, the caller's send follows it
+    }
+  }
+  slot = u->slot_tail % u->slots;
+  memcpy(u->pool + (size_t)slot * u->slot_size, pkt, len);
+  u->slot_addr[slot] = *addr;
+  if (queue_send(sock, fd, slot, len) < 0) {
+    return -1;
+  }
+  u->slot_busy[slot] = 1;
+  ++u->slot_tail;
+  return 0;
+}
@@ -0,0 +1,356 @@
+/**
+ * Copyright (C) 2024 Hong Kong University of Science and Technology
+ *
+ * This repository is used for the Computer Networks (ELEC 3120) course taught
+ * at Hong Kong University of Science and Technology.
+ *
+ * No part of the project may be copied and/or distributed without the express
+ * permission of the course staff. Everyone is prohibited from releasing their
+ * forks in any public places.
+ */
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "foggy_backend.h"
+#include "foggy_compress.h"
+#include "foggy_function.h"
+#include "foggy_lz.h"
+#include "foggy_packet.h"
+#include "foggy_sockopt.h"
+#include "foggy_tcp.h"
+
+/**
+ * This file implements microbenchmarks for the per-packet hot paths: header
+ * construction and parsing, send window ACK processing, receive side
+ * reassembly, timer updates and the compression codec. Each benchmark reports the time and the heap
+ * allocations per operation; allocations are counted by wrapping the malloc
+ * family.
+ *
+ * Usage: ./microbench [filter]
+ *
+ * Only the benchmarks whose name contains `filter` run.
+ */
+
+#define MIN_BENCH_NS 200000000  // run every benchmark for at least 0.2 s
+#define HLEN sizeof(foggy_tcp_header_t)
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+}
+
+static __thread uint64_t allocs = 0;
+
+void *malloc(size_t size) {
+  allocs++;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+  allocs++;
+  return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  allocs++;
+  return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) { __libc_free(ptr); }
+
+static uint64_t now_ns() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static volatile uint64_t sink;  // keeps results alive
+
+/* Time and allocations inside timer_start()/timer_stop(), so benchmarks can
+ * keep their setup off the clock. */
+static uint64_t timed_ns, timed_allocs, timer_ns, timer_allocs;
+
+static inline void timer_start() {
+  timer_allocs = allocs;
+  timer_ns = now_ns();
+}
+
+static inline void timer_stop() {
+  timed_ns += now_ns() - timer_ns;
+  timed_allocs += allocs - timer_allocs;
+}
+
+typedef struct {
+  const char *name;
+  void (*setup)(int arg);
+  uint64_t (*run)(int arg, uint64_t iters);  // returns the ops it performed
+  int arg;
+} bench_t;
+
+/**
+ * Runs a benchmark with growing iteration counts until it lasts long enough,
+ * then prints ns/op and allocs/op of the last round.
+ */
+static void run_bench(const bench_t *bench) {
+  uint64_t iters = 1, ops, elapsed;
+  char name[64];
+
+  while (1) {
+    if (bench->setup != NULL) bench->setup(bench->arg);
+    timed_ns = timed_allocs = 0;
+    ops = bench->run(bench->arg, iters);
+    elapsed = timed_ns;
+    if (elapsed >= MIN_BENCH_NS || iters >= (1ULL << 40)) break;
+    iters = elapsed == 0 ? iters * 100
+                         : iters * MIN_BENCH_NS / elapsed * 12 / 10 + 1;
+  }
+  snprintf(name, sizeof(name), bench->arg > 0 ? "%s/%d" : "%s", bench->name,
+           bench->arg);
+  printf("%-32s %12lu ops %10.1f ns/op %8.2f allocs/op\n", name,
+         (unsigned long)ops, (double)elapsed / ops, (double)timed_allocs / ops);
+}
+
+/* A connected socket without a backend, enough for the window functions. */
+static foggy_socket_t *bench_sock = NULL;
+static int sink_fd = -1;
+
+static foggy_socket_t *make_socket() {
+  foggy_socket_t *sock = new foggy_socket_t();
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+
+  // ACKs go to a socket nobody reads, the kernel drops them once it is full
+  if (sink_fd < 0) {
+    sink_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(sink_fd, (struct sockaddr *)&addr, sizeof(addr));
+  }
+  getsockname(sink_fd, (struct sockaddr *)&addr, &len);
+  sock->socket = socket(AF_INET, SOCK_DGRAM, 0);
+  sock->conn = addr;
+  sock->my_port = 4000;
+  sock->connected = 2;
+  sock->mss = MSS;
+  sockopt_init(sock);
+  sock->window.rto = RTO_MIN;
+  sock->window.congestion_window = WINDOW_INITIAL_WINDOW_SIZE;
+  sock->window.advertised_window = WINDOW_INITIAL_ADVERTISED;
+  pthread_mutex_init(&(sock->recv_lock), NULL);
+  pthread_mutex_init(&(sock->window.ack_lock), NULL);
+  send_ring_init(&(sock->send_window));
+  timer_wheel_init(&(sock->timers), get_time_us());
+  timer_init(&(sock->rto_timer), retransmission_timeout, sock);
+  return sock;
+}
+
+static void reset_socket(int arg) {
+  (void)arg;
+  if (bench_sock == NULL) bench_sock = make_socket();
+  free(bench_sock->received_buf);
+  bench_sock->received_buf = NULL;
+  bench_sock->received_len = 0;
+}
+
+static uint64_t bench_create_packet(int arg, uint64_t iters) {
+  static uint8_t payload[MSS];
+
+  timer_start();
+  for (uint64_t i = 0; i < iters; ++i) {
+    uint8_t *pkt = create_packet(4000, 4001, i, i, HLEN, HLEN + arg,
+                                 ACK_FLAG_MASK, 1000, 0, NULL, payload, arg);
+    sink += pkt[0];
+    free(pkt);
+  }
+  timer_stop();
+  return iters;
+}
+
+static uint64_t bench_parse_header(int arg, uint64_t iters) {
+  uint8_t *pkt = create_packet(4000, 4001, 1, 2, HLEN, HLEN, ACK_FLAG_MASK,
+                               1000, 0, NULL, NULL, 0);
+  foggy_tcp_header_t *hdr = (foggy_tcp_header_t *)pkt;
+  uint64_t sum = 0;
+
+  (void)arg;
+  timer_start();
+  for (uint64_t i = 0; i < iters; ++i) {
+    sum += get_src(hdr) + get_dst(hdr) + get_seq(hdr) + get_ack(hdr) +
+           get_hlen(hdr) + get_plen(hdr) + get_flags(hdr) +
+           get_advertised_window(hdr) + get_payload_len(pkt);
+  }
+  timer_stop();
+  sink += sum;
+  free(pkt);
+  return iters;
+}
+
+/* Queues `window` sent segments and ACKs them all at once, only the ACK
+ * processing is timed. */
+static uint64_t bench_ack_window(int window, uint64_t iters) {
+  foggy_socket_t *sock = bench_sock;
+  uint8_t payload[MSS] = {0};
+  uint64_t ops = 0;
+
+  for (uint64_t i = 0; i < iters; i += window) {
+    for (int j = 0; j < window; ++j) {
+      uint8_t *msg = create_socket_packet(sock, sock->window.last_byte_sent, 0,
+                                          ACK_FLAG_MASK, 0, NULL, payload, MSS);
+      send_ring_push(&(sock->send_window), msg, sock->window.last_byte_sent,
+                     MSS);
+      sock->window.last_byte_sent += MSS;
+    }
+    sock->send_window.next = sock->send_window.tail;  // all sent
+    sock->window.last_ack_received = sock->window.last_byte_sent;
+
+    timer_start();
+    receive_send_window(sock);
+    timer_stop();
+    ops += window;
+  }
+  return ops;
+}
+
+/* Delivers data segments, swapping every `reorder`th pair. The packets are
+ * built off the clock; the ACK each one triggers is part of the cost. */
+static uint64_t bench_receive(int reorder, uint64_t iters) {
+  foggy_socket_t *sock = bench_sock;
+  static uint8_t *pkts[64];
+  static uint8_t payload[MSS];
+  uint64_t ops = 0;
+
+  for (uint64_t i = 0; i < iters; i += 64) {
+    uint32_t seq = sock->window.next_seq_expected;
+    for (int j = 0; j < 64; ++j) {
+      pkts[j] = create_packet(4001, 4000, seq + j * MSS, 0, HLEN, HLEN + MSS,
+                              ACK_FLAG_MASK, 1000, 0, NULL, payload, MSS);
+    }
+    if (reorder > 0) {
+      for (int j = 0; j + 1 < 64; j += 2 * reorder) {
+        uint8_t *tmp = pkts[j];
+        pkts[j] = pkts[j + 1];
+        pkts[j + 1] = tmp;
+      }
+    }
+    timer_start();
+    for (int j = 0; j < 64; ++j) {
+      on_recv_pkt(sock, pkts[j]);
+    }
+    timer_stop();
+    for (int j = 0; j < 64; ++j) {
+      free(pkts[j]);
+    }
+    // The application reads what was delivered
+    free(sock->received_buf);
+    sock->received_buf = NULL;
+    sock->received_len = 0;
+    // Resynchronise on what a retransmission would have filled in
+    sock->window.next_seq_expected = seq + 64 * MSS;
+    ops += 64;
+  }
+  return ops;
+}
+
+/* Keeps `pending` timers armed and moves one of them per operation, the way
+ * every ACK restarts the retransmission timer. */
+static uint64_t bench_timer_rearm(int pending, uint64_t iters) {
+  static timer_wheel_t wheel;
+  static foggy_timer_t timers[4096];
+  uint64_t now = get_time_us();
+
+  timer_wheel_init(&wheel, now);
+  for (int i = 0; i < pending; ++i) {
+    timer_init(&timers[i], NULL, NULL);
+    timer_arm(&wheel, &timers[i], now + 1000 + (i * 7919) % 600000);
+  }
+  timer_start();
+  for (uint64_t i = 0; i < iters; ++i) {
+    timer_arm(&wheel, &timers[i % pending], now + 200000 + (i % 1000) * 100);
+  }
+  timer_stop();
+  sink += timer_wheel_next(&wheel);
+  return iters;
+}
+
+/* One block of the stream, log-like text if arg is 0, random bytes if 1. */
+static uint8_t lz_block[COMPRESS_BLOCK], lz_packed[COMPRESS_BLOCK * 2];
+static int lz_packed_len;
+
+static void fill_block(int random) {
+  char line[64];
+  int n;
+
+  srand(1);
+  for (int len = 0; len < COMPRESS_BLOCK; len += n) {
+    if (random) {
+      lz_block[len] = (uint8_t)rand();
+      n = 1;
+      continue;
+    }
+    n = snprintf(line, sizeof(line), "seq %d ack %d window %d flags %s\n",
+                 rand() % 100000, rand() % 100000, rand() % 65536,
+                 rand() % 2 ? "ACK" : "SYN");
+    if (n > COMPRESS_BLOCK - len) n = COMPRESS_BLOCK - len;
+    memcpy(lz_block + len, line, n);
+  }
+  lz_packed_len = lz_compress(lz_block, COMPRESS_BLOCK, lz_packed,
+                              sizeof(lz_packed));
+}
+
+static uint64_t bench_lz_compress(int random, uint64_t iters) {
+  timer_start();
+  for (uint64_t i = 0; i < iters; ++i) {
+    sink += lz_compress(lz_block, COMPRESS_BLOCK, lz_packed, sizeof(lz_packed));
+  }
+  timer_stop();
+  (void)random;
+  return iters;
+}
+
+static uint64_t bench_lz_decompress(int random, uint64_t iters) {
+  static uint8_t out[COMPRESS_BLOCK];
+
+  timer_start();
+  for (uint64_t i = 0; i < iters; ++i) {
+    sink += lz_decompress(lz_packed, lz_packed_len, out, sizeof(out));
+  }
+  timer_stop();
+  (void)random;
+  return iters;
+}
+
+int main(int argc, const char *argv[]) {
+  const char *filter = argc > 1 ? argv[1] : "";
+  const bench_t benches[] = {
+      {"create_packet", NULL, bench_create_packet, 0},
+      {"create_packet", NULL, bench_create_packet, MSS},
+      {"parse_header", NULL, bench_parse_header, 0},
+      {"ack_window", reset_socket, bench_ack_window, 1},
+      {"ack_window", reset_socket, bench_ack_window, 16},
+      {"ack_window", reset_socket, bench_ack_window, 256},
+      {"receive_in_order", reset_socket, bench_receive, 0},
+      {"receive_reordered", reset_socket, bench_receive, 1},
+      {"receive_reordered", reset_socket, bench_receive, 8},
+      {"timer_rearm", NULL, bench_timer_rearm, 16},
+      {"timer_rearm", NULL, bench_timer_rearm, 4096},
+      {"lz_compress_text", fill_block, bench_lz_compress, 0},
+      {"lz_compress_random", fill_block, bench_lz_compress, 1},
+      {"lz_decompress_text", fill_block, bench_lz_decompress, 0},
+  };
+
+  for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); ++i) {
+    if (strstr(benches[i].name, filter) != NULL) {
+      run_bench(&benches[i]);
+    }
+  }
+  return 0;
+}
@@ -11,12 +11,18 @@
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <linux/sockios.h>
+#include <linux/tcp.h>
 #include <netinet/in.h>
+#include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <unistd.h>
 #include <cstdio>
 
+#include "foggy_cq.h"
 #include "foggy_tcp.h"
 
 struct system_socket {
@@ -60,6 +66,175 @@ int foggy_close(void* in_sock) {
   return close(sock->init_sock_fd);
 }
 
+int foggy_shutdown(void* in_sock) {
+  struct system_socket* sock = (struct system_socket*)in_sock;
+  int sock_fd = sock->socket_type == TCP_LISTENER
+                    ? sock->accept_sock_fd
+                    : sock->init_sock_fd;
+  return shutdown(sock_fd, SHUT_WR);
+}
+
+int foggy_set_coalescing(void* in_sock, foggy_coalesce_t mode) {
+  struct system_socket* sock = (struct system_socket*)in_sock;
+  int sock_fd = sock->socket_type == TCP_LISTENER
+                    ? sock->accept_sock_fd
+                    : sock->init_sock_fd;
+  int nodelay = mode == FOGGY_NODELAY, cork = mode == FOGGY_CORK;
+
+  // Clearing TCP_CORK pushes what it held
+  if (setsockopt(sock_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay,
+                 sizeof(nodelay)) < 0 ||
+      setsockopt(sock_fd, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork)) < 0) {
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Maps an option to its kernel counterpart. The kernel has none for the
+ * initial window, initial RTO, pacing on or off, the delayed ACK timeout and
+ * the CPU of a backend thread, RTO bounds only in recent versions. Its busy
+ * polling spins in the application's reads instead, and it keeps TIME_WAIT
+ * past the process, so nothing needs to linger.
+ *
+ * @return 0 on success, -1 if the option has no counterpart.
+ */
+static int kernel_option(foggy_sockopt_t option, int* level, int* name) {
+  switch (option) {
+    case FOGGY_SO_SNDBUF:
+      *level = SOL_SOCKET;
+      *name = SO_SNDBUF;
+      return 0;
+    case FOGGY_SO_RCVBUF:
+      *level = SOL_SOCKET;
+      *name = SO_RCVBUF;
+      return 0;
+    case FOGGY_CONGESTION:
+      *level = IPPROTO_TCP;
+      *name = TCP_CONGESTION;
+      return 0;
+    case FOGGY_BUSY_POLL:
+      *level = SOL_SOCKET;
+      *name = SO_BUSY_POLL;
+      return 0;
+#ifdef TCP_RTO_MIN_US
+    case FOGGY_RTO_MIN:
+      *level = IPPROTO_TCP;
+      *name = TCP_RTO_MIN_US;
+      return 0;
+#endif
+    default:
+      return -1;
+  }
+}
+
+static const char* cc_names[] = {"reno", "cubic"};
+
+int foggy_setsockopt(void* in_sock, foggy_sockopt_t option, int value) {
+  struct system_socket* sock = (struct system_socket*)in_sock;
+  int sock_fd = sock->socket_type == TCP_LISTENER
+                    ? sock->accept_sock_fd
+                    : sock->init_sock_fd;
+  int level, name;
+
+  if (kernel_option(option, &level, &name) < 0) {
+    return -1;
+  }
+  if (option == FOGGY_CONGESTION) {
+    if (value != FOGGY_CC_RENO && value != FOGGY_CC_CUBIC) {
+      return -1;
+    }
+    return setsockopt(sock_fd, level, name, cc_names[value],
+                      strlen(cc_names[value]));
+  }
+  return setsockopt(sock_fd, level, name, &value, sizeof(value));
+}
+
+int foggy_getsockopt(void* in_sock, foggy_sockopt_t option, int* value) {
+  struct system_socket* sock = (struct system_socket*)in_sock;
+  int sock_fd = sock->socket_type == TCP_LISTENER
+                    ? sock->accept_sock_fd
+                    : sock->init_sock_fd;
+  int level, name;
+  char cc[16] = {0};
+  socklen_t len = sizeof(*value);
+
+  if (kernel_option(option, &level, &name) < 0) {
+    return -1;
+  }
+  if (option == FOGGY_CONGESTION) {
+    len = sizeof(cc) - 1;
+    if (getsockopt(sock_fd, level, name, cc, &len) < 0) {
+      return -1;
+    }
+    *value = strcmp(cc, "cubic") == 0 ? FOGGY_CC_CUBIC : FOGGY_CC_RENO;
+    return 0;
+  }
+  if (getsockopt(sock_fd, level, name, value, &len) < 0) {
+    return -1;
+  }
+  // The kernel reports the buffers doubled, for its own bookkeeping
+  if (option == FOGGY_SO_SNDBUF || option == FOGGY_SO_RCVBUF) {
+    *value /= 2;
+  }
+  return 0;
+}
+
+int foggy_get_info(void* in_sock, foggy_info_t* info) {
+  struct system_socket* sock = (struct system_socket*)in_sock;
+  int sock_fd = sock->socket_type == TCP_LISTENER
+                    ? sock->accept_sock_fd
+                    : sock->init_sock_fd;
+  struct tcp_info ti;
+  socklen_t len = sizeof(ti);
+  int queued = 0;
+
+  if (getsockopt(sock_fd, IPPROTO_TCP, TCP_INFO, &ti, &len) < 0) {
+    return -1;
+  }
+  ioctl(sock_fd, SIOCINQ, &queued);
+
+  // The kernel counts the windows in segments
+  info->cwnd = ti.tcpi_snd_cwnd * ti.tcpi_snd_mss;
+  info->ssthresh = ti.tcpi_snd_ssthresh >= 0x7fffffff / ti.tcpi_snd_mss
+                       ? 0xffffffff
+                       : ti.tcpi_snd_ssthresh * ti.tcpi_snd_mss;
+  if (ti.tcpi_ca_state >= TCP_CA_Recovery) {
+    info->reno_state = RENO_FAST_RECOVERY;
+  } else if (ti.tcpi_snd_cwnd < ti.tcpi_snd_ssthresh) {
+    info->reno_state = RENO_SLOW_START;
+  } else {
+    info->reno_state = RENO_CONGESTION_AVOIDANCE;
+  }
+  info->srtt_us = ti.tcpi_rtt;
+  info->rttvar_us = ti.tcpi_rttvar;
+  info->rto_us = ti.tcpi_rto;
+  info->bytes_sent = ti.tcpi_bytes_sent;
+  info->bytes_acked = ti.tcpi_bytes_acked;
+  info->bytes_retrans = ti.tcpi_bytes_retrans;
+  info->segs_sent = ti.tcpi_segs_out;
+  info->segs_retrans = ti.tcpi_total_retrans;
+  info->dup_acks = 0;  // not exported by the kernel
+  info->ooo_segments = ti.tcpi_rcv_ooopack;
+  info->fec_parity_sent = 0;
+  info->fec_recovered = 0;
+  info->compress_saved = 0;
+  info->syscalls = 0;  // not counted, the application makes them
+  info->spin_us = 0;
+  info->rcv_occupancy = queued;
+  info->pacing_rate = ti.tcpi_pacing_rate;
+  info->mss = ti.tcpi_snd_mss;
+  return 0;
+}
+
+int foggy_get_latency(void* in_sock, foggy_latency_kind_t kind,
+                      foggy_latency_t* latency) {
+  (void)in_sock;
+  (void)kind;
+  (void)latency;
+  return -1;  // the kernel keeps no such histograms
+}
+
 int foggy_read(void* in_sock, void* buf, const int length) {
   struct system_socket* sock = (struct system_socket*)in_sock;
   int sock_fd = sock->socket_type == TCP_LISTENER
@@ -74,4 +249,122 @@ int foggy_write(void* in_sock, const void* buf, const int length) {
                     ? sock->accept_sock_fd
                     : sock->init_sock_fd;
   return write(sock_fd, buf, length);
-}
\ No newline at end of file
+}
+int foggy_stream_open(void* in_sock) {
+  (void)in_sock;
+  return -1;  // a kernel socket is a single stream
+}
+
+int foggy_stream_accept(void* in_sock) {
+  (void)in_sock;
+  return -1;
+}
+
+int foggy_stream_read(void* in_sock, int stream, void* buf, int length) {
+  return stream == 0 ? foggy_read(in_sock, buf, length) : -1;
+}
+
+int foggy_stream_write(void* in_sock, int stream, const void* buf,
+                       int length) {
+  return stream == 0 ? foggy_write(in_sock, buf, length) : -1;
+}
+
+int foggy_stream_close(void* in_sock, int stream) {
+  return stream == 0 ? foggy_shutdown(in_sock) : -1;
+}
+
+/**
+ * An asynchronous operation that would have blocked, finished by a thread of
+ * its own.
+ */
+typedef struct {
+  void* sock;
+  int fd;
+  foggy_cq_t* cq;
+  foggy_op_t op;
+  uint8_t* buf;
+  int len;
+  int done;
+  void* user_data;
+} system_op_t;
+
+static void* finish_op(void* in) {
+  system_op_t* op = (system_op_t*)in;
+  int n = 0;
+
+  if (op->op == FOGGY_OP_READ) {
+    n = read(op->fd, op->buf, op->len);
+  } else {
+    while (op->done < op->len &&
+           (n = send(op->fd, op->buf + op->done, op->len - op->done,
+                     MSG_NOSIGNAL)) > 0) {
+      op->done += n;
+    }
+    n = op->done == op->len ? op->len : -1;
+  }
+  cq_post(op->cq, op->sock, op->op, n, op->user_data);
+  free(op);
+  return NULL;
+}
+
+/**
+ * Tries an operation without blocking and leaves what would block to a
+ * thread. Operations on one socket are only ordered if at most one read and
+ * one write are outstanding.
+ */
+static int submit_op(void* in_sock, foggy_cq_t* cq, foggy_op_t type,
+                     void* buf, int length, void* user_data) {
+  struct system_socket* sock = (struct system_socket*)in_sock;
+  int sock_fd = sock->socket_type == TCP_LISTENER
+                    ? sock->accept_sock_fd
+                    : sock->init_sock_fd;
+  system_op_t* op;
+  pthread_t thread;
+  int n, done = 0;
+
+  if (cq == NULL || length < 0) return -1;
+  if (type == FOGGY_OP_READ) {
+    n = recv(sock_fd, buf, length, MSG_DONTWAIT);
+    if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+      cq_post(cq, in_sock, type, n, user_data);
+      return 0;
+    }
+  } else {
+    while (done < length && (n = send(sock_fd, (uint8_t*)buf + done,
+                                      length - done,
+                                      MSG_DONTWAIT | MSG_NOSIGNAL)) > 0) {
+      done += n;
+    }
+    if (done == length || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+      cq_post(cq, in_sock, type, done == length ? length : -1, user_data);
+      return 0;
+    }
+  }
+
+  op = (system_op_t*)malloc(sizeof(system_op_t));
+  op->sock = in_sock;
+  op->fd = sock_fd;
+  op->cq = cq;
+  op->op = type;
+  op->buf = (uint8_t*)buf;
+  op->len = length;
+  op->done = done;
+  op->user_data = user_data;
+  if (pthread_create(&thread, NULL, finish_op, op) != 0) {
+    free(op);
+    return -1;
+  }
+  pthread_detach(thread);
+  return 0;
+}
+
+int foggy_submit_read(void* in_sock, foggy_cq_t* cq, void* buf, int length,
+                      void* user_data) {
+  return submit_op(in_sock, cq, FOGGY_OP_READ, buf, length, user_data);
+}
+
+int foggy_submit_write(void* in_sock, foggy_cq_t* cq, const void* buf,
+                       int length, void* user_data) {
+  return submit_op(in_sock, cq, FOGGY_OP_WRITE, (void*)buf, length,
+                   user_data);
+}
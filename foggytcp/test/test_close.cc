@@ -0,0 +1,79 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+
+
+/* This file tests how long foggy_close() blocks, end to end over loopback
+ * with a 20 ms one-way delay. It returns once our FIN is acknowledged and
+ * leaves FIN_WAIT_2 and TIME_WAIT to the backend, which still acknowledges
+ * the peer's FIN. With FOGGY_LINGER it blocks through TIME_WAIT.
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "test_util.h"
+
+#define DELAY_US 20000
+
+typedef struct {
+  char port[8];
+  int close_result;
+} peer_t;
+
+static void *listener(void *arg) {
+  peer_t *peer = (peer_t *)arg;
+  char buf[4096];
+
+  void *sock = foggy_socket(TCP_LISTENER, peer->port, "127.0.0.1");
+  CHECK(sock != NULL);
+  while (foggy_read(sock, buf, sizeof(buf)) > 0) {
+  }
+  // It closes second: its FIN needs the ACK of a backend whose
+  // application already returned from foggy_close()
+  peer->close_result = foggy_close(sock);
+  return NULL;
+}
+
+/**
+ * Connects, writes, closes first and returns how long the close took in us.
+ */
+static uint64_t close_time(int port, int linger) {
+  char buf[4096] = {0};
+  peer_t peer;
+  pthread_t thread;
+
+  snprintf(peer.port, sizeof(peer.port), "%d", port);
+  peer.close_result = -1;
+  pthread_create(&thread, NULL, listener, &peer);
+  usleep(100000);  // let it bind
+  void *sock = foggy_socket(TCP_INITIATOR, peer.port, "127.0.0.1");
+  CHECK(sock != NULL);
+  CHECK(foggy_write(sock, buf, sizeof(buf)) == 0);
+  CHECK(foggy_setsockopt(sock, FOGGY_LINGER, linger) == 0);
+
+  uint64_t start = get_time_us();
+  CHECK(foggy_close(sock) == 0);
+  uint64_t elapsed = get_time_us() - start;
+  pthread_join(thread, NULL);
+  CHECK(peer.close_result == 0);
+  return elapsed;
+}
+
+int main() {
+  int port = 20000 + getpid() % 20000;
+
+  setenv("FOGGY_NETEM", "delay=20ms", 1);
+  // The data and the FIN take about one RTT to be acknowledged
+  CHECK(close_time(port, 0) < RTO_MIN);
+  // TIME_WAIT alone lasts two RTOs, which are at least RTO_MIN each
+  CHECK(close_time(port + 1, 1) >= 2 * RTO_MIN);
+  printf("test_close: OK\n");
+  return 0;
+}
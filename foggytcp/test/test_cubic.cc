@@ -0,0 +1,87 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+
+/* This file tests CUBIC: the reduction on a loss with fast convergence, and
+ * window growth along the cubic curve in congestion avoidance.
+ */
+
+#include <cmath>
+
+#include "test_util.h"
+
+static foggy_socket_t *make_cubic_socket() {
+  foggy_socket_t *sock = make_socket();
+  sock->opts.congestion = FOGGY_CC_CUBIC;
+  return sock;
+}
+
+static void test_loss() {
+  foggy_socket_t *sock = make_cubic_socket();
+  window_t *win = &(sock->window);
+
+  win->congestion_window = 10 * MSS;
+  app_write(sock, 10 * MSS);
+  retransmission_timeout(sock);
+  CHECK(win->w_max == 10 * MSS);
+  CHECK(win->ssthresh == (uint32_t)(10 * MSS * CUBIC_BETA));
+
+  // A loss below the last maximum gives up more of it (fast convergence)
+  peer_ack(sock, TEST_ISS + 10 * MSS);
+  win->congestion_window = 8 * MSS;
+  app_write(sock, 8 * MSS);
+  retransmission_timeout(sock);
+  CHECK(win->w_max == (uint32_t)(8 * MSS * (1 + CUBIC_BETA) / 2));
+  CHECK(win->ssthresh == (uint32_t)(8 * MSS * CUBIC_BETA));
+}
+
+/**
+ * Returns how much one ACK of a full segment grows a window of 7 segments
+ * in congestion avoidance, `since` us into an epoch that climbs back to 10.
+ */
+static uint32_t growth(int cc, uint64_t since) {
+  foggy_socket_t *sock = make_socket();
+  window_t *win = &(sock->window);
+
+  sock->opts.congestion = cc;
+  win->reno_state = RENO_CONGESTION_AVOIDANCE;
+  win->congestion_window = 7 * MSS;
+  win->ssthresh = 7 * MSS;
+  win->srtt = 10000;
+  app_write(sock, 7 * MSS);
+  win->w_max = 10 * MSS;
+  peer_ack(sock, TEST_ISS + MSS);  // starts the epoch
+  win->epoch -= since;
+  uint32_t cwnd = win->congestion_window;
+  peer_ack(sock, TEST_ISS + 2 * MSS);
+  return win->congestion_window - cwnd;
+}
+
+static void test_growth() {
+  uint32_t reno = growth(FOGGY_CC_RENO, 0);
+  double k = cbrt(3 / CUBIC_C);  // s back from 7 to 10 segments
+
+  CHECK(reno > 0 && reno <= MSS / 7);
+  // Right after the loss the curve is flat, CUBIC follows the Reno estimate
+  // at 3(1-beta)/(1+beta) of its pace
+  uint32_t flat = growth(FOGGY_CC_CUBIC, 0);
+  CHECK(flat > reno / 2 && flat < reno);
+  // Around K the curve is back near w_max: 3/7 of a segment per ACK
+  uint32_t at_k = growth(FOGGY_CC_CUBIC, (uint64_t)(k * 1e6));
+  CHECK(at_k > 2 * reno && at_k <= 3 * MSS / 7 + 1);
+  // Beyond it the window probes for more
+  CHECK(growth(FOGGY_CC_CUBIC, (uint64_t)(3 * k * 1e6)) > at_k);
+}
+
+int main() {
+  test_loss();
+  test_growth();
+  printf("test_cubic: OK\n");
+  return 0;
+}
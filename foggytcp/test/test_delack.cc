@@ -0,0 +1,77 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+
+/* This file tests delayed ACKs, and slow start counting the two segments a
+ * delayed ACK covers.
+ */
+
+#include "test_util.h"
+
+static foggy_socket_t *make_delack_socket() {
+  foggy_socket_t *sock = make_socket();
+  sock->opts.delack = 40000;
+  timer_init(&(sock->delack_timer), delack_timeout, sock);
+  return sock;
+}
+
+static void test_every_other() {
+  foggy_socket_t *sock = make_delack_socket();
+
+  peer_data(sock, TEST_IRS, MSS);
+  CHECK(sock->stats.segs_sent == 0);
+  CHECK(timer_pending(&(sock->delack_timer)));
+  peer_data(sock, TEST_IRS + MSS, MSS);
+  CHECK(sock->stats.segs_sent == 1);
+  CHECK(sock->ack_pending == 0);
+  CHECK(!timer_pending(&(sock->delack_timer)));
+}
+
+static void test_out_of_order() {
+  foggy_socket_t *sock = make_delack_socket();
+
+  // A hole is reported at once, and so is the segment that fills it
+  peer_data(sock, TEST_IRS + MSS, MSS);
+  CHECK(sock->stats.segs_sent == 1);
+  peer_data(sock, TEST_IRS, MSS);
+  CHECK(sock->stats.segs_sent == 2);
+}
+
+static void test_timeout() {
+  foggy_socket_t *sock = make_delack_socket();
+
+  peer_data(sock, TEST_IRS, MSS);
+  delack_timeout(sock);
+  CHECK(sock->stats.segs_sent == 1);
+  // The sender was waiting for it, the next segments are ACKed at once
+  CHECK(sock->quickacks == DELACK_QUICKACKS);
+  peer_data(sock, TEST_IRS + MSS, MSS);
+  CHECK(sock->stats.segs_sent == 2);
+}
+
+static void test_slow_start() {
+  foggy_socket_t *sock = make_socket();
+
+  sock->window.congestion_window = 4 * MSS;
+  app_write(sock, 4 * MSS);
+  peer_ack(sock, TEST_ISS + 2 * MSS);
+  CHECK(sock->window.congestion_window == 6 * MSS);
+  // But never more than two segments per ACK (RFC 3465)
+  peer_ack(sock, TEST_ISS + 6 * MSS);
+  CHECK(sock->window.congestion_window == 8 * MSS);
+}
+
+int main() {
+  test_every_other();
+  test_out_of_order();
+  test_timeout();
+  test_slow_start();
+  printf("test_delack: OK\n");
+  return 0;
+}
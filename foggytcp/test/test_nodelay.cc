@@ -0,0 +1,69 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+
+/* This file tests the latency of a write that ends in a partial segment,
+ * end to end over loopback with a 50 ms one-way delay. With FOGGY_NODELAY
+ * the tail leaves with the full segments before it, so the whole write
+ * arrives after one delay rather than after the ACK of the first segment.
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "test_util.h"
+
+#define WRITE_LEN 2000
+#define DELAY_US 50000
+
+static char port[8];
+static uint64_t arrival;
+
+static void *listener(void *arg) {
+  char buf[WRITE_LEN];
+  int got = 0;
+
+  (void)arg;
+  void *sock = foggy_socket(TCP_LISTENER, port, "127.0.0.1");
+  CHECK(sock != NULL);
+  while (got < WRITE_LEN) {
+    int n = foggy_read(sock, buf + got, WRITE_LEN - got);
+    CHECK(n > 0);
+    got += n;
+  }
+  arrival = get_time_us();
+  return NULL;
+}
+
+int main() {
+  char buf[WRITE_LEN] = {0};
+  pthread_t thread;
+
+  // No PMTU probing, so the write is one segment of MSS and a tail, and a
+  // window with room for both
+  setenv("FOGGY_MSS", "1", 1);
+  setenv("FOGGY_SOCKOPTS", "init_cwnd=4", 1);
+  setenv("FOGGY_NETEM", "delay=50ms", 1);
+  setenv("FOGGY_NODELAY", "1", 1);
+  snprintf(port, sizeof(port), "%d", 20000 + getpid() % 20000);
+
+  pthread_create(&thread, NULL, listener, NULL);
+  usleep(100000);  // let it bind
+  void *sock = foggy_socket(TCP_INITIATOR, port, "127.0.0.1");
+  CHECK(sock != NULL);
+  usleep(2 * DELAY_US);  // the backend goes idle, the write wakes it
+
+  uint64_t start = get_time_us();
+  CHECK(foggy_write(sock, buf, WRITE_LEN) == 0);
+  pthread_join(thread, NULL);
+  // Well below the two delays and more it takes when the tail waits
+  CHECK(arrival - start < 2 * DELAY_US);
+  printf("test_nodelay: OK\n");
+  return 0;
+}
@@ -0,0 +1,69 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+
+/* This file tests pacing: a window goes out spread over the RTT rather than
+ * in one burst.
+ */
+
+#include <unistd.h>
+
+#include "test_util.h"
+
+static foggy_socket_t *make_paced_socket() {
+  foggy_socket_t *sock = make_socket();
+  window_t *win = &(sock->window);
+
+  sock->opts.pacing = 1;
+  timer_init(&(sock->pace_timer), pace_timeout, sock);
+  win->reno_state = RENO_CONGESTION_AVOIDANCE;
+  win->congestion_window = 10 * MSS;
+  win->srtt = 10000;  // a segment every 833 us
+  return sock;
+}
+
+static void test_paced() {
+  foggy_socket_t *sock = make_paced_socket();
+
+  // Idle time earns no more than a timer tick of credit
+  app_write(sock, 10 * MSS);
+  CHECK(sock->stats.segs_sent <= 2);
+  CHECK(timer_pending(&(sock->pace_timer)));
+
+  // The timer lets the next ones go, again a few at a time
+  uint64_t sent = sock->stats.segs_sent;
+  usleep(20000);
+  pace_timeout(sock);
+  CHECK(sock->stats.segs_sent > sent && sock->stats.segs_sent <= sent + 2);
+}
+
+static void test_unpaced() {
+  foggy_socket_t *sock = make_paced_socket();
+
+  // Without an RTT sample there is nothing to pace at
+  sock->window.srtt = 0;
+  app_write(sock, 10 * MSS);
+  CHECK(sock->stats.segs_sent == 10);
+
+  // Turning pacing off sends what it held back
+  sock = make_paced_socket();
+  app_write(sock, 10 * MSS);
+  CHECK(foggy_setsockopt(sock, FOGGY_PACING, 0) == 0);
+  sockopt_apply(sock);
+  CHECK(!timer_pending(&(sock->pace_timer)));
+  transmit_send_window(sock);
+  CHECK(sock->stats.segs_sent == 10);
+}
+
+int main() {
+  test_paced();
+  test_unpaced();
+  printf("test_pacing: OK\n");
+  return 0;
+}
@@ -0,0 +1,129 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+
+/* This file tests the sender's loss recovery (fast retransmit, NewReno
+ * partial ACKs, go-back-N on RTO, Karn's rule) and the receiver's
+ * out-of-order reassembly.
+ */
+
+#include "test_util.h"
+
+static uint32_t in_flight(foggy_socket_t *sock) {
+  return send_ring_in_flight(&(sock->send_window));
+}
+
+static void test_fast_retransmit() {
+  foggy_socket_t *sock = make_socket();
+  window_t *win = &(sock->window);
+
+  win->congestion_window = 10 * MSS;
+  app_write(sock, 10 * MSS);
+  CHECK(sock->stats.segs_sent == 10);
+  CHECK(in_flight(sock) == 10 * MSS);
+
+  // The second segment is lost, the eight after it trigger duplicates
+  peer_ack(sock, TEST_ISS + MSS);
+  peer_ack(sock, TEST_ISS + MSS);
+  peer_ack(sock, TEST_ISS + MSS);
+  CHECK(win->reno_state != RENO_FAST_RECOVERY);
+  CHECK(sock->stats.segs_retrans == 0);
+  peer_ack(sock, TEST_ISS + MSS);
+  CHECK(win->reno_state == RENO_FAST_RECOVERY);
+  CHECK(sock->stats.segs_retrans == 1);
+  CHECK(win->ssthresh == 9 * MSS / 2);
+  CHECK(win->recover == TEST_ISS + 10 * MSS);
+
+  // A partial ACK: the fourth segment was lost too and is resent at once
+  peer_ack(sock, TEST_ISS + 3 * MSS);
+  CHECK(win->reno_state == RENO_FAST_RECOVERY);
+  CHECK(sock->stats.segs_retrans == 2);
+  CHECK(win->congestion_window == win->ssthresh);
+
+  // Everything up to `recover` is acknowledged, recovery ends
+  peer_ack(sock, TEST_ISS + 10 * MSS);
+  CHECK(win->reno_state == RENO_CONGESTION_AVOIDANCE);
+  CHECK(win->congestion_window == win->ssthresh);
+  CHECK(send_ring_empty(&(sock->send_window)));
+}
+
+static void test_window_update_is_not_duplicate() {
+  foggy_socket_t *sock = make_socket();
+
+  sock->window.congestion_window = 4 * MSS;
+  app_write(sock, 4 * MSS);
+  for (int i = 0; i < 3; ++i) {
+    sock->window.advertised_window--;  // the next ACK looks like an update
+    peer_ack(sock, TEST_ISS);
+  }
+  CHECK(sock->window.dup_ack_count == 0);
+  CHECK(sock->stats.segs_retrans == 0);
+}
+
+static void test_rto() {
+  foggy_socket_t *sock = make_socket();
+  window_t *win = &(sock->window);
+
+  win->congestion_window = 4 * MSS;
+  app_write(sock, 4 * MSS);
+
+  // Everything outstanding counts as lost, slow start from the head
+  retransmission_timeout(sock);
+  transmit_send_window(sock);
+  CHECK(win->congestion_window == MSS);
+  CHECK(win->ssthresh == 2 * MSS);
+  CHECK(win->reno_state == RENO_SLOW_START);
+  CHECK(win->rto == 2 * RTO_MIN);
+  CHECK(sock->stats.segs_retrans == 1);
+  CHECK(in_flight(sock) == MSS);
+
+  // The ACK of a retransmission gives no RTT sample (Karn)
+  peer_ack(sock, TEST_ISS + MSS);
+  CHECK(win->srtt == 0);
+  CHECK(win->congestion_window == 2 * MSS);
+  CHECK(sock->stats.segs_retrans == 3);
+
+  // The last segment went out only once before the timeout, it does
+  peer_ack(sock, TEST_ISS + 4 * MSS);
+  CHECK(win->srtt != 0);
+  CHECK(send_ring_empty(&(sock->send_window)));
+  CHECK(!timer_pending(&(sock->rto_timer)));
+}
+
+static void test_reassembly() {
+  foggy_socket_t *sock = make_socket();
+
+  peer_data(sock, TEST_IRS + MSS, MSS);
+  peer_data(sock, TEST_IRS + 2 * MSS, 100);
+  CHECK(sock->window.next_seq_expected == TEST_IRS);
+  CHECK(sock->received_len == 0);
+  CHECK(sock->stats.ooo_segments == 2);
+
+  // The hole is filled, all three are delivered in order
+  peer_data(sock, TEST_IRS, MSS);
+  CHECK(sock->window.next_seq_expected == TEST_IRS + 2 * MSS + 100);
+  CHECK(sock->received_len == 2 * MSS + 100);
+  for (int i = 0; i < sock->received_len; ++i) {
+    CHECK(sock->received_buf[i] == (uint8_t)i);
+  }
+
+  // A retransmission of what was delivered changes nothing
+  peer_data(sock, TEST_IRS + MSS, MSS);
+  CHECK(sock->received_len == 2 * MSS + 100);
+  CHECK(sock->receive_window_used == 0);
+}
+
+int main() {
+  test_fast_retransmit();
+  test_window_update_is_not_duplicate();
+  test_rto();
+  test_reassembly();
+  printf("test_reno: OK\n");
+  return 0;
+}
@@ -0,0 +1,76 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+
+/* This file tests the socket options: FOGGY_SOCKOPTS, the checks and clamps
+ * of foggy_setsockopt and how the backend applies them.
+ */
+
+#include "test_util.h"
+
+static void test_env() {
+  foggy_socket_t *sock = make_socket();
+
+  CHECK(sock->opts.sndbuf == 1024 * 1024);
+  CHECK(sock->opts.rcvbuf == 256 * 1024);
+  CHECK(sock->opts.init_cwnd == 4 * MSS);
+  CHECK(sock->opts.rto_min == 50000);
+  // The receive slots cover the receive buffer with full segments
+  CHECK(sock->rcv_slots >= (int)(256 * 1024 / MSS));
+}
+
+static void test_set_and_apply() {
+  foggy_socket_t *sock = make_socket();
+  int value;
+
+  CHECK(foggy_setsockopt(sock, FOGGY_INIT_CWND, 10 * MSS) == 0);
+  CHECK(foggy_setsockopt(sock, FOGGY_RTO_MAX, 1000000) == 0);
+  CHECK(foggy_getsockopt(sock, FOGGY_INIT_CWND, &value) == 0);
+  CHECK(value == 10 * MSS);
+  // Nothing changes until the backend takes the options over
+  CHECK(sock->opts.init_cwnd == 4 * MSS);
+  sockopt_apply(sock);
+  CHECK(sock->window.congestion_window == 10 * MSS);
+  CHECK(sock->window.rto == 1000000);  // rto_init was clamped to rto_max
+
+  // The RTO stays within the bounds
+  update_rtt(sock, 1000);
+  CHECK(sock->window.rto == 50000);
+  update_rtt(sock, 5000000);
+  CHECK(sock->window.rto == 1000000);
+
+  // Once data went out the initial window no longer applies
+  app_write(sock, MSS);
+  CHECK(foggy_setsockopt(sock, FOGGY_INIT_CWND, 2 * MSS) == 0);
+  sockopt_apply(sock);
+  CHECK(sock->window.congestion_window == 10 * MSS);
+}
+
+static void test_invalid() {
+  foggy_socket_t *sock = make_socket();
+  int value;
+
+  CHECK(foggy_setsockopt(sock, FOGGY_RTO_MIN, 2000000000) != 0);
+  CHECK(foggy_setsockopt(sock, FOGGY_SO_SNDBUF, -1) != 0);
+  CHECK(foggy_setsockopt(sock, (foggy_sockopt_t)100, 1) != 0);
+  // Buffers are clamped rather than refused
+  CHECK(foggy_setsockopt(sock, FOGGY_SO_SNDBUF, 1) == 0);
+  CHECK(foggy_getsockopt(sock, FOGGY_SO_SNDBUF, &value) == 0);
+  CHECK(value == 2 * MSS);
+}
+
+int main() {
+  setenv("FOGGY_SOCKOPTS",
+         "sndbuf=1mb,rcvbuf=256kb,init_cwnd=4,rto_min=50ms", 1);
+  test_env();
+  test_set_and_apply();
+  test_invalid();
+  printf("test_sockopt: OK\n");
+  return 0;
+}
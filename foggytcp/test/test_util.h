@@ -0,0 +1,129 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+
+/* This file holds what the unit tests share: a connected socket without a
+ * backend, driven by calling the window functions directly, and the packets
+ * its peer would send. Every test is a program that exits non-zero on the
+ * first failed check.
+ */
+
+#ifndef FOGGY_TEST_UTIL_H_
+#define FOGGY_TEST_UTIL_H_
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "foggy_backend.h"
+#include "foggy_function.h"
+#include "foggy_packet.h"
+#include "foggy_pmtu.h"
+#include "foggy_sockopt.h"
+#include "foggy_tcp.h"
+
+#define HLEN sizeof(foggy_tcp_header_t)
+#define TEST_ISS 1000  // our first sequence number
+#define TEST_IRS 5000  // the peer's
+
+#define CHECK(cond)                                                    \
+  do {                                                                 \
+    if (!(cond)) {                                                     \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+              #cond);                                                  \
+      exit(1);                                                         \
+    }                                                                  \
+  } while (0)
+
+/**
+ * Returns a connected socket whose packets go to a UDP socket nobody reads.
+ */
+static inline foggy_socket_t *make_socket() {
+  static int sink_fd = -1;
+  foggy_socket_t *sock = new foggy_socket_t();
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+
+  if (sink_fd < 0) {
+    sink_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(sink_fd, (struct sockaddr *)&addr, sizeof(addr));
+  }
+  getsockname(sink_fd, (struct sockaddr *)&addr, &len);
+  sock->socket = socket(AF_INET, SOCK_DGRAM, 0);
+  sock->conn = addr;
+  sock->my_port = 4000;
+  sock->connected = 2;
+  sock->mss = MSS;
+  sockopt_init(sock);
+  pmtu_init(sock);
+  sock->window.last_byte_sent = TEST_ISS;
+  sock->window.last_ack_received = TEST_ISS;
+  sock->window.next_seq_expected = TEST_IRS;
+  sock->window.rto = RTO_MIN;
+  sock->window.ssthresh = WINDOW_INITIAL_SSTHRESH;
+  sock->window.congestion_window = WINDOW_INITIAL_WINDOW_SIZE;
+  sock->window.advertised_window = MAX_NETWORK_BUFFER;
+  sock->window.reno_state = RENO_SLOW_START;
+  sock->event_fd = -1;  // no backend to wake up
+  pthread_mutex_init(&(sock->recv_lock), NULL);
+  pthread_mutex_init(&(sock->send_lock), NULL);
+  pthread_cond_init(&(sock->send_cond), NULL);
+  pthread_mutex_init(&(sock->window.ack_lock), NULL);
+  send_ring_init(&(sock->send_window));
+  timer_wheel_init(&(sock->timers), get_time_us());
+  timer_init(&(sock->rto_timer), retransmission_timeout, sock);
+  return sock;
+}
+
+/**
+ * Queues `len` bytes and sends what the window allows, as foggy_write()
+ * followed by a backend pass would.
+ */
+static inline void app_write(foggy_socket_t *sock, int len) {
+  uint8_t *data = (uint8_t *)calloc(len, 1);
+  send_pkts(sock, data, len);
+  free(data);
+}
+
+/**
+ * Delivers a pure ACK from the peer and lets the sender act on it.
+ */
+static inline void peer_ack(foggy_socket_t *sock, uint32_t ack) {
+  uint8_t *pkt = create_packet(4001, 4000, sock->window.next_seq_expected, ack,
+                               HLEN, HLEN, ACK_FLAG_MASK, MAX_NETWORK_BUFFER,
+                               0, NULL, NULL, 0);
+  on_recv_pkt(sock, pkt);
+  free(pkt);
+  receive_send_window(sock);
+  transmit_send_window(sock);
+}
+
+/**
+ * Delivers `len` bytes of data from the peer starting at `seq`, every byte
+ * set to its offset from TEST_IRS.
+ */
+static inline void peer_data(foggy_socket_t *sock, uint32_t seq, uint16_t len) {
+  uint8_t *payload = (uint8_t *)malloc(len);
+  for (uint16_t i = 0; i < len; ++i) {
+    payload[i] = (uint8_t)(seq - TEST_IRS + i);
+  }
+  uint8_t *pkt = create_packet(4001, 4000, seq, sock->window.last_byte_sent,
+                               HLEN, HLEN + len, ACK_FLAG_MASK,
+                               MAX_NETWORK_BUFFER, 0, NULL, payload, len);
+  on_recv_pkt(sock, pkt);
+  free(pkt);
+  free(payload);
+}
+
+#endif  // FOGGY_TEST_UTIL_H_
@@ -0,0 +1,81 @@
+/* Copyright (C) 2024 Hong Kong University of Science and Technology
+
+This repository is used for the Computer Networks (ELEC 3120) 
+course taught at Hong Kong University of Science and Technology. 
+
+No part of the project may be copied and/or distributed without 
+the express permission of the course staff. Everyone is prohibited 
+from releasing their forks in any public places. */
+
+
+/* This file tests the window scale option: its negotiation on the SYNs and
+ * the scaling of the windows both ways.
+ */
+
+#include "foggy_option.h"
+#include "test_util.h"
+
+/**
+ * Returns the SYN-ACK the listener answers a SYN with, options only.
+ */
+static uint8_t *syn_ack(foggy_socket_t *listener) {
+  uint8_t ext[OPT_WSCALE_LEN];
+  uint16_t ext_len = sockopt_put_wscale(listener, ext);
+  return create_socket_packet(listener, TEST_IRS, TEST_ISS + 1,
+                              SYN_FLAG_MASK | ACK_FLAG_MASK, ext_len, ext,
+                              NULL, 0);
+}
+
+static void test_negotiated() {
+  foggy_socket_t *init = make_socket(), *lst = make_socket();
+
+  init->type = TCP_INITIATOR;
+  init->opts.rcvbuf = 1024 * 1024;
+  lst->type = TCP_LISTENER;
+
+  uint8_t *syn = create_syn_packet(init, NULL, 0);
+  sockopt_start(lst, syn);
+  CHECK(lst->wscale_ok);
+  CHECK(lst->snd_wscale == 5);  // 1 MiB >> 5 fits 16 bits
+  CHECK(lst->rcv_wscale == 0);  // 64 KiB need no scaling
+
+  uint8_t *synack = syn_ack(lst);
+  sockopt_start(init, synack);
+  CHECK(init->wscale_ok);
+  CHECK(init->snd_wscale == 0);
+
+  // SYNs are never scaled, everything after is
+  CHECK(sockopt_advertise(init, SYN_FLAG_MASK) == UINT16_MAX);
+  uint16_t adv = sockopt_advertise(init, ACK_FLAG_MASK);
+  CHECK(adv == 1024 * 1024 >> 5);
+  uint8_t *ack = create_socket_packet(init, TEST_ISS + 1, TEST_IRS + 1,
+                                      ACK_FLAG_MASK, 0, NULL, NULL, 0);
+  CHECK(sockopt_peer_window(lst, (foggy_tcp_header_t *)ack) == 1024 * 1024);
+  free(syn);
+  free(synack);
+  free(ack);
+}
+
+static void test_not_offered() {
+  foggy_socket_t *init = make_socket(), *lst = make_socket();
+
+  lst->type = TCP_LISTENER;
+  lst->opts.rcvbuf = 1024 * 1024;
+
+  // A SYN without the option: the listener neither scales nor answers it
+  uint8_t *syn = create_socket_packet(init, TEST_ISS, 0, SYN_FLAG_MASK, 0,
+                                      NULL, NULL, 0);
+  sockopt_start(lst, syn);
+  CHECK(!lst->wscale_ok);
+  uint8_t ext[OPT_WSCALE_LEN];
+  CHECK(sockopt_put_wscale(lst, ext) == 0);
+  CHECK(sockopt_advertise(lst, ACK_FLAG_MASK) == UINT16_MAX);
+  free(syn);
+}
+
+int main() {
+  test_negotiated();
+  test_not_offered();
+  printf("test_wscale: OK\n");
+  return 0;
+}
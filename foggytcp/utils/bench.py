@@ -0,0 +1,142 @@
+#!/usr/bin/env python3
+# Copyright (C) 2024 Hong Kong University of Science and Technology
+#
+# This repository is used for the Computer Networks (ELEC 3120) course taught
+# at Hong Kong University of Science and Technology.
+#
+# No part of the project may be copied and/or distributed without the express
+# permission of the course staff. Everyone is prohibited from releasing their
+# forks in any public places.
+
+"""Runs the foggy and system TCP benchmarks and writes the results as JSON.
+
+Every (stack, condition, size) combination runs the bench binary of that stack
+once per repetition. Link conditions are applied with FOGGY_NETEM, which only
+the foggy stack understands, so the system stack only runs the clean link.
+Once a size times out, the larger sizes of the same condition are skipped.
+
+usage: ./bench.py [--sizes 1k,1m] [--conditions clean,delay=10ms] [--reps N]
+                  [--timeout SECONDS] [--out FILE]
+"""
+
+import argparse
+import datetime
+import json
+import os
+import platform
+import subprocess
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+TOP = os.path.dirname(HERE)
+
+# The Generate_file.py ladder, and beyond
+SIZES = ["1k", "5k", "25k", "100k", "1m", "10m", "100m"]
+
+# Bandwidth x delay x loss
+CONDITIONS = [
+    "clean",
+    "delay=10ms",
+    "loss=1%",
+    "delay=10ms,loss=1%",
+    "rate=100mbit,limit=256kb",
+    "rate=100mbit,limit=256kb,delay=10ms",
+    "rate=10mbit,limit=64kb,delay=10ms",
+    "rate=10mbit,limit=64kb,delay=10ms,loss=1%",
+]
+
+STACKS = {"foggy": "bench-foggy", "system": "bench-system"}
+
+
+def parse_size(text):
+    units = {"k": 1024, "m": 1024 * 1024, "g": 1024 * 1024 * 1024}
+    text = text.strip().lower()
+    if text[-1] in units:
+        return int(float(text[:-1]) * units[text[-1]])
+    return int(text)
+
+
+def run_once(binary, port, size, condition, timeout):
+    env = dict(os.environ)
+    env.pop("FOGGY_NETEM", None)
+    if condition != "clean":
+        env["FOGGY_NETEM"] = condition
+    try:
+        proc = subprocess.run([os.path.join(TOP, binary), str(port), str(size)],
+                              env=env, capture_output=True, text=True,
+                              timeout=timeout)
+    except subprocess.TimeoutExpired:
+        return {"status": "timeout"}
+    lines = [l for l in proc.stdout.splitlines() if l.startswith("{")]
+    if not lines:
+        return {"status": "error", "returncode": proc.returncode,
+                "stderr": proc.stderr.strip()[-200:]}
+    result = json.loads(lines[-1])
+    result["status"] = "ok" if proc.returncode == 0 else "incomplete"
+    return result
+
+
+def git_revision():
+    try:
+        return subprocess.run(["git", "rev-parse", "--short", "HEAD"], cwd=TOP,
+                              capture_output=True, text=True).stdout.strip()
+    except OSError:
+        return ""
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--sizes", default=",".join(SIZES))
+    parser.add_argument("--conditions", default=";".join(CONDITIONS),
+                        help="semicolon separated FOGGY_NETEM specs")
+    parser.add_argument("--stacks", default="foggy,system")
+    parser.add_argument("--reps", type=int, default=1)
+    parser.add_argument("--timeout", type=float, default=30)
+    parser.add_argument("--port", type=int, default=4200)
+    parser.add_argument("--out", default="-")
+    args = parser.parse_args()
+
+    sizes = [parse_size(s) for s in args.sizes.split(",")]
+    conditions = [c for c in args.conditions.split(";") if c]
+    port = args.port
+    results = []
+
+    for stack in args.stacks.split(","):
+        for condition in conditions:
+            if stack != "foggy" and condition != "clean":
+                continue
+            timed_out = False
+            for size in sizes:
+                for rep in range(args.reps):
+                    entry = {"stack": stack, "condition": condition,
+                             "size": size, "rep": rep}
+                    if timed_out:
+                        entry["status"] = "skipped"
+                    else:
+                        entry.update(run_once(STACKS[stack], port, size,
+                                              condition, args.timeout))
+                        port += 1
+                        timed_out = entry["status"] == "timeout"
+                    results.append(entry)
+                    print("%-6s %-40s %10d %s" % (stack, condition, size,
+                                                  entry.get("fct_ms",
+                                                            entry["status"])),
+                          file=sys.stderr)
+
+    report = {
+        "meta": {
+            "date": datetime.datetime.now().isoformat(timespec="seconds"),
+            "host": platform.node(),
+            "kernel": platform.release(),
+            "revision": git_revision(),
+            "timeout_s": args.timeout,
+        },
+        "results": results,
+    }
+    out = sys.stdout if args.out == "-" else open(args.out, "w")
+    json.dump(report, out, indent=2)
+    out.write("\n")
+
+
+if __name__ == "__main__":
+    main()
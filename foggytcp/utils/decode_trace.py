@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+# Copyright (C) 2024 Hong Kong University of Science and Technology
+#
+# This repository is used for the Computer Networks (ELEC 3120) course taught
+# at Hong Kong University of Science and Technology.
+#
+# No part of the project may be copied and/or distributed without the express
+# permission of the course staff. Everyone is prohibited from releasing their
+# forks in any public places.
+
+"""Prints a trace written by foggy_trace_dump() as text, ordered by time.
+
+usage: ./decode_trace.py TRACE_FILE
+"""
+
+import struct
+import sys
+
+TRACE_MAGIC = 0x52544746
+RECORD = struct.Struct("<QQIIHHI")
+EVENTS = {1: "send", 2: "recv", 3: "ack", 4: "retransmit", 5: "cwnd"}
+FLAGS = {0x8: "SYN", 0x4: "ACK", 0x2: "FIN"}
+
+
+def read_trace(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    magic, version, size = struct.unpack_from("<III", data, 0)
+    if magic != TRACE_MAGIC or size != RECORD.size:
+        sys.exit("%s: not a foggy trace (version %d)" % (path, version))
+    off, records = 12, []
+    while off < len(data):
+        (count,) = struct.unpack_from("<I", data, off)
+        off += 4
+        for _ in range(count):
+            records.append(RECORD.unpack_from(data, off))
+            off += RECORD.size
+    records.sort()
+    return records
+
+
+def describe(rec):
+    _, conn, a, b, kind, flags, tid = rec
+    name = EVENTS.get(kind, "event%d" % kind)
+    if kind == 5:
+        detail = "cwnd=%d ssthresh=%d" % (a, b)
+    elif kind == 3:
+        detail = "ack=%d bytes=%d" % (a, b)
+    else:
+        names = "|".join(v for k, v in FLAGS.items() if flags & k) or "-"
+        detail = "seq=%d len=%d flags=%s" % (a, b, names)
+    return "conn=%#x tid=%d %-10s %s" % (conn, tid, name, detail)
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit(__doc__.strip())
+    records = read_trace(sys.argv[1])
+    if not records:
+        return
+    start = records[0][0]
+    for rec in records:
+        print("%12.6f %s" % ((rec[0] - start) / 1e9, describe(rec)))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+# Copyright (C) 2024 Hong Kong University of Science and Technology
+#
+# This repository is used for the Computer Networks (ELEC 3120) course taught
+# at Hong Kong University of Science and Technology.
+#
+# No part of the project may be copied and/or distributed without the express
+# permission of the course staff. Everyone is prohibited from releasing their
+# forks in any public places.
+
+"""Plots a congestion control time series written with FOGGY_CC_LOG.
+
+The top panel shows cwnd, ssthresh and the bytes in flight against the
+goodput computed from the ACKed bytes, the bottom one SRTT and RTO.
+
+usage: ./plot_cc.py CSV [PNG]
+"""
+
+import csv
+import sys
+
+STATES = ["slow start", "congestion avoidance", "fast recovery"]
+
+
+def read_series(path):
+    with open(path) as f:
+        rows = [{k: int(v) for k, v in row.items()} for row in csv.DictReader(f)]
+    if not rows:
+        sys.exit("%s: no samples" % path)
+    return rows
+
+
+def goodput(rows, window_us=100000):
+    """Mbit/s ACKed over the trailing window at every sample."""
+    result, first = [], 0
+    for row in rows:
+        while row["time_us"] - rows[first]["time_us"] > window_us:
+            first += 1
+        span = row["time_us"] - rows[first]["time_us"]
+        acked = row["bytes_acked"] - rows[first]["bytes_acked"]
+        result.append(acked * 8 / span if span > 0 else 0.0)
+    return result
+
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        sys.exit(__doc__.strip())
+    path = sys.argv[1]
+    out = sys.argv[2] if len(sys.argv) == 3 else path.rsplit(".", 1)[0] + ".png"
+    rows = read_series(path)
+
+    import matplotlib
+    matplotlib.use("Agg")
+    import matplotlib.pyplot as plt
+
+    t = [row["time_us"] / 1e6 for row in rows]
+    fig, (top, bottom) = plt.subplots(2, 1, sharex=True, figsize=(10, 7))
+
+    top.step(t, [row["cwnd"] for row in rows], where="post", label="cwnd")
+    top.step(t, [min(row["ssthresh"], 2 * max(r["cwnd"] for r in rows))
+                 for row in rows], where="post", label="ssthresh")
+    top.step(t, [row["in_flight"] for row in rows], where="post",
+             label="in flight")
+    for i, row in enumerate(rows):
+        if row["state"] == 2 and (i == 0 or rows[i - 1]["state"] != 2):
+            top.axvline(t[i], color="grey", alpha=0.3)
+    top.set_ylabel("bytes")
+    rate = top.twinx()
+    rate.plot(t, goodput(rows), color="black", alpha=0.6, label="goodput")
+    rate.set_ylabel("goodput (Mbit/s)")
+    lines = top.get_legend_handles_labels()
+    more = rate.get_legend_handles_labels()
+    top.legend(lines[0] + more[0], lines[1] + more[1], loc="upper left")
+    top.set_title("%s (grey lines: entering %s)" % (path, STATES[2]))
+
+    bottom.plot(t, [row["srtt_us"] / 1e3 for row in rows], label="SRTT")
+    bottom.step(t, [row["rto_us"] / 1e3 for row in rows], where="post",
+                label="RTO")
+    bottom.set_ylabel("ms")
+    bottom.set_xlabel("time (s)")
+    bottom.legend(loc="upper left")
+
+    fig.tight_layout()
+    fig.savefig(out)
+    print(out)
+
+
+if __name__ == "__main__":
+    main()